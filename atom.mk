@@ -9,8 +9,14 @@ LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)/include
 LOCAL_CFLAGS := -DRTP_API_EXPORTS -fvisibility=hidden -std=gnu99
 LOCAL_SRC_FILES := \
 	src/rtcp_pkt.c \
+	src/rtp_bwe.c \
+	src/rtp_clk.c \
+	src/rtp_demux.c \
 	src/rtp_jitter.c \
-	src/rtp_pkt.c
+	src/rtp_jitter_group.c \
+	src/rtp_pkt.c \
+	src/rtp_pkt_pool.c \
+	src/rtp_twcc.c
 LOCAL_LIBRARIES := \
 	libfutils \
 	libpomp \
@@ -20,6 +26,10 @@ ifeq ("$(TARGET_OS)","windows")
   LOCAL_LDLIBS += -lws2_32
 endif
 
+ifneq ("$(TARGET_OS_FLAVOUR)","android")
+  LOCAL_LDLIBS += -lpthread
+endif
+
 include $(BUILD_LIBRARY)
 
 ifdef TARGET_TEST
@@ -29,4 +39,126 @@ LOCAL_CFLAGS := -std=gnu99
 LOCAL_SRC_FILES := tests/test_rtp_ntp.c
 LOCAL_LIBRARIES := librtp
 include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := tst-rtp-clk
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	tests/test_rtp_clk.c \
+	tests/check.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := tst-rtcp-rtpfb
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	tests/test_rtcp_rtpfb.c \
+	tests/check.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := tst-rtp-twcc
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	tests/test_rtp_twcc.c \
+	tests/check.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := tst-rtp-bwe
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	tests/test_rtp_bwe.c \
+	tests/check.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := tst-rtp-pkt-pool
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	tests/test_rtp_pkt_pool.c \
+	tests/check.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := tst-rtp-pkt
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	tests/test_rtp_pkt.c \
+	tests/check.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := tst-rtp-demux
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	tests/test_rtp_demux.c \
+	tests/check.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := tst-rtp-jitter
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	tests/test_rtp_jitter.c \
+	tests/check.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := tst-rtp-jitter-group
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	tests/test_rtp_jitter_group.c \
+	tests/check.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := tst-rtp-jitter-evict
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	tests/test_rtp_jitter_evict.c \
+	tests/check.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := bench-rtp-pkt-read
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := tests/bench_rtp_pkt_read.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := bench-rtp-skew
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	tests/bench_rtp_skew.c \
+	tests/skew_trace.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := bench-rtp-skew-replay
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	tests/bench_rtp_skew_replay.c \
+	tests/skew_trace.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := bench-rtcp-rtpfb
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := tests/bench_rtcp_rtpfb.c
+LOCAL_LIBRARIES := librtp
+include $(BUILD_EXECUTABLE)
 endif
@@ -66,10 +66,13 @@ static inline int ntp_timestamp64_to_us(const struct ntp_timestamp64 *t,
 static inline int ntp_timestamp64_from_us(struct ntp_timestamp64 *t,
 					  uint64_t us)
 {
+	uint64_t seconds = 0;
+
 	if (t == NULL)
 		return -EINVAL;
-	t->seconds = us / 1000000;
-	t->fraction = ((uint64_t)(us % 1000000) << 32) / 1000000;
+	seconds = rtp_div_1000000(us);
+	t->seconds = seconds;
+	t->fraction = rtp_div_1000000((us - seconds * 1000000) << 32);
 	return 0;
 }
 
@@ -91,7 +94,7 @@ static inline int ntp_timestamp64_from_timespec(struct ntp_timestamp64 *t,
 	if (t == NULL || ts == NULL)
 		return -EINVAL;
 	t->seconds = ts->tv_sec;
-	t->fraction = ((uint64_t)ts->tv_nsec << 32) / 1000000000;
+	t->fraction = rtp_div_1000000000((uint64_t)ts->tv_nsec << 32);
 	return 0;
 }
 
@@ -134,10 +137,13 @@ static inline int ntp_timestamp32_to_us(const struct ntp_timestamp32 *t,
 static inline int ntp_timestamp32_from_us(struct ntp_timestamp32 *t,
 					  uint64_t us)
 {
+	uint64_t seconds = 0;
+
 	if (t == NULL)
 		return -EINVAL;
-	t->seconds = us / 1000000;
-	t->fraction = ((uint64_t)(us % 1000000) << 16) / 1000000;
+	seconds = rtp_div_1000000(us);
+	t->seconds = seconds;
+	t->fraction = rtp_div_1000000((us - seconds * 1000000) << 16);
 	return 0;
 }
 
@@ -159,7 +165,7 @@ static inline int ntp_timestamp32_from_timespec(struct ntp_timestamp32 *t,
 	if (t == NULL || ts == NULL)
 		return -EINVAL;
 	t->seconds = ts->tv_sec;
-	t->fraction = ((uint64_t)ts->tv_nsec << 16) / 1000000000;
+	t->fraction = rtp_div_1000000000((uint64_t)ts->tv_nsec << 16);
 	return 0;
 }
 
@@ -66,6 +66,10 @@
  * pkt average size of 500 and report every 100ms. */
 #define RTPFB_MAX_PKT 2000
 
+/* Maximum number of feedbacks given at once to the rtpfb_report read
+ * callback, larger reports are given in several parts */
+#define RTPFB_REPORT_PART_MAX 128
+
 
 /**
  *         0                   1                   2                   3
@@ -281,6 +285,21 @@ struct rtcp_pkt_rtpfb_report {
 };
 
 
+/* Lazy decoder of the feedbacks of an RTPFB report, see
+ * rtcp_pkt_read_cbs.rtpfb_report_iter (fields are internal) */
+struct rtcp_pkt_rtpfb_iter {
+	const uint8_t *chunks;
+	const uint8_t *deltas;
+	uint16_t base_seq;
+	uint16_t status_count;
+	uint16_t index;
+	uint16_t chunk;
+	uint16_t chunk_count;
+	uint16_t chunk_index;
+	uint8_t symbols[16];
+};
+
+
 struct rtcp_pkt_sdes_item {
 	uint8_t type;
 	uint8_t data_len;
@@ -401,8 +420,22 @@ struct rtcp_pkt_read_cbs {
 
 	void (*app)(const struct rtcp_pkt_app *app, void *userdata);
 
+	/* The feedbacks are decoded without allocation in parts of at most
+	 * RTPFB_REPORT_PART_MAX statuses, each given as a report of its own
+	 * (same feedback_pkt_count, consecutive base_seq); the reference time
+	 * and first receive delta of the following parts are rebased so that
+	 * each part gives the original reception times on its own */
 	void (*rtpfb_report)(const struct rtcp_pkt_rtpfb_report *rtpfb,
 			     void *userdata);
+
+	/* Allocation-free variant of rtpfb_report, used instead of it if
+	 * set: rtpfb->feedbacks is NULL and the feedbacks are decoded in order
+	 * by rtcp_pkt_rtpfb_iter_next() (no RTPFB_MAX_PKT limit); the
+	 * iterator is only valid during the call, it can be copied to walk
+	 * the feedbacks several times */
+	void (*rtpfb_report_iter)(const struct rtcp_pkt_rtpfb_report *rtpfb,
+				  struct rtcp_pkt_rtpfb_iter *iter,
+				  void *userdata);
 };
 
 
@@ -450,10 +483,41 @@ int rtcp_pkt_write_rtpfb(struct pomp_buffer *buf,
 			 const struct rtcp_pkt_rtpfb_report *cr);
 
 
+/* Write a transport-wide feedback report as consecutive RTPFB packets,
+ * starting a new packet every RTPFB_MAX_PKT statuses or when it would
+ * exceed max_size bytes (0 for no limit); the base sequence number,
+ * reference time and feedback packet count of the following packets are
+ * adjusted, and the receive delta of their first received packet rebased.
+ * Returns the number of packets written or a negative errno (-ERANGE if a
+ * rebased receive delta does not fit 16 bits) */
+RTP_API
+int rtcp_pkt_write_rtpfb_split(struct pomp_buffer *buf,
+			       size_t *pos,
+			       const struct rtcp_pkt_rtpfb_report *rtpfb,
+			       size_t max_size);
+
+
 RTP_API
 int rtcp_pkt_read(const struct pomp_buffer *buf,
 		  const struct rtcp_pkt_read_cbs *cbs,
 		  void *userdata);
 
 
+/* Decode the next feedback of an RTPFB report; the packet is checked
+ * before the rtpfb_report_iter callback, so the only error is -ENOENT
+ * after the last feedback */
+RTP_API
+int rtcp_pkt_rtpfb_iter_next(struct rtcp_pkt_rtpfb_iter *iter,
+			     struct rtcp_pkt_rtpfb_feedback *feedback);
+
+
+/* Decode up to count next feedbacks of an RTPFB report, a whole packet
+ * chunk at a time; returns the number of feedbacks decoded (0 after the
+ * last one) or a negative errno */
+RTP_API
+int rtcp_pkt_rtpfb_iter_read(struct rtcp_pkt_rtpfb_iter *iter,
+			     struct rtcp_pkt_rtpfb_feedback *feedbacks,
+			     size_t count);
+
+
 #endif /* !_RTCP_PKT_H_ */
@@ -49,16 +49,28 @@ extern "C" {
 #	define RTP_API
 #endif /* !RTP_API_EXPORTS */
 
+/* Division helpers used by the inline functions of the other headers */
+#include "rtp/rtp_clk.h"
+
 #include "rtp/ntp.h"
 #include "rtp/rtcp_pkt.h"
+#include "rtp/rtp_bwe.h"
+#include "rtp/rtp_demux.h"
 #include "rtp/rtp_jitter.h"
+#include "rtp/rtp_jitter_group.h"
 #include "rtp/rtp_pkt.h"
+#include "rtp/rtp_pkt_pool.h"
+#include "rtp/rtp_twcc.h"
 
 
 static inline uint64_t rtp_timestamp_to_us(uint64_t rtp_timestamp,
 					   uint32_t clk_rate)
 {
-	if (clk_rate == 0)
+	if (clk_rate == 90000)
+		return rtp_timestamp_to_us_90k(rtp_timestamp);
+	else if (clk_rate == 48000)
+		return rtp_timestamp_to_us_48k(rtp_timestamp);
+	else if (clk_rate == 0)
 		return 0;
 	else
 		return (rtp_timestamp * 1000000 + clk_rate / 2) / clk_rate;
@@ -67,7 +79,7 @@ static inline uint64_t rtp_timestamp_to_us(uint64_t rtp_timestamp,
 
 static inline uint64_t rtp_timestamp_from_us(uint64_t us, uint32_t clk_rate)
 {
-	return (us * clk_rate + 500000) / 1000000;
+	return rtp_div_1000000(us * clk_rate + 500000);
 }
 
 
@@ -0,0 +1,183 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _RTP_BWE_H_
+#define _RTP_BWE_H_
+
+
+/**
+ * Sender-side delay-based bandwidth estimator. The send times of the
+ * packets carrying a transport-wide sequence number are kept in a bounded
+ * history, joined with the transport-wide congestion control feedback
+ * (RTPFB) of the receiver to get the one-way delay variation between
+ * groups of packets. A trendline filter of the accumulated delay variation
+ * feeds an overuse detector with an adaptive threshold, which drives an
+ * AIMD rate controller: the target bitrate increases while the delay is
+ * stable and decreases below the acknowledged bitrate as soon as queues
+ * build up on the path.
+ */
+
+
+struct rtcp_pkt_rtpfb_iter;
+struct rtcp_pkt_rtpfb_report;
+struct rtp_bwe;
+
+
+/* Default number of transport sequence numbers kept in the send history */
+#define RTP_BWE_DEFAULT_HISTORY_SIZE 4096
+
+/* Maximum number of transport sequence numbers kept in the send history */
+#define RTP_BWE_MAX_HISTORY_SIZE 32768
+
+/* Default bitrates (bits/s) */
+#define RTP_BWE_DEFAULT_START_BITRATE 300000
+#define RTP_BWE_DEFAULT_MIN_BITRATE 30000
+#define RTP_BWE_DEFAULT_MAX_BITRATE 20000000
+
+
+/* State of the path given by the delay variation trend */
+enum rtp_bwe_usage {
+	/* Stable delay */
+	RTP_BWE_USAGE_NORMAL = 0,
+
+	/* Decreasing delay, queues are draining */
+	RTP_BWE_USAGE_UNDERUSE,
+
+	/* Increasing delay, queues are building up */
+	RTP_BWE_USAGE_OVERUSE,
+};
+
+
+struct rtp_bwe_cfg {
+	/* Number of transport sequence numbers kept in the send history,
+	 * rounded up to a power of 2 (0 means RTP_BWE_DEFAULT_HISTORY_SIZE,
+	 * at most RTP_BWE_MAX_HISTORY_SIZE); feedback for older packets is
+	 * ignored */
+	uint32_t history_size;
+
+	/* Initial, minimum and maximum target bitrates in bits/s (0 means
+	 * the RTP_BWE_DEFAULT_xxx_BITRATE values) */
+	uint32_t start_bitrate;
+	uint32_t min_bitrate;
+	uint32_t max_bitrate;
+};
+
+
+struct rtp_bwe_estimate {
+	/* Bitrate the sender should not exceed (bits/s) */
+	uint32_t target_bitrate;
+
+	/* Bitrate received by the peer, as acknowledged by the feedback
+	 * (bits/s, 0 if not known yet) */
+	uint32_t acked_bitrate;
+
+	/* Output of the overuse detector */
+	enum rtp_bwe_usage usage;
+
+	/* Modified trend of the delay variation and current threshold of the
+	 * overuse detector (ms) */
+	double trend;
+	double threshold;
+};
+
+
+struct rtp_bwe_stats {
+	/* Number of packets added to the send history */
+	uint64_t sent;
+
+	/* Number of packets reported received, or lost, by the feedback */
+	uint64_t received;
+	uint64_t lost;
+
+	/* Number of feedbacks ignored because their sequence number is not
+	 * in the send history (never sent, too old or already reported
+	 * received) */
+	uint64_t unknown;
+
+	/* Number of RTPFB reports processed */
+	uint64_t reports;
+
+	/* Number of times the overuse detector switched to overuse */
+	uint64_t overuses;
+};
+
+
+/* Create a bandwidth estimator; its memory is allocated once at
+ * creation */
+RTP_API
+int rtp_bwe_new(const struct rtp_bwe_cfg *cfg, struct rtp_bwe **ret_obj);
+
+
+RTP_API
+int rtp_bwe_destroy(struct rtp_bwe *self);
+
+
+/* Add to the send history the packet with the given transport sequence
+ * number, its size in bytes (including the headers the bitrate is computed
+ * on) and its send time (in us, from any monotonic clock); returns -ERANGE
+ * if the sequence number is older than the span of the history */
+RTP_API
+int rtp_bwe_sent(struct rtp_bwe *self,
+		 uint16_t seqnum,
+		 size_t size,
+		 uint64_t send_us);
+
+
+/* Process an RTPFB report (see rtcp_pkt_read_cbs.rtpfb_report) received
+ * at now_us (same clock as the send times) and update the target
+ * bitrate; returns -EPROTO if no packet was sent yet */
+RTP_API
+int rtp_bwe_feedback(struct rtp_bwe *self,
+		     const struct rtcp_pkt_rtpfb_report *report,
+		     uint64_t now_us);
+
+
+/* Same as rtp_bwe_feedback() for the allocation-free variant (see
+ * rtcp_pkt_read_cbs.rtpfb_report_iter); the iterator is not consumed */
+RTP_API
+int rtp_bwe_feedback_iter(struct rtp_bwe *self,
+			  const struct rtcp_pkt_rtpfb_report *report,
+			  const struct rtcp_pkt_rtpfb_iter *iter,
+			  uint64_t now_us);
+
+
+/* Set the round-trip time (us, e.g. from the RTCP receiver reports), which
+ * paces the additive increase and the successive decreases of the target
+ * bitrate (200 ms until set) */
+RTP_API
+int rtp_bwe_set_rtt(struct rtp_bwe *self, uint32_t rtt_us);
+
+
+RTP_API
+int rtp_bwe_get_estimate(struct rtp_bwe *self,
+			 struct rtp_bwe_estimate *estimate);
+
+
+RTP_API
+int rtp_bwe_get_stats(struct rtp_bwe *self, struct rtp_bwe_stats *stats);
+
+
+#endif /* !_RTP_BWE_H_ */
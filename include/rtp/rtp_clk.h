@@ -0,0 +1,173 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _RTP_CLK_H_
+#define _RTP_CLK_H_
+
+
+/**
+ * Division-free conversions between RTP clock ticks and microseconds.
+ * A 64-bit division by a 32-bit constant is replaced by a multiplication
+ * by its reciprocal (Granlund-Montgomery): q = (t + ((n - t) >> sh1)) >>
+ * sh2 with t = mulhi(n, mul), exact for all 64-bit numerators, so the
+ * results are bit-exact with rtp_timestamp_to_us(), rtp_timestamp_from_us()
+ * and the ntp_timestamp helpers, including their rounding and wrapping.
+ */
+
+
+/* Reciprocal of a 32-bit divisor, see rtp_recip_init() */
+struct rtp_recip {
+	uint64_t mul;
+	uint8_t sh1;
+	uint8_t sh2;
+};
+
+
+/* Clock rate with its precomputed reciprocal, see rtp_clk_init() */
+struct rtp_clk {
+	uint32_t clk_rate;
+	struct rtp_recip recip;
+};
+
+
+/* High 64 bits of the 128-bit product */
+static inline uint64_t rtp_mulhi64(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+	return ((unsigned __int128)a * b) >> 64;
+#else /* !__SIZEOF_INT128__ */
+	uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+	uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+	uint64_t lo = a_lo * b_lo;
+	uint64_t mid1 = a_hi * b_lo + (lo >> 32);
+	uint64_t mid2 = a_lo * b_hi + (uint32_t)mid1;
+	return a_hi * b_hi + (mid1 >> 32) + (mid2 >> 32);
+#endif /* !__SIZEOF_INT128__ */
+}
+
+
+static inline uint64_t
+rtp_recip_div_raw(uint64_t n, uint64_t mul, uint32_t sh1, uint32_t sh2)
+{
+	uint64_t t = rtp_mulhi64(n, mul);
+	return (t + ((n - t) >> sh1)) >> sh2;
+}
+
+
+static inline uint64_t rtp_recip_div(const struct rtp_recip *r, uint64_t n)
+{
+	return rtp_recip_div_raw(n, r->mul, r->sh1, r->sh2);
+}
+
+
+/* Compile-time reciprocals */
+static inline uint64_t rtp_div_90000(uint64_t n)
+{
+	return rtp_recip_div_raw(n, 0x74d3b7ba75827af9ULL, 1, 16);
+}
+
+
+static inline uint64_t rtp_div_48000(uint64_t n)
+{
+	return rtp_recip_div_raw(n, 0x5d867c3ece2a534aULL, 1, 15);
+}
+
+
+static inline uint64_t rtp_div_1000000(uint64_t n)
+{
+	return rtp_recip_div_raw(n, 0x0c6f7a0b5ed8d36cULL, 1, 19);
+}
+
+
+static inline uint64_t rtp_div_1000000000(uint64_t n)
+{
+	return rtp_recip_div_raw(n, 0x12e0be826d694b2fULL, 1, 29);
+}
+
+
+/* Same as rtp_timestamp_to_us() for the usual video and audio clocks */
+static inline uint64_t rtp_timestamp_to_us_90k(uint64_t rtp_timestamp)
+{
+	return rtp_div_90000(rtp_timestamp * 1000000 + 45000);
+}
+
+
+static inline uint64_t rtp_timestamp_to_us_48k(uint64_t rtp_timestamp)
+{
+	return rtp_div_48000(rtp_timestamp * 1000000 + 24000);
+}
+
+
+/* Same as rtp_timestamp_to_us(), using the precomputed reciprocal (or the
+ * compile-time ones for 90 kHz and 48 kHz) */
+static inline uint64_t rtp_clk_to_us(const struct rtp_clk *clk,
+				     uint64_t rtp_timestamp)
+{
+	if (clk->clk_rate == 90000)
+		return rtp_timestamp_to_us_90k(rtp_timestamp);
+	if (clk->clk_rate == 48000)
+		return rtp_timestamp_to_us_48k(rtp_timestamp);
+	if (clk->clk_rate == 0)
+		return 0;
+	return rtp_recip_div(&clk->recip,
+			     rtp_timestamp * 1000000 + clk->clk_rate / 2);
+}
+
+
+/* Same as rtp_timestamp_from_us() */
+static inline uint64_t rtp_clk_from_us(const struct rtp_clk *clk, uint64_t us)
+{
+	return rtp_div_1000000(us * clk->clk_rate + 500000);
+}
+
+
+/* Compute the reciprocal of a non-zero divisor */
+RTP_API
+int rtp_recip_init(struct rtp_recip *recip, uint32_t div);
+
+
+/* A clock rate of 0 converts all timestamps to 0, as
+ * rtp_timestamp_to_us() */
+RTP_API
+int rtp_clk_init(struct rtp_clk *clk, uint32_t clk_rate);
+
+
+/* Convert count values; in and out can be the same array */
+RTP_API
+int rtp_clk_to_us_batch(const struct rtp_clk *clk,
+			const uint64_t *rtp_timestamps,
+			uint64_t *us,
+			size_t count);
+
+
+RTP_API
+int rtp_clk_from_us_batch(const struct rtp_clk *clk,
+			  const uint64_t *us,
+			  uint64_t *rtp_timestamps,
+			  size_t count);
+
+
+#endif /* !_RTP_CLK_H_ */
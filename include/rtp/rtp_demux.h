@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _RTP_DEMUX_H_
+#define _RTP_DEMUX_H_
+
+
+struct rtp_pkt;
+struct rtp_jitter;
+struct rtp_demux;
+
+
+/* Key sources by SSRC and payload type instead of SSRC only */
+#define RTP_DEMUX_FLAG_KEY_PAYLOAD_TYPE (1 << 0)
+
+
+enum rtp_demux_remove_reason {
+	/* Removed by rtp_demux_remove_source() */
+	RTP_DEMUX_REMOVE_REASON_EXPLICIT = 0,
+
+	/* No packet received during the configured timeout */
+	RTP_DEMUX_REMOVE_REASON_TIMEOUT,
+
+	/* RTCP BYE received for the source */
+	RTP_DEMUX_REMOVE_REASON_BYE,
+
+	/* The demultiplexer is destroyed */
+	RTP_DEMUX_REMOVE_REASON_DESTROY,
+};
+
+
+struct rtp_demux_cfg {
+	/* RTP_DEMUX_FLAG_xxx */
+	uint32_t flags;
+
+	/* Number of sources that can be added before the table needs to
+	 * grow (0 means RTP_DEMUX_DEFAULT_CAPACITY) */
+	uint32_t capacity;
+
+	/* Maximum number of sources (0 means unlimited) */
+	uint32_t max_sources;
+
+	/* Inactivity timeout (in us) after which rtp_demux_expire() removes
+	 * a source (0 means never) */
+	uint64_t timeout;
+};
+
+
+struct rtp_demux_cbs {
+	/* Called on the first packet of an unknown source. The callback can
+	 * provide a jitter buffer to which the packets of the source will be
+	 * enqueued (it remains owned by the caller) and some userdata
+	 * associated with the source. Returning a negative error rejects the
+	 * packet. If not set, sources are added without jitter buffer. */
+	int (*source_add)(struct rtp_demux *demux,
+			  const struct rtp_pkt *pkt,
+			  struct rtp_jitter **ret_jitter,
+			  void **ret_source_userdata,
+			  void *userdata);
+
+	/* Called when a source is removed, the jitter buffer given when the
+	 * source was added can be destroyed here */
+	void (*source_remove)(struct rtp_demux *demux,
+			      uint32_t ssrc,
+			      uint8_t payload_type,
+			      struct rtp_jitter *jitter,
+			      void *source_userdata,
+			      enum rtp_demux_remove_reason reason,
+			      void *userdata);
+
+	/* Called for the packets of sources without jitter buffer, the
+	 * ownership of the packet is transferred to the callback */
+	void (*process_pkt)(struct rtp_demux *demux,
+			    struct rtp_pkt *pkt,
+			    void *source_userdata,
+			    void *userdata);
+};
+
+
+#define RTP_DEMUX_DEFAULT_CAPACITY 64
+
+
+RTP_API
+int rtp_demux_new(const struct rtp_demux_cfg *cfg,
+		  const struct rtp_demux_cbs *cbs,
+		  void *userdata,
+		  struct rtp_demux **ret_obj);
+
+
+/* All remaining sources are removed (see rtp_demux_cbs.source_remove) */
+RTP_API
+int rtp_demux_destroy(struct rtp_demux *self);
+
+
+/**
+ * Dispatch a parsed packet to its source (added if needed): the packet is
+ * enqueued in the jitter buffer of the source, or given to the process_pkt
+ * callback. The ownership of the packet is always transferred (it is
+ * destroyed if it can not be dispatched), so only packets allocated by the
+ * library are accepted (see rtp_pkt_destroy()).
+ * The input timestamp of the packet is used as last activity time of the
+ * source.
+ */
+RTP_API
+int rtp_demux_dispatch(struct rtp_demux *self, struct rtp_pkt *pkt);
+
+
+/* Remove the sources inactive for more than the configured timeout */
+RTP_API
+int rtp_demux_expire(struct rtp_demux *self, uint64_t cur_timestamp);
+
+
+/* Remove all the sources with the given SSRC (whatever their payload type) */
+RTP_API
+int rtp_demux_remove_source(struct rtp_demux *self, uint32_t ssrc);
+
+
+/* Remove the sources listed in an RTCP BYE packet; to be called from the
+ * bye callback of rtcp_pkt_read() (see also rtp_demux_rtcp_read()) */
+RTP_API
+int rtp_demux_process_bye(struct rtp_demux *self,
+			  const struct rtcp_pkt_bye *bye);
+
+
+/* Same as rtcp_pkt_read(), but the sources of BYE packets are removed from
+ * the demultiplexer before the given callbacks are called */
+RTP_API
+int rtp_demux_rtcp_read(struct rtp_demux *self,
+			const struct pomp_buffer *buf,
+			const struct rtcp_pkt_read_cbs *cbs,
+			void *userdata);
+
+
+/* Payload type is ignored if the demultiplexer is keyed by SSRC only.
+ * Returns -ENOENT if the source is unknown. */
+RTP_API
+int rtp_demux_get_source(struct rtp_demux *self,
+			 uint32_t ssrc,
+			 uint8_t payload_type,
+			 struct rtp_jitter **ret_jitter,
+			 void **ret_source_userdata);
+
+
+RTP_API
+int rtp_demux_get_source_count(struct rtp_demux *self, uint32_t *count);
+
+
+#endif /* !_RTP_DEMUX_H_ */
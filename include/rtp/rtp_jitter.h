@@ -28,13 +28,159 @@
 #define _RTP_JITTER_H_
 
 
+struct pomp_loop;
 struct rtp_pkt;
 struct rtp_jitter;
 
 
+enum rtp_jitter_storage {
+	/* Packets are kept in a list sorted by sequence number; insertion
+	 * cost grows with the reordering depth, suited for sparse cases */
+	RTP_JITTER_STORAGE_LIST = 0,
+
+	/* Packets are kept in a ring indexed by sequence number, with
+	 * constant insertion cost; the sequence number span of the queued
+	 * packets is limited to the ring size (oldest packets are dropped
+	 * when exceeded) */
+	RTP_JITTER_STORAGE_RING,
+};
+
+
+enum rtp_jitter_release_mode {
+	/* Packets are released one by one (process_pkt or process_pkts) */
+	RTP_JITTER_RELEASE_MODE_PACKET = 0,
+
+	/* Packets are released by frames (process_frame), i.e. consecutive
+	 * packets with the same RTP timestamp, as soon as a frame is complete
+	 * (it follows the last released packet and has no missing packet up
+	 * to the one with the marker bit) or when the deadline of its first
+	 * packet expires */
+	RTP_JITTER_RELEASE_MODE_FRAME,
+};
+
+
+/* Some packets of the frame may be missing */
+#define RTP_JITTER_FRAME_FLAG_INCOMPLETE (1 << 0)
+
+
+enum rtp_jitter_skew_mode {
+	/* The skew is the minimum over a window sliding on the last samples,
+	 * smoothed on each packet */
+	RTP_JITTER_SKEW_MODE_SLIDING = 0,
+
+	/* The skew is the minimum over consecutive blocks of samples,
+	 * smoothed at the end of each block */
+	RTP_JITTER_SKEW_MODE_BLOCK,
+
+	/* The minima of consecutive blocks of samples are fitted by a line
+	 * (least squares, forgetting older blocks by 1/skew_avg_alpha), whose
+	 * slope is the clock drift (see rtp_jitter_stats.skew_drift); the
+	 * skew follows the drift between blocks instead of lagging behind.
+	 * No samples are stored */
+	RTP_JITTER_SKEW_MODE_REGRESSION,
+
+	/* The skew is an exponential average falling quickly on lower samples
+	 * and rising by 1/skew_avg_alpha on higher ones, tracking a low
+	 * quantile of the samples; cheapest mode, no samples are stored and
+	 * no window is used */
+	RTP_JITTER_SKEW_MODE_EWMA,
+};
+
+
+#define RTP_JITTER_DEFAULT_RING_SIZE 1024
+
+#define RTP_JITTER_MAX_RING_SIZE 32768
+
+#define RTP_JITTER_MAX_SKEW_WINDOW_SIZE 32768
+
+#define RTP_JITTER_MAX_INGRESS_SIZE 32768
+
+
 struct rtp_jitter_cfg {
 	uint32_t clk_rate;
 	uint32_t delay;
+
+	/* Adaptive delay: if delay_percentile is non-zero (up to 100), the
+	 * delay used to release packets follows this percentile of the
+	 * measured transit variation (input timestamp minus out timestamp)
+	 * plus delay_margin, between delay_min and delay (used as initial
+	 * value). It is updated every second, only when the target differs
+	 * by more than delay_hysteresis, by at most delay_slew per update (0
+	 * means 2 ms and 10 ms respectively) */
+	uint32_t delay_percentile;
+	uint32_t delay_margin;
+	uint32_t delay_min;
+	uint32_t delay_hysteresis;
+	uint32_t delay_slew;
+
+	enum rtp_jitter_storage storage;
+
+	enum rtp_jitter_release_mode release_mode;
+
+	/* If non-zero, time (in us) after which a missing packet is declared
+	 * lost, counted from its expected arrival interpolated between the
+	 * packets around it; packets after it can then be released before
+	 * their own deadline (in RTP_JITTER_RELEASE_MODE_FRAME, an incomplete
+	 * frame is released). 0 means missing packets are only skipped when
+	 * the next packet reaches its deadline */
+	uint32_t reorder_tolerance;
+
+	/* Live mode: if non-zero (not below delay), latency is bounded at the
+	 * expense of completeness. Packets are late if their out timestamp is
+	 * older than max_latency, or if they were received before a packet
+	 * that would be released more than max_latency after its arrival (the
+	 * timing is then restarted from the first packet of that frame). Late
+	 * packets are dropped from the head of the queue up to the next frame
+	 * that is not late, except those with an importance lower than
+	 * skip_keep_importance (low numbers are more important), which are
+	 * released immediately. Drops are reported by the skip_pkts
+	 * callback */
+	uint32_t max_latency;
+	uint32_t skip_keep_importance;
+
+	/* Budget of the queued packets (number and total size of their raw
+	 * data), 0 means unlimited. When it is exceeded, the packets with the
+	 * highest eviction score (see cbs.evict_score) are evicted, the
+	 * oldest first among equal scores, including the new packet. With an
+	 * ingress ring, it is applied when the packets are drained (up to
+	 * ingress_size packets can be pending) */
+	uint32_t max_pkts;
+	size_t max_bytes;
+
+	/* Number of entries of the ring for RTP_JITTER_STORAGE_RING (power of
+	 * 2, up to RTP_JITTER_MAX_RING_SIZE), 0 means
+	 * RTP_JITTER_DEFAULT_RING_SIZE */
+	uint32_t ring_size;
+
+	enum rtp_jitter_skew_mode skew_mode;
+
+	/* Number of samples of the skew window or block (up to
+	 * RTP_JITTER_MAX_SKEW_WINDOW_SIZE), 0 means 512 in sliding mode, 400
+	 * in block mode and 100 in regression mode */
+	uint32_t skew_window_size;
+
+	/* Duration of the skew window or block (in us), 0 means 2s in sliding
+	 * mode, 5s in block mode and 1s in regression mode */
+	uint32_t skew_window_timeout;
+
+	/* Smoothing factors (the average moves by 1/alpha of the difference
+	 * on each update), 0 means 128 (64 in block mode, 16 blocks in
+	 * regression mode, 1024 in EWMA mode) for the skew and 16 for the
+	 * jitter */
+	uint32_t skew_avg_alpha;
+	uint32_t jitter_avg_alpha;
+
+	/* If non-zero, the skew samples are stored on 32 bits relative to a
+	 * base value instead of 64 bits, halving the window memory */
+	int skew_compact;
+
+	/* If non-zero, rtp_jitter_enqueue() can be called from one thread
+	 * (producer) while the other functions are called from another one
+	 * (consumer), without locking: the skew and jitter are estimated by
+	 * the producer, which passes the packets through a lock-free ring of
+	 * this size (power of 2, up to RTP_JITTER_MAX_INGRESS_SIZE) drained
+	 * by the consumer on process */
+	uint32_t ingress_size;
 };
 
 
@@ -43,6 +189,101 @@ struct rtp_jitter_cbs {
 			    const struct rtp_pkt *pkt,
 			    uint32_t gap,
 			    void *userdata);
+
+	/* Batch variant of process_pkt, used instead of it if set: called
+	 * once per rtp_jitter_process() with all the released packets in
+	 * order and their gaps; the callback can take ownership of a packet
+	 * by setting its entry to NULL, the others are destroyed after the
+	 * call */
+	void (*process_pkts)(struct rtp_jitter *jitter,
+			     struct rtp_pkt **pkts,
+			     const uint32_t *gaps,
+			     size_t count,
+			     void *userdata);
+
+	/* Frame release mode: called with the packets of a frame in order,
+	 * gaps are the numbers of missing packets before each of them (the
+	 * previous frame or holes within this one) and flags is a combination
+	 * of RTP_JITTER_FRAME_FLAG_xxx; ownership of the packets can be taken
+	 * as with process_pkts */
+	void (*process_frame)(struct rtp_jitter *jitter,
+			      struct rtp_pkt **pkts,
+			      const uint32_t *gaps,
+			      size_t count,
+			      uint32_t flags,
+			      void *userdata);
+
+	/* Live mode: count packets were dropped by the current process
+	 * (optional) */
+	void (*skip_pkts)(struct rtp_jitter *jitter,
+			  uint32_t count,
+			  void *userdata);
+
+	/* Eviction score of a packet (optional), called once when it is
+	 * queued if a budget applies to the jitter buffer (own budget or
+	 * group): packets with higher scores are evicted first; the default
+	 * score evicts the least important packets first (highest
+	 * importance, then priority values) */
+	uint64_t (*evict_score)(struct rtp_jitter *jitter,
+				const struct rtp_pkt *pkt,
+				void *userdata);
+};
+
+
+struct rtp_jitter_stats {
+	/* Packets accepted by rtp_jitter_enqueue() */
+	uint64_t enqueued;
+
+	/* Packets dropped by rtp_jitter_enqueue() because the ingress ring
+	 * was full (cfg.ingress_size) */
+	uint64_t ingress_dropped;
+
+	/* Packets released to the callbacks */
+	uint64_t released;
+
+	/* Missing packets skipped on release (sum of the gaps) */
+	uint64_t lost;
+
+	/* Packets dropped on arrival: duplicates of queued packets, packets
+	 * received after the release of the following ones (late packets or
+	 * duplicates of released ones), packets out of the span of the ring
+	 * (RTP_JITTER_STORAGE_RING, including the oldest ones dropped to make
+	 * room) */
+	uint64_t duplicates;
+	uint64_t late;
+	uint64_t overflow;
+
+	/* Packets dropped in live mode (cfg.max_latency) */
+	uint64_t skipped;
+
+	/* Packets evicted to stay within the budgets */
+	uint64_t evicted_pkts;
+	uint64_t evicted_bytes;
+
+	/* Packets received after one with a higher sequence number, and the
+	 * largest sequence number distance seen */
+	uint64_t reordered;
+	uint32_t reorder_max_depth;
+
+	/* Restarts of the skew estimation (sender restarts, large gaps, out
+	 * timestamps late in live mode) */
+	uint32_t skew_resets;
+
+	/* Current number, total size (raw data) and duration (in us, between
+	 * the out timestamps of the first and last ones) of the queued
+	 * packets */
+	uint32_t queue_pkts;
+	size_t queue_bytes;
+	uint32_t queue_duration;
+
+	/* Current delay (see rtp_jitter_get_target_delay()) and estimations
+	 * (see rtp_jitter_get_info()); the clock drift of the sender relative
+	 * to the receiver (in ppm, positive if the sender is slower) is only
+	 * estimated in RTP_JITTER_SKEW_MODE_REGRESSION */
+	uint32_t delay;
+	uint32_t jitter_avg;
+	int64_t skew_avg;
+	int32_t skew_drift;
 };
 
 
@@ -53,14 +294,27 @@ int rtp_jitter_new(const struct rtp_jitter_cfg *cfg,
 		   struct rtp_jitter **ret_obj);
 
 
+/* Memory used by a jitter buffer created with the given configuration,
+ * excluding the queued packets */
+RTP_API
+int rtp_jitter_get_mem_size(const struct rtp_jitter_cfg *cfg, size_t *size);
+
+
 RTP_API
 int rtp_jitter_destroy(struct rtp_jitter *self);
 
 
+/* With an ingress ring, the skew estimation is reset by the producer on its
+ * next enqueue */
 RTP_API
 int rtp_jitter_clear(struct rtp_jitter *self, uint16_t next_seqnum);
 
 
+/* Takes ownership of the packet unless the arguments are invalid; only
+ * packets allocated by the library are accepted (see rtp_pkt_destroy()),
+ * the jitter buffer keeps internal state in them and destroys them; with an
+ * ingress ring, returns -ENOBUFS if it is full (the packet is then dropped
+ * without being accounted in the estimations) */
 RTP_API
 int rtp_jitter_enqueue(struct rtp_jitter *self, struct rtp_pkt *pkt);
 
@@ -69,6 +323,42 @@ RTP_API
 int rtp_jitter_process(struct rtp_jitter *self, uint64_t cur_timestamp);
 
 
+/* Timestamp from which rtp_jitter_process() will release the first queued
+ * packet: 0 if it is the next expected one, its out timestamp plus the
+ * delay otherwise; returns -ENOENT if no packet is queued */
+RTP_API
+int rtp_jitter_get_next_deadline(struct rtp_jitter *self, uint64_t *deadline);
+
+
+/* Let the jitter buffer call rtp_jitter_process() from the given loop when
+ * the next packet is due, using a timer re-armed after each enqueue and
+ * process; packets input timestamps must then be taken from the monotonic
+ * clock (time_get_monotonic). With an ingress ring, the loop is the
+ * consumer, woken up by the producer with an event; it must be attached
+ * before the producer starts */
+RTP_API
+int rtp_jitter_attach_loop(struct rtp_jitter *self, struct pomp_loop *loop);
+
+
+RTP_API
+int rtp_jitter_detach_loop(struct rtp_jitter *self);
+
+
+/* Delay currently used to release packets (cfg.delay unless adaptive) */
+RTP_API
+int rtp_jitter_get_target_delay(struct rtp_jitter *self, uint32_t *delay);
+
+
+/* Number and total size of the packets evicted to stay within the budgets
+ * of the jitter buffer and of its group (if any) */
+RTP_API
+int rtp_jitter_get_evictions(struct rtp_jitter *self,
+			     uint64_t *pkts,
+			     uint64_t *bytes);
+
+
+/* With an ingress ring, the averages are the last ones published by the
+ * producer */
 RTP_API
 int rtp_jitter_get_info(struct rtp_jitter *self,
 			uint32_t *clk_rate,
@@ -76,4 +366,13 @@ int rtp_jitter_get_info(struct rtp_jitter *self,
 			int64_t *skew_avg);
 
 
+/* Counters are cumulated since the creation of the jitter buffer; with an
+ * ingress ring, the ones updated by the producer (enqueued, ingress_dropped,
+ * skew_resets and the averages) are read with relaxed atomics and may lag
+ * behind the other ones */
+RTP_API
+int rtp_jitter_get_stats(struct rtp_jitter *self,
+			 struct rtp_jitter_stats *stats);
+
+
 #endif /* _RTP_JITTER_H_ */
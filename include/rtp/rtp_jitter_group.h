@@ -0,0 +1,113 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _RTP_JITTER_GROUP_H_
+#define _RTP_JITTER_GROUP_H_
+
+
+struct pomp_loop;
+struct rtp_jitter;
+struct rtp_jitter_group;
+
+
+/* Default resolution of the timing wheel (in us) */
+#define RTP_JITTER_GROUP_DEFAULT_TICK 1000
+
+
+struct rtp_jitter_group_cfg {
+	/* Resolution of the timing wheel (in us), 0 means
+	 * RTP_JITTER_GROUP_DEFAULT_TICK; packets are released up to one tick
+	 * after their deadline */
+	uint32_t tick;
+
+	/* Budget of the packets queued in all the members (number and total
+	 * size of their raw data), 0 means unlimited. When it is exceeded,
+	 * packets are evicted from the member using the largest part of the
+	 * exceeded budget, according to its eviction policy (see
+	 * rtp_jitter_cfg.max_pkts) */
+	uint32_t max_pkts;
+	size_t max_bytes;
+};
+
+
+/* Create a group sharing the scheduling of many jitter buffers: the next
+ * deadlines of the members are kept in a hierarchical timing wheel and only
+ * the due members are processed. If loop is not NULL, the group processes
+ * its members from a single timer on this loop and the packets input
+ * timestamps must be taken from the monotonic clock (time_get_monotonic);
+ * otherwise rtp_jitter_group_process() must be called by the application
+ * according to rtp_jitter_group_get_next_deadline() */
+RTP_API
+int rtp_jitter_group_new(const struct rtp_jitter_group_cfg *cfg,
+			 struct pomp_loop *loop,
+			 struct rtp_jitter_group **ret_obj);
+
+
+/* Returns -EBUSY if the group still has members */
+RTP_API
+int rtp_jitter_group_destroy(struct rtp_jitter_group *self);
+
+
+/* A jitter buffer can only be in one group and can not be attached to a
+ * loop at the same time (-EBUSY), nor use an ingress ring (-EINVAL);
+ * destroying a member removes it from its group */
+RTP_API
+int rtp_jitter_group_add(struct rtp_jitter_group *self,
+			 struct rtp_jitter *jitter);
+
+
+RTP_API
+int rtp_jitter_group_remove(struct rtp_jitter_group *self,
+			    struct rtp_jitter *jitter);
+
+
+/* Process the members whose deadline is before cur_timestamp */
+RTP_API
+int rtp_jitter_group_process(struct rtp_jitter_group *self,
+			     uint64_t cur_timestamp);
+
+
+/* Timestamp from which rtp_jitter_group_process() has work to do (0 if it
+ * should be called immediately); returns -ENOENT if nothing is scheduled */
+RTP_API
+int rtp_jitter_group_get_next_deadline(struct rtp_jitter_group *self,
+				       uint64_t *deadline);
+
+
+RTP_API
+int rtp_jitter_group_get_member_count(struct rtp_jitter_group *self,
+				      uint32_t *count);
+
+
+/* Number and total size of the packets evicted to stay within the budget of
+ * the group */
+RTP_API
+int rtp_jitter_group_get_evictions(struct rtp_jitter_group *self,
+				   uint64_t *pkts,
+				   uint64_t *bytes);
+
+
+#endif /* _RTP_JITTER_GROUP_H_ */
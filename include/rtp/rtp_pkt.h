@@ -28,6 +28,9 @@
 #define _RTP_PKT_H_
 
 
+struct rtp_pkt_pool;
+
+
 #define RTP_PKT_VERSION 2
 
 #define RTP_PKT_HEADER_SIZE 12
@@ -58,6 +61,11 @@
 	((_flags) |= ((_val)&RTP_PKT_HEADER_FLAGS_##_name##_MASK)              \
 		     << RTP_PKT_HEADER_FLAGS_##_name##_SHIFT)
 
+/* RFC 5761: range of the second byte of the header (marker bit + payload
+ * type for RTP) that identifies RTCP packets on a multiplexed socket */
+#define RTP_PKT_RTCP_TYPE_MIN 192
+#define RTP_PKT_RTCP_TYPE_MAX 223
+
 
 /**
  * 5.1 RTP Fixed Header Fields
@@ -95,6 +103,28 @@ struct rtp_pkt_header {
 };
 
 
+/* Routing fields of an RTP packet, see rtp_pkt_peek() */
+struct rtp_pkt_peek_info {
+	uint32_t ssrc;
+	uint32_t timestamp;
+	uint16_t seqnum;
+	uint8_t payload_type;
+	uint8_t marker;
+};
+
+
+enum rtp_pkt_class {
+	/* Too short or bad version */
+	RTP_PKT_CLASS_INVALID = 0,
+
+	/* RTP packet (at least a full fixed header) */
+	RTP_PKT_CLASS_RTP,
+
+	/* RTCP packet (at least a full RTCP header) */
+	RTP_PKT_CLASS_RTCP,
+};
+
+
 struct rtp_pkt {
 	struct rtp_pkt_header header;
 
@@ -145,14 +175,75 @@ struct rtp_pkt {
 };
 
 
+/**
+ * Classify a raw datagram received on a socket where RTP and RTCP may be
+ * multiplexed (RFC 5761), without parsing nor allocating anything.
+ */
+static inline enum rtp_pkt_class rtp_pkt_classify(const uint8_t *data,
+						  size_t len)
+{
+	if (data == NULL || len < RTCP_PKT_HEADER_SIZE ||
+	    (data[0] >> 6) != RTP_PKT_VERSION)
+		return RTP_PKT_CLASS_INVALID;
+	if (data[1] >= RTP_PKT_RTCP_TYPE_MIN &&
+	    data[1] <= RTP_PKT_RTCP_TYPE_MAX)
+		return RTP_PKT_CLASS_RTCP;
+	if (len < RTP_PKT_HEADER_SIZE)
+		return RTP_PKT_CLASS_INVALID;
+	return RTP_PKT_CLASS_RTP;
+}
+
+
+/**
+ * Extract the routing fields of an RTP packet from a raw datagram, only the
+ * version and the fixed header length are checked (CSRC, extension header
+ * and padding are not). Returns -EIO if the data is not a valid RTP packet
+ * (including RTCP packets, see rtp_pkt_classify()).
+ */
+static inline int rtp_pkt_peek(const uint8_t *data,
+			       size_t len,
+			       struct rtp_pkt_peek_info *info)
+{
+	if (info == NULL)
+		return -EINVAL;
+	if (rtp_pkt_classify(data, len) != RTP_PKT_CLASS_RTP)
+		return -EIO;
+	info->marker = data[1] >> 7;
+	info->payload_type = data[1] & RTP_PKT_HEADER_FLAGS_PAYLOAD_TYPE_MASK;
+	info->seqnum = ((uint16_t)data[2] << 8) | data[3];
+	info->timestamp = ((uint32_t)data[4] << 24) |
+			  ((uint32_t)data[5] << 16) |
+			  ((uint32_t)data[6] << 8) | data[7];
+	info->ssrc = ((uint32_t)data[8] << 24) | ((uint32_t)data[9] << 16) |
+		     ((uint32_t)data[10] << 8) | data[11];
+	return 0;
+}
+
+
 RTP_API
 int rtp_pkt_new(struct rtp_pkt **ret_obj);
 
 
+/* Same as rtp_pkt_new() but draws the packet from the given pool,
+ * rtp_pkt_destroy() will give it back to the pool */
+RTP_API
+int rtp_pkt_new_from_pool(struct rtp_pkt_pool *pool, struct rtp_pkt **ret_obj);
+
+
 RTP_API
 int rtp_pkt_clone(const struct rtp_pkt *pkt, struct rtp_pkt **ret_obj);
 
 
+/* Same as rtp_pkt_clone() but draws the clone from the given pool */
+RTP_API
+int rtp_pkt_clone_from_pool(struct rtp_pkt_pool *pool,
+			    const struct rtp_pkt *pkt,
+			    struct rtp_pkt **ret_obj);
+
+
+/* Only packets allocated by the library (rtp_pkt_new(), rtp_pkt_clone() and
+ * their _from_pool variants) can be destroyed, not a struct rtp_pkt owned by
+ * the caller (e.g. filled by rtp_pkt_read() or rtp_pkt_read_batch()) */
 RTP_API
 int rtp_pkt_destroy(struct rtp_pkt *pkt);
 
@@ -165,4 +256,23 @@ RTP_API
 int rtp_pkt_read(struct pomp_buffer *buf, struct rtp_pkt *pkt);
 
 
+/**
+ * Parse a batch of received buffers, equivalent to calling rtp_pkt_read()
+ * on each of them but without stopping on errors.
+ * The result of each parse is stored in results[i] (if not NULL); on
+ * success pkts[i] holds a reference on bufs[i] (pkts[i].raw.buf) that the
+ * caller must release, on error pkts[i].raw.buf is set to NULL.
+ * The pkts[] structures are owned by the caller: they must not be given to
+ * rtp_pkt_destroy(), rtp_jitter_enqueue() or rtp_demux_dispatch(), use
+ * rtp_pkt_clone_from_pool() (or rtp_pkt_clone()) to get a packet that can
+ * be queued.
+ * Returns the number of packets successfully parsed.
+ */
+RTP_API
+int rtp_pkt_read_batch(struct pomp_buffer **bufs,
+		       size_t n,
+		       struct rtp_pkt *pkts,
+		       int *results);
+
+
 #endif /* !_RTP_PKT_H_ */
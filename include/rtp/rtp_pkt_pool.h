@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _RTP_PKT_POOL_H_
+#define _RTP_PKT_POOL_H_
+
+
+struct rtp_pkt_pool;
+
+
+struct rtp_pkt_pool_cfg {
+	/* Number of packets preallocated at creation */
+	uint32_t initial_count;
+
+	/* Number of packets added each time the pool grows
+	 * (0 means RTP_PKT_POOL_DEFAULT_GROW_COUNT) */
+	uint32_t grow_count;
+
+	/* High-water mark: maximum number of packets allocated by the pool
+	 * (0 means unlimited); once reached, new packets are allocated on
+	 * the heap and are not returned to the pool when destroyed */
+	uint32_t max_count;
+
+	/* Maximum number of free packets kept in each thread cache
+	 * (0 means RTP_PKT_POOL_DEFAULT_CACHE_SIZE) */
+	uint32_t cache_size;
+};
+
+
+struct rtp_pkt_pool_stats {
+	/* Number of packets served from already allocated memory */
+	uint64_t hits;
+
+	/* Number of packets that required growing the pool or a heap
+	 * allocation */
+	uint64_t misses;
+
+	/* Number of pool packets currently in use */
+	uint32_t outstanding;
+
+	/* Number of packets allocated by the pool (free or in use) */
+	uint32_t allocated;
+};
+
+
+#define RTP_PKT_POOL_DEFAULT_GROW_COUNT 256
+
+#define RTP_PKT_POOL_DEFAULT_CACHE_SIZE 64
+
+
+RTP_API
+int rtp_pkt_pool_new(const struct rtp_pkt_pool_cfg *cfg,
+		     struct rtp_pkt_pool **ret_obj);
+
+
+/* Returns -EBUSY if some packets drawn from the pool are still in use */
+RTP_API
+int rtp_pkt_pool_destroy(struct rtp_pkt_pool *self);
+
+
+/* Counters are gathered from all thread caches without locking them, they
+ * are only approximate while other threads use the pool */
+RTP_API
+int rtp_pkt_pool_get_stats(struct rtp_pkt_pool *self,
+			   struct rtp_pkt_pool_stats *stats);
+
+
+#endif /* !_RTP_PKT_POOL_H_ */
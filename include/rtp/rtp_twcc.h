@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _RTP_TWCC_H_
+#define _RTP_TWCC_H_
+
+
+struct pomp_buffer;
+struct rtcp_pkt_rtpfb_report;
+struct rtp_twcc_recorder;
+
+
+/* Default number of transport sequence numbers tracked by a recorder */
+#define RTP_TWCC_RECORDER_DEFAULT_SIZE 4096
+
+/* Maximum number of transport sequence numbers tracked by a recorder */
+#define RTP_TWCC_RECORDER_MAX_SIZE 32768
+
+
+struct rtp_twcc_recorder_cfg {
+	/* SSRCs written in the reports */
+	uint32_t sender_ssrc;
+	uint32_t media_ssrc;
+
+	/* Number of transport sequence numbers tracked, rounded up to a
+	 * power of 2 (0 means RTP_TWCC_RECORDER_DEFAULT_SIZE, at most
+	 * RTP_TWCC_RECORDER_MAX_SIZE); it bounds the span of a report, the
+	 * oldest packets not reported yet are dropped when it is exceeded */
+	uint32_t size;
+};
+
+
+struct rtp_twcc_recorder_stats {
+	/* Number of packets recorded */
+	uint64_t recorded;
+
+	/* Number of packets ignored because their sequence number was
+	 * already recorded */
+	uint64_t duplicates;
+
+	/* Number of packets ignored because they arrived after their
+	 * sequence number was reported (as lost) */
+	uint64_t late;
+
+	/* Number of recorded packets dropped before being reported, when the
+	 * span of the recorder was exceeded */
+	uint64_t dropped;
+
+	/* Number of reports built */
+	uint64_t reports;
+};
+
+
+/* Create a recorder of the arrival times of packets carrying a
+ * transport-wide sequence number, building the transport-wide congestion
+ * control feedback reports (RTPFB) for their sender; its memory is
+ * allocated once at creation */
+RTP_API
+int rtp_twcc_recorder_new(const struct rtp_twcc_recorder_cfg *cfg,
+			  struct rtp_twcc_recorder **ret_obj);
+
+
+RTP_API
+int rtp_twcc_recorder_destroy(struct rtp_twcc_recorder *self);
+
+
+/* Record the arrival time (in us, from any monotonic clock) of the packet
+ * with the given transport sequence number; sequence number wraps,
+ * reordering and gaps are handled. Duplicates and packets older than the
+ * last report are ignored (-EALREADY) */
+RTP_API
+int rtp_twcc_recorder_record(struct rtp_twcc_recorder *self,
+			     uint16_t seqnum,
+			     uint64_t arrival_us);
+
+
+/* Build the report of the packets recorded since the previous report,
+ * from the first sequence number not reported yet to the highest one
+ * received, with the receive deltas in 250 us units relative to a reference
+ * time in 64 ms units. report->feedbacks points to an internal array valid
+ * until the next call. The report ends early before a receive delta that
+ * does not fit 16 bits (more than 8 s), the following packets are reported
+ * by the next call. Returns -EAGAIN if there is nothing to report */
+RTP_API
+int rtp_twcc_recorder_get_report(struct rtp_twcc_recorder *self,
+				 struct rtcp_pkt_rtpfb_report *report);
+
+
+/* Build the report of the packets recorded since the previous report and
+ * write it with rtcp_pkt_write_rtpfb_split(); returns the number of RTPFB
+ * packets written, or -EAGAIN if there is nothing to report */
+RTP_API
+int rtp_twcc_recorder_write(struct rtp_twcc_recorder *self,
+			    struct pomp_buffer *buf,
+			    size_t *pos,
+			    size_t max_size);
+
+
+RTP_API
+int rtp_twcc_recorder_get_stats(struct rtp_twcc_recorder *self,
+				struct rtp_twcc_recorder_stats *stats);
+
+
+#endif /* !_RTP_TWCC_H_ */
@@ -38,6 +38,10 @@
 #define STATUS_VECTOR_TWO_BIT_SYMBOLS_MASK 0x4000
 #define STATUS_VECTOR_CHUNK_MASK 0x8000
 
+/* Size of the receive delta of a status symbol: 1 byte for a small delta,
+ * 2 bytes for a large or negative delta, none otherwise */
+#define SV_DELTA(s) ((s) == 1 ? 1 : (s) == 2 ? 2 : 0)
+
 /* clang-format off */
 #define CHECK(_x) do { if ((res = (_x)) < 0) goto out; } while (0)
 /* clang-format on */
@@ -147,33 +151,6 @@ out:
 }
 
 
-/**
- * Get the RTCP Feedback packet chunks 'status'.
- * This means:
- *	- symbol list in Status Vector Chunk
- *	- run length in Run Length Chunk
- * Refer to google congestion control draft for more info:
- * draft-holmer-rmcat-transport-wide-cc-extensions-01.pdf
- */
-static uint16_t
-build_rtcpfb_chunk_status(uint8_t *symbols, uint16_t len, bool two_bit_symbols)
-{
-	const int bits_per_symbol = two_bit_symbols ? 2 : 1;
-	const int nb_symbols = STATUS_VECTOR_CHUNK_ACK_LG / bits_per_symbol;
-
-	uint16_t status = STATUS_VECTOR_CHUNK_MASK;
-	if (two_bit_symbols)
-		status |= STATUS_VECTOR_TWO_BIT_SYMBOLS_MASK;
-
-	for (int i = 0; i < len; i++) {
-		const int bit_pos = (nb_symbols - 1 - i) * bits_per_symbol;
-		status |= symbols[i] << bit_pos;
-	}
-
-	return status;
-}
-
-
 const char *rtcp_pkt_type_str(uint8_t type)
 {
 	switch (type) {
@@ -430,156 +407,482 @@ out:
 }
 
 
-/**
- * RTPFB Congestion Control Feedback
- */
-int rtcp_pkt_write_rtpfb(struct pomp_buffer *buf,
-			 size_t *pos,
-			 const struct rtcp_pkt_rtpfb_report *rtpfb)
+/* Size of the fixed part of an RTPFB packet, including the header */
+#define RTPFB_FIXED_SIZE (RTCP_PKT_HEADER_SIZE + 16)
+
+/* Time units of the reference time and of the receive deltas */
+#define RTPFB_REF_TIME_DELTAS 256
+
+
+/* Greedy packet chunk encoder: statuses are accumulated as long as they
+ * fit a single chunk, which is emitted as a run length if they are all
+ * equal or as a status vector otherwise */
+struct rtpfb_chunker {
+	uint8_t symbols[STATUS_VECTOR_CHUNK_ACK_LG];
+	uint16_t count;
+	bool all_same;
+	bool large;
+};
+
+
+/* Layout of an RTPFB packet written by rtcp_pkt_write_rtpfb_packets() */
+struct rtpfb_packet {
+	/* Statuses [first, first + count[ of the report */
+	uint16_t first;
+	uint16_t count;
+	uint32_t ref_time;
+	/* First received status, with its delta rebased on ref_time */
+	uint16_t first_rx;
+	uint8_t first_rx_symbol;
+	int16_t first_rx_delta;
+	uint16_t chunks;
+	size_t size;
+};
+
+
+static void rtpfb_chunker_reset(struct rtpfb_chunker *c)
 {
-	int res = 0;
-	struct rtcp_pkt_header header;
-	size_t header_pos = 0;
+	c->count = 0;
+	c->all_same = true;
+	c->large = false;
+}
 
-	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(pos == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(rtpfb == NULL, EINVAL);
 
-	/* Remember where to write header and skip it */
-	header_pos = *pos;
-	*pos += RTCP_PKT_HEADER_SIZE;
+static bool rtpfb_chunker_can_add(const struct rtpfb_chunker *c,
+				  uint8_t symbol)
+{
+	if (c->count < STATUS_VECTOR_CHUNK_ACK_LG / 2)
+		return true;
+	if (c->count < STATUS_VECTOR_CHUNK_ACK_LG && !c->large && symbol <= 1)
+		return true;
+	return c->all_same && symbol == c->symbols[0] && c->count < 0x1FFF;
+}
+
+
+static void rtpfb_chunker_add(struct rtpfb_chunker *c, uint8_t symbol)
+{
+	if (c->count < STATUS_VECTOR_CHUNK_ACK_LG)
+		c->symbols[c->count] = symbol;
+	if (c->count > 0 && symbol != c->symbols[0])
+		c->all_same = false;
+	if (symbol > 1)
+		c->large = true;
+	c->count++;
+}
 
-	CHECK(rtp_write_u32(buf, pos, rtpfb->sender_ssrc));
-	CHECK(rtp_write_u32(buf, pos, rtpfb->media_ssrc));
-	CHECK(rtp_write_u16(buf, pos, rtpfb->base_seq));
-	CHECK(rtp_write_u16(buf, pos, rtpfb->status_count));
-
-	CHECK(rtp_write_u16(buf, pos, rtpfb->ref_time >> 8));
-	CHECK(rtp_write_u8(buf, pos, rtpfb->ref_time & 0xFF));
-	CHECK(rtp_write_u8(buf, pos, rtpfb->feedback_pkt_count));
-
-	/* Write packet chunks */
-	struct pkt_chunk {
-		/* Represents the Run Length in a Run Length Chunk.
-		 * Represents Status symbol list in Status Vector Chunk. */
-		uint8_t ack[STATUS_VECTOR_CHUNK_ACK_LG];
-		/* Boolean value to indicate if it is
-		 * a run length chunk or a status chunk */
-		uint8_t run;
-		/* Boolean value to indicate if it is a status with
-		 * only small deltas or also contains large deltas */
-		uint8_t large;
-		uint16_t pos;
-	};
-
-	uint16_t i, j;
-	struct pkt_chunk chunk;
-	chunk.run = 1;
-	chunk.large = 0;
-	chunk.pos = 0;
-	for (i = 0; i < rtpfb->status_count; ++i) {
-		/* Check if chunk should be written */
-		if (chunk.pos == STATUS_VECTOR_CHUNK_ACK_LG &&
-		    chunk.large == 0 && chunk.run == 0) {
-			/* Status Vector Chunk containing 14 1-bits symbols */
-			uint16_t status = build_rtcpfb_chunk_status(
-				chunk.ack, chunk.pos, false);
-			CHECK(rtp_write_u16(buf, pos, status));
-			chunk.pos = 0;
-		} else if (chunk.pos >= 7 && chunk.large && chunk.run == 0) {
-			/* Status Vector Chunk containing 7 2-bits symbols */
-			uint16_t status = build_rtcpfb_chunk_status(
-				chunk.ack, chunk.pos, true);
-			CHECK(rtp_write_u16(buf, pos, status));
-			uint8_t left = chunk.pos - 7;
-			for (j = 0; j < left; ++j)
-				chunk.ack[j] = chunk.ack[j + 7];
-			chunk.pos = left;
-		} else if (chunk.pos >= STATUS_VECTOR_CHUNK_ACK_LG &&
-			   chunk.ack[0] !=
-				   rtpfb->feedbacks[i].pkt_status_symbol) {
-			uint16_t status =
-				(chunk.ack[0] << RUN_LENGTH_CHUNK_ACK_LG) |
-				chunk.pos;
-			CHECK(rtp_write_u16(buf, pos, status));
-			chunk.pos = 0;
+
+static uint16_t
+rtpfb_chunk_vector(const uint8_t *symbols, uint16_t count, bool two_bit)
+{
+	uint16_t chunk = STATUS_VECTOR_CHUNK_MASK;
+	uint16_t i;
+
+	if (two_bit) {
+		chunk |= STATUS_VECTOR_TWO_BIT_SYMBOLS_MASK;
+		for (i = 0; i < count; i++)
+			chunk |= symbols[i] << (12 - 2 * i);
+	} else {
+		for (i = 0; i < count; i++)
+			chunk |= symbols[i] << (13 - i);
+	}
+	return chunk;
+}
+
+
+/* Emit the chunk of the accumulated statuses, when the next one can not be
+ * added; only the first 7 statuses are emitted if a 2-bit symbols vector is
+ * needed, the remaining ones are kept */
+static uint16_t rtpfb_chunker_emit(struct rtpfb_chunker *c)
+{
+	uint16_t chunk, i;
+
+	if (c->all_same) {
+		chunk = (c->symbols[0] << RUN_LENGTH_CHUNK_ACK_LG) | c->count;
+		rtpfb_chunker_reset(c);
+		return chunk;
+	}
+	if (c->count == STATUS_VECTOR_CHUNK_ACK_LG) {
+		chunk = rtpfb_chunk_vector(c->symbols, c->count, false);
+		rtpfb_chunker_reset(c);
+		return chunk;
+	}
+
+	chunk = rtpfb_chunk_vector(
+		c->symbols, STATUS_VECTOR_CHUNK_ACK_LG / 2, true);
+	c->count -= STATUS_VECTOR_CHUNK_ACK_LG / 2;
+	c->all_same = true;
+	c->large = false;
+	for (i = 0; i < c->count; i++) {
+		c->symbols[i] = c->symbols[i + STATUS_VECTOR_CHUNK_ACK_LG / 2];
+		c->all_same = c->all_same && c->symbols[i] == c->symbols[0];
+		c->large = c->large || c->symbols[i] > 1;
+	}
+	return chunk;
+}
+
+
+/* Emit the chunk of the last statuses */
+static uint16_t rtpfb_chunker_emit_last(const struct rtpfb_chunker *c)
+{
+	if (c->all_same)
+		return (c->symbols[0] << RUN_LENGTH_CHUNK_ACK_LG) | c->count;
+	if (c->count <= STATUS_VECTOR_CHUNK_ACK_LG / 2)
+		return rtpfb_chunk_vector(c->symbols, c->count, true);
+	return rtpfb_chunk_vector(c->symbols, c->count, false);
+}
+
+
+static inline uint8_t
+rtpfb_packet_symbol(const struct rtpfb_packet *pkt,
+		    const struct rtcp_pkt_rtpfb_feedback *feedbacks,
+		    uint16_t i)
+{
+	return i == pkt->first_rx ? pkt->first_rx_symbol
+				  : feedbacks[i].pkt_status_symbol;
+}
+
+
+/* Number of statuses from i extending the pending chunk when it can only
+ * be a run length anymore, to skip the chunker for long runs */
+static uint16_t rtpfb_packet_run(const struct rtpfb_packet *pkt,
+				 const struct rtcp_pkt_rtpfb_feedback *feedbacks,
+				 const struct rtpfb_chunker *c,
+				 uint16_t i,
+				 uint16_t end)
+{
+	uint16_t n = 0, max;
+
+	if (!c->all_same || c->count < STATUS_VECTOR_CHUNK_ACK_LG)
+		return 0;
+	max = 0x1FFF - c->count;
+	if (end - i < max)
+		max = end - i;
+	if (i <= pkt->first_rx && pkt->first_rx - i < max)
+		max = pkt->first_rx - i;
+	while (n < max && feedbacks[i + n].pkt_status_symbol == c->symbols[0])
+		n++;
+	return n;
+}
+
+
+/* Fast path for a new chunk with at least 14 statuses left, classifying
+ * them without branches: returns the number of statuses of the status
+ * vector the chunker would emit for them (14 for 1-bit symbols, 7 for 2-bit
+ * symbols), or 0 if they start a run or hold invalid symbols */
+static uint16_t
+rtpfb_packet_vector(const struct rtpfb_packet *pkt,
+		    const struct rtcp_pkt_rtpfb_feedback *feedbacks,
+		    uint16_t i,
+		    uint8_t symbols[STATUS_VECTOR_CHUNK_ACK_LG])
+{
+	uint8_t any = 0, diff = 0;
+	uint16_t k;
+
+	for (k = 0; k < STATUS_VECTOR_CHUNK_ACK_LG; k++) {
+		symbols[k] = rtpfb_packet_symbol(pkt, feedbacks, i + k);
+		any |= symbols[k];
+		diff |= symbols[k] ^ symbols[0];
+	}
+	if (diff == 0 || any > 3)
+		return 0;
+	if (any <= 1)
+		return STATUS_VECTOR_CHUNK_ACK_LG;
+
+	/* The first 7 statuses are emitted as a 2-bit symbols vector, unless
+	 * they are all equal */
+	diff = 0;
+	for (k = 0; k < STATUS_VECTOR_CHUNK_ACK_LG / 2; k++)
+		diff |= symbols[k] ^ symbols[0];
+	return diff != 0 ? STATUS_VECTOR_CHUNK_ACK_LG / 2 : 0;
+}
+
+
+static size_t rtpfb_vector_delta_size(const uint8_t *symbols, uint16_t count)
+{
+	size_t size = 0;
+
+	for (uint16_t k = 0; k < count; k++)
+		size += SV_DELTA(symbols[k]);
+	return size;
+}
+
+
+/* Choose the statuses of the next packet, from pkt->first, so that it
+ * holds at most max_count statuses and max_size bytes (if not 0), write its
+ * packet chunks and compute its exact size */
+static int rtpfb_packet_chunks(struct rtpfb_packet *pkt,
+			       const struct rtcp_pkt_rtpfb_report *rtpfb,
+			       size_t max_size,
+			       uint16_t max_count,
+			       uint8_t *chunks)
+{
+	struct rtpfb_chunker chunker;
+	uint8_t symbols[STATUS_VECTOR_CHUNK_ACK_LG];
+	size_t count = 0, delta_size = 0, size, room, vector_size;
+	uint16_t end = rtpfb->status_count, i, n;
+	uint8_t symbol;
+	bool emit;
+
+	if (end - pkt->first > max_count)
+		end = pkt->first + max_count;
+
+	/* The last chunk is always pending after an addition, the size of the
+	 * packet before padding must not exceed max_size rounded down */
+	max_size &= ~3;
+	rtpfb_chunker_reset(&chunker);
+	i = pkt->first;
+	while (i < end) {
+		if (chunker.count == 0 &&
+		    end - i >= STATUS_VECTOR_CHUNK_ACK_LG) {
+			n = rtpfb_packet_vector(
+				pkt, rtpfb->feedbacks, i, symbols);
+			vector_size = rtpfb_vector_delta_size(symbols, n);
+			size = RTPFB_FIXED_SIZE + 2 * (count + 1) + delta_size +
+			       vector_size;
+			if (n > 0 && (max_size == 0 || size <= max_size)) {
+				rtp_store_u16(
+					&chunks[2 * count++],
+					rtpfb_chunk_vector(symbols, n, n < 14));
+				delta_size += vector_size;
+				i += n;
+				continue;
+			}
+		}
+
+		symbol = rtpfb_packet_symbol(pkt, rtpfb->feedbacks, i);
+		if (symbol > 3)
+			return -EINVAL;
+		emit = !rtpfb_chunker_can_add(&chunker, symbol);
+		size = RTPFB_FIXED_SIZE + 2 * (count + emit + 1) + delta_size +
+		       SV_DELTA(symbol);
+		if (max_size != 0 && size > max_size)
+			break;
+		if (emit) {
+			rtp_store_u16(&chunks[2 * count++],
+				      rtpfb_chunker_emit(&chunker));
+			/* Give a chance to the fast path */
+			if (chunker.count == 0)
+				continue;
 		}
-		if (chunk.pos == 0) {
-			chunk.large = 0;
-			chunk.run = 1;
+		rtpfb_chunker_add(&chunker, symbol);
+		delta_size += SV_DELTA(symbol);
+		i++;
+
+		n = rtpfb_packet_run(pkt, rtpfb->feedbacks, &chunker, i, end);
+		if (max_size != 0 && SV_DELTA(symbol) != 0) {
+			room = (max_size - size) / SV_DELTA(symbol);
+			if (n > room)
+				n = room;
 		}
+		chunker.count += n;
+		delta_size += n * SV_DELTA(symbol);
+		i += n;
+	}
+	if (chunker.count > 0)
+		rtp_store_u16(&chunks[2 * count++],
+			      rtpfb_chunker_emit_last(&chunker));
+
+	pkt->count = i - pkt->first;
+	pkt->chunks = count;
+	pkt->size = RTPFB_FIXED_SIZE + 2 * pkt->chunks + delta_size;
+	pkt->size = (pkt->size + 3) & ~3;
+	return 0;
+}
+
 
-		if (chunk.pos < STATUS_VECTOR_CHUNK_ACK_LG) {
-			chunk.ack[chunk.pos] =
-				rtpfb->feedbacks[i].pkt_status_symbol;
-			if (rtpfb->feedbacks[i].pkt_status_symbol > 1)
-				chunk.large = 1;
-			if (chunk.pos > 0 &&
-			    chunk.ack[chunk.pos - 1] != chunk.ack[chunk.pos])
-				chunk.run = 0;
+/* Write the header, receive deltas and padding of a packet whose chunks
+ * have been written; returns the sum of the original receive deltas of its
+ * statuses */
+static int64_t rtpfb_packet_write(const struct rtpfb_packet *pkt,
+				  const struct rtcp_pkt_rtpfb_report *rtpfb,
+				  uint8_t feedback_pkt_count,
+				  uint8_t *data)
+{
+	const struct rtcp_pkt_rtpfb_feedback *feedbacks = rtpfb->feedbacks;
+	uint8_t *deltas = data + RTPFB_FIXED_SIZE + 2 * pkt->chunks;
+	uint8_t *end = data + pkt->size;
+	int64_t time = 0;
+	uint16_t delta, i;
+	uint8_t symbol;
+	bool received;
+
+	data[0] = (RTCP_PKT_VERSION << RTCP_PKT_HEADER_FLAGS_VERSION_SHIFT) |
+		  (15 << RTCP_PKT_HEADER_FLAGS_COUNT_SHIFT);
+	data[1] = RTCP_PKT_TYPE_RTPFB;
+	rtp_store_u16(&data[2], pkt->size / 4 - 1);
+	rtp_store_u32(&data[4], rtpfb->sender_ssrc);
+	rtp_store_u32(&data[8], rtpfb->media_ssrc);
+	rtp_store_u16(&data[12], rtpfb->base_seq + pkt->first);
+	rtp_store_u16(&data[14], pkt->count);
+	rtp_store_u32(&data[16],
+		      ((pkt->ref_time & 0xFFFFFF) << 8) | feedback_pkt_count);
+
+	/* Both bytes of a delta are always written (unless at the very end of
+	 * the packet) and the next delta or the padding overwrites the unused
+	 * ones, so that there is no branch on the symbols */
+	for (i = pkt->first; i < pkt->first + pkt->count; i++) {
+		symbol = rtpfb_packet_symbol(pkt, feedbacks, i);
+		received = symbol == 1 || symbol == 2;
+		delta = i == pkt->first_rx ? pkt->first_rx_delta
+					   : feedbacks[i].recv_delta;
+		time += received ? feedbacks[i].recv_delta : 0;
+		if (deltas + 2 <= end) {
+			deltas[0] = symbol == 2 ? delta >> 8 : delta;
+			deltas[1] = delta;
+		} else if (symbol == 1) {
+			deltas[0] = delta;
 		}
-		chunk.pos++;
+		deltas += SV_DELTA(symbol);
 	}
 
-	if (chunk.pos != 0) {
-		if (chunk.run) {
-			uint16_t status =
-				(chunk.ack[0] << RUN_LENGTH_CHUNK_ACK_LG) |
-				chunk.pos;
-			CHECK(rtp_write_u16(buf, pos, status));
-		} else if (chunk.large) {
-			/* Status Vector Chunk containing 7 2-bits symbols with
-			 * long delta */
-
-			/* Write a first chunk if needed */
-			if (chunk.pos >= 7) {
-				uint16_t status = build_rtcpfb_chunk_status(
-					chunk.ack, chunk.pos, true);
-				CHECK(rtp_write_u16(buf, pos, status));
-				uint8_t left = chunk.pos - 7;
-				for (j = 0; j < left; ++j)
-					chunk.ack[j] = chunk.ack[j + 7];
-				chunk.pos = left;
-			}
-			if (chunk.pos != 0) {
-				uint16_t status = build_rtcpfb_chunk_status(
-					chunk.ack, chunk.pos, true);
-				CHECK(rtp_write_u16(buf, pos, status));
+	/* Zero padding */
+	memset(deltas, 0, end - deltas);
+
+	return time;
+}
+
+
+/* Write the report as consecutive packets of at most max_count statuses
+ * and max_size bytes; returns the number of packets written */
+static int
+rtcp_pkt_write_rtpfb_packets(struct pomp_buffer *buf,
+			     size_t *pos,
+			     const struct rtcp_pkt_rtpfb_report *rtpfb,
+			     size_t max_size,
+			     uint16_t max_count)
+{
+	int res = 0, n = 0;
+	struct rtpfb_packet pkt;
+	const struct rtcp_pkt_rtpfb_feedback *fb = NULL;
+	int64_t time, rebased;
+	size_t start = *pos, len = 0, end, bound, count;
+	void *data = NULL;
+
+	/* Reception time of the last received packet, in deltas units */
+	time = (int64_t)rtpfb->ref_time * RTPFB_REF_TIME_DELTAS;
+
+	memset(&pkt, 0, sizeof(pkt));
+	do {
+		/* The receive delta of the first received packet is relative
+		 * to the reference time: rebase it on the last reception time
+		 * for the following packets */
+		pkt.ref_time = rtpfb->ref_time;
+		pkt.first_rx = pkt.first;
+		while (pkt.first_rx < rtpfb->status_count) {
+			fb = &rtpfb->feedbacks[pkt.first_rx];
+			if (fb->pkt_status_symbol == 1 ||
+			    fb->pkt_status_symbol == 2)
+				break;
+			pkt.first_rx++;
+		}
+		if (pkt.first_rx < rtpfb->status_count) {
+			fb = &rtpfb->feedbacks[pkt.first_rx];
+			pkt.first_rx_symbol = fb->pkt_status_symbol;
+			pkt.first_rx_delta = fb->recv_delta;
+		}
+		if (n > 0 && pkt.first_rx < rtpfb->status_count) {
+			pkt.ref_time = time > 0 ? time / RTPFB_REF_TIME_DELTAS
+						: 0;
+			rebased = time - (int64_t)pkt.ref_time *
+						 RTPFB_REF_TIME_DELTAS +
+				  fb->recv_delta;
+			if (rebased < INT16_MIN || rebased > INT16_MAX) {
+				res = -ERANGE;
+				goto out;
 			}
-		} else {
-			/* Status Vector Chunk containing 14 1-bits symbols
-			 * with short delta */
-			uint16_t status = build_rtcpfb_chunk_status(
-				chunk.ack, chunk.pos, false);
-			CHECK(rtp_write_u16(buf, pos, status));
+			pkt.first_rx_delta = rebased;
+			if (rebased < 0 || rebased > UINT8_MAX)
+				pkt.first_rx_symbol = 2;
 		}
-	}
 
-	for (i = 0; i < rtpfb->status_count; ++i) {
-		int16_t delta = rtpfb->feedbacks[i].recv_delta;
-		if (rtpfb->feedbacks[i].pkt_status_symbol == 1)
-			CHECK(rtp_write_u8(buf, pos, delta));
-		else if (rtpfb->feedbacks[i].pkt_status_symbol == 2)
-			CHECK(rtp_write_u16(buf, pos, delta));
-	}
+		/* Ensure the capacity for the largest possible packet, a chunk
+		 * holding at least 7 statuses except for the last one */
+		count = rtpfb->status_count - pkt.first;
+		if (count > max_count)
+			count = max_count;
+		bound = RTPFB_FIXED_SIZE + 2 * (count / 7 + 1) + 2 * count + 3;
+		if (max_size != 0 && bound > max_size)
+			bound = max_size;
+		res = pomp_buffer_ensure_capacity(buf, *pos + bound);
+		if (res < 0)
+			goto out;
+		res = pomp_buffer_get_data(buf, &data, &len, NULL);
+		if (res < 0)
+			goto out;
 
-	while ((*pos) % 4)
-		CHECK(rtp_write_u8(buf, pos, 0));
+		/* Write the packet in place */
+		res = rtpfb_packet_chunks(&pkt,
+					  rtpfb,
+					  max_size,
+					  max_count,
+					  (uint8_t *)data + *pos +
+						  RTPFB_FIXED_SIZE);
+		if (res < 0)
+			goto out;
+		end = *pos + pkt.size;
+		time += rtpfb_packet_write(&pkt,
+					   rtpfb,
+					   rtpfb->feedback_pkt_count + n,
+					   (uint8_t *)data + *pos);
+		if (end > len) {
+			res = pomp_buffer_set_len(buf, end);
+			if (res < 0)
+				goto out;
+		}
+		*pos = end;
+		n++;
+		pkt.first += pkt.count;
+	} while (pkt.first < rtpfb->status_count);
 
-	/* Write header */
-	memset(&header, 0, sizeof(header));
-	header.flags =
-		(RTCP_PKT_VERSION << RTCP_PKT_HEADER_FLAGS_VERSION_SHIFT) |
-		(15 << RTCP_PKT_HEADER_FLAGS_COUNT_SHIFT);
-	header.type = RTCP_PKT_TYPE_RTPFB;
-	header.len = ((*pos - header_pos) / 4) - 1;
-	CHECK(rtcp_pkt_write_header(buf, &header_pos, &header));
+	return n;
 
 out:
+	*pos = start;
 	return res;
 }
 
 
+/**
+ * RTPFB Congestion Control Feedback
+ */
+int rtcp_pkt_write_rtpfb(struct pomp_buffer *buf,
+			 size_t *pos,
+			 const struct rtcp_pkt_rtpfb_report *rtpfb)
+{
+	int res;
+
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pos == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(rtpfb == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(rtpfb->feedbacks == NULL &&
+					 rtpfb->status_count > 0,
+				 EINVAL);
+
+	res = rtcp_pkt_write_rtpfb_packets(buf, pos, rtpfb, 0, UINT16_MAX);
+	return res < 0 ? res : 0;
+}
+
+
+int rtcp_pkt_write_rtpfb_split(struct pomp_buffer *buf,
+			       size_t *pos,
+			       const struct rtcp_pkt_rtpfb_report *rtpfb,
+			       size_t max_size)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pos == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(rtpfb == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(rtpfb->feedbacks == NULL &&
+					 rtpfb->status_count > 0,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(max_size != 0 &&
+					 max_size < RTPFB_FIXED_SIZE + 4,
+				 EINVAL);
+
+	return rtcp_pkt_write_rtpfb_packets(
+		buf, pos, rtpfb, max_size, RTPFB_MAX_PKT);
+}
+
+
 static int rtcp_pkt_read_header(const struct pomp_buffer *buf,
 				size_t *pos,
 				struct rtcp_pkt_header *header)
@@ -872,73 +1175,341 @@ out:
 }
 
 
-static int
-rtcp_pkt_read_rtpfb_run_length_chunk(uint16_t chunk,
-				     const struct rtcp_pkt_rtpfb_report *report,
-				     size_t *pos)
+/* Symbols and receive deltas size of 7 1-bit symbols */
+#define SV1_SYMBOLS(v)                                                         \
+	{                                                                      \
+		((v) >> 6) & 1, ((v) >> 5) & 1, ((v) >> 4) & 1,                \
+			((v) >> 3) & 1, ((v) >> 2) & 1, ((v) >> 1) & 1,       \
+			(v) & 1, 0,                                            \
+	}
+#define SV1_DELTA_SIZE(v)                                                      \
+	((((v) >> 6) & 1) + (((v) >> 5) & 1) + (((v) >> 4) & 1) +             \
+	 (((v) >> 3) & 1) + (((v) >> 2) & 1) + (((v) >> 1) & 1) + ((v) & 1))
+
+/* Symbols and receive deltas size of 4 2-bit symbols */
+#define SV2_SYMBOLS(v)                                                         \
+	{                                                                      \
+		((v) >> 6) & 3, ((v) >> 4) & 3, ((v) >> 2) & 3, (v) & 3,      \
+	}
+#define SV2_DELTA_SIZE(v)                                                      \
+	(SV_DELTA(((v) >> 6) & 3) + SV_DELTA(((v) >> 4) & 3) +                 \
+	 SV_DELTA(((v) >> 2) & 3) + SV_DELTA((v) & 3))
+
+#define REP4(M, v) M(v), M((v) + 1), M((v) + 2), M((v) + 3)
+#define REP16(M, v)                                                            \
+	REP4(M, v), REP4(M, (v) + 4), REP4(M, (v) + 8), REP4(M, (v) + 12)
+#define REP64(M, v)                                                            \
+	REP16(M, v), REP16(M, (v) + 16), REP16(M, (v) + 32),                   \
+		REP16(M, (v) + 48)
+#define REP128(M, v) REP64(M, v), REP64(M, (v) + 64)
+#define REP256(M, v) REP128(M, v), REP128(M, (v) + 128)
+
+
+/* Status vector chunks are expanded through these tables: a 1-bit symbol
+ * vector as two halves of 7 symbols, a 2-bit symbol vector as 4 symbols
+ * followed by 3 symbols (shifted left, the 4th one is then unused) */
+static const uint8_t sv1_symbols[128][8] = {REP128(SV1_SYMBOLS, 0)};
+static const uint8_t sv1_delta_size[128] = {REP128(SV1_DELTA_SIZE, 0)};
+static const uint8_t sv2_symbols[256][4] = {REP256(SV2_SYMBOLS, 0)};
+static const uint8_t sv2_delta_size[256] = {REP256(SV2_DELTA_SIZE, 0)};
+
+
+/* Number of statuses of a packet chunk */
+static uint16_t rtpfb_chunk_count(uint16_t chunk)
 {
-	int res = 0;
-	size_t j = *pos;
-	size_t len = (chunk & 0x1FFF) + j;
-	uint8_t status_symbol;
-
-	CHECK(report->status_count - len);
-	status_symbol = (chunk >> RUN_LENGTH_CHUNK_ACK_LG) & 0x03;
-	for (; j < len; j++) {
-		report->feedbacks[j].seq_num = report->base_seq + j;
-		report->feedbacks[j].pkt_status_symbol = status_symbol;
+	if ((chunk & STATUS_VECTOR_CHUNK_MASK) == 0)
+		return chunk & 0x1FFF;
+	if (chunk & STATUS_VECTOR_TWO_BIT_SYMBOLS_MASK)
+		return STATUS_VECTOR_CHUNK_ACK_LG / 2;
+	return STATUS_VECTOR_CHUNK_ACK_LG;
+}
+
+
+/* Size of the receive deltas of the first count statuses of a chunk */
+static size_t rtpfb_chunk_delta_size(uint16_t chunk, uint16_t count)
+{
+	unsigned int bits;
+
+	if ((chunk & STATUS_VECTOR_CHUNK_MASK) == 0)
+		return count * SV_DELTA((chunk >> RUN_LENGTH_CHUNK_ACK_LG) & 3);
+
+	/* Clear the unused symbols of a last partial vector */
+	bits = chunk & 0x3FFF;
+	if (chunk & STATUS_VECTOR_TWO_BIT_SYMBOLS_MASK) {
+		bits &= 0x3FFF << (STATUS_VECTOR_CHUNK_ACK_LG - 2 * count);
+		return sv2_delta_size[bits >> 6] +
+		       sv2_delta_size[(bits << 2) & 0xFF];
 	}
-	*pos = j;
+	bits &= 0x3FFF << (STATUS_VECTOR_CHUNK_ACK_LG - count);
+	return sv1_delta_size[bits >> 7] + sv1_delta_size[bits & 0x7F];
+}
 
-out:
-	return res;
+
+/* Load the next chunk of an iterator, expanding status vectors */
+static void rtpfb_iter_load_chunk(struct rtcp_pkt_rtpfb_iter *iter)
+{
+	uint16_t chunk = rtp_load_u16(iter->chunks);
+
+	iter->chunks += 2;
+	iter->chunk = chunk;
+	iter->chunk_count = rtpfb_chunk_count(chunk);
+	iter->chunk_index = 0;
+	if ((chunk & STATUS_VECTOR_CHUNK_MASK) == 0)
+		return;
+	if (chunk & STATUS_VECTOR_TWO_BIT_SYMBOLS_MASK) {
+		memcpy(iter->symbols, sv2_symbols[(chunk >> 6) & 0xFF], 4);
+		memcpy(iter->symbols + 4, sv2_symbols[(chunk << 2) & 0xFF], 4);
+	} else {
+		memcpy(iter->symbols, sv1_symbols[(chunk >> 7) & 0x7F], 8);
+		memcpy(iter->symbols + 7, sv1_symbols[chunk & 0x7F], 8);
+	}
 }
 
 
-static int rtcp_pkt_read_rtpfb_status_vector_chunk(
-	uint16_t chunk,
-	const struct rtcp_pkt_rtpfb_report *report,
-	size_t *pos)
+/* Decode count feedbacks of a run length chunk */
+static void rtpfb_iter_read_run(struct rtcp_pkt_rtpfb_iter *iter,
+				struct rtcp_pkt_rtpfb_feedback *feedbacks,
+				uint16_t count)
 {
-	int res = 0;
-	size_t len = 0;
-	size_t i = *pos;
-	size_t j = 1;
-
-	if ((chunk & 0x4000) == 0) {
-		/* Small delta chunk */
-		len = STATUS_VECTOR_CHUNK_ACK_LG;
-		if (len + i >= report->status_count)
-			len = report->status_count - i;
-		CHECK(report->status_count - len);
-		while (j <= len) {
-			const uint8_t offset = STATUS_VECTOR_CHUNK_ACK_LG - j;
-			const uint8_t symbol = (chunk >> offset) & 0x01;
-			report->feedbacks[i].pkt_status_symbol = symbol;
-			report->feedbacks[i].seq_num = report->base_seq + i;
-			++i;
-			++j;
+	uint8_t symbol = (iter->chunk >> RUN_LENGTH_CHUNK_ACK_LG) & 3;
+	uint16_t seq_num = iter->base_seq + iter->index;
+	const uint8_t *deltas = iter->deltas;
+	uint16_t i;
+
+	switch (symbol) {
+	case 1:
+		for (i = 0; i < count; i++) {
+			feedbacks[i].seq_num = seq_num + i;
+			feedbacks[i].recv_delta = deltas[i];
+			feedbacks[i].pkt_status_symbol = symbol;
 		}
-	} else {
-		/* Large delta chunk */
-		len = STATUS_VECTOR_CHUNK_ACK_LG / 2;
-		if (len + i >= report->status_count)
-			len = report->status_count - i;
-		CHECK(report->status_count - len);
-		while (j <= len) {
-			const uint8_t offset =
-				STATUS_VECTOR_CHUNK_ACK_LG - j * 2;
-			const uint8_t symbol = (chunk >> offset) & 0x03;
-			report->feedbacks[i].pkt_status_symbol = symbol;
-			report->feedbacks[i].seq_num = report->base_seq + i;
-			++i;
-			++j;
+		break;
+	case 2:
+		for (i = 0; i < count; i++) {
+			feedbacks[i].seq_num = seq_num + i;
+			feedbacks[i].recv_delta =
+				(int16_t)rtp_load_u16(&deltas[2 * i]);
+			feedbacks[i].pkt_status_symbol = symbol;
+		}
+		break;
+	default:
+		for (i = 0; i < count; i++) {
+			feedbacks[i].seq_num = seq_num + i;
+			feedbacks[i].recv_delta = 0;
+			feedbacks[i].pkt_status_symbol = symbol;
 		}
+		break;
 	}
-	*pos = i;
+	iter->deltas += count * SV_DELTA(symbol);
+}
 
-out:
-	return res;
+
+/* Decode count feedbacks of an expanded status vector chunk */
+static void rtpfb_iter_read_vector(struct rtcp_pkt_rtpfb_iter *iter,
+				   struct rtcp_pkt_rtpfb_feedback *feedbacks,
+				   uint16_t count)
+{
+	const uint8_t *symbols = &iter->symbols[iter->chunk_index];
+	uint16_t seq_num = iter->base_seq + iter->index;
+	const uint8_t *deltas = iter->deltas;
+	size_t offset = 0;
+
+	for (uint16_t i = 0; i < count; i++) {
+		uint8_t symbol = symbols[i];
+		feedbacks[i].seq_num = seq_num + i;
+		feedbacks[i].pkt_status_symbol = symbol;
+		if (symbol == 1)
+			feedbacks[i].recv_delta = deltas[offset];
+		else if (symbol == 2)
+			feedbacks[i].recv_delta =
+				(int16_t)rtp_load_u16(&deltas[offset]);
+		else
+			feedbacks[i].recv_delta = 0;
+		offset += SV_DELTA(symbol);
+	}
+	iter->deltas += offset;
+}
+
+
+static size_t rtpfb_iter_read(struct rtcp_pkt_rtpfb_iter *iter,
+			      struct rtcp_pkt_rtpfb_feedback *feedbacks,
+			      size_t count)
+{
+	size_t n = 0;
+	uint16_t len;
+
+	while (n < count && iter->index < iter->status_count) {
+		/* Skip to the next chunk; the chunks have been checked by
+		 * rtpfb_iter_init() */
+		if (iter->chunk_index >= iter->chunk_count) {
+			rtpfb_iter_load_chunk(iter);
+			continue;
+		}
+		len = iter->chunk_count - iter->chunk_index;
+		if (len > iter->status_count - iter->index)
+			len = iter->status_count - iter->index;
+		if (len > count - n)
+			len = count - n;
+		if (iter->chunk & STATUS_VECTOR_CHUNK_MASK)
+			rtpfb_iter_read_vector(iter, &feedbacks[n], len);
+		else
+			rtpfb_iter_read_run(iter, &feedbacks[n], len);
+		iter->chunk_index += len;
+		iter->index += len;
+		n += len;
+	}
+
+	return n;
+}
+
+
+/* Walk the packet chunks to locate the receive deltas and check that the
+ * packet holds all of them, so that the iteration can not fail */
+static int rtpfb_iter_init(struct rtcp_pkt_rtpfb_iter *iter,
+			   const struct rtcp_pkt_rtpfb_report *report,
+			   const uint8_t *data,
+			   size_t len)
+{
+	const uint8_t *p = data;
+	const uint8_t *end = data + len;
+	uint32_t remaining = report->status_count;
+	size_t delta_size = 0;
+	uint16_t chunk = 0, count = 0;
+
+	while (remaining > 0) {
+		if (end - p < 2)
+			return -EIO;
+		chunk = rtp_load_u16(p);
+		p += 2;
+		count = rtpfb_chunk_count(chunk);
+		if (count > remaining) {
+			/* Only the last status vector can have unused
+			 * symbols */
+			if ((chunk & STATUS_VECTOR_CHUNK_MASK) == 0)
+				return -EIO;
+			count = remaining;
+		}
+		delta_size += rtpfb_chunk_delta_size(chunk, count);
+		remaining -= count;
+	}
+	if ((size_t)(end - p) < delta_size)
+		return -EIO;
+
+	memset(iter, 0, sizeof(*iter));
+	iter->chunks = data;
+	iter->deltas = p;
+	iter->base_seq = report->base_seq;
+	iter->status_count = report->status_count;
+	return 0;
+}
+
+
+int rtcp_pkt_rtpfb_iter_next(struct rtcp_pkt_rtpfb_iter *iter,
+			     struct rtcp_pkt_rtpfb_feedback *feedback)
+{
+	uint8_t symbol;
+
+	ULOG_ERRNO_RETURN_ERR_IF(iter == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(feedback == NULL, EINVAL);
+
+	if (iter->index >= iter->status_count)
+		return -ENOENT;
+	while (iter->chunk_index >= iter->chunk_count)
+		rtpfb_iter_load_chunk(iter);
+
+	if (iter->chunk & STATUS_VECTOR_CHUNK_MASK)
+		symbol = iter->symbols[iter->chunk_index];
+	else
+		symbol = (iter->chunk >> RUN_LENGTH_CHUNK_ACK_LG) & 3;
+	feedback->seq_num = iter->base_seq + iter->index;
+	feedback->pkt_status_symbol = symbol;
+	if (symbol == 1)
+		feedback->recv_delta = iter->deltas[0];
+	else if (symbol == 2)
+		feedback->recv_delta = (int16_t)rtp_load_u16(iter->deltas);
+	else
+		feedback->recv_delta = 0;
+	iter->deltas += SV_DELTA(symbol);
+	iter->chunk_index++;
+	iter->index++;
+	return 0;
+}
+
+
+int rtcp_pkt_rtpfb_iter_read(struct rtcp_pkt_rtpfb_iter *iter,
+			     struct rtcp_pkt_rtpfb_feedback *feedbacks,
+			     size_t count)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(iter == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(feedbacks == NULL && count > 0, EINVAL);
+
+	return rtpfb_iter_read(iter, feedbacks, count);
+}
+
+
+/* Rebase the receive delta of the first received packet of a part on the
+ * reception time of the last received packet of the previous parts (in
+ * deltas units): the new reference time is rounded towards the delta, so
+ * the rebased delta stays within 255 of the original one */
+static void rtpfb_report_rebase(struct rtcp_pkt_rtpfb_report *part,
+				struct rtcp_pkt_rtpfb_feedback *fb,
+				int64_t *time)
+{
+	int64_t ref = *time / RTPFB_REF_TIME_DELTAS;
+	int64_t rem = *time - ref * RTPFB_REF_TIME_DELTAS;
+
+	/* Floor if the delta is negative, ceil otherwise */
+	if (fb->recv_delta < 0 && rem < 0)
+		ref--;
+	else if (fb->recv_delta >= 0 && rem > 0)
+		ref++;
+
+	fb->recv_delta += *time - ref * RTPFB_REF_TIME_DELTAS;
+	if (fb->recv_delta < 0 || fb->recv_delta > UINT8_MAX)
+		fb->pkt_status_symbol = 2;
+	part->ref_time = (uint32_t)ref & 0xFFFFFF;
+	*time = ref * RTPFB_REF_TIME_DELTAS;
+}
+
+
+/* Decode the feedbacks for the rtpfb_report callback in parts of at most
+ * RTPFB_REPORT_PART_MAX statuses */
+static void rtcp_pkt_rtpfb_report(const struct rtcp_pkt_rtpfb_report *report,
+				  struct rtcp_pkt_rtpfb_iter *iter,
+				  const struct rtcp_pkt_read_cbs *cbs,
+				  void *userdata)
+{
+	struct rtcp_pkt_rtpfb_feedback feedbacks[RTPFB_REPORT_PART_MAX];
+	struct rtcp_pkt_rtpfb_report part = *report;
+	int64_t time = (int64_t)report->ref_time * RTPFB_REF_TIME_DELTAS;
+	uint16_t offset = 0;
+	bool received = false, rebase = false;
+	size_t n = 0;
+
+	do {
+		n = rtpfb_iter_read(iter, feedbacks, RTPFB_REPORT_PART_MAX);
+		part.base_seq = report->base_seq + offset;
+		part.status_count = n;
+		part.feedbacks = n > 0 ? feedbacks : NULL;
+
+		/* Until a packet is received, the deltas stay relative to the
+		 * reference time of the report */
+		rebase = received;
+		for (size_t i = 0; i < n; i++) {
+			if (feedbacks[i].pkt_status_symbol != 1 &&
+			    feedbacks[i].pkt_status_symbol != 2)
+				continue;
+			if (rebase) {
+				rtpfb_report_rebase(&part, &feedbacks[i], &time);
+				rebase = false;
+			}
+			time += feedbacks[i].recv_delta;
+			received = true;
+		}
+
+		(*cbs->rtpfb_report)(&part, userdata);
+		offset += n;
+	} while (offset < report->status_count);
 }
 
 
@@ -950,10 +1521,12 @@ static int rtcp_pkt_read_rtpfb(const struct pomp_buffer *buf,
 			       void *userdata)
 {
 	int res = 0;
-	size_t i = 0;
 	struct rtcp_pkt_rtpfb_report report;
-	report.status_count = 0;
-	report.feedbacks = NULL;
+	struct rtcp_pkt_rtpfb_iter iter;
+	const void *data = NULL;
+	size_t len = 0;
+
+	memset(&report, 0, sizeof(report));
 	CHECK(rtp_read_u32(buf, pos, &report.sender_ssrc));
 	CHECK(rtp_read_u32(buf, pos, &report.media_ssrc));
 	CHECK(rtp_read_u16(buf, pos, &report.base_seq));
@@ -962,55 +1535,25 @@ static int rtcp_pkt_read_rtpfb(const struct pomp_buffer *buf,
 	report.feedback_pkt_count = report.ref_time & 0xFF;
 	report.ref_time = report.ref_time >> 8;
 
-	if (report.status_count > RTPFB_MAX_PKT) {
+	if (cbs->rtpfb_report_iter == NULL &&
+	    report.status_count > RTPFB_MAX_PKT) {
 		res = -E2BIG;
 		goto out;
 	}
-	report.feedbacks = calloc(report.status_count,
-				  sizeof(struct rtcp_pkt_rtpfb_feedback));
-	if (report.feedbacks == NULL) {
-		res = -ENOMEM;
-		goto out;
-	}
-
-	while (i < report.status_count) {
-		uint16_t chunk;
-		CHECK(rtp_read_u16(buf, pos, &chunk));
-		if ((chunk & 0x8000) == 0) {
-			rtcp_pkt_read_rtpfb_run_length_chunk(
-				chunk, &report, &i);
-		} else {
-			rtcp_pkt_read_rtpfb_status_vector_chunk(
-				chunk, &report, &i);
-		}
-	}
 
-	uint8_t short_delta;
-	uint16_t long_delta;
-	for (i = 0; i < report.status_count; ++i) {
-		switch (report.feedbacks[i].pkt_status_symbol) {
-		case 0:
-		case 3:
-			report.feedbacks[i].recv_delta = 0;
-			break;
-		case 1:
-			CHECK(rtp_read_u8(buf, pos, &short_delta));
-			report.feedbacks[i].recv_delta = short_delta;
-			break;
-		case 2:
-			CHECK(rtp_read_u16(buf, pos, &long_delta));
-			report.feedbacks[i].recv_delta = long_delta;
-			break;
-		}
+	/* Chunks and deltas */
+	if (*pos < end) {
+		len = end - *pos;
+		CHECK(pomp_buffer_cread(buf, pos, &data, len));
 	}
+	CHECK(rtpfb_iter_init(&iter, &report, data, len));
 
-	if (cbs->rtpfb_report != NULL)
-		(*cbs->rtpfb_report)(&report, userdata);
+	if (cbs->rtpfb_report_iter != NULL)
+		(*cbs->rtpfb_report_iter)(&report, &iter, userdata);
+	else if (cbs->rtpfb_report != NULL)
+		rtcp_pkt_rtpfb_report(&report, &iter, cbs, userdata);
 
 out:
-	if (report.feedbacks != NULL)
-		free(report.feedbacks);
-
 	return res;
 }
 
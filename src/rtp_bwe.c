@@ -0,0 +1,747 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "rtp_priv.h"
+
+
+/* Send time of a sequence number not in the history */
+#define NOT_SENT UINT64_MAX
+
+/* Unit of the receive deltas (us) */
+#define DELTA_US 250
+
+/* Reference time unit, in receive deltas units (64 ms) */
+#define REF_TIME_DELTAS 256
+
+/* Packets sent within this duration of the first packet of a group belong
+ * to the group (us) */
+#define GROUP_US 5000
+
+/* Trendline filter: number of points of the linear regression, smoothing
+ * of the accumulated delay, gain and maximum number of deltas applied to
+ * the slope */
+#define TREND_WINDOW 20
+#define TREND_SMOOTHING 0.9
+#define TREND_GAIN 4.0
+#define TREND_MAX_DELTAS 60
+
+/* Overuse detector: the modified trend must stay above the threshold for
+ * this duration (ms), the threshold adapts to the trend at a rate of
+ * K_UP or K_DOWN per ms, unless the trend jumps too far above it */
+#define OVERUSE_TIME_MS 10.0
+#define THRESHOLD_INIT 12.5
+#define THRESHOLD_MIN 6.0
+#define THRESHOLD_MAX 600.0
+#define THRESHOLD_K_UP 0.0087
+#define THRESHOLD_K_DOWN 0.039
+#define THRESHOLD_MAX_JUMP 15.0
+#define THRESHOLD_MAX_DT_MS 100.0
+
+/* Window of the acknowledged bitrate (us) */
+#define ACKED_WINDOW_US 500000
+
+/* Rate controller */
+#define DEFAULT_RTT_US 200000
+#define MIN_DECREASE_INTERVAL_US 10000
+#define MAX_DECREASE_INTERVAL_US 200000
+#define MAX_UPDATE_INTERVAL_US 1000000
+#define INCREASE_RESPONSE_US 100000
+#define INCREASE_FACTOR 0.08
+#define INCREASE_MIN 1000.0
+#define INCREASE_ADDITIVE_MIN 4000.0
+#define INCREASE_FPS 30
+#define INCREASE_PACKET_BITS (1200 * 8)
+#define DECREASE_FACTOR 0.85
+#define ACKED_MAX_RATIO 1.5
+#define ACKED_MARGIN 10000.0
+#define CAPACITY_ALPHA 0.05
+#define CAPACITY_MIN_DEV 0.05
+
+/* Number of feedbacks decoded at a time from an iterator */
+#define ITER_BATCH 64
+
+
+struct sent_pkt {
+	uint64_t send_us;
+	uint32_t size;
+};
+
+
+/* Group of packets sent in a burst; the delay variation is computed
+ * between the last packets of consecutive groups */
+struct pkt_group {
+	uint64_t first_send;
+	uint64_t last_send;
+	int64_t last_arrival;
+	bool valid;
+};
+
+
+enum rate_state {
+	RATE_HOLD = 0,
+	RATE_INCREASE,
+	RATE_DECREASE,
+};
+
+
+struct rtp_bwe {
+	struct rtp_bwe_cfg cfg;
+	uint32_t mask;
+	uint32_t rtt_us;
+
+	/* Send history indexed by extended sequence number, the slots hold
+	 * the sequence numbers from highest - mask to highest (valid if
+	 * started is set); the packets reported received are removed */
+	struct sent_pkt *history;
+	uint64_t highest;
+	bool started;
+
+	/* Unwrapped reference time of the last report, in 64 ms units */
+	int64_t ref_time;
+	bool has_ref_time;
+
+	struct pkt_group group;
+	struct pkt_group prev_group;
+
+	struct {
+		/* Arrival times (ms, relative to first_arrival) and smoothed
+		 * accumulated delays (ms) of the last TREND_WINDOW groups */
+		double x[TREND_WINDOW];
+		double y[TREND_WINDOW];
+		uint32_t count;
+		uint32_t index;
+		uint32_t num_deltas;
+		int64_t first_arrival;
+		double acc_delay;
+		double smoothed_delay;
+		double slope;
+	} trend;
+
+	struct {
+		enum rtp_bwe_usage usage;
+		double modified_trend;
+		double prev_trend;
+		double threshold;
+		double time_over_using;
+		uint32_t overuse_counter;
+		int64_t last_update;
+		bool has_last_update;
+	} detector;
+
+	struct {
+		int64_t start;
+		uint64_t bytes;
+		bool started;
+		uint32_t bitrate;
+	} acked;
+
+	struct {
+		enum rate_state state;
+		double target;
+		uint64_t last_update;
+		uint64_t last_decrease;
+		bool has_last_update;
+		bool has_last_decrease;
+
+		/* Average acknowledged bitrate at the decreases and its mean
+		 * deviation, when known */
+		double capacity;
+		double capacity_dev;
+		bool has_capacity;
+	} rate;
+
+	struct rtp_bwe_stats stats;
+};
+
+
+/* Position in the report being processed */
+struct feedback_ctx {
+	uint64_t seq;
+	int64_t ticks;
+};
+
+
+int rtp_bwe_new(const struct rtp_bwe_cfg *cfg, struct rtp_bwe **ret_obj)
+{
+	struct rtp_bwe *self = NULL;
+	uint32_t size = RTP_BWE_DEFAULT_HISTORY_SIZE;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->history_size > RTP_BWE_MAX_HISTORY_SIZE,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	*ret_obj = NULL;
+
+	if (cfg->history_size != 0) {
+		size = 1;
+		while (size < cfg->history_size)
+			size <<= 1;
+	}
+
+	self = calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+	self->cfg = *cfg;
+	self->cfg.history_size = size;
+	if (self->cfg.min_bitrate == 0)
+		self->cfg.min_bitrate = RTP_BWE_DEFAULT_MIN_BITRATE;
+	if (self->cfg.max_bitrate == 0)
+		self->cfg.max_bitrate = RTP_BWE_DEFAULT_MAX_BITRATE;
+	if (self->cfg.start_bitrate == 0)
+		self->cfg.start_bitrate = RTP_BWE_DEFAULT_START_BITRATE;
+	if (self->cfg.min_bitrate > self->cfg.max_bitrate ||
+	    self->cfg.start_bitrate < self->cfg.min_bitrate ||
+	    self->cfg.start_bitrate > self->cfg.max_bitrate) {
+		ULOGE("invalid bitrates: start=%" PRIu32 " min=%" PRIu32
+		      " max=%" PRIu32,
+		      self->cfg.start_bitrate,
+		      self->cfg.min_bitrate,
+		      self->cfg.max_bitrate);
+		free(self);
+		return -EINVAL;
+	}
+	self->mask = size - 1;
+	self->rtt_us = DEFAULT_RTT_US;
+	self->detector.threshold = THRESHOLD_INIT;
+	self->detector.time_over_using = -1;
+	self->rate.target = self->cfg.start_bitrate;
+
+	self->history = malloc(size * sizeof(*self->history));
+	if (self->history == NULL) {
+		rtp_bwe_destroy(self);
+		return -ENOMEM;
+	}
+
+	*ret_obj = self;
+	return 0;
+}
+
+
+int rtp_bwe_destroy(struct rtp_bwe *self)
+{
+	if (self == NULL)
+		return 0;
+
+	free(self->history);
+	free(self);
+	return 0;
+}
+
+
+int rtp_bwe_sent(struct rtp_bwe *self,
+		 uint16_t seqnum,
+		 size_t size,
+		 uint64_t send_us)
+{
+	uint64_t ext, seq;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(size > UINT32_MAX, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(send_us == NOT_SENT, EINVAL);
+
+	if (!self->started) {
+		/* Start far from 0 so that older sequence numbers can still
+		 * be extended */
+		self->highest = ((uint64_t)1 << 32) | seqnum;
+		self->history[self->highest & self->mask].send_us = NOT_SENT;
+		self->started = true;
+	}
+	ext = self->highest + rtp_diff_seqnum(seqnum, self->highest);
+
+	if (ext > self->highest) {
+		/* Clear the slots of the skipped sequence numbers */
+		seq = self->highest + 1;
+		if (ext - seq > self->mask)
+			seq = ext - self->mask;
+		for (; seq < ext; seq++)
+			self->history[seq & self->mask].send_us = NOT_SENT;
+		self->highest = ext;
+	} else if (self->highest - ext > self->mask) {
+		return -ERANGE;
+	}
+
+	self->history[ext & self->mask].send_us = send_us;
+	self->history[ext & self->mask].size = size;
+	self->stats.sent++;
+	return 0;
+}
+
+
+/* Slope of the linear regression of the trendline window, false if the
+ * arrival times are all equal */
+static bool trend_slope(struct rtp_bwe *self, double *slope)
+{
+	double x_avg = 0, y_avg = 0, num = 0, den = 0;
+	uint32_t i;
+
+	for (i = 0; i < TREND_WINDOW; i++) {
+		x_avg += self->trend.x[i];
+		y_avg += self->trend.y[i];
+	}
+	x_avg /= TREND_WINDOW;
+	y_avg /= TREND_WINDOW;
+	for (i = 0; i < TREND_WINDOW; i++) {
+		num += (self->trend.x[i] - x_avg) * (self->trend.y[i] - y_avg);
+		den += (self->trend.x[i] - x_avg) * (self->trend.x[i] - x_avg);
+	}
+	if (den == 0)
+		return false;
+	*slope = num / den;
+	return true;
+}
+
+
+static void update_threshold(struct rtp_bwe *self, int64_t now_us)
+{
+	double trend = self->detector.modified_trend;
+	double dt, k;
+
+	if (trend < 0)
+		trend = -trend;
+	if (!self->detector.has_last_update) {
+		self->detector.last_update = now_us;
+		self->detector.has_last_update = true;
+	}
+
+	/* Do not adapt to sudden large spikes (e.g. route changes) */
+	if (trend > self->detector.threshold + THRESHOLD_MAX_JUMP) {
+		self->detector.last_update = now_us;
+		return;
+	}
+
+	k = trend < self->detector.threshold ? THRESHOLD_K_DOWN
+					     : THRESHOLD_K_UP;
+	dt = (now_us - self->detector.last_update) / 1000.0;
+	if (dt < 0)
+		dt = 0;
+	else if (dt > THRESHOLD_MAX_DT_MS)
+		dt = THRESHOLD_MAX_DT_MS;
+	self->detector.threshold += k * (trend - self->detector.threshold) * dt;
+	if (self->detector.threshold < THRESHOLD_MIN)
+		self->detector.threshold = THRESHOLD_MIN;
+	else if (self->detector.threshold > THRESHOLD_MAX)
+		self->detector.threshold = THRESHOLD_MAX;
+	self->detector.last_update = now_us;
+}
+
+
+/* Compare the modified trend with the threshold; ts_delta is the send
+ * time delta between the groups (ms) */
+static void detect(struct rtp_bwe *self, double ts_delta, int64_t now_us)
+{
+	double trend = self->detector.modified_trend;
+	enum rtp_bwe_usage usage = self->detector.usage;
+
+	if (trend > self->detector.threshold) {
+		if (self->detector.time_over_using < 0)
+			self->detector.time_over_using = ts_delta / 2;
+		else
+			self->detector.time_over_using += ts_delta;
+		self->detector.overuse_counter++;
+		if (self->detector.time_over_using > OVERUSE_TIME_MS &&
+		    self->detector.overuse_counter > 1 &&
+		    trend >= self->detector.prev_trend) {
+			self->detector.time_over_using = 0;
+			self->detector.overuse_counter = 0;
+			usage = RTP_BWE_USAGE_OVERUSE;
+		}
+	} else if (trend < -self->detector.threshold) {
+		self->detector.time_over_using = -1;
+		self->detector.overuse_counter = 0;
+		usage = RTP_BWE_USAGE_UNDERUSE;
+	} else {
+		self->detector.time_over_using = -1;
+		self->detector.overuse_counter = 0;
+		usage = RTP_BWE_USAGE_NORMAL;
+	}
+
+	if (usage == RTP_BWE_USAGE_OVERUSE &&
+	    self->detector.usage != RTP_BWE_USAGE_OVERUSE)
+		self->stats.overuses++;
+	self->detector.usage = usage;
+	self->detector.prev_trend = trend;
+	update_threshold(self, now_us);
+}
+
+
+/* Add the delay variation between the last two groups to the trendline
+ * filter and run the detector */
+static void trend_update(struct rtp_bwe *self,
+			 int64_t send_delta,
+			 int64_t arrival_delta,
+			 int64_t arrival_us)
+{
+	double delta = (arrival_delta - send_delta) / 1000.0;
+	uint32_t i = self->trend.index;
+	double slope;
+
+	if (self->trend.num_deltas == 0)
+		self->trend.first_arrival = arrival_us;
+	if (self->trend.num_deltas < TREND_MAX_DELTAS)
+		self->trend.num_deltas++;
+
+	self->trend.acc_delay += delta;
+	self->trend.smoothed_delay =
+		TREND_SMOOTHING * self->trend.smoothed_delay +
+		(1 - TREND_SMOOTHING) * self->trend.acc_delay;
+	self->trend.x[i] = (arrival_us - self->trend.first_arrival) / 1000.0;
+	self->trend.y[i] = self->trend.smoothed_delay;
+	self->trend.index = (i + 1) % TREND_WINDOW;
+	if (self->trend.count < TREND_WINDOW)
+		self->trend.count++;
+	if (self->trend.count == TREND_WINDOW && trend_slope(self, &slope))
+		self->trend.slope = slope;
+
+	self->detector.modified_trend =
+		self->trend.num_deltas * self->trend.slope * TREND_GAIN;
+	detect(self, send_delta / 1000.0, arrival_us);
+}
+
+
+static void acked_update(struct rtp_bwe *self, uint32_t size, int64_t arrival)
+{
+	int64_t span;
+
+	if (!self->acked.started) {
+		self->acked.start = arrival;
+		self->acked.bytes = 0;
+		self->acked.started = true;
+	}
+	self->acked.bytes += size;
+	span = arrival - self->acked.start;
+	if (span < ACKED_WINDOW_US)
+		return;
+	self->acked.bitrate = self->acked.bytes * 8 * 1000000 / span;
+	self->acked.start = arrival;
+	self->acked.bytes = 0;
+}
+
+
+/* Process a packet reported received, in sequence number order */
+static void packet_received(struct rtp_bwe *self,
+			    const struct sent_pkt *pkt,
+			    int64_t arrival)
+{
+	struct pkt_group *group = &self->group;
+
+	acked_update(self, pkt->size, arrival);
+
+	if (!group->valid) {
+		group->first_send = pkt->send_us;
+		group->last_send = pkt->send_us;
+		group->last_arrival = arrival;
+		group->valid = true;
+		return;
+	}
+
+	/* Packets sent before the current group are reordered, ignore them
+	 * for the delay variation */
+	if (pkt->send_us < group->first_send)
+		return;
+	if (pkt->send_us - group->first_send <= GROUP_US) {
+		if (pkt->send_us > group->last_send)
+			group->last_send = pkt->send_us;
+		if (arrival > group->last_arrival)
+			group->last_arrival = arrival;
+		return;
+	}
+
+	/* The current group is complete */
+	if (self->prev_group.valid) {
+		trend_update(self,
+			     group->last_send - self->prev_group.last_send,
+			     group->last_arrival -
+				     self->prev_group.last_arrival,
+			     group->last_arrival);
+	}
+	self->prev_group = *group;
+	group->first_send = pkt->send_us;
+	group->last_send = pkt->send_us;
+	group->last_arrival = arrival;
+}
+
+
+static void feedback_begin(struct rtp_bwe *self,
+			   const struct rtcp_pkt_rtpfb_report *report,
+			   struct feedback_ctx *ctx)
+{
+	uint32_t diff;
+
+	/* Unwrap the 24-bit reference time: the difference modulo 2^24 is
+	 * sign-extended from bit 23 */
+	if (!self->has_ref_time) {
+		self->ref_time = report->ref_time & 0xFFFFFF;
+		self->has_ref_time = true;
+	} else {
+		diff = (report->ref_time - (uint32_t)self->ref_time) & 0xFFFFFF;
+		if (diff & 0x800000)
+			self->ref_time += (int32_t)diff - 0x1000000;
+		else
+			self->ref_time += diff;
+	}
+	ctx->ticks = self->ref_time * REF_TIME_DELTAS;
+	ctx->seq = self->highest + rtp_diff_seqnum(report->base_seq,
+						   self->highest);
+	self->stats.reports++;
+}
+
+
+static void feedback_add(struct rtp_bwe *self,
+			 struct feedback_ctx *ctx,
+			 const struct rtcp_pkt_rtpfb_feedback *fb)
+{
+	uint64_t seq = ctx->seq++;
+	struct sent_pkt *pkt = &self->history[seq & self->mask];
+	bool known = seq <= self->highest &&
+		     self->highest - seq <= self->mask &&
+		     pkt->send_us != NOT_SENT;
+
+	if (fb->pkt_status_symbol != 1 && fb->pkt_status_symbol != 2) {
+		if (known)
+			self->stats.lost++;
+		return;
+	}
+
+	ctx->ticks += fb->recv_delta;
+	if (!known) {
+		self->stats.unknown++;
+		return;
+	}
+	self->stats.received++;
+	packet_received(self, pkt, ctx->ticks * DELTA_US);
+	pkt->send_us = NOT_SENT;
+}
+
+
+/* Update the link capacity estimate with the acknowledged bitrate at a
+ * decrease */
+static void capacity_update(struct rtp_bwe *self, double acked)
+{
+	double dev = acked - self->rate.capacity;
+
+	if (!self->rate.has_capacity) {
+		self->rate.capacity = acked;
+		self->rate.capacity_dev = 0;
+		self->rate.has_capacity = true;
+		return;
+	}
+	if (dev < 0)
+		dev = -dev;
+	self->rate.capacity_dev =
+		(1 - CAPACITY_ALPHA) * self->rate.capacity_dev +
+		CAPACITY_ALPHA * dev;
+	self->rate.capacity = (1 - CAPACITY_ALPHA) * self->rate.capacity +
+			      CAPACITY_ALPHA * acked;
+}
+
+
+/* AIMD rate controller, run once per report */
+static void rate_update(struct rtp_bwe *self, uint64_t now_us)
+{
+	double acked = self->acked.bitrate;
+	double target = self->rate.target;
+	double dt = 0, increase, frame_bits, packet_bits, limit, upper, dev;
+	uint64_t interval;
+	uint32_t packets;
+
+	switch (self->detector.usage) {
+	case RTP_BWE_USAGE_OVERUSE:
+		self->rate.state = RATE_DECREASE;
+		break;
+	case RTP_BWE_USAGE_UNDERUSE:
+		/* Let the queues drain */
+		self->rate.state = RATE_HOLD;
+		break;
+	default:
+		if (self->rate.state == RATE_HOLD)
+			self->rate.state = RATE_INCREASE;
+		break;
+	}
+
+	if (self->rate.has_last_update && now_us > self->rate.last_update) {
+		dt = now_us - self->rate.last_update;
+		if (dt > MAX_UPDATE_INTERVAL_US)
+			dt = MAX_UPDATE_INTERVAL_US;
+		dt /= 1000000.0;
+	}
+	self->rate.last_update = now_us;
+	self->rate.has_last_update = true;
+
+	switch (self->rate.state) {
+	case RATE_INCREASE:
+		dev = self->rate.capacity_dev;
+		if (dev < CAPACITY_MIN_DEV * self->rate.capacity)
+			dev = CAPACITY_MIN_DEV * self->rate.capacity;
+		upper = self->rate.capacity + 3 * dev;
+		if (self->rate.has_capacity && acked > upper)
+			self->rate.has_capacity = false;
+		if (self->rate.has_capacity) {
+			/* Close to the link capacity: about one packet per
+			 * response time */
+			frame_bits = target / INCREASE_FPS;
+			packets = frame_bits / INCREASE_PACKET_BITS + 1;
+			packet_bits = frame_bits / packets;
+			increase = packet_bits * 1000000 /
+				   (self->rtt_us + INCREASE_RESPONSE_US);
+			if (increase < INCREASE_ADDITIVE_MIN)
+				increase = INCREASE_ADDITIVE_MIN;
+			increase *= dt;
+		} else {
+			increase = target * INCREASE_FACTOR * dt;
+			if (increase < INCREASE_MIN)
+				increase = INCREASE_MIN;
+		}
+		target += increase;
+
+		/* Do not go too far above what actually goes through */
+		limit = ACKED_MAX_RATIO * acked + ACKED_MARGIN;
+		if (acked > 0 && target > limit)
+			target = self->rate.target > limit ? self->rate.target
+							   : limit;
+		break;
+
+	case RATE_DECREASE:
+		interval = self->rtt_us;
+		if (interval < MIN_DECREASE_INTERVAL_US)
+			interval = MIN_DECREASE_INTERVAL_US;
+		else if (interval > MAX_DECREASE_INTERVAL_US)
+			interval = MAX_DECREASE_INTERVAL_US;
+		if (self->rate.has_last_decrease &&
+		    now_us - self->rate.last_decrease < interval)
+			break;
+
+		if (acked > 0) {
+			if (DECREASE_FACTOR * acked < target)
+				target = DECREASE_FACTOR * acked;
+			capacity_update(self, acked);
+		} else {
+			target *= DECREASE_FACTOR;
+		}
+		self->rate.last_decrease = now_us;
+		self->rate.has_last_decrease = true;
+		self->rate.state = RATE_HOLD;
+		break;
+
+	default:
+		break;
+	}
+
+	if (target < self->cfg.min_bitrate)
+		target = self->cfg.min_bitrate;
+	else if (target > self->cfg.max_bitrate)
+		target = self->cfg.max_bitrate;
+	self->rate.target = target;
+}
+
+
+int rtp_bwe_feedback(struct rtp_bwe *self,
+		     const struct rtcp_pkt_rtpfb_report *report,
+		     uint64_t now_us)
+{
+	struct feedback_ctx ctx;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(report == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(report->status_count > 0 &&
+					 report->feedbacks == NULL,
+				 EINVAL);
+
+	if (!self->started)
+		return -EPROTO;
+
+	feedback_begin(self, report, &ctx);
+	for (uint16_t i = 0; i < report->status_count; i++)
+		feedback_add(self, &ctx, &report->feedbacks[i]);
+	rate_update(self, now_us);
+	return 0;
+}
+
+
+int rtp_bwe_feedback_iter(struct rtp_bwe *self,
+			  const struct rtcp_pkt_rtpfb_report *report,
+			  const struct rtcp_pkt_rtpfb_iter *iter,
+			  uint64_t now_us)
+{
+	struct rtcp_pkt_rtpfb_feedback feedbacks[ITER_BATCH];
+	struct rtcp_pkt_rtpfb_iter it;
+	struct feedback_ctx ctx;
+	int res;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(report == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(iter == NULL, EINVAL);
+
+	if (!self->started)
+		return -EPROTO;
+
+	it = *iter;
+	feedback_begin(self, report, &ctx);
+	while ((res = rtcp_pkt_rtpfb_iter_read(&it, feedbacks, ITER_BATCH)) >
+	       0) {
+		for (int i = 0; i < res; i++)
+			feedback_add(self, &ctx, &feedbacks[i]);
+	}
+	if (res < 0)
+		return res;
+	rate_update(self, now_us);
+	return 0;
+}
+
+
+int rtp_bwe_set_rtt(struct rtp_bwe *self, uint32_t rtt_us)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+
+	self->rtt_us = rtt_us;
+	return 0;
+}
+
+
+int rtp_bwe_get_estimate(struct rtp_bwe *self,
+			 struct rtp_bwe_estimate *estimate)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(estimate == NULL, EINVAL);
+
+	memset(estimate, 0, sizeof(*estimate));
+	estimate->target_bitrate = self->rate.target;
+	estimate->acked_bitrate = self->acked.bitrate;
+	estimate->usage = self->detector.usage;
+	estimate->trend = self->detector.modified_trend;
+	estimate->threshold = self->detector.threshold;
+	return 0;
+}
+
+
+int rtp_bwe_get_stats(struct rtp_bwe *self, struct rtp_bwe_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	*stats = self->stats;
+	return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "rtp_priv.h"
+
+
+int rtp_recip_init(struct rtp_recip *recip, uint32_t div)
+{
+	uint32_t l = 0;
+	uint64_t r = 0, q_hi = 0, q_lo = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(recip == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(div == 0, EINVAL);
+
+	/* l = ceil(log2(div)) */
+	l = div > 1 ? 64 - __builtin_clzll((uint64_t)div - 1) : 0;
+
+	/* mul = floor(2^64 * (2^l - div) / div) + 1, with 2^l - div < div so
+	 * that the long division in two 32-bit steps does not overflow */
+	r = ((uint64_t)1 << l) - div;
+	q_hi = (r << 32) / div;
+	r = (r << 32) % div;
+	q_lo = (r << 32) / div;
+	recip->mul = ((q_hi << 32) | q_lo) + 1;
+	recip->sh1 = l < 1 ? l : 1;
+	recip->sh2 = l > 1 ? l - 1 : 0;
+
+	return 0;
+}
+
+
+int rtp_clk_init(struct rtp_clk *clk, uint32_t clk_rate)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(clk == NULL, EINVAL);
+
+	memset(clk, 0, sizeof(*clk));
+	clk->clk_rate = clk_rate;
+	if (clk_rate == 0)
+		return 0;
+	return rtp_recip_init(&clk->recip, clk_rate);
+}
+
+
+int rtp_clk_to_us_batch(const struct rtp_clk *clk,
+			const uint64_t *rtp_timestamps,
+			uint64_t *us,
+			size_t count)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(clk == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(rtp_timestamps == NULL && count > 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(us == NULL && count > 0, EINVAL);
+
+	/* Dispatch once, the loops are then branch-free */
+	switch (clk->clk_rate) {
+	case 90000:
+		for (size_t i = 0; i < count; i++)
+			us[i] = rtp_timestamp_to_us_90k(rtp_timestamps[i]);
+		break;
+	case 48000:
+		for (size_t i = 0; i < count; i++)
+			us[i] = rtp_timestamp_to_us_48k(rtp_timestamps[i]);
+		break;
+	case 0:
+		memset(us, 0, count * sizeof(*us));
+		break;
+	default:
+		for (size_t i = 0; i < count; i++) {
+			us[i] = rtp_recip_div(&clk->recip,
+					      rtp_timestamps[i] * 1000000 +
+						      clk->clk_rate / 2);
+		}
+		break;
+	}
+
+	return 0;
+}
+
+
+int rtp_clk_from_us_batch(const struct rtp_clk *clk,
+			  const uint64_t *us,
+			  uint64_t *rtp_timestamps,
+			  size_t count)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(clk == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(us == NULL && count > 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(rtp_timestamps == NULL && count > 0, EINVAL);
+
+	for (size_t i = 0; i < count; i++)
+		rtp_timestamps[i] = rtp_clk_from_us(clk, us[i]);
+
+	return 0;
+}
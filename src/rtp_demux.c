@@ -0,0 +1,734 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "rtp_priv.h"
+
+/* Maximum load factor of the table (in percent) before growing */
+#define TABLE_MAX_LOAD 50
+
+#define KEY_EMPTY 0
+
+#define INVALID_INDEX UINT32_MAX
+
+
+/* Hash table slot (open addressing with linear probing), kept small so
+ * that probing stays within a few cache lines */
+struct slot {
+	uint64_t key;
+	uint32_t index;
+};
+
+
+/* Number of slots is a power of 2 */
+struct table {
+	struct slot *slots;
+	uint32_t mask;
+};
+
+
+struct source {
+	uint64_t key;
+	uint32_t ssrc;
+	uint8_t payload_type;
+	struct rtp_jitter *jitter;
+	void *userdata;
+	uint64_t last_seen;
+
+	/* Next source with the same SSRC (RTP_DEMUX_FLAG_KEY_PAYLOAD_TYPE) */
+	uint32_t ssrc_next;
+
+	/* Activity list (least recently active first) or free list */
+	uint32_t prev;
+	uint32_t next;
+};
+
+
+struct rtp_demux {
+	struct rtp_demux_cfg cfg;
+	struct rtp_demux_cbs cbs;
+	void *userdata;
+
+	struct table table;
+
+	/* First source of each SSRC, the others are chained by ssrc_next
+	 * (RTP_DEMUX_FLAG_KEY_PAYLOAD_TYPE only) */
+	struct table ssrc_table;
+
+	/* Sources are referenced by index so that the array can grow */
+	struct source *sources;
+	uint32_t capacity;
+	uint32_t used;
+	uint32_t count;
+	uint32_t free_head;
+
+	uint32_t lru_head;
+	uint32_t lru_tail;
+};
+
+
+struct rtcp_read_ctx {
+	struct rtp_demux *self;
+	const struct rtcp_pkt_read_cbs *cbs;
+	void *userdata;
+};
+
+
+static inline uint64_t make_key(const struct rtp_demux *self,
+				uint32_t ssrc,
+				uint8_t payload_type)
+{
+	/* The upper part is never 0 so that KEY_EMPTY is not a valid key */
+	uint64_t pt = 1;
+	if (self->cfg.flags & RTP_DEMUX_FLAG_KEY_PAYLOAD_TYPE)
+		pt += payload_type & RTP_PKT_HEADER_FLAGS_PAYLOAD_TYPE_MASK;
+	return (pt << 32) | ssrc;
+}
+
+
+/* Key of the SSRC index, whatever the payload type */
+static inline uint64_t make_ssrc_key(uint32_t ssrc)
+{
+	return (1ULL << 32) | ssrc;
+}
+
+
+static inline uint32_t hash_key(uint64_t key)
+{
+	/* Fibonacci hashing, SSRCs are random but may be chosen badly */
+	return (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+
+static uint32_t table_lookup(const struct table *table, uint64_t key)
+{
+	uint32_t pos = hash_key(key) & table->mask;
+
+	while (table->slots[pos].key != KEY_EMPTY) {
+		if (table->slots[pos].key == key)
+			return pos;
+		pos = (pos + 1) & table->mask;
+	}
+	return INVALID_INDEX;
+}
+
+
+static void
+table_insert(struct slot *slots, uint32_t mask, uint64_t key, uint32_t index)
+{
+	uint32_t pos = hash_key(key) & mask;
+
+	while (slots[pos].key != KEY_EMPTY)
+		pos = (pos + 1) & mask;
+	slots[pos].key = key;
+	slots[pos].index = index;
+}
+
+
+/* Backward shift deletion, no tombstones are needed */
+static void table_remove(struct table *table, uint32_t pos)
+{
+	uint32_t i = pos, j = pos, k = 0;
+
+	while (1) {
+		j = (j + 1) & table->mask;
+		if (table->slots[j].key == KEY_EMPTY)
+			break;
+		k = hash_key(table->slots[j].key) & table->mask;
+		/* Move the entry if its home slot is not cyclically
+		 * within ]i, j] */
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		table->slots[i] = table->slots[j];
+		i = j;
+	}
+	table->slots[i].key = KEY_EMPTY;
+}
+
+
+static int table_resize(struct table *table, uint32_t slot_count)
+{
+	struct slot *slots = NULL;
+	uint32_t mask = slot_count - 1;
+
+	slots = calloc(slot_count, sizeof(*slots));
+	if (slots == NULL)
+		return -ENOMEM;
+
+	for (uint32_t i = 0; table->slots != NULL && i <= table->mask; i++) {
+		if (table->slots[i].key != KEY_EMPTY) {
+			table_insert(slots,
+				     mask,
+				     table->slots[i].key,
+				     table->slots[i].index);
+		}
+	}
+
+	free(table->slots);
+	table->slots = slots;
+	table->mask = mask;
+	return 0;
+}
+
+
+/* Both tables have the same size, the SSRC index never holds more entries
+ * than the sources table */
+static int tables_resize(struct rtp_demux *self, uint32_t slot_count)
+{
+	int res = table_resize(&self->table, slot_count);
+	if (res < 0)
+		return res;
+	if (!(self->cfg.flags & RTP_DEMUX_FLAG_KEY_PAYLOAD_TYPE))
+		return 0;
+	return table_resize(&self->ssrc_table, slot_count);
+}
+
+
+/* Add a source to the chain of its SSRC */
+static void ssrc_link(struct rtp_demux *self, uint32_t index)
+{
+	struct source *src = &self->sources[index];
+	uint64_t key = make_ssrc_key(src->ssrc);
+	uint32_t pos = table_lookup(&self->ssrc_table, key);
+
+	if (pos == INVALID_INDEX) {
+		src->ssrc_next = INVALID_INDEX;
+		table_insert(self->ssrc_table.slots,
+			     self->ssrc_table.mask,
+			     key,
+			     index);
+		return;
+	}
+	src->ssrc_next = self->ssrc_table.slots[pos].index;
+	self->ssrc_table.slots[pos].index = index;
+}
+
+
+/* Remove a source from the chain of its SSRC (only a few payload types
+ * are expected per SSRC) */
+static void ssrc_unlink(struct rtp_demux *self, uint32_t index)
+{
+	struct source *src = &self->sources[index];
+	uint64_t key = make_ssrc_key(src->ssrc);
+	uint32_t pos = table_lookup(&self->ssrc_table, key);
+	uint32_t prev = 0;
+
+	if (pos == INVALID_INDEX)
+		return;
+
+	prev = self->ssrc_table.slots[pos].index;
+	if (prev == index) {
+		if (src->ssrc_next == INVALID_INDEX)
+			table_remove(&self->ssrc_table, pos);
+		else
+			self->ssrc_table.slots[pos].index = src->ssrc_next;
+		return;
+	}
+	while (self->sources[prev].ssrc_next != index)
+		prev = self->sources[prev].ssrc_next;
+	self->sources[prev].ssrc_next = src->ssrc_next;
+}
+
+
+static void lru_unlink(struct rtp_demux *self, uint32_t index)
+{
+	struct source *src = &self->sources[index];
+
+	if (src->prev != INVALID_INDEX)
+		self->sources[src->prev].next = src->next;
+	else
+		self->lru_head = src->next;
+	if (src->next != INVALID_INDEX)
+		self->sources[src->next].prev = src->prev;
+	else
+		self->lru_tail = src->prev;
+}
+
+
+static void lru_append(struct rtp_demux *self, uint32_t index)
+{
+	struct source *src = &self->sources[index];
+
+	src->prev = self->lru_tail;
+	src->next = INVALID_INDEX;
+	if (self->lru_tail != INVALID_INDEX)
+		self->sources[self->lru_tail].next = index;
+	else
+		self->lru_head = index;
+	self->lru_tail = index;
+}
+
+
+static int source_alloc(struct rtp_demux *self, uint32_t *ret_index)
+{
+	uint32_t capacity = 0;
+	struct source *sources = NULL;
+
+	if (self->free_head != INVALID_INDEX) {
+		*ret_index = self->free_head;
+		self->free_head = self->sources[self->free_head].next;
+		return 0;
+	}
+
+	if (self->used == self->capacity) {
+		capacity = self->capacity * 2;
+		sources = realloc(self->sources, capacity * sizeof(*sources));
+		if (sources == NULL)
+			return -ENOMEM;
+		self->sources = sources;
+		self->capacity = capacity;
+	}
+
+	*ret_index = self->used++;
+	return 0;
+}
+
+
+static int source_add(struct rtp_demux *self,
+		      uint64_t key,
+		      const struct rtp_pkt *pkt,
+		      uint32_t *ret_index)
+{
+	int res = 0;
+	uint32_t index = 0;
+	struct source *src = NULL;
+	struct rtp_jitter *jitter = NULL;
+	void *source_userdata = NULL;
+
+	if (self->cfg.max_sources != 0 &&
+	    self->count >= self->cfg.max_sources)
+		return -ENOSPC;
+
+	/* Keep the load factor low to have short probe sequences */
+	if ((uint64_t)(self->count + 1) * 100 >
+	    (uint64_t)(self->table.mask + 1) * TABLE_MAX_LOAD) {
+		res = tables_resize(self, (self->table.mask + 1) * 2);
+		if (res < 0)
+			return res;
+	}
+
+	if (self->cbs.source_add != NULL) {
+		res = (*self->cbs.source_add)(
+			self, pkt, &jitter, &source_userdata, self->userdata);
+		if (res < 0)
+			return res;
+	}
+
+	res = source_alloc(self, &index);
+	if (res < 0) {
+		/* Give the jitter buffer back */
+		if (self->cbs.source_remove != NULL) {
+			(*self->cbs.source_remove)(
+				self,
+				pkt->header.ssrc,
+				RTP_PKT_HEADER_FLAGS_GET(pkt->header.flags,
+							 PAYLOAD_TYPE),
+				jitter,
+				source_userdata,
+				RTP_DEMUX_REMOVE_REASON_EXPLICIT,
+				self->userdata);
+		}
+		return res;
+	}
+
+	src = &self->sources[index];
+	memset(src, 0, sizeof(*src));
+	src->key = key;
+	src->ssrc = pkt->header.ssrc;
+	src->payload_type =
+		RTP_PKT_HEADER_FLAGS_GET(pkt->header.flags, PAYLOAD_TYPE);
+	src->jitter = jitter;
+	src->userdata = source_userdata;
+	lru_append(self, index);
+	table_insert(self->table.slots, self->table.mask, key, index);
+	if (self->cfg.flags & RTP_DEMUX_FLAG_KEY_PAYLOAD_TYPE)
+		ssrc_link(self, index);
+	self->count++;
+
+	*ret_index = index;
+	return 0;
+}
+
+
+static void source_remove(struct rtp_demux *self,
+			  uint32_t pos,
+			  enum rtp_demux_remove_reason reason)
+{
+	uint32_t index = self->table.slots[pos].index;
+	struct source src = self->sources[index];
+
+	/* Remove the source before calling the callback, so that the
+	 * demultiplexer is in a consistent state if it is used from there */
+	table_remove(&self->table, pos);
+	if (self->cfg.flags & RTP_DEMUX_FLAG_KEY_PAYLOAD_TYPE)
+		ssrc_unlink(self, index);
+	lru_unlink(self, index);
+	self->sources[index].key = KEY_EMPTY;
+	self->sources[index].next = self->free_head;
+	self->free_head = index;
+	self->count--;
+
+	if (self->cbs.source_remove != NULL) {
+		(*self->cbs.source_remove)(self,
+					   src.ssrc,
+					   src.payload_type,
+					   src.jitter,
+					   src.userdata,
+					   reason,
+					   self->userdata);
+	}
+}
+
+
+static int remove_ssrc(struct rtp_demux *self,
+		       uint32_t ssrc,
+		       enum rtp_demux_remove_reason reason)
+{
+	uint32_t pos = 0, index = 0;
+	int count = 0;
+
+	if (!(self->cfg.flags & RTP_DEMUX_FLAG_KEY_PAYLOAD_TYPE)) {
+		pos = table_lookup(&self->table, make_key(self, ssrc, 0));
+		if (pos == INVALID_INDEX)
+			return 0;
+		source_remove(self, pos, reason);
+		return 1;
+	}
+
+	/* Remove the first source of the SSRC until there is none left, the
+	 * chain is looked up again as the callback may modify it */
+	while (1) {
+		pos = table_lookup(&self->ssrc_table, make_ssrc_key(ssrc));
+		if (pos == INVALID_INDEX)
+			break;
+		index = self->ssrc_table.slots[pos].index;
+		pos = table_lookup(&self->table, self->sources[index].key);
+		source_remove(self, pos, reason);
+		count++;
+	}
+	return count;
+}
+
+
+int rtp_demux_new(const struct rtp_demux_cfg *cfg,
+		  const struct rtp_demux_cbs *cbs,
+		  void *userdata,
+		  struct rtp_demux **ret_obj)
+{
+	int res = 0;
+	struct rtp_demux *self = NULL;
+	uint32_t slot_count = 1;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cbs == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	*ret_obj = NULL;
+
+	self = calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+	self->cfg = *cfg;
+	self->cbs = *cbs;
+	self->userdata = userdata;
+	self->free_head = INVALID_INDEX;
+	self->lru_head = INVALID_INDEX;
+	self->lru_tail = INVALID_INDEX;
+	if (self->cfg.capacity == 0)
+		self->cfg.capacity = RTP_DEMUX_DEFAULT_CAPACITY;
+
+	/* Size the table for the requested capacity */
+	while ((uint64_t)slot_count * TABLE_MAX_LOAD <
+	       (uint64_t)self->cfg.capacity * 100)
+		slot_count *= 2;
+	res = tables_resize(self, slot_count);
+	if (res < 0)
+		goto error;
+
+	self->capacity = self->cfg.capacity;
+	self->sources = calloc(self->capacity, sizeof(*self->sources));
+	if (self->sources == NULL) {
+		res = -ENOMEM;
+		goto error;
+	}
+
+	*ret_obj = self;
+	return 0;
+
+error:
+	free(self->table.slots);
+	free(self->ssrc_table.slots);
+	free(self);
+	return res;
+}
+
+
+int rtp_demux_destroy(struct rtp_demux *self)
+{
+	if (self == NULL)
+		return 0;
+
+	while (self->lru_head != INVALID_INDEX) {
+		uint32_t pos = table_lookup(
+			&self->table, self->sources[self->lru_head].key);
+		source_remove(self, pos, RTP_DEMUX_REMOVE_REASON_DESTROY);
+	}
+
+	free(self->sources);
+	free(self->table.slots);
+	free(self->ssrc_table.slots);
+	free(self);
+	return 0;
+}
+
+
+int rtp_demux_dispatch(struct rtp_demux *self, struct rtp_pkt *pkt)
+{
+	int res = 0;
+	uint64_t key = 0;
+	uint32_t pos = 0, index = 0;
+	struct source *src = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+
+	key = make_key(self,
+		       pkt->header.ssrc,
+		       RTP_PKT_HEADER_FLAGS_GET(pkt->header.flags,
+						PAYLOAD_TYPE));
+	pos = table_lookup(&self->table, key);
+	if (pos != INVALID_INDEX) {
+		index = self->table.slots[pos].index;
+		/* Move to the end of the activity list */
+		if (index != self->lru_tail) {
+			lru_unlink(self, index);
+			lru_append(self, index);
+		}
+	} else {
+		res = source_add(self, key, pkt, &index);
+		if (res < 0) {
+			ULOGD("demux: source 0x%08x not added: %d",
+			      pkt->header.ssrc,
+			      res);
+			rtp_pkt_destroy(pkt);
+			return res;
+		}
+	}
+
+	src = &self->sources[index];
+	src->last_seen = pkt->in_timestamp;
+
+	/* The jitter buffer takes ownership of the packet even on error */
+	if (src->jitter != NULL)
+		return rtp_jitter_enqueue(src->jitter, pkt);
+	if (self->cbs.process_pkt != NULL) {
+		(*self->cbs.process_pkt)(
+			self, pkt, src->userdata, self->userdata);
+		return 0;
+	}
+
+	rtp_pkt_destroy(pkt);
+	return 0;
+}
+
+
+int rtp_demux_expire(struct rtp_demux *self, uint64_t cur_timestamp)
+{
+	struct source *src = NULL;
+	uint32_t pos = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+
+	if (self->cfg.timeout == 0)
+		return 0;
+
+	/* The activity list is sorted, stop at the first active source */
+	while (self->lru_head != INVALID_INDEX) {
+		src = &self->sources[self->lru_head];
+		if (src->last_seen + self->cfg.timeout > cur_timestamp)
+			break;
+		pos = table_lookup(&self->table, src->key);
+		source_remove(self, pos, RTP_DEMUX_REMOVE_REASON_TIMEOUT);
+	}
+
+	return 0;
+}
+
+
+int rtp_demux_remove_source(struct rtp_demux *self, uint32_t ssrc)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+
+	return remove_ssrc(self, ssrc, RTP_DEMUX_REMOVE_REASON_EXPLICIT) > 0
+		       ? 0
+		       : -ENOENT;
+}
+
+
+int rtp_demux_process_bye(struct rtp_demux *self,
+			  const struct rtcp_pkt_bye *bye)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(bye == NULL, EINVAL);
+
+	for (uint32_t i = 0; i < bye->source_count; i++)
+		remove_ssrc(self, bye->sources[i], RTP_DEMUX_REMOVE_REASON_BYE);
+
+	return 0;
+}
+
+
+static void rtcp_sender_report_cb(const struct rtcp_pkt_sender_report *sr,
+				  void *userdata)
+{
+	struct rtcp_read_ctx *ctx = userdata;
+	if (ctx->cbs->sender_report != NULL)
+		(*ctx->cbs->sender_report)(sr, ctx->userdata);
+}
+
+
+static void
+rtcp_receiver_report_cb(const struct rtcp_pkt_receiver_report *rr,
+			void *userdata)
+{
+	struct rtcp_read_ctx *ctx = userdata;
+	if (ctx->cbs->receiver_report != NULL)
+		(*ctx->cbs->receiver_report)(rr, ctx->userdata);
+}
+
+
+static void rtcp_sdes_item_cb(uint32_t ssrc,
+			      const struct rtcp_pkt_sdes_item *item,
+			      void *userdata)
+{
+	struct rtcp_read_ctx *ctx = userdata;
+	if (ctx->cbs->sdes_item != NULL)
+		(*ctx->cbs->sdes_item)(ssrc, item, ctx->userdata);
+}
+
+
+static void rtcp_bye_cb(const struct rtcp_pkt_bye *bye, void *userdata)
+{
+	struct rtcp_read_ctx *ctx = userdata;
+	rtp_demux_process_bye(ctx->self, bye);
+	if (ctx->cbs->bye != NULL)
+		(*ctx->cbs->bye)(bye, ctx->userdata);
+}
+
+
+static void rtcp_app_cb(const struct rtcp_pkt_app *app, void *userdata)
+{
+	struct rtcp_read_ctx *ctx = userdata;
+	if (ctx->cbs->app != NULL)
+		(*ctx->cbs->app)(app, ctx->userdata);
+}
+
+
+static void rtcp_rtpfb_report_cb(const struct rtcp_pkt_rtpfb_report *rtpfb,
+				 void *userdata)
+{
+	struct rtcp_read_ctx *ctx = userdata;
+	if (ctx->cbs->rtpfb_report != NULL)
+		(*ctx->cbs->rtpfb_report)(rtpfb, ctx->userdata);
+}
+
+
+static void rtcp_rtpfb_report_iter_cb(const struct rtcp_pkt_rtpfb_report *rtpfb,
+				      struct rtcp_pkt_rtpfb_iter *iter,
+				      void *userdata)
+{
+	struct rtcp_read_ctx *ctx = userdata;
+	(*ctx->cbs->rtpfb_report_iter)(rtpfb, iter, ctx->userdata);
+}
+
+
+int rtp_demux_rtcp_read(struct rtp_demux *self,
+			const struct pomp_buffer *buf,
+			const struct rtcp_pkt_read_cbs *cbs,
+			void *userdata)
+{
+	struct rtcp_read_ctx ctx = {
+		.self = self,
+		.cbs = cbs,
+		.userdata = userdata,
+	};
+	struct rtcp_pkt_read_cbs demux_cbs;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cbs == NULL, EINVAL);
+
+	/* Only forward the callbacks set by the caller to avoid useless
+	 * parsing work */
+	memset(&demux_cbs, 0, sizeof(demux_cbs));
+	if (cbs->sender_report != NULL)
+		demux_cbs.sender_report = &rtcp_sender_report_cb;
+	if (cbs->receiver_report != NULL)
+		demux_cbs.receiver_report = &rtcp_receiver_report_cb;
+	if (cbs->sdes_item != NULL)
+		demux_cbs.sdes_item = &rtcp_sdes_item_cb;
+	demux_cbs.bye = &rtcp_bye_cb;
+	if (cbs->app != NULL)
+		demux_cbs.app = &rtcp_app_cb;
+	if (cbs->rtpfb_report != NULL)
+		demux_cbs.rtpfb_report = &rtcp_rtpfb_report_cb;
+	if (cbs->rtpfb_report_iter != NULL)
+		demux_cbs.rtpfb_report_iter = &rtcp_rtpfb_report_iter_cb;
+
+	return rtcp_pkt_read(buf, &demux_cbs, &ctx);
+}
+
+
+int rtp_demux_get_source(struct rtp_demux *self,
+			 uint32_t ssrc,
+			 uint8_t payload_type,
+			 struct rtp_jitter **ret_jitter,
+			 void **ret_source_userdata)
+{
+	uint32_t pos = 0;
+	struct source *src = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+
+	pos = table_lookup(&self->table, make_key(self, ssrc, payload_type));
+	if (pos == INVALID_INDEX)
+		return -ENOENT;
+
+	src = &self->sources[self->table.slots[pos].index];
+	if (ret_jitter != NULL)
+		*ret_jitter = src->jitter;
+	if (ret_source_userdata != NULL)
+		*ret_source_userdata = src->userdata;
+	return 0;
+}
+
+
+int rtp_demux_get_source_count(struct rtp_demux *self, uint32_t *count)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == NULL, EINVAL);
+
+	*count = self->count;
+	return 0;
+}
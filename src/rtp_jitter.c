@@ -26,60 +26,1036 @@
 
 #include "rtp_priv.h"
 
-#define SKEW_WINDOW_SLIDING
-
-#ifdef SKEW_WINDOW_SLIDING
-#	define SKEW_WINDOW_MAX_SIZE 512
-#	define SKEW_WINDOW_TIMEOUT 2000000
-#	define SKEW_AVG_ALPHA 128
-#else
-#	define SKEW_WINDOW_MAX_SIZE 400
-#	define SKEW_WINDOW_TIMEOUT 5000000
-#	define SKEW_AVG_ALPHA 64
-#endif
+#define SKEW_SLIDING_WINDOW_SIZE 512
+#define SKEW_SLIDING_WINDOW_TIMEOUT 2000000
+#define SKEW_SLIDING_AVG_ALPHA 128
+
+#define SKEW_BLOCK_WINDOW_SIZE 400
+#define SKEW_BLOCK_WINDOW_TIMEOUT 5000000
+#define SKEW_BLOCK_AVG_ALPHA 64
+
+#define SKEW_REGRESSION_BLOCK_SIZE 100
+#define SKEW_REGRESSION_BLOCK_TIMEOUT 1000000
+#define SKEW_REGRESSION_AVG_ALPHA 16
+
+/* Bound of the drift (in ppm) to keep the extrapolation sane on bad fits */
+#define SKEW_REGRESSION_MAX_DRIFT 1000.0
+
+#define SKEW_EWMA_AVG_ALPHA 1024
+#define SKEW_EWMA_FALL_ALPHA 8
+#define SKEW_EWMA_FRAC_BITS 8
 
 #define SKEW_LARGE_GAP 1000000
 
+/* Compact samples are rebased when they get further than this from the
+ * base value */
+#define SKEW_COMPACT_RANGE (INT32_MAX / 2)
+
 #define JITTER_AVG_ALPHA 16
 
+#define BATCH_INITIAL_SIZE 16
+
+#define EVICT_HEAP_INITIAL_SIZE 64
+
+/* Increment a counter of the producer (single writer), read concurrently
+ * with relaxed atomic loads */
+#define PUB_INC(_v) __atomic_store_n(&(_v), (_v) + 1, __ATOMIC_RELAXED)
+
+
+enum skip_action {
+	/* Not in live mode or the packet is not late */
+	SKIP_ACTION_NONE = 0,
+
+	/* The late packet has been dropped */
+	SKIP_ACTION_DROP,
+
+	/* The late packet is important, release it now */
+	SKIP_ACTION_KEEP,
+};
+
+#define DELAY_UPDATE_PERIOD 1000000
+#define DELAY_DEFAULT_HYSTERESIS 2000
+#define DELAY_DEFAULT_SLEW 10000
+
+/* Transit variation histogram: exact buckets for values below
+ * 2^HIST_SUB_BITS us, then 2^HIST_SUB_BITS buckets per power of 2 (the last
+ * one also counts larger values, above 16s) */
+#define HIST_SUB_BITS 2
+#define HIST_SIZE 96
+
+
+enum skew_window {
+	/* The samples are not stored */
+	SKEW_WINDOW_NONE = 0,
+
+	/* The samples are stored in the window */
+	SKEW_WINDOW_SAMPLES,
+
+	/* The samples are stored in the window, with the monotonic deque of
+	 * the minimum candidates */
+	SKEW_WINDOW_DEQUE,
+};
+
+
+/* Skew estimator: update is called with each skew sample (receive time
+ * minus send time since the first packet) and updates skew_avg, it returns
+ * -EINVAL if the estimation must be restarted; the defaults are used for
+ * the configuration values left to 0 */
+struct skew_estimator {
+	int (*update)(struct rtp_jitter *self,
+		      uint64_t rx_timestamp,
+		      int64_t skew);
+	enum skew_window window;
+	uint32_t window_size;
+	uint32_t window_timeout;
+	uint32_t avg_alpha;
+};
+
+
+static int update_skew_sliding(struct rtp_jitter *self,
+			       uint64_t rx_timestamp,
+			       int64_t skew);
+static int update_skew_block(struct rtp_jitter *self,
+			     uint64_t rx_timestamp,
+			     int64_t skew);
+static int update_skew_regression(struct rtp_jitter *self,
+				  uint64_t rx_timestamp,
+				  int64_t skew);
+static int update_skew_ewma(struct rtp_jitter *self,
+			    uint64_t rx_timestamp,
+			    int64_t skew);
+
+
+static const struct skew_estimator skew_estimators[] = {
+	[RTP_JITTER_SKEW_MODE_SLIDING] = {
+		.update = &update_skew_sliding,
+		.window = SKEW_WINDOW_DEQUE,
+		.window_size = SKEW_SLIDING_WINDOW_SIZE,
+		.window_timeout = SKEW_SLIDING_WINDOW_TIMEOUT,
+		.avg_alpha = SKEW_SLIDING_AVG_ALPHA,
+	},
+	[RTP_JITTER_SKEW_MODE_BLOCK] = {
+		.update = &update_skew_block,
+		.window = SKEW_WINDOW_SAMPLES,
+		.window_size = SKEW_BLOCK_WINDOW_SIZE,
+		.window_timeout = SKEW_BLOCK_WINDOW_TIMEOUT,
+		.avg_alpha = SKEW_BLOCK_AVG_ALPHA,
+	},
+	[RTP_JITTER_SKEW_MODE_REGRESSION] = {
+		.update = &update_skew_regression,
+		.window = SKEW_WINDOW_NONE,
+		.window_size = SKEW_REGRESSION_BLOCK_SIZE,
+		.window_timeout = SKEW_REGRESSION_BLOCK_TIMEOUT,
+		.avg_alpha = SKEW_REGRESSION_AVG_ALPHA,
+	},
+	[RTP_JITTER_SKEW_MODE_EWMA] = {
+		.update = &update_skew_ewma,
+		.window = SKEW_WINDOW_NONE,
+		.window_size = 0,
+		.window_timeout = 0,
+		.avg_alpha = SKEW_EWMA_AVG_ALPHA,
+	},
+};
+
 
 struct rtp_jitter {
 	struct rtp_jitter_cfg cfg;
 	struct rtp_jitter_cbs cbs;
 	void *userdata;
 
+	/* Clock rate with its reciprocal for the conversions to us */
+	struct rtp_clk clk;
+
+	/* Queued packets (RTP_JITTER_STORAGE_LIST) */
 	struct list_node packets;
+
+	/* Queued packets (RTP_JITTER_STORAGE_RING), indexed by sequence
+	 * number; head and tail are the sequence numbers of the first and
+	 * last queued packets when count is not 0 */
+	struct {
+		struct rtp_pkt **pkts;
+		uint32_t mask;
+		uint16_t head;
+		uint16_t tail;
+	} ring;
+
+	/* Number and total size (raw data) of queued packets */
+	uint32_t count;
+	size_t bytes;
+
+	/* Counters (the queue, estimation and producer fields are filled by
+	 * rtp_jitter_get_stats); highest_seqnum is the highest sequence
+	 * number received, valid if highest_valid is set */
+	struct rtp_jitter_stats stats;
+
+	/* Counters and estimations of the producer, written by it with
+	 * relaxed atomic stores (see PUB_INC() and publish_estimation()) and
+	 * read with relaxed atomic loads from any thread */
+	struct {
+		uint64_t enqueued;
+		uint64_t ingress_dropped;
+		uint32_t skew_resets;
+		uint32_t jitter_avg;
+		int64_t skew_avg;
+		int32_t skew_drift;
+	} pub;
+	uint16_t highest_seqnum;
+	int highest_valid;
+
 	uint16_t next_seqnum;
 
+	/* Out and RTP timestamps of the last released packet
+	 * (next_seqnum - 1), valid if last_released is set */
+	uint64_t last_out_timestamp;
+	uint64_t last_released_rtp_timestamp;
+	int last_released;
+
+	/* Live mode (cfg.max_latency): late packets are being dropped until
+	 * the next recent frame; skip_count is the number of packets dropped
+	 * by the current process. cut is written by the producer when it
+	 * restarts the timing from a new frame (generation in the upper 16
+	 * bits, seqnum of the frame in the lower ones), the packets before
+	 * cut_seqnum are then late */
+	int skipping;
+	uint32_t skip_count;
+	uint32_t cut;
+	uint32_t cut_seen;
+	uint16_t cut_seqnum;
+	int cut_pending;
+
 	uint64_t first_rx_timestamp;
 	uint64_t first_rtp_timestamp;
 
 	uint64_t last_rx_timestamp;
 	uint64_t last_rtp_timestamp;
 
-	int64_t window[SKEW_WINDOW_MAX_SIZE];
+	/* Skew samples (cfg.skew_window_size entries), on 32 bits relative to
+	 * window_base if cfg.skew_compact is set */
+	union {
+		int64_t *v64;
+		int32_t *v32;
+	} window;
+	int64_t window_base;
 	uint32_t window_pos;
 	uint32_t window_size;
 	uint64_t window_start_timestamp;
 	int64_t window_min;
+
+	/* Positions in the window of the candidates for the minimum, oldest
+	 * first, with increasing values (monotonic deque, sliding mode only) */
+	uint16_t *window_deque;
+	uint32_t window_deque_start;
+	uint32_t window_deque_count;
+
+	/* Regression estimator: the minimum of each block of samples (block
+	 * progress is tracked with window_size and window_start_timestamp)
+	 * is a point of the lower envelope of the skew, fitted by weighted
+	 * least squares with exponential forgetting (times in s relative to
+	 * origin, the time of the last point, so that the sums stay well
+	 * conditioned); drift is the slope in ppm. EWMA estimator:
+	 * ewma is the average with SKEW_EWMA_FRAC_BITS fractional bits */
+	struct {
+		uint64_t origin;
+		double sum_w;
+		double sum_t;
+		double sum_s;
+		double sum_tt;
+		double sum_ts;
+		uint32_t points;
+		int64_t block_min;
+		uint64_t block_min_timestamp;
+		int64_t ewma;
+		int32_t drift;
+	} est;
+
 	int64_t skew_avg;
 
 	/* Estimated jitter (in us) */
 	uint32_t jitter_avg;
+
+	/* Adaptive delay (cfg.delay_percentile); hist has HIST_SIZE buckets,
+	 * decayed by half on each update. delay is written by the producer
+	 * and read by the consumer with an ingress ring */
+	uint32_t *hist;
+	uint32_t hist_total;
+	uint64_t delay_update_timestamp;
+	uint32_t delay;
+
+	/* Lock-free single producer / single consumer ring of enqueued packets
+	 * (cfg.ingress_size); tail is written by the producer, head by the
+	 * consumer. reset is set by the consumer to request a reset of the
+	 * producer state, signaled by the producer when evt is signaled */
+	struct {
+		struct rtp_pkt **pkts;
+		uint32_t mask;
+		uint32_t head;
+		uint32_t tail;
+		int reset;
+		int signaled;
+	} ingress;
+
+	/* Packets released by the current process (cbs.process_pkts), or
+	 * frame being released (cbs.process_frame) */
+	struct {
+		struct rtp_pkt **pkts;
+		uint32_t *gaps;
+		size_t count;
+		size_t size;
+		uint32_t frame_flags;
+	} batch;
+
+	/* Queued packets by eviction order (binary max-heap on the score, then
+	 * on the age), only maintained when a budget applies (own budget or
+	 * group) */
+	struct {
+		struct rtp_pkt **pkts;
+		uint32_t count;
+		uint32_t size;
+		int active;
+	} evict_heap;
+
+	/* Group membership (rtp_jitter_group_add) */
+	struct rtp_jitter_group *group;
+	struct rtp_jitter_group_entry *group_entry;
+
+	/* Loop integration (rtp_jitter_attach_loop); armed_deadline is the
+	 * deadline the timer is set for, 0 if not armed */
+	struct pomp_loop *loop;
+	struct pomp_timer *timer;
+	struct pomp_evt *evt;
+	uint64_t armed_deadline;
+	int idle_pending;
+};
+
+
+struct layout {
+	size_t ring_offset;
+	size_t ingress_offset;
+	size_t hist_offset;
+	size_t window_offset;
+	size_t deque_offset;
+	size_t size;
 };
 
 
+/* Validate a configuration and fill the default values */
+static int cfg_normalize(const struct rtp_jitter_cfg *cfg,
+			 struct rtp_jitter_cfg *out)
+{
+	const struct skew_estimator *est = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->clk_rate == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->storage != RTP_JITTER_STORAGE_LIST &&
+					 cfg->storage != RTP_JITTER_STORAGE_RING,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		cfg->release_mode != RTP_JITTER_RELEASE_MODE_PACKET &&
+			cfg->release_mode != RTP_JITTER_RELEASE_MODE_FRAME,
+		EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF((cfg->ring_size & (cfg->ring_size - 1)) != 0,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->ring_size > RTP_JITTER_MAX_RING_SIZE,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF((unsigned int)cfg->skew_mode >=
+					 sizeof(skew_estimators) /
+						 sizeof(skew_estimators[0]),
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->skew_window_size >
+					 RTP_JITTER_MAX_SKEW_WINDOW_SIZE,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		cfg->max_latency != 0 && cfg->max_latency < cfg->delay, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->delay_percentile > 100, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		cfg->delay_percentile != 0 && cfg->delay_min > cfg->delay,
+		EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		(cfg->ingress_size & (cfg->ingress_size - 1)) != 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		cfg->ingress_size > RTP_JITTER_MAX_INGRESS_SIZE, EINVAL);
+
+	*out = *cfg;
+	est = &skew_estimators[cfg->skew_mode];
+	if (out->storage == RTP_JITTER_STORAGE_RING && out->ring_size == 0)
+		out->ring_size = RTP_JITTER_DEFAULT_RING_SIZE;
+	if (out->storage != RTP_JITTER_STORAGE_RING)
+		out->ring_size = 0;
+	if (out->skew_window_size == 0)
+		out->skew_window_size = est->window_size;
+	if (out->skew_window_timeout == 0)
+		out->skew_window_timeout = est->window_timeout;
+	if (out->skew_avg_alpha == 0)
+		out->skew_avg_alpha = est->avg_alpha;
+	if (out->jitter_avg_alpha == 0)
+		out->jitter_avg_alpha = JITTER_AVG_ALPHA;
+	if (out->delay_hysteresis == 0)
+		out->delay_hysteresis = DELAY_DEFAULT_HYSTERESIS;
+	if (out->delay_slew == 0)
+		out->delay_slew = DELAY_DEFAULT_SLEW;
+	out->skew_compact = (cfg->skew_compact != 0);
+
+	return 0;
+}
+
+
+static size_t align_up(size_t size, size_t align)
+{
+	return (size + align - 1) & ~(align - 1);
+}
+
+
+/* The object, window, rings, histogram and deque are stored in a single
+ * allocation, in order of decreasing alignment, each region starting at an
+ * offset aligned for its type (the object itself may be less aligned than
+ * the 64-bit window on 32-bit targets); cfg must be normalized */
+static void get_layout(const struct rtp_jitter_cfg *cfg, struct layout *layout)
+{
+	size_t size = sizeof(struct rtp_jitter);
+	enum skew_window window = skew_estimators[cfg->skew_mode].window;
+
+	if (cfg->skew_compact) {
+		layout->window_offset = align_up(size, __alignof__(int32_t));
+		size = layout->window_offset;
+		if (window != SKEW_WINDOW_NONE)
+			size += cfg->skew_window_size * sizeof(int32_t);
+	} else {
+		layout->window_offset = align_up(size, __alignof__(int64_t));
+		size = layout->window_offset;
+		if (window != SKEW_WINDOW_NONE)
+			size += cfg->skew_window_size * sizeof(int64_t);
+	}
+	layout->ring_offset = align_up(size, __alignof__(struct rtp_pkt *));
+	size = layout->ring_offset + cfg->ring_size * sizeof(struct rtp_pkt *);
+	layout->ingress_offset = size;
+	size += cfg->ingress_size * sizeof(struct rtp_pkt *);
+	layout->hist_offset = align_up(size, __alignof__(uint32_t));
+	size = layout->hist_offset;
+	if (cfg->delay_percentile != 0)
+		size += HIST_SIZE * sizeof(uint32_t);
+	layout->deque_offset = align_up(size, __alignof__(uint16_t));
+	size = layout->deque_offset;
+	if (window == SKEW_WINDOW_DEQUE)
+		size += cfg->skew_window_size * sizeof(uint16_t);
+
+	layout->size = size;
+}
+
+
+static struct rtp_pkt *ring_slot_get(struct rtp_jitter *self, uint16_t seqnum)
+{
+	return self->ring.pkts[seqnum & self->ring.mask];
+}
+
+
+static struct rtp_pkt *store_first(struct rtp_jitter *self)
+{
+	if (self->count == 0)
+		return NULL;
+	if (self->cfg.storage == RTP_JITTER_STORAGE_RING)
+		return ring_slot_get(self, self->ring.head);
+	return list_entry(list_first(&self->packets), struct rtp_pkt, node);
+}
+
+
+static struct rtp_pkt *store_next(struct rtp_jitter *self,
+				  struct rtp_pkt *pkt)
+{
+	struct list_node *node = NULL;
+	struct rtp_pkt *next = NULL;
+	uint16_t seqnum = pkt->header.seqnum;
+
+	if (self->cfg.storage != RTP_JITTER_STORAGE_RING) {
+		node = list_next(&self->packets, &pkt->node);
+		return node != NULL ? list_entry(node, struct rtp_pkt, node)
+				    : NULL;
+	}
+
+	while (seqnum != self->ring.tail) {
+		seqnum++;
+		next = ring_slot_get(self, seqnum);
+		if (next != NULL)
+			return next;
+	}
+	return NULL;
+}
+
+
+/* Is a evicted before b? */
+static int evict_before(const struct rtp_pkt *a, const struct rtp_pkt *b)
+{
+	uint64_t score_a = rtp_pkt_priv(a)->evict_score;
+	uint64_t score_b = rtp_pkt_priv(b)->evict_score;
+
+	if (score_a != score_b)
+		return score_a > score_b;
+	return rtp_diff_seqnum(a->header.seqnum, b->header.seqnum) < 0;
+}
+
+
+static void evict_heap_set(struct rtp_jitter *self,
+			   uint32_t index,
+			   struct rtp_pkt *pkt)
+{
+	self->evict_heap.pkts[index] = pkt;
+	rtp_pkt_priv(pkt)->evict_index = index;
+}
+
+
+static void evict_heap_sift(struct rtp_jitter *self, uint32_t index)
+{
+	struct rtp_pkt **pkts = self->evict_heap.pkts;
+	struct rtp_pkt *pkt = pkts[index];
+	uint32_t count = self->evict_heap.count;
+	uint32_t parent = 0, child = 0;
+
+	/* Up */
+	while (index > 0) {
+		parent = (index - 1) / 2;
+		if (!evict_before(pkt, pkts[parent]))
+			break;
+		evict_heap_set(self, index, pkts[parent]);
+		index = parent;
+	}
+
+	/* Down */
+	while ((child = 2 * index + 1) < count) {
+		if (child + 1 < count &&
+		    evict_before(pkts[child + 1], pkts[child]))
+			child++;
+		if (!evict_before(pkts[child], pkt))
+			break;
+		evict_heap_set(self, index, pkts[child]);
+		index = child;
+	}
+	evict_heap_set(self, index, pkt);
+}
+
+
+static int evict_heap_alloc(struct rtp_jitter *self, uint32_t size)
+{
+	struct rtp_pkt **pkts = NULL;
+
+	pkts = realloc(self->evict_heap.pkts, size * sizeof(*pkts));
+	if (pkts == NULL)
+		return -ENOMEM;
+	self->evict_heap.pkts = pkts;
+	self->evict_heap.size = size;
+	return 0;
+}
+
+
+static uint64_t get_evict_score(struct rtp_jitter *self,
+				const struct rtp_pkt *pkt)
+{
+	if (self->cbs.evict_score != NULL)
+		return (self->cbs.evict_score)(self, pkt, self->userdata);
+	return ((uint64_t)pkt->importance << 32) | pkt->priority;
+}
+
+
+/* The heap has room for all the queued packets (see evict_heap_reserve) */
+static void evict_heap_push(struct rtp_jitter *self, struct rtp_pkt *pkt)
+{
+	rtp_pkt_priv(pkt)->evict_score = get_evict_score(self, pkt);
+	evict_heap_set(self, self->evict_heap.count++, pkt);
+	evict_heap_sift(self, rtp_pkt_priv(pkt)->evict_index);
+}
+
+
+static void evict_heap_remove(struct rtp_jitter *self, struct rtp_pkt *pkt)
+{
+	uint32_t index = rtp_pkt_priv(pkt)->evict_index;
+	struct rtp_pkt *last = self->evict_heap.pkts[--self->evict_heap.count];
+
+	if (index == self->evict_heap.count)
+		return;
+	evict_heap_set(self, index, last);
+	evict_heap_sift(self, index);
+}
+
+
+/* Make room for one more packet in the heap */
+static int evict_heap_reserve(struct rtp_jitter *self)
+{
+	if (self->evict_heap.count < self->evict_heap.size)
+		return 0;
+	return evict_heap_alloc(self,
+				self->evict_heap.size != 0
+					? 2 * self->evict_heap.size
+					: EVICT_HEAP_INITIAL_SIZE);
+}
+
+
+static void store_remove(struct rtp_jitter *self, struct rtp_pkt *pkt)
+{
+	uint16_t seqnum = pkt->header.seqnum;
+
+	self->count--;
+	self->bytes -= pkt->raw.len;
+	if (self->evict_heap.active)
+		evict_heap_remove(self, pkt);
+	if (self->group != NULL)
+		rtp_jitter_group_account(self->group,
+					 self->group_entry,
+					 -1,
+					 -(int64_t)pkt->raw.len);
+	if (self->cfg.storage != RTP_JITTER_STORAGE_RING) {
+		list_del(&pkt->node);
+		return;
+	}
+
+	self->ring.pkts[seqnum & self->ring.mask] = NULL;
+	if (self->count == 0)
+		return;
+
+	/* Move head/tail to the next/previous queued packet */
+	if (seqnum == self->ring.head) {
+		do {
+			self->ring.head++;
+		} while (ring_slot_get(self, self->ring.head) == NULL);
+	} else if (seqnum == self->ring.tail) {
+		do {
+			self->ring.tail--;
+		} while (ring_slot_get(self, self->ring.tail) == NULL);
+	}
+}
+
+
+/* Returns -EEXIST for duplicates and -ENOSPC if the packet does not fit in
+ * the ring, in both cases the packet is not queued */
+static int store_insert(struct rtp_jitter *self, struct rtp_pkt *pkt)
+{
+	struct rtp_pkt *item = NULL;
+	uint16_t seqnum = pkt->header.seqnum;
+
+	if (self->cfg.storage != RTP_JITTER_STORAGE_RING) {
+		list_walk_entry_backward(&self->packets, item, node)
+		{
+			int16_t diff =
+				rtp_diff_seqnum(item->header.seqnum, seqnum);
+			if (diff > 0)
+				continue;
+
+			if (diff == 0) {
+				/* Duplicate packet */
+				return -EEXIST;
+			}
+
+			/* Add in the list in order */
+			list_add_after(&item->node, &pkt->node);
+			self->count++;
+			return 0;
+		}
+
+		/* Empty list or current packet to be added as first */
+		list_add_before(list_first(&self->packets), &pkt->node);
+		self->count++;
+		return 0;
+	}
+
+	if (self->count == 0) {
+		self->ring.head = seqnum;
+		self->ring.tail = seqnum;
+	} else if (rtp_diff_seqnum(seqnum, self->ring.tail) > 0) {
+		/* New last packet, drop the oldest ones if the span of the
+		 * ring is exceeded */
+		while (self->count > 0 &&
+		       (uint16_t)(seqnum - self->ring.head) > self->ring.mask) {
+			item = ring_slot_get(self, self->ring.head);
+			ULOGW("ring overflow: drop packet %u (new %u)",
+			      item->header.seqnum,
+			      seqnum);
+			self->stats.overflow++;
+			store_remove(self, item);
+			rtp_pkt_destroy(item);
+		}
+		if (self->count == 0)
+			self->ring.head = seqnum;
+		self->ring.tail = seqnum;
+	} else if (rtp_diff_seqnum(seqnum, self->ring.head) < 0) {
+		/* New first packet */
+		if ((uint16_t)(self->ring.tail - seqnum) > self->ring.mask)
+			return -ENOSPC;
+		self->ring.head = seqnum;
+	} else if (ring_slot_get(self, seqnum) != NULL) {
+		/* Duplicate packet */
+		return -EEXIST;
+	}
+
+	self->ring.pkts[seqnum & self->ring.mask] = pkt;
+	self->count++;
+	return 0;
+}
+
+
+/* Evict the queued packet with the highest score, the oldest one among
+ * equal scores */
+static int evict(struct rtp_jitter *self, size_t *bytes)
+{
+	struct rtp_pkt *victim = NULL;
+
+	if (!self->evict_heap.active || self->evict_heap.count == 0)
+		return -ENOENT;
+	victim = self->evict_heap.pkts[0];
+
+	ULOGD("budget exceeded: evict packet %u (%zu packets, %zu bytes)",
+	      victim->header.seqnum,
+	      (size_t)self->count,
+	      self->bytes);
+	*bytes = victim->raw.len;
+	self->stats.evicted_pkts++;
+	self->stats.evicted_bytes += victim->raw.len;
+	store_remove(self, victim);
+	rtp_pkt_destroy(victim);
+	return 0;
+}
+
+
+/* Queue an enqueued packet (consumer side) */
+static void store_pkt(struct rtp_jitter *self, struct rtp_pkt *pkt)
+{
+	int res = 0;
+	size_t bytes = 0;
+	int16_t depth = 0;
+
+	if (!self->highest_valid) {
+		self->highest_seqnum = pkt->header.seqnum;
+		self->highest_valid = 1;
+	} else {
+		depth = rtp_diff_seqnum(self->highest_seqnum,
+					pkt->header.seqnum);
+		if (depth < 0) {
+			self->highest_seqnum = pkt->header.seqnum;
+		} else if (depth > 0) {
+			self->stats.reordered++;
+			if ((uint32_t)depth > self->stats.reorder_max_depth)
+				self->stats.reorder_max_depth = depth;
+		}
+	}
+
+	if (rtp_diff_seqnum(self->next_seqnum, pkt->header.seqnum) > 0) {
+		/* Old packet or duplicate of a packet that has already
+		 * been processed */
+		self->stats.late++;
+		rtp_pkt_destroy(pkt);
+		return;
+	}
+
+	if (self->evict_heap.active) {
+		res = evict_heap_reserve(self);
+		if (res < 0) {
+			ULOG_ERRNO("evict_heap_reserve", -res);
+			rtp_pkt_destroy(pkt);
+			return;
+		}
+	}
+
+	res = store_insert(self, pkt);
+	if (res < 0) {
+		/* Duplicate packet, or too old to fit in the ring */
+		if (res == -ENOSPC) {
+			ULOGW("ring overflow: drop packet %u",
+			      pkt->header.seqnum);
+			self->stats.overflow++;
+		} else {
+			self->stats.duplicates++;
+		}
+		rtp_pkt_destroy(pkt);
+		return;
+	}
+
+	self->bytes += pkt->raw.len;
+	if (self->evict_heap.active)
+		evict_heap_push(self, pkt);
+	if (self->group != NULL) {
+		rtp_jitter_group_account(
+			self->group, self->group_entry, 1, pkt->raw.len);
+	}
+
+	/* The new packet may be evicted itself */
+	while ((self->cfg.max_pkts != 0 && self->count > self->cfg.max_pkts) ||
+	       (self->cfg.max_bytes != 0 && self->bytes > self->cfg.max_bytes))
+		evict(self, &bytes);
+	if (self->group != NULL)
+		rtp_jitter_group_enforce(self->group);
+}
+
+
+/* Producer side: the consumer can only make room, a ring that is not full
+ * stays so until the next push */
+static int ingress_is_full(struct rtp_jitter *self)
+{
+	uint32_t tail = __atomic_load_n(&self->ingress.tail, __ATOMIC_RELAXED);
+	uint32_t head = __atomic_load_n(&self->ingress.head, __ATOMIC_ACQUIRE);
+
+	return tail - head > self->ingress.mask;
+}
+
+
+/* Producer side, the ring must not be full; the packet is published by the
+ * release store of tail */
+static void ingress_push(struct rtp_jitter *self, struct rtp_pkt *pkt)
+{
+	uint32_t tail = __atomic_load_n(&self->ingress.tail, __ATOMIC_RELAXED);
+
+	self->ingress.pkts[tail & self->ingress.mask] = pkt;
+	__atomic_store_n(&self->ingress.tail, tail + 1, __ATOMIC_RELEASE);
+
+	/* Wake up the consumer unless a wake up is already pending; the
+	 * consumer clears the flag before draining the ring */
+	if (self->evt != NULL &&
+	    __atomic_exchange_n(&self->ingress.signaled, 1, __ATOMIC_SEQ_CST) ==
+		    0)
+		pomp_evt_signal(self->evt);
+}
+
+
+/* Consumer side: queue (or destroy if discard is set) all the packets
+ * published by the producer */
+static void ingress_drain(struct rtp_jitter *self, int discard)
+{
+	uint32_t head = __atomic_load_n(&self->ingress.head, __ATOMIC_RELAXED);
+	uint32_t tail = __atomic_load_n(&self->ingress.tail, __ATOMIC_ACQUIRE);
+	struct rtp_pkt *pkt = NULL;
+
+	if (head == tail)
+		return;
+
+	for (; head != tail; head++) {
+		pkt = self->ingress.pkts[head & self->ingress.mask];
+		if (discard)
+			rtp_pkt_destroy(pkt);
+		else
+			store_pkt(self, pkt);
+	}
+	__atomic_store_n(&self->ingress.head, head, __ATOMIC_RELEASE);
+}
+
+
+/* Make the estimations of the producer visible to rtp_jitter_get_info()
+ * and rtp_jitter_get_stats() */
+static void publish_estimation(struct rtp_jitter *self)
+{
+	__atomic_store_n(
+		&self->pub.jitter_avg, self->jitter_avg, __ATOMIC_RELAXED);
+	__atomic_store_n(&self->pub.skew_avg, self->skew_avg, __ATOMIC_RELAXED);
+	__atomic_store_n(
+		&self->pub.skew_drift, self->est.drift, __ATOMIC_RELAXED);
+}
+
+
 static void reset_skew(struct rtp_jitter *self,
 		       uint64_t rx_timestamp,
 		       uint64_t rtp_timestamp)
 {
+	/* Not a restart on the first packet */
+	if (self->first_rx_timestamp != 0 && self->first_rtp_timestamp != 0)
+		PUB_INC(self->pub.skew_resets);
 	self->first_rx_timestamp = rx_timestamp;
 	self->first_rtp_timestamp = rtp_timestamp;
+	self->window_base = 0;
 	self->window_pos = 0;
 	self->window_size = 0;
 	self->window_start_timestamp = 0;
 	self->window_min = 0;
+	self->window_deque_start = 0;
+	self->window_deque_count = 0;
+	memset(&self->est, 0, sizeof(self->est));
+	self->skew_avg = 0;
+}
+
+
+/* Reset the skew and jitter estimation */
+static void reset_estimation(struct rtp_jitter *self)
+{
+	self->first_rx_timestamp = 0;
+	self->first_rtp_timestamp = 0;
+	self->last_rx_timestamp = 0;
+	self->last_rtp_timestamp = 0;
+	self->window_size = 0;
+	self->window_start_timestamp = 0;
 	self->skew_avg = 0;
+	self->jitter_avg = 0;
+	self->delay_update_timestamp = 0;
+	publish_estimation(self);
+}
+
+
+static int64_t window_get(struct rtp_jitter *self, uint32_t pos)
+{
+	if (self->cfg.skew_compact)
+		return self->window_base + self->window.v32[pos];
+	return self->window.v64[pos];
+}
+
+
+static void window_set(struct rtp_jitter *self, uint32_t pos, int64_t skew)
+{
+	int64_t delta = 0;
+
+	if (!self->cfg.skew_compact) {
+		self->window.v64[pos] = skew;
+		return;
+	}
+
+	delta = skew - self->window_base;
+	if (delta < -SKEW_COMPACT_RANGE || delta > SKEW_COMPACT_RANGE) {
+		/* Rebase all samples around the new value; samples in the
+		 * window are within SKEW_LARGE_GAP of each other so they
+		 * do not overflow */
+		for (uint32_t i = 0; i < self->cfg.skew_window_size; i++) {
+			int64_t v = self->window_base + self->window.v32[i];
+			v -= skew;
+			if (v < INT32_MIN)
+				v = INT32_MIN;
+			else if (v > INT32_MAX)
+				v = INT32_MAX;
+			self->window.v32[i] = v;
+		}
+		self->window_base = skew;
+		delta = 0;
+	}
+	self->window.v32[pos] = delta;
+}
+
+
+/**
+ * Store a new value in the window at the current position and update the
+ * minimum in O(1) amortized: the oldest value leaves the deque if it was a
+ * candidate, then all candidates larger than the new value are dropped as
+ * they can not be the minimum anymore.
+ */
+static void window_push(struct rtp_jitter *self, int64_t skew)
+{
+	uint32_t size = self->cfg.skew_window_size;
+	uint32_t pos = self->window_pos;
+	uint32_t back = 0;
+
+	if (self->window_deque_count > 0 &&
+	    self->window_deque[self->window_deque_start] == pos) {
+		self->window_deque_start = (self->window_deque_start + 1) % size;
+		self->window_deque_count--;
+	}
+
+	window_set(self, pos, skew);
+
+	while (self->window_deque_count > 0) {
+		back = (self->window_deque_start + self->window_deque_count -
+			1) % size;
+		if (window_get(self, self->window_deque[back]) <= skew)
+			break;
+		self->window_deque_count--;
+	}
+
+	back = (self->window_deque_start + self->window_deque_count) % size;
+	self->window_deque[back] = pos;
+	self->window_deque_count++;
+
+	self->window_min =
+		window_get(self, self->window_deque[self->window_deque_start]);
+}
+
+
+static uint32_t hist_get_index(uint64_t value)
+{
+	uint32_t msb = 0;
+	uint32_t index = 0;
+
+	if (value < (1 << HIST_SUB_BITS))
+		return value;
+
+	msb = 63 - __builtin_clzll(value);
+	index = ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+		((value >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+	return index < HIST_SIZE ? index : HIST_SIZE - 1;
+}
+
+
+/* Upper bound of the values counted in a bucket */
+static uint64_t hist_get_value(uint32_t index)
+{
+	uint32_t msb = 0;
+	uint64_t sub = 0;
+
+	if (index < (1 << HIST_SUB_BITS))
+		return index;
+
+	msb = (index >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+	sub = index & ((1 << HIST_SUB_BITS) - 1);
+	return ((((uint64_t)1 << HIST_SUB_BITS) + sub + 1)
+		<< (msb - HIST_SUB_BITS)) -
+	       1;
+}
+
+
+static uint64_t hist_get_percentile(struct rtp_jitter *self,
+				    uint32_t percentile)
+{
+	uint64_t target = ((uint64_t)self->hist_total * percentile + 99) / 100;
+	uint64_t count = 0;
+
+	for (uint32_t i = 0; i < HIST_SIZE; i++) {
+		count += self->hist[i];
+		if (count >= target)
+			return hist_get_value(i);
+	}
+	return hist_get_value(HIST_SIZE - 1);
+}
+
+
+/* Account the transit variation of a packet and periodically move the
+ * delay towards the target percentile */
+static void update_delay(struct rtp_jitter *self,
+			 uint64_t rx_timestamp,
+			 uint64_t out_timestamp)
+{
+	uint64_t target = 0;
+	uint32_t delay = self->delay;
+	uint32_t diff = 0;
+
+	self->hist[hist_get_index(rx_timestamp > out_timestamp
+					  ? rx_timestamp - out_timestamp
+					  : 0)]++;
+	self->hist_total++;
+
+	if (self->delay_update_timestamp == 0)
+		self->delay_update_timestamp = rx_timestamp;
+	if (rx_timestamp < self->delay_update_timestamp + DELAY_UPDATE_PERIOD)
+		return;
+	self->delay_update_timestamp = rx_timestamp;
+
+	target = hist_get_percentile(self, self->cfg.delay_percentile) +
+		 self->cfg.delay_margin;
+	if (target < self->cfg.delay_min)
+		target = self->cfg.delay_min;
+	else if (target > self->cfg.delay)
+		target = self->cfg.delay;
+
+	/* Hysteresis and bounded slew */
+	diff = target > delay ? target - delay : delay - target;
+	if (diff > self->cfg.delay_hysteresis) {
+		if (diff > self->cfg.delay_slew)
+			diff = self->cfg.delay_slew;
+		delay = target > delay ? delay + diff : delay - diff;
+		ULOGD("delay: %u -> %u (target %" PRIu64 ")",
+		      self->delay,
+		      delay,
+		      target);
+		__atomic_store_n(&self->delay, delay, __ATOMIC_RELAXED);
+	}
+
+	/* Forget the past progressively */
+	self->hist_total = 0;
+	for (uint32_t i = 0; i < HIST_SIZE; i++) {
+		self->hist[i] /= 2;
+		self->hist_total += self->hist[i];
+	}
+}
+
+
+static uint32_t get_delay(struct rtp_jitter *self)
+{
+	return __atomic_load_n(&self->delay, __ATOMIC_RELAXED);
 }
 
 
@@ -94,7 +1070,6 @@ static void compute_jitter(struct rtp_jitter *self,
 			   uint64_t rx_timestamp,
 			   uint64_t rtp_timestamp)
 {
-	uint32_t clk_rate = self->cfg.clk_rate;
 	int64_t delta_rx = 0;
 	int64_t delta_rtp = 0;
 	int64_t jitter = 0;
@@ -103,14 +1078,219 @@ static void compute_jitter(struct rtp_jitter *self,
 	delta_rx = rx_timestamp - self->last_rx_timestamp;
 	delta_rtp = rtp_timestamp - self->last_rtp_timestamp;
 	if (delta_rtp > 0)
-		delta_rtp = rtp_timestamp_to_us(delta_rtp, clk_rate);
+		delta_rtp = rtp_clk_to_us(&self->clk, delta_rtp);
 	else
-		delta_rtp = -rtp_timestamp_to_us(-delta_rtp, clk_rate);
+		delta_rtp = -rtp_clk_to_us(&self->clk, -delta_rtp);
 
 	jitter = delta_rx - delta_rtp;
 	if (jitter < 0)
 		jitter = -jitter;
-	self->jitter_avg += (jitter - self->jitter_avg) / JITTER_AVG_ALPHA;
+	self->jitter_avg +=
+		(jitter - self->jitter_avg) / (int64_t)self->cfg.jitter_avg_alpha;
+}
+
+
+/* Skew over a sliding window: minimum of the last samples, smoothed on each
+ * packet; returns -EINVAL if the window start is after the current
+ * sample */
+static int update_skew_sliding(struct rtp_jitter *self,
+			       uint64_t rx_timestamp,
+			       int64_t skew)
+{
+	uint32_t window_size = self->cfg.skew_window_size;
+	uint32_t window_timeout = self->cfg.skew_window_timeout;
+
+	/* Are we at initialization stage? */
+	if (self->window_size == 0) {
+		/* Save value */
+		if (self->window_pos == 0) {
+			/* First value in window */
+			self->window_start_timestamp = rx_timestamp;
+		}
+		window_push(self, skew);
+
+		/* Are we done? */
+		self->window_pos++;
+		if (self->window_pos >= window_size ||
+		    rx_timestamp >=
+			    self->window_start_timestamp + window_timeout) {
+			self->window_size = self->window_pos;
+			self->window_pos = 0;
+			self->skew_avg = self->window_min;
+		} else if (rx_timestamp >= self->window_start_timestamp) {
+			uint32_t perc_time =
+				(rx_timestamp - self->window_start_timestamp) *
+				100 / window_timeout;
+			uint32_t perc_window =
+				(uint64_t)self->window_pos * 100 / window_size;
+			uint32_t perc = perc_time > perc_window ? perc_time
+								: perc_window;
+			/* Parabolic function */
+			perc = perc * perc;
+			self->skew_avg += perc *
+					  (self->window_min - self->skew_avg) /
+					  10000;
+		} else {
+			return -EINVAL;
+		}
+	} else {
+		/* Replace the oldest value by the new one */
+		window_push(self, skew);
+
+		/* Update position and wrap if needed */
+		self->window_pos++;
+		if (self->window_pos >= self->window_size)
+			self->window_pos = 0;
+
+		/* Sliding average */
+		self->skew_avg += (self->window_min - self->skew_avg) /
+				  (int64_t)self->cfg.skew_avg_alpha;
+	}
+
+	return 0;
+}
+
+
+/* Skew over blocks: minimum of consecutive blocks of samples, smoothed at
+ * the end of each block */
+static int update_skew_block(struct rtp_jitter *self,
+			     uint64_t rx_timestamp,
+			     int64_t skew)
+{
+	uint32_t window_size = self->cfg.skew_window_size;
+
+	/* Fill the window */
+	if (self->window_size == 0)
+		self->window_start_timestamp = rx_timestamp;
+	window_set(self, self->window_size, skew);
+	self->window_size++;
+
+	if ((self->window_size >= window_size) ||
+	    (self->window_size >= window_size / 2 &&
+	     rx_timestamp >= self->window_start_timestamp +
+				     self->cfg.skew_window_timeout)) {
+		/* Window is full or half-full and on timeout */
+		self->window_min = window_get(self, 0);
+		for (uint32_t i = 1; i < self->window_size; i++) {
+			int64_t v = window_get(self, i);
+			if (v < self->window_min)
+				self->window_min = v;
+		}
+
+		/* Sliding average */
+		self->skew_avg += (self->window_min - self->skew_avg) /
+				  (int64_t)self->cfg.skew_avg_alpha;
+
+		/* Reset the window */
+		self->window_size = 0;
+	}
+
+	return 0;
+}
+
+
+/* Add a point of the lower envelope to the fit, after moving the time
+ * origin to it and forgetting the past by 1/skew_avg_alpha */
+static void regression_add_point(struct rtp_jitter *self,
+				 uint64_t timestamp,
+				 int64_t skew)
+{
+	double lambda = 1.0 - 1.0 / self->cfg.skew_avg_alpha;
+	double d = ((int64_t)(timestamp - self->est.origin)) / 1000000.0;
+
+	self->est.sum_ts -= d * self->est.sum_s;
+	self->est.sum_tt -= 2 * d * self->est.sum_t - d * d * self->est.sum_w;
+	self->est.sum_t -= d * self->est.sum_w;
+	self->est.origin = timestamp;
+
+	self->est.sum_w = lambda * self->est.sum_w + 1;
+	self->est.sum_t = lambda * self->est.sum_t;
+	self->est.sum_s = lambda * self->est.sum_s + skew;
+	self->est.sum_tt = lambda * self->est.sum_tt;
+	self->est.sum_ts = lambda * self->est.sum_ts;
+	self->est.points++;
+}
+
+
+/* Skew by linear regression: the minima of the blocks of samples are
+ * fitted by a line whose slope is the clock drift, the skew is the line
+ * extrapolated at the current sample; until two blocks are complete, it is
+ * the minimum of the samples. Returns -EINVAL if the current sample is
+ * before the first one */
+static int update_skew_regression(struct rtp_jitter *self,
+				  uint64_t rx_timestamp,
+				  int64_t skew)
+{
+	double det = 0, slope = 0, offset = 0, t = 0;
+
+	if (rx_timestamp < self->first_rx_timestamp)
+		return -EINVAL;
+
+	/* Minimum of the current block */
+	if (self->window_size == 0) {
+		self->window_start_timestamp = rx_timestamp;
+		self->est.block_min = skew;
+		self->est.block_min_timestamp = rx_timestamp;
+	} else if (skew < self->est.block_min) {
+		self->est.block_min = skew;
+		self->est.block_min_timestamp = rx_timestamp;
+	}
+	self->window_size++;
+
+	if (self->window_size >= self->cfg.skew_window_size ||
+	    rx_timestamp >= self->window_start_timestamp +
+				    self->cfg.skew_window_timeout) {
+		regression_add_point(self,
+				     self->est.block_min_timestamp,
+				     self->est.block_min);
+		self->window_size = 0;
+	}
+
+	if (self->est.points < 2) {
+		if (skew < self->skew_avg)
+			self->skew_avg = skew;
+		return 0;
+	}
+
+	det = self->est.sum_w * self->est.sum_tt -
+	      self->est.sum_t * self->est.sum_t;
+	if (det > 1e-9) {
+		slope = (self->est.sum_w * self->est.sum_ts -
+			 self->est.sum_t * self->est.sum_s) /
+			det;
+	}
+	if (slope > SKEW_REGRESSION_MAX_DRIFT)
+		slope = SKEW_REGRESSION_MAX_DRIFT;
+	else if (slope < -SKEW_REGRESSION_MAX_DRIFT)
+		slope = -SKEW_REGRESSION_MAX_DRIFT;
+	offset = (self->est.sum_s - slope * self->est.sum_t) / self->est.sum_w;
+
+	/* The slope is in us per s, i.e. ppm */
+	t = ((int64_t)(rx_timestamp - self->est.origin)) / 1000000.0;
+	offset += slope * t;
+	self->skew_avg = offset < 0 ? offset - 0.5 : offset + 0.5;
+	self->est.drift = slope < 0 ? slope - 0.5 : slope + 0.5;
+
+	return 0;
+}
+
+
+/* Skew by asymmetric exponential average: it falls quickly on lower
+ * samples and rises slowly (by 1/skew_avg_alpha) on higher ones, tracking
+ * a low quantile of the samples without storing them */
+static int update_skew_ewma(struct rtp_jitter *self,
+			    uint64_t rx_timestamp,
+			    int64_t skew)
+{
+	int64_t diff = skew * (1 << SKEW_EWMA_FRAC_BITS) - self->est.ewma;
+
+	if (diff < 0)
+		self->est.ewma += diff / SKEW_EWMA_FALL_ALPHA;
+	else
+		self->est.ewma += diff / (int64_t)self->cfg.skew_avg_alpha;
+	self->skew_avg = self->est.ewma / (1 << SKEW_EWMA_FRAC_BITS);
+
+	return 0;
 }
 
 
@@ -118,159 +1298,442 @@ static uint64_t compute_skew(struct rtp_jitter *self,
 			     uint64_t rx_timestamp,
 			     uint64_t rtp_timestamp)
 {
-	uint32_t clk_rate = self->cfg.clk_rate;
 	int64_t delta_recv = 0;
 	int64_t delta_send = 0;
 	int64_t skew = 0;
 	uint64_t out_timestamp = 0;
 
-	/* Compute delta in us */
-	delta_send = rtp_timestamp - self->first_rtp_timestamp;
-	if (delta_send < 0) {
-		/* The sender probably restarted */
-		delta_send = -rtp_timestamp_to_us(-delta_send, clk_rate);
-		ULOGD("reset skew: delta_send(%.6f) < 0",
-		      delta_send / 1000000.0);
-		reset_skew(self, rx_timestamp, rtp_timestamp);
-		delta_send = 0;
-	} else {
-		delta_send = rtp_timestamp_to_us(delta_send, clk_rate);
-	}
-	delta_recv = rx_timestamp - self->first_rx_timestamp;
+	/* Compute delta in us */
+	delta_send = rtp_timestamp - self->first_rtp_timestamp;
+	if (delta_send < 0) {
+		/* The sender probably restarted */
+		delta_send = -rtp_clk_to_us(&self->clk, -delta_send);
+		ULOGD("reset skew: delta_send(%.6f) < 0",
+		      delta_send / 1000000.0);
+		reset_skew(self, rx_timestamp, rtp_timestamp);
+		delta_send = 0;
+	} else {
+		delta_send = rtp_clk_to_us(&self->clk, delta_send);
+	}
+	delta_recv = rx_timestamp - self->first_rx_timestamp;
+
+	/* Current skew */
+	skew = delta_recv - delta_send;
+
+	/* Check for large gaps */
+	if (skew - self->skew_avg < -SKEW_LARGE_GAP ||
+	    skew - self->skew_avg > SKEW_LARGE_GAP) {
+		ULOGD("reset skew: skew(%.6f) - skew_avg(%.6f) too large",
+		      skew / 1000000.0,
+		      self->skew_avg / 1000000.0);
+		reset_skew(self, rx_timestamp, rtp_timestamp);
+		delta_send = 0;
+		delta_recv = 0;
+		skew = 0;
+	}
+
+	if ((skew_estimators[self->cfg.skew_mode].update)(
+		    self, rx_timestamp, skew) < 0) {
+		/* Might be different links */
+		ULOGD("reset skew: rx_timestamp before window start");
+		reset_skew(self, rx_timestamp, rtp_timestamp);
+		out_timestamp = rx_timestamp;
+		goto out;
+	}
+
+	/* Estimated out timestamp */
+	out_timestamp = self->first_rx_timestamp + delta_send + self->skew_avg;
+
+	/* Make sure we don't go backwards; compare against the configured
+	 * delay (the upper bound of the adapted one): the adapted delay only
+	 * covers most of the transit distribution, resetting on its tail
+	 * would feed zero transit back into the adaptation */
+	if (out_timestamp + self->cfg.delay < rx_timestamp) {
+		ULOGD("reset skew: out(%.6f) + delay(%.6f) < in(%.6f)",
+		      out_timestamp / 1000000.0,
+		      self->cfg.delay / 1000000.0,
+		      rx_timestamp / 1000000.0);
+		reset_skew(self, rx_timestamp, rtp_timestamp);
+		out_timestamp = rx_timestamp;
+	}
+
+out:
+	return out_timestamp;
+}
+
+
+static int batch_alloc(struct rtp_jitter *self, size_t size)
+{
+	struct rtp_pkt **pkts = NULL;
+	uint32_t *gaps = NULL;
+
+	pkts = realloc(self->batch.pkts, size * sizeof(*pkts));
+	if (pkts == NULL)
+		return -ENOMEM;
+	self->batch.pkts = pkts;
+	gaps = realloc(self->batch.gaps, size * sizeof(*gaps));
+	if (gaps == NULL)
+		return -ENOMEM;
+	self->batch.gaps = gaps;
+	self->batch.size = size;
+	return 0;
+}
+
+
+static void batch_flush(struct rtp_jitter *self)
+{
+	size_t count = self->batch.count;
+
+	if (count == 0)
+		return;
+
+	if (self->cfg.release_mode == RTP_JITTER_RELEASE_MODE_FRAME) {
+		(self->cbs.process_frame)(self,
+					  self->batch.pkts,
+					  self->batch.gaps,
+					  count,
+					  self->batch.frame_flags,
+					  self->userdata);
+	} else {
+		(self->cbs.process_pkts)(self,
+					 self->batch.pkts,
+					 self->batch.gaps,
+					 count,
+					 self->userdata);
+	}
+
+	/* Destroy the packets not taken by the callback */
+	for (size_t i = 0; i < count; i++)
+		rtp_pkt_destroy(self->batch.pkts[i]);
+	self->batch.count = 0;
+}
+
+
+static void batch_add(struct rtp_jitter *self, struct rtp_pkt *pkt, uint32_t gap)
+{
+	if (self->batch.count == self->batch.size &&
+	    batch_alloc(self, 2 * self->batch.size) < 0) {
+		/* Deliver the current batch to make room; a frame is then
+		 * split */
+		if (self->cfg.release_mode == RTP_JITTER_RELEASE_MODE_FRAME)
+			self->batch.frame_flags |= RTP_JITTER_FRAME_FLAG_INCOMPLETE;
+		batch_flush(self);
+	}
+
+	self->batch.pkts[self->batch.count] = pkt;
+	self->batch.gaps[self->batch.count] = gap;
+	self->batch.count++;
+}
+
+
+static void set_released(struct rtp_jitter *self, struct rtp_pkt *pkt)
+{
+	self->next_seqnum = (pkt->header.seqnum + 1) & 0xffff;
+	self->last_out_timestamp = pkt->out_timestamp;
+	self->last_released_rtp_timestamp = pkt->rtp_timestamp;
+	self->last_released = 1;
+}
+
+
+/* Live mode: a packet is late if it is stale (older than max_latency) or
+ * before the point where the timing was restarted; late packets are
+ * dropped from the head of the queue up to the next frame that is not
+ * late, except the important ones which are released immediately */
+static enum skip_action
+skip_head(struct rtp_jitter *self, struct rtp_pkt *pkt, uint64_t cur_timestamp)
+{
+	int late = 0;
+	int frame_start = 0;
+
+	if (self->cfg.max_latency == 0)
+		return SKIP_ACTION_NONE;
+
+	if (self->cut_pending) {
+		if (rtp_diff_seqnum(pkt->header.seqnum, self->cut_seqnum) < 0)
+			late = 1;
+		else
+			self->cut_pending = 0;
+	}
+	if (cur_timestamp > pkt->out_timestamp + self->cfg.max_latency)
+		late = 1;
+
+	if (!self->skipping) {
+		if (!late)
+			return SKIP_ACTION_NONE;
+		ULOGD("skip: from packet %u", pkt->header.seqnum);
+		self->skipping = 1;
+	}
+
+	/* Resume at the first frame that is not late */
+	frame_start = !self->last_released ||
+		      pkt->rtp_timestamp != self->last_released_rtp_timestamp;
+	if (!late && frame_start) {
+		self->skipping = 0;
+		return SKIP_ACTION_NONE;
+	}
+
+	if (pkt->importance < self->cfg.skip_keep_importance)
+		return SKIP_ACTION_KEEP;
+
+	set_released(self, pkt);
+	store_remove(self, pkt);
+	rtp_pkt_destroy(pkt);
+	self->skip_count++;
+	self->stats.skipped++;
+	return SKIP_ACTION_DROP;
+}
+
+
+/* Live mode (producer side): if the packet would be released more than
+ * max_latency after its arrival, the out timestamps lag behind (e.g. after
+ * a burst following a stall); restart the timing from it if it starts a
+ * new frame and let the consumer drop the packets before it */
+static void check_latency(struct rtp_jitter *self, struct rtp_pkt *pkt)
+{
+	uint32_t cut = 0;
+
+	if (pkt->out_timestamp + get_delay(self) <=
+	    pkt->in_timestamp + self->cfg.max_latency)
+		return;
+	if (pkt->rtp_timestamp == self->last_rtp_timestamp)
+		return;
+
+	ULOGD("skip: restart timing at packet %u (%.3f ms late)",
+	      pkt->header.seqnum,
+	      (pkt->out_timestamp - pkt->in_timestamp) / 1000.0);
+	reset_skew(self, pkt->in_timestamp, pkt->rtp_timestamp);
+	pkt->out_timestamp = pkt->in_timestamp;
+
+	/* Published before the packet itself, after the previous ones */
+	cut = __atomic_load_n(&self->cut, __ATOMIC_RELAXED);
+	cut = ((cut >> 16) + 1) << 16 | pkt->header.seqnum;
+	__atomic_store_n(&self->cut, cut, __ATOMIC_RELEASE);
+}
+
+
+/* Expected arrival of the first packet missing after the consecutive
+ * packets starting at the head frame, interpolated between the out
+ * timestamps of the queued packets around it; 0 if the frame is complete or
+ * if no later packet is queued */
+static uint64_t get_frame_hole_timestamp(struct rtp_jitter *self,
+					 struct rtp_pkt *pkt)
+{
+	struct rtp_pkt *next = NULL;
+	uint16_t span = 0;
+
+	while (!RTP_PKT_HEADER_FLAGS_GET(pkt->header.flags, MARKER)) {
+		next = store_next(self, pkt);
+		if (next == NULL)
+			return 0;
+		span = next->header.seqnum - pkt->header.seqnum;
+		if (span > 1)
+			break;
+		pkt = next;
+	}
+	if (next == NULL || span <= 1)
+		return 0;
+
+	if (next->out_timestamp > pkt->out_timestamp) {
+		return pkt->out_timestamp +
+		       (next->out_timestamp - pkt->out_timestamp) / span;
+	}
+	return pkt->out_timestamp;
+}
+
+
+/* Time from which the first queued packet can be released if it is not the
+ * next expected one (or, in frame release mode, if its frame is
+ * incomplete): its own deadline, or the time at which the packets missing
+ * before it (or inside its frame) are declared lost if earlier. The
+ * expected arrival of the last missing packet is interpolated between the
+ * out timestamps of the last released packet and of this one */
+static uint64_t get_head_deadline(struct rtp_jitter *self, struct rtp_pkt *pkt)
+{
+	uint64_t deadline = pkt->out_timestamp + get_delay(self);
+	uint64_t lost = 0;
+	uint16_t span = 0;
+
+	if (self->cfg.reorder_tolerance == 0)
+		return deadline;
+
+	if (self->last_released)
+		span = pkt->header.seqnum - self->next_seqnum + 1;
+	if (span <= 1) {
+		if (self->cfg.release_mode != RTP_JITTER_RELEASE_MODE_FRAME)
+			return deadline;
+		lost = get_frame_hole_timestamp(self, pkt);
+		if (lost == 0)
+			return deadline;
+		lost += self->cfg.reorder_tolerance;
+		return lost < deadline ? lost : deadline;
+	}
+
+	if (pkt->out_timestamp > self->last_out_timestamp) {
+		lost = self->last_out_timestamp +
+		       (pkt->out_timestamp - self->last_out_timestamp) *
+			       (span - 1) / span;
+	} else {
+		lost = pkt->out_timestamp;
+	}
+	lost += self->cfg.reorder_tolerance;
+
+	return lost < deadline ? lost : deadline;
+}
+
+
+/* A frame is complete if its first packet is the next expected one and all
+ * its packets up to the one with the marker bit are queued */
+static int frame_is_complete(struct rtp_jitter *self, struct rtp_pkt *first)
+{
+	struct rtp_pkt *pkt = first;
+	struct rtp_pkt *next = NULL;
+
+	if (first->header.seqnum != self->next_seqnum)
+		return 0;
+
+	while (!RTP_PKT_HEADER_FLAGS_GET(pkt->header.flags, MARKER)) {
+		next = store_next(self, pkt);
+		if (next == NULL ||
+		    next->header.seqnum != ((pkt->header.seqnum + 1) & 0xffff) ||
+		    next->rtp_timestamp != first->rtp_timestamp)
+			return 0;
+		pkt = next;
+	}
+
+	return 1;
+}
+
+
+/* Release the frame starting with the first queued packet: up to the marker
+ * bit if complete, all the queued packets with the same RTP timestamp
+ * otherwise */
+static void frame_release(struct rtp_jitter *self,
+			  struct rtp_pkt *first,
+			  int complete)
+{
+	struct rtp_pkt *pkt = first;
+	struct rtp_pkt *next = NULL;
+	uint64_t rtp_timestamp = first->rtp_timestamp;
+	uint32_t gap = 0;
+	int end = 0;
+
+	self->batch.frame_flags = complete ? 0 : RTP_JITTER_FRAME_FLAG_INCOMPLETE;
+
+	do {
+		next = store_next(self, pkt);
+		end = complete ? RTP_PKT_HEADER_FLAGS_GET(pkt->header.flags,
+							  MARKER)
+			       : (next == NULL ||
+				  next->rtp_timestamp != rtp_timestamp);
+		/* Packets missing before the frame or within it */
+		gap = rtp_diff_seqnum(pkt->header.seqnum, self->next_seqnum);
+		self->stats.lost += gap;
+		set_released(self, pkt);
+		store_remove(self, pkt);
+		batch_add(self, pkt, gap);
+		self->stats.released++;
+		pkt = next;
+	} while (!end);
+
+	batch_flush(self);
+}
+
+
+static void idle_cb(void *userdata);
 
-	/* Current skew */
-	skew = delta_recv - delta_send;
 
-	/* Check for large gaps */
-	if (skew - self->skew_avg < -SKEW_LARGE_GAP ||
-	    skew - self->skew_avg > SKEW_LARGE_GAP) {
-		ULOGD("reset skew: skew(%.6f) - skew_avg(%.6f) too large",
-		      skew / 1000000.0,
-		      self->skew_avg / 1000000.0);
-		reset_skew(self, rx_timestamp, rtp_timestamp);
-		delta_send = 0;
-		delta_recv = 0;
-		skew = 0;
-	}
+/* Arm the timer for the next deadline, or schedule an immediate process if
+ * a packet is already due; members of a group let the group do it */
+static void loop_schedule(struct rtp_jitter *self)
+{
+	int res = 0;
+	uint64_t deadline = 0, now = 0;
+	struct timespec ts = {0, 0};
 
-#ifdef SKEW_WINDOW_SLIDING
-	/* Are we at initialization stage? */
-	if (self->window_size == 0) {
-		/* Save value */
-		self->window[self->window_pos] = skew;
-		if (self->window_pos == 0) {
-			/* First value in window */
-			self->window_start_timestamp = rx_timestamp;
-			self->window_min = skew;
-		} else if (skew < self->window_min) {
-			/* New minimum found */
-			self->window_min = skew;
+	if (self->group != NULL) {
+		rtp_jitter_group_update(self->group, self->group_entry);
+		return;
+	}
+	if (self->loop == NULL)
+		return;
+
+	res = rtp_jitter_get_next_deadline(self, &deadline);
+	if (res < 0) {
+		/* Nothing queued */
+		if (self->armed_deadline != 0) {
+			pomp_timer_clear(self->timer);
+			self->armed_deadline = 0;
 		}
-
-		/* Are we done? */
-		self->window_pos++;
-		if (self->window_pos >= SKEW_WINDOW_MAX_SIZE ||
-		    rx_timestamp >= self->window_start_timestamp +
-					    SKEW_WINDOW_TIMEOUT) {
-			self->window_size = self->window_pos;
-			self->window_pos = 0;
-			self->skew_avg = self->window_min;
-		} else if (rx_timestamp >= self->window_start_timestamp) {
-			uint32_t perc_time =
-				(rx_timestamp - self->window_start_timestamp) *
-				100 / SKEW_WINDOW_TIMEOUT;
-			uint32_t perc_window =
-				self->window_pos * 100 / SKEW_WINDOW_MAX_SIZE;
-			uint32_t perc = perc_time > perc_window ? perc_time
-								: perc_window;
-			/* Parabolic function */
-			perc = perc * perc;
-			self->skew_avg += perc *
-					  (self->window_min - self->skew_avg) /
-					  10000;
-		} else {
-			/* Might be different links */
-			ULOGD("reset skew: "
-			      "window_start_timestamp > rx_timestamp");
-			reset_skew(self, rx_timestamp, rtp_timestamp);
-			out_timestamp = rx_timestamp;
-			goto out;
+		return;
+	}
+	if (self->armed_deadline != 0 && deadline == self->armed_deadline)
+		return;
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &now);
+	if (deadline <= now) {
+		if (self->armed_deadline != 0) {
+			pomp_timer_clear(self->timer);
+			self->armed_deadline = 0;
 		}
-	} else {
-		/* Remember the old value and set the new one */
-		int64_t old = self->window[self->window_pos];
-		self->window[self->window_pos] = skew;
-
-		if (skew < self->window_min) {
-			/* New minimum found */
-			self->window_min = skew;
-		} else if (old == self->window_min) {
-			/* We replace the current min value, find the new min */
-			self->window_min = INT64_MAX;
-			for (uint32_t i = 0; i < self->window_size; i++) {
-				if (self->window[i] == old) {
-					/* We found the old min again, save it
-					 * and break */
-					self->window_min = self->window[i];
-					break;
-				} else if (self->window[i] < self->window_min) {
-					/* Save new min, and continue search */
-					self->window_min = self->window[i];
-				}
-			}
+		if (!self->idle_pending) {
+			res = pomp_loop_idle_add(self->loop, &idle_cb, self);
+			if (res < 0)
+				ULOG_ERRNO("pomp_loop_idle_add", -res);
+			else
+				self->idle_pending = 1;
 		}
+		return;
+	}
 
-		/* Update position and wrap if needed */
-		self->window_pos++;
-		if (self->window_pos >= self->window_size)
-			self->window_pos = 0;
-
-		/* Sliding average */
-		self->skew_avg +=
-			(self->window_min - self->skew_avg) / SKEW_AVG_ALPHA;
+	/* Round up to the next ms so the packet is due when the timer
+	 * fires */
+	res = pomp_timer_set(self->timer, (deadline - now + 999) / 1000);
+	if (res < 0) {
+		ULOG_ERRNO("pomp_timer_set", -res);
+		return;
 	}
-#else
-	/* Fill the window */
-	if (self->window_size == 0)
-		self->window_start_timestamp = rx_timestamp;
-	self->window[self->window_size] = skew;
-	self->window_size++;
+	self->armed_deadline = deadline;
+}
 
-	if ((self->window_size >= SKEW_WINDOW_MAX_SIZE) ||
-	    (self->window_size >= SKEW_WINDOW_MAX_SIZE / 2 &&
-	     rx_timestamp >=
-		     self->window_start_timestamp + SKEW_WINDOW_TIMEOUT)) {
-		/* Window is full or half-full and on timeout */
-		self->window_min = self->window[0];
-		for (uint32_t i = 1; i < self->window_size; i++) {
-			if (self->window[i] < self->window_min)
-				self->window_min = self->window[i];
-		}
 
-		/* Sliding average */
-		self->skew_avg +=
-			(self->window_min - self->skew_avg) / SKEW_AVG_ALPHA;
+static void loop_process(struct rtp_jitter *self)
+{
+	uint64_t now = 0;
+	struct timespec ts = {0, 0};
 
-		/* Reset the window */
-		self->window_size = 0;
-	}
-#endif
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &now);
+	rtp_jitter_process(self, now);
+}
 
-	/* Estimated out timestamp */
-	out_timestamp = self->first_rx_timestamp + delta_send + self->skew_avg;
 
-	/* Make sure we don't go backwards */
-	if (out_timestamp + self->cfg.delay < rx_timestamp) {
-		ULOGD("reset skew: out(%.6f) + delay(%.6f) < in(%.6f)",
-		      out_timestamp / 1000000.0,
-		      self->cfg.delay / 1000000.0,
-		      rx_timestamp / 1000000.0);
-		reset_skew(self, rx_timestamp, rtp_timestamp);
-		out_timestamp = rx_timestamp;
-	}
+static void idle_cb(void *userdata)
+{
+	struct rtp_jitter *self = userdata;
 
-out:
-	return out_timestamp;
+	self->idle_pending = 0;
+	loop_process(self);
+}
+
+
+static void timer_cb(struct pomp_timer *timer, void *userdata)
+{
+	struct rtp_jitter *self = userdata;
+
+	self->armed_deadline = 0;
+	loop_process(self);
+}
+
+
+static void evt_cb(struct pomp_evt *evt, void *userdata)
+{
+	struct rtp_jitter *self = userdata;
+
+	/* Clear the flag before draining so that packets pushed from now on
+	 * signal the event again */
+	__atomic_exchange_n(&self->ingress.signaled, 0, __ATOMIC_SEQ_CST);
+	loop_process(self);
 }
 
 
@@ -279,34 +1742,120 @@ int rtp_jitter_new(const struct rtp_jitter_cfg *cfg,
 		   void *userdata,
 		   struct rtp_jitter **ret_obj)
 {
+	int res = 0;
 	struct rtp_jitter *self = NULL;
+	struct rtp_jitter_cfg norm_cfg;
+	struct layout layout;
 
 	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(cfg->clk_rate == 0, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(cbs == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->release_mode ==
+						 RTP_JITTER_RELEASE_MODE_FRAME &&
+					 cbs->process_frame == NULL,
+				 EINVAL);
 
 	*ret_obj = NULL;
 
-	self = calloc(1, sizeof(*self));
+	res = cfg_normalize(cfg, &norm_cfg);
+	if (res < 0)
+		return res;
+	get_layout(&norm_cfg, &layout);
+
+	self = calloc(1, layout.size);
 	if (self == NULL)
 		return -ENOMEM;
-	self->cfg = *cfg;
+	self->cfg = norm_cfg;
 	self->cbs = *cbs;
 	self->userdata = userdata;
+	rtp_clk_init(&self->clk, self->cfg.clk_rate);
 	list_init(&self->packets);
 
+	if (self->cfg.storage == RTP_JITTER_STORAGE_RING) {
+		self->ring.mask = self->cfg.ring_size - 1;
+		self->ring.pkts = (struct rtp_pkt **)((uint8_t *)self +
+						      layout.ring_offset);
+	}
+	if (self->cfg.ingress_size != 0) {
+		self->ingress.mask = self->cfg.ingress_size - 1;
+		self->ingress.pkts = (struct rtp_pkt **)((uint8_t *)self +
+							 layout.ingress_offset);
+	}
+	if (skew_estimators[self->cfg.skew_mode].window == SKEW_WINDOW_NONE) {
+		/* The samples are not stored */
+	} else if (self->cfg.skew_compact) {
+		self->window.v32 =
+			(int32_t *)((uint8_t *)self + layout.window_offset);
+	} else {
+		self->window.v64 =
+			(int64_t *)((uint8_t *)self + layout.window_offset);
+	}
+	if (skew_estimators[self->cfg.skew_mode].window == SKEW_WINDOW_DEQUE) {
+		self->window_deque =
+			(uint16_t *)((uint8_t *)self + layout.deque_offset);
+	}
+	if (self->cfg.delay_percentile != 0)
+		self->hist = (uint32_t *)((uint8_t *)self + layout.hist_offset);
+	self->delay = self->cfg.delay;
+
+	if (self->cbs.process_pkts != NULL ||
+	    self->cfg.release_mode == RTP_JITTER_RELEASE_MODE_FRAME) {
+		res = batch_alloc(self, BATCH_INITIAL_SIZE);
+		if (res < 0) {
+			rtp_jitter_destroy(self);
+			return res;
+		}
+	}
+
+	if (self->cfg.max_pkts != 0 || self->cfg.max_bytes != 0) {
+		/* One more packet than the budget is queued before eviction */
+		res = evict_heap_alloc(self,
+				       self->cfg.max_pkts != 0
+					       ? self->cfg.max_pkts + 1
+					       : EVICT_HEAP_INITIAL_SIZE);
+		if (res < 0) {
+			rtp_jitter_destroy(self);
+			return res;
+		}
+		self->evict_heap.active = 1;
+	}
+
 	*ret_obj = self;
 	return 0;
 }
 
 
+int rtp_jitter_get_mem_size(const struct rtp_jitter_cfg *cfg, size_t *size)
+{
+	int res = 0;
+	struct rtp_jitter_cfg norm_cfg;
+	struct layout layout;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(size == NULL, EINVAL);
+
+	res = cfg_normalize(cfg, &norm_cfg);
+	if (res < 0)
+		return res;
+	get_layout(&norm_cfg, &layout);
+	*size = layout.size;
+
+	return 0;
+}
+
+
 int rtp_jitter_destroy(struct rtp_jitter *self)
 {
 	if (self == NULL)
 		return 0;
 
+	if (self->group != NULL)
+		rtp_jitter_group_remove(self->group, self);
+	rtp_jitter_detach_loop(self);
 	rtp_jitter_clear(self, 0);
+	free(self->batch.pkts);
+	free(self->batch.gaps);
+	free(self->evict_heap.pkts);
 	free(self);
 	return 0;
 }
@@ -319,24 +1868,28 @@ int rtp_jitter_clear(struct rtp_jitter *self, uint16_t next_seqnum)
 	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
 
 	/* Destroy all packets in the queue */
-	while (!list_is_empty(&self->packets)) {
-		pkt = list_entry(
-			list_first(&self->packets), struct rtp_pkt, node);
-		list_del(&pkt->node);
+	if (self->cfg.ingress_size != 0)
+		ingress_drain(self, 1);
+	while ((pkt = store_first(self)) != NULL) {
+		store_remove(self, pkt);
 		rtp_pkt_destroy(pkt);
 	}
 
-	self->first_rx_timestamp = 0;
-	self->first_rtp_timestamp = 0;
-	self->last_rx_timestamp = 0;
-	self->last_rtp_timestamp = 0;
-	self->window_size = 0;
-	self->window_start_timestamp = 0;
-	self->skew_avg = 0;
-	self->jitter_avg = 0;
-
 	/* Set the seq num of the next expected packet */
 	self->next_seqnum = next_seqnum;
+	self->last_released = 0;
+	self->highest_valid = 0;
+	self->skipping = 0;
+	self->cut_pending = 0;
+
+	if (self->cfg.ingress_size != 0) {
+		/* The estimation state belongs to the producer */
+		__atomic_store_n(&self->ingress.reset, 1, __ATOMIC_RELEASE);
+	} else {
+		reset_estimation(self);
+	}
+
+	loop_schedule(self);
 	return 0;
 }
 
@@ -345,51 +1898,49 @@ int rtp_jitter_enqueue(struct rtp_jitter *self, struct rtp_pkt *pkt)
 {
 	uint64_t in_timestamp = 0;
 	uint64_t rtp_timestamp = 0;
-	struct rtp_pkt *item = NULL;
 
 	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
 
+	/* Drop the packet before it is accounted in the estimations */
+	if (self->cfg.ingress_size != 0 && ingress_is_full(self)) {
+		ULOGW("ingress ring full: drop packet %u", pkt->header.seqnum);
+		PUB_INC(self->pub.ingress_dropped);
+		rtp_pkt_destroy(pkt);
+		return -ENOBUFS;
+	}
+
 	in_timestamp = pkt->in_timestamp;
 	rtp_timestamp = pkt->rtp_timestamp;
 
+	if (self->cfg.ingress_size != 0 &&
+	    __atomic_exchange_n(&self->ingress.reset, 0, __ATOMIC_ACQUIRE))
+		reset_estimation(self);
+
 	if (self->first_rx_timestamp == 0 || self->first_rtp_timestamp == 0)
 		reset_skew(self, in_timestamp, rtp_timestamp);
 
 	if (self->last_rx_timestamp != 0 && self->last_rtp_timestamp != 0)
 		compute_jitter(self, in_timestamp, rtp_timestamp);
 	pkt->out_timestamp = compute_skew(self, in_timestamp, rtp_timestamp);
+	if (self->cfg.delay_percentile != 0)
+		update_delay(self, in_timestamp, pkt->out_timestamp);
+	if (self->cfg.max_latency != 0)
+		check_latency(self, pkt);
 
 	self->last_rx_timestamp = in_timestamp;
 	self->last_rtp_timestamp = rtp_timestamp;
+	publish_estimation(self);
 
-	if (rtp_diff_seqnum(self->next_seqnum, pkt->header.seqnum) > 0) {
-		/* Old packet or duplicate of a packet that has already
-		 * been processed */
-		rtp_pkt_destroy(pkt);
+	PUB_INC(self->pub.enqueued);
+	if (self->cfg.ingress_size != 0) {
+		ingress_push(self, pkt);
 		return 0;
 	}
 
-	list_walk_entry_backward(&self->packets, item, node)
-	{
-		int16_t diff = rtp_diff_seqnum(item->header.seqnum,
-					       pkt->header.seqnum);
-		if (diff > 0)
-			continue;
-
-		if (diff == 0) {
-			/* Duplicate packet */
-			rtp_pkt_destroy(pkt);
-			return 0;
-		}
-
-		/* Add in the list in order */
-		list_add_after(&item->node, &pkt->node);
-		return 0;
-	}
+	store_pkt(self, pkt);
 
-	/* Empty list or current packet to be added as first */
-	list_add_before(list_first(&self->packets), &pkt->node);
+	loop_schedule(self);
 	return 0;
 }
 
@@ -398,20 +1949,54 @@ int rtp_jitter_process(struct rtp_jitter *self, uint64_t cur_timestamp)
 {
 	struct rtp_pkt *pkt = NULL;
 	uint32_t gap = 0;
+	uint32_t cut = 0;
+	int complete = 0;
+	enum skip_action skip = SKIP_ACTION_NONE;
 
 	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
 
-	while (!list_is_empty(&self->packets)) {
-		/* Get first packet */
-		pkt = list_entry(
-			list_first(&self->packets), struct rtp_pkt, node);
+	/* Read the cut before draining so that the packets before it are
+	 * queued */
+	if (self->cfg.max_latency != 0) {
+		cut = __atomic_load_n(&self->cut, __ATOMIC_ACQUIRE);
+		if (cut != self->cut_seen) {
+			self->cut_seen = cut;
+			self->cut_seqnum = cut & 0xffff;
+			self->cut_pending = 1;
+		}
+	}
+
+	if (self->cfg.ingress_size != 0)
+		ingress_drain(self, 0);
+
+	while (self->cfg.release_mode == RTP_JITTER_RELEASE_MODE_FRAME &&
+	       (pkt = store_first(self)) != NULL) {
+		skip = skip_head(self, pkt, cur_timestamp);
+		if (skip == SKIP_ACTION_DROP)
+			continue;
+
+		/* Is it complete or time to process it? */
+		complete = frame_is_complete(self, pkt);
+		if (!complete && skip != SKIP_ACTION_KEEP &&
+		    cur_timestamp < get_head_deadline(self, pkt))
+			break;
+		frame_release(self, pkt, complete);
+	}
+
+	while (self->cfg.release_mode == RTP_JITTER_RELEASE_MODE_PACKET &&
+	       (pkt = store_first(self)) != NULL) {
+		skip = skip_head(self, pkt, cur_timestamp);
+		if (skip == SKIP_ACTION_DROP)
+			continue;
+		if (skip == SKIP_ACTION_KEEP)
+			goto do_process;
 
 		/* Is it the next one to process? */
 		if (pkt->header.seqnum == self->next_seqnum)
 			goto do_process;
 
 		/* Is it time to process it? */
-		if (cur_timestamp >= pkt->out_timestamp + self->cfg.delay)
+		if (cur_timestamp >= get_head_deadline(self, pkt))
 			goto do_process;
 
 		/* No more packet eligible for process */
@@ -420,12 +2005,213 @@ int rtp_jitter_process(struct rtp_jitter *self, uint64_t cur_timestamp)
 	/* codecheck_ignore[INDENTED_LABEL] */
 	do_process:
 		gap = rtp_diff_seqnum(pkt->header.seqnum, self->next_seqnum);
+		self->stats.lost += gap;
+		self->stats.released++;
+		if (self->cbs.process_pkts != NULL) {
+			set_released(self, pkt);
+			store_remove(self, pkt);
+			batch_add(self, pkt, gap);
+			continue;
+		}
 		(self->cbs.process_pkt)(self, pkt, gap, self->userdata);
-		self->next_seqnum = (pkt->header.seqnum + 1) & 0xffff;
-		list_del(&pkt->node);
+		set_released(self, pkt);
+		store_remove(self, pkt);
 		rtp_pkt_destroy(pkt);
 	}
 
+	batch_flush(self);
+
+	if (self->skip_count > 0) {
+		if (self->cbs.skip_pkts != NULL) {
+			(self->cbs.skip_pkts)(
+				self, self->skip_count, self->userdata);
+		}
+		self->skip_count = 0;
+	}
+
+	loop_schedule(self);
+	return 0;
+}
+
+
+int rtp_jitter_get_next_deadline(struct rtp_jitter *self, uint64_t *deadline)
+{
+	struct rtp_pkt *pkt = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(deadline == NULL, EINVAL);
+
+	if (self->cfg.ingress_size != 0)
+		ingress_drain(self, 0);
+
+	pkt = store_first(self);
+	if (pkt == NULL)
+		return -ENOENT;
+
+	if (self->cfg.release_mode == RTP_JITTER_RELEASE_MODE_FRAME
+		    ? frame_is_complete(self, pkt)
+		    : pkt->header.seqnum == self->next_seqnum)
+		*deadline = 0;
+	else
+		*deadline = get_head_deadline(self, pkt);
+
+	return 0;
+}
+
+
+int rtp_jitter_attach_loop(struct rtp_jitter *self, struct pomp_loop *loop)
+{
+	int res = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(loop == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(self->loop != NULL, EBUSY);
+	ULOG_ERRNO_RETURN_ERR_IF(self->group != NULL, EBUSY);
+
+	self->timer = pomp_timer_new(loop, &timer_cb, self);
+	if (self->timer == NULL)
+		return -ENOMEM;
+
+	if (self->cfg.ingress_size != 0) {
+		self->evt = pomp_evt_new();
+		if (self->evt == NULL) {
+			res = -ENOMEM;
+			goto error;
+		}
+		res = pomp_evt_attach_to_loop(self->evt, loop, &evt_cb, self);
+		if (res < 0) {
+			ULOG_ERRNO("pomp_evt_attach_to_loop", -res);
+			goto error;
+		}
+	}
+
+	self->loop = loop;
+	self->armed_deadline = 0;
+
+	loop_schedule(self);
+	return 0;
+
+error:
+	if (self->evt != NULL) {
+		pomp_evt_destroy(self->evt);
+		self->evt = NULL;
+	}
+	pomp_timer_destroy(self->timer);
+	self->timer = NULL;
+	return res;
+}
+
+
+int rtp_jitter_detach_loop(struct rtp_jitter *self)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+
+	if (self->loop == NULL)
+		return 0;
+
+	if (self->idle_pending) {
+		pomp_loop_idle_remove(self->loop, &idle_cb, self);
+		self->idle_pending = 0;
+	}
+	if (self->evt != NULL) {
+		pomp_evt_detach_from_loop(self->evt, self->loop);
+		pomp_evt_destroy(self->evt);
+		self->evt = NULL;
+	}
+	pomp_timer_clear(self->timer);
+	pomp_timer_destroy(self->timer);
+	self->timer = NULL;
+	self->loop = NULL;
+	self->armed_deadline = 0;
+	return 0;
+}
+
+
+int rtp_jitter_set_group(struct rtp_jitter *jitter,
+			 struct rtp_jitter_group *group,
+			 struct rtp_jitter_group_entry *entry)
+{
+	int res = 0;
+	struct rtp_pkt *pkt = NULL;
+
+	if (group != NULL && (jitter->group != NULL || jitter->loop != NULL))
+		return -EBUSY;
+
+	/* The group can not be notified of packets enqueued from another
+	 * thread */
+	if (group != NULL && jitter->cfg.ingress_size != 0)
+		return -EINVAL;
+
+	if (group != NULL && !jitter->evict_heap.active) {
+		/* The group budget applies to the packets already queued */
+		if (jitter->evict_heap.size < jitter->count + 1) {
+			res = evict_heap_alloc(
+				jitter,
+				jitter->count + EVICT_HEAP_INITIAL_SIZE);
+			if (res < 0)
+				return res;
+		}
+		for (pkt = store_first(jitter); pkt != NULL;
+		     pkt = store_next(jitter, pkt))
+			evict_heap_push(jitter, pkt);
+		jitter->evict_heap.active = 1;
+	} else if (group == NULL && jitter->cfg.max_pkts == 0 &&
+		   jitter->cfg.max_bytes == 0) {
+		/* No budget applies anymore */
+		jitter->evict_heap.count = 0;
+		jitter->evict_heap.active = 0;
+	}
+
+	jitter->group = group;
+	jitter->group_entry = entry;
+	return 0;
+}
+
+
+void rtp_jitter_get_queued(struct rtp_jitter *jitter,
+			   uint32_t *count,
+			   size_t *bytes)
+{
+	*count = jitter->count;
+	*bytes = jitter->bytes;
+}
+
+
+int rtp_jitter_evict(struct rtp_jitter *jitter, size_t *bytes)
+{
+	return evict(jitter, bytes);
+}
+
+
+struct rtp_jitter_group_entry *
+rtp_jitter_get_group_entry(struct rtp_jitter *jitter,
+			   struct rtp_jitter_group *group)
+{
+	return jitter->group == group ? jitter->group_entry : NULL;
+}
+
+
+int rtp_jitter_get_target_delay(struct rtp_jitter *self, uint32_t *delay)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(delay == NULL, EINVAL);
+
+	*delay = get_delay(self);
+	return 0;
+}
+
+
+int rtp_jitter_get_evictions(struct rtp_jitter *self,
+			     uint64_t *pkts,
+			     uint64_t *bytes)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+
+	if (pkts != NULL)
+		*pkts = self->stats.evicted_pkts;
+	if (bytes != NULL)
+		*bytes = self->stats.evicted_bytes;
+
 	return 0;
 }
 
@@ -440,9 +2226,55 @@ int rtp_jitter_get_info(struct rtp_jitter *self,
 	if (clk_rate != NULL)
 		*clk_rate = self->cfg.clk_rate;
 	if (jitter_avg != NULL)
-		*jitter_avg = self->jitter_avg;
+		*jitter_avg = __atomic_load_n(&self->pub.jitter_avg,
+					      __ATOMIC_RELAXED);
 	if (skew_avg != NULL)
-		*skew_avg = self->skew_avg;
+		*skew_avg = __atomic_load_n(&self->pub.skew_avg,
+					    __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+
+int rtp_jitter_get_stats(struct rtp_jitter *self,
+			 struct rtp_jitter_stats *stats)
+{
+	struct rtp_pkt *first = NULL;
+	struct rtp_pkt *last = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	*stats = self->stats;
+	stats->enqueued =
+		__atomic_load_n(&self->pub.enqueued, __ATOMIC_RELAXED);
+	stats->ingress_dropped =
+		__atomic_load_n(&self->pub.ingress_dropped, __ATOMIC_RELAXED);
+	stats->skew_resets =
+		__atomic_load_n(&self->pub.skew_resets, __ATOMIC_RELAXED);
+	stats->queue_pkts = self->count;
+	stats->queue_bytes = self->bytes;
+	stats->queue_duration = 0;
+	first = store_first(self);
+	if (first != NULL) {
+		if (self->cfg.storage == RTP_JITTER_STORAGE_RING) {
+			last = ring_slot_get(self, self->ring.tail);
+		} else {
+			last = list_entry(list_last(&self->packets),
+					  struct rtp_pkt,
+					  node);
+		}
+		if (last->out_timestamp > first->out_timestamp) {
+			stats->queue_duration =
+				last->out_timestamp - first->out_timestamp;
+		}
+	}
+	stats->delay = get_delay(self);
+	stats->jitter_avg =
+		__atomic_load_n(&self->pub.jitter_avg, __ATOMIC_RELAXED);
+	stats->skew_avg = __atomic_load_n(&self->pub.skew_avg, __ATOMIC_RELAXED);
+	stats->skew_drift =
+		__atomic_load_n(&self->pub.skew_drift, __ATOMIC_RELAXED);
 
 	return 0;
 }
@@ -0,0 +1,730 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "rtp_priv.h"
+
+
+/* The wheel has WHEEL_LEVELS levels of WHEEL_SIZE slots; slots of level n
+ * span WHEEL_SIZE^n ticks, entries further than the wheel span are put in
+ * the last level and rescheduled when it cascades */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN (1ULL << (WHEEL_BITS * WHEEL_LEVELS))
+
+#define HEAP_INITIAL_SIZE 8
+
+
+enum entry_state {
+	ENTRY_STATE_IDLE = 0,
+	ENTRY_STATE_READY,
+	ENTRY_STATE_WHEEL,
+};
+
+
+/* Budgets, and heaps of the members by usage of each */
+enum usage {
+	USAGE_PKTS = 0,
+	USAGE_BYTES,
+	USAGE_COUNT,
+};
+
+
+struct rtp_jitter_group_entry {
+	struct rtp_jitter *jitter;
+
+	/* Node in the members list */
+	struct list_node member_node;
+
+	/* Node in the ready list or in a wheel slot */
+	struct list_node node;
+	enum entry_state state;
+	uint64_t expire_tick;
+	uint8_t level;
+	uint8_t slot;
+
+	/* Number and total size of the packets queued in the member, and
+	 * position in the usage heaps */
+	uint32_t count;
+	size_t bytes;
+	uint32_t heap_index[USAGE_COUNT];
+};
+
+
+struct rtp_jitter_group {
+	struct rtp_jitter_group_cfg cfg;
+
+	struct list_node members;
+	uint32_t member_count;
+
+	/* Number and total size of the packets queued in the members, and of
+	 * the packets evicted to stay within the budget */
+	uint32_t count;
+	size_t bytes;
+	uint64_t evicted_pkts;
+	uint64_t evicted_bytes;
+
+	/* Members by usage of each budget (binary max-heaps), only maintained
+	 * for the budgets that are set; heap_size is the allocated size of
+	 * both */
+	struct rtp_jitter_group_entry **heaps[USAGE_COUNT];
+	uint32_t heap_size;
+
+	/* Last processed tick; entries are only put in the wheel once it is
+	 * known (first process), they stay in the ready list before */
+	uint64_t now_tick;
+	int started;
+
+	/* Members that can be processed immediately */
+	struct list_node ready;
+
+	struct list_node slots[WHEEL_LEVELS][WHEEL_SIZE];
+	/* Non-empty slots of each level */
+	uint64_t occupied[WHEEL_LEVELS];
+
+	/* Loop integration; armed_tick is the tick the timer is set for, 0 if
+	 * not armed */
+	struct pomp_loop *loop;
+	struct pomp_timer *timer;
+	uint64_t armed_tick;
+	int idle_pending;
+};
+
+
+static void list_move_all(struct list_node *from, struct list_node *to)
+{
+	list_init(to);
+	if (list_is_empty(from))
+		return;
+	to->next = from->next;
+	to->prev = from->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	list_init(from);
+}
+
+
+static uint64_t rotr64(uint64_t v, uint32_t n)
+{
+	n &= 63;
+	return n == 0 ? v : (v >> n) | (v << (64 - n));
+}
+
+
+static void entry_unlink(struct rtp_jitter_group *self,
+			 struct rtp_jitter_group_entry *entry)
+{
+	if (entry->state == ENTRY_STATE_IDLE)
+		return;
+
+	list_del(&entry->node);
+	if (entry->state == ENTRY_STATE_WHEEL &&
+	    list_is_empty(&self->slots[entry->level][entry->slot]))
+		self->occupied[entry->level] &= ~(1ULL << entry->slot);
+	entry->state = ENTRY_STATE_IDLE;
+}
+
+
+static void entry_insert(struct rtp_jitter_group *self,
+			 struct rtp_jitter_group_entry *entry)
+{
+	uint64_t expire = entry->expire_tick;
+	uint64_t delta = 0;
+	uint32_t level = 0;
+
+	if (!self->started || expire <= self->now_tick) {
+		list_add_before(&self->ready, &entry->node);
+		entry->state = ENTRY_STATE_READY;
+		return;
+	}
+
+	delta = expire - self->now_tick;
+	if (delta >= WHEEL_SPAN) {
+		/* Cascaded again when the last level wraps */
+		expire = self->now_tick + WHEEL_SPAN - 1;
+		delta = WHEEL_SPAN - 1;
+	}
+	while (delta >= (1ULL << (WHEEL_BITS * (level + 1))))
+		level++;
+
+	entry->level = level;
+	entry->slot = (expire >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	list_add_before(&self->slots[level][entry->slot], &entry->node);
+	self->occupied[level] |= 1ULL << entry->slot;
+	entry->state = ENTRY_STATE_WHEEL;
+}
+
+
+/* First tick after now_tick at which the wheel needs to be serviced (an
+ * entry expires or a slot cascades), 0 if the wheel is empty */
+static uint64_t wheel_next_tick(struct rtp_jitter_group *self)
+{
+	uint64_t next = 0;
+
+	for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+		uint32_t shift = WHEEL_BITS * level;
+		uint64_t period = self->now_tick >> shift;
+		uint64_t bits = 0;
+		uint64_t tick = 0;
+
+		if (self->occupied[level] == 0)
+			continue;
+
+		/* Slots are looked up from the one after the current one */
+		bits = rotr64(self->occupied[level], (period & WHEEL_MASK) + 1);
+		tick = (period + 1 + __builtin_ctzll(bits)) << shift;
+		if (next == 0 || tick < next)
+			next = tick;
+	}
+
+	return next;
+}
+
+
+/* Run the given tick: cascade the upper level slots starting at this tick
+ * and move the expired entries to the ready list */
+static void wheel_run_tick(struct rtp_jitter_group *self, uint64_t tick)
+{
+	struct list_node tmp;
+	struct rtp_jitter_group_entry *entry = NULL;
+
+	self->now_tick = tick;
+
+	for (uint32_t level = 1; level < WHEEL_LEVELS; level++) {
+		uint32_t shift = WHEEL_BITS * level;
+		uint32_t slot = (tick >> shift) & WHEEL_MASK;
+
+		/* Only cascade when all the lower levels wrapped */
+		if ((tick & ((1ULL << shift) - 1)) != 0)
+			break;
+
+		list_move_all(&self->slots[level][slot], &tmp);
+		self->occupied[level] &= ~(1ULL << slot);
+		while (!list_is_empty(&tmp)) {
+			entry = list_entry(list_first(&tmp),
+					   struct rtp_jitter_group_entry,
+					   node);
+			list_del(&entry->node);
+			entry->state = ENTRY_STATE_IDLE;
+			entry_insert(self, entry);
+		}
+	}
+
+	list_move_all(&self->slots[0][tick & WHEEL_MASK], &tmp);
+	self->occupied[0] &= ~(1ULL << (tick & WHEEL_MASK));
+	while (!list_is_empty(&tmp)) {
+		entry = list_entry(
+			list_first(&tmp), struct rtp_jitter_group_entry, node);
+		list_del(&entry->node);
+		list_add_before(&self->ready, &entry->node);
+		entry->state = ENTRY_STATE_READY;
+	}
+}
+
+
+/* Advance the wheel up to the given tick, jumping over the ticks with
+ * nothing to do */
+static void wheel_advance(struct rtp_jitter_group *self, uint64_t to_tick)
+{
+	uint64_t next = 0;
+
+	while (self->now_tick < to_tick) {
+		next = wheel_next_tick(self);
+		if (next == 0 || next > to_tick) {
+			self->now_tick = to_tick;
+			break;
+		}
+		wheel_run_tick(self, next);
+	}
+}
+
+
+static uint64_t get_cur_timestamp(void)
+{
+	uint64_t now = 0;
+	struct timespec ts = {0, 0};
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &now);
+	return now;
+}
+
+
+static void idle_cb(void *userdata);
+
+
+/* Arm the timer for the next tick to service, or schedule an immediate
+ * process if some members are ready */
+static void loop_schedule(struct rtp_jitter_group *self)
+{
+	int res = 0;
+	uint64_t next = 0, now = 0, delay = 0;
+
+	if (self->loop == NULL)
+		return;
+
+	if (!list_is_empty(&self->ready)) {
+		if (!self->idle_pending) {
+			res = pomp_loop_idle_add(self->loop, &idle_cb, self);
+			if (res < 0)
+				ULOG_ERRNO("pomp_loop_idle_add", -res);
+			else
+				self->idle_pending = 1;
+		}
+		return;
+	}
+
+	next = wheel_next_tick(self);
+	if (next == 0) {
+		if (self->armed_tick != 0) {
+			pomp_timer_clear(self->timer);
+			self->armed_tick = 0;
+		}
+		return;
+	}
+	if (next == self->armed_tick)
+		return;
+
+	now = get_cur_timestamp();
+	if (next * self->cfg.tick > now)
+		delay = (next * self->cfg.tick - now + 999) / 1000;
+	res = pomp_timer_set(self->timer, delay > 0 ? delay : 1);
+	if (res < 0) {
+		ULOG_ERRNO("pomp_timer_set", -res);
+		return;
+	}
+	self->armed_tick = next;
+}
+
+
+static void idle_cb(void *userdata)
+{
+	struct rtp_jitter_group *self = userdata;
+
+	self->idle_pending = 0;
+	rtp_jitter_group_process(self, get_cur_timestamp());
+}
+
+
+static void timer_cb(struct pomp_timer *timer, void *userdata)
+{
+	struct rtp_jitter_group *self = userdata;
+
+	self->armed_tick = 0;
+	rtp_jitter_group_process(self, get_cur_timestamp());
+}
+
+
+void rtp_jitter_group_update(struct rtp_jitter_group *group,
+			     struct rtp_jitter_group_entry *entry)
+{
+	int res = 0;
+	uint64_t deadline = 0;
+
+	entry_unlink(group, entry);
+
+	res = rtp_jitter_get_next_deadline(entry->jitter, &deadline);
+	if (res < 0) {
+		/* Nothing queued */
+		return;
+	}
+
+	entry->expire_tick =
+		(deadline + group->cfg.tick - 1) / group->cfg.tick;
+	entry_insert(group, entry);
+
+	/* Only an earlier deadline requires re-arming the timer */
+	if (group->loop != NULL &&
+	    (entry->state == ENTRY_STATE_READY || group->armed_tick == 0 ||
+	     entry->expire_tick < group->armed_tick))
+		loop_schedule(group);
+}
+
+
+static int usage_is_set(struct rtp_jitter_group *self, enum usage usage)
+{
+	return usage == USAGE_BYTES ? self->cfg.max_bytes != 0
+				    : self->cfg.max_pkts != 0;
+}
+
+
+static size_t get_usage(const struct rtp_jitter_group_entry *entry,
+			enum usage usage)
+{
+	return usage == USAGE_BYTES ? entry->bytes : entry->count;
+}
+
+
+static void heap_set(struct rtp_jitter_group *self,
+		     enum usage usage,
+		     uint32_t index,
+		     struct rtp_jitter_group_entry *entry)
+{
+	self->heaps[usage][index] = entry;
+	entry->heap_index[usage] = index;
+}
+
+
+static void heap_sift(struct rtp_jitter_group *self,
+		      enum usage usage,
+		      struct rtp_jitter_group_entry *entry)
+{
+	struct rtp_jitter_group_entry **heap = self->heaps[usage];
+	uint32_t index = entry->heap_index[usage];
+	uint32_t parent = 0, child = 0;
+	size_t value = get_usage(entry, usage);
+
+	/* Up */
+	while (index > 0) {
+		parent = (index - 1) / 2;
+		if (get_usage(heap[parent], usage) >= value)
+			break;
+		heap_set(self, usage, index, heap[parent]);
+		index = parent;
+	}
+
+	/* Down */
+	while ((child = 2 * index + 1) < self->member_count) {
+		if (child + 1 < self->member_count &&
+		    get_usage(heap[child + 1], usage) >
+			    get_usage(heap[child], usage))
+			child++;
+		if (get_usage(heap[child], usage) <= value)
+			break;
+		heap_set(self, usage, index, heap[child]);
+		index = child;
+	}
+	heap_set(self, usage, index, entry);
+}
+
+
+/* The heaps have room for the member (see rtp_jitter_group_add) and
+ * member_count includes it */
+static void heap_push(struct rtp_jitter_group *self,
+		      struct rtp_jitter_group_entry *entry)
+{
+	for (enum usage usage = 0; usage < USAGE_COUNT; usage++) {
+		if (!usage_is_set(self, usage))
+			continue;
+		heap_set(self, usage, self->member_count - 1, entry);
+		heap_sift(self, usage, entry);
+	}
+}
+
+
+/* member_count does not include the member anymore */
+static void heap_remove(struct rtp_jitter_group *self,
+			struct rtp_jitter_group_entry *entry)
+{
+	struct rtp_jitter_group_entry *last = NULL;
+
+	for (enum usage usage = 0; usage < USAGE_COUNT; usage++) {
+		if (!usage_is_set(self, usage))
+			continue;
+		last = self->heaps[usage][self->member_count];
+		if (last == entry)
+			continue;
+		heap_set(self, usage, entry->heap_index[usage], last);
+		heap_sift(self, usage, last);
+	}
+}
+
+
+static int heap_alloc(struct rtp_jitter_group *self, uint32_t size)
+{
+	struct rtp_jitter_group_entry **heap = NULL;
+
+	for (enum usage usage = 0; usage < USAGE_COUNT; usage++) {
+		if (!usage_is_set(self, usage))
+			continue;
+		heap = realloc(self->heaps[usage], size * sizeof(*heap));
+		if (heap == NULL)
+			return -ENOMEM;
+		self->heaps[usage] = heap;
+	}
+	self->heap_size = size;
+	return 0;
+}
+
+
+void rtp_jitter_group_account(struct rtp_jitter_group *group,
+			      struct rtp_jitter_group_entry *entry,
+			      int32_t pkts,
+			      int64_t bytes)
+{
+	group->count += pkts;
+	group->bytes += bytes;
+	entry->count += pkts;
+	entry->bytes += bytes;
+	for (enum usage usage = 0; usage < USAGE_COUNT; usage++) {
+		if (usage_is_set(group, usage))
+			heap_sift(group, usage, entry);
+	}
+}
+
+
+static int is_over_budget(struct rtp_jitter_group *self, int *by_bytes)
+{
+	*by_bytes = (self->cfg.max_bytes != 0 &&
+		     self->bytes > self->cfg.max_bytes);
+	return *by_bytes ||
+	       (self->cfg.max_pkts != 0 && self->count > self->cfg.max_pkts);
+}
+
+
+void rtp_jitter_group_enforce(struct rtp_jitter_group *group)
+{
+	int res = 0;
+	int by_bytes = 0;
+	struct rtp_jitter_group_entry *victim = NULL;
+	size_t bytes = 0;
+
+	while (is_over_budget(group, &by_bytes)) {
+		/* Evict from the member using the most of the exceeded
+		 * budget */
+		if (group->member_count == 0)
+			break;
+		victim = group->heaps[by_bytes ? USAGE_BYTES : USAGE_PKTS][0];
+		if (victim->count == 0)
+			break;
+
+		res = rtp_jitter_evict(victim->jitter, &bytes);
+		if (res < 0)
+			break;
+		group->evicted_pkts++;
+		group->evicted_bytes += bytes;
+		rtp_jitter_group_update(group, victim);
+	}
+}
+
+
+int rtp_jitter_group_new(const struct rtp_jitter_group_cfg *cfg,
+			 struct pomp_loop *loop,
+			 struct rtp_jitter_group **ret_obj)
+{
+	struct rtp_jitter_group *self = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	*ret_obj = NULL;
+
+	self = calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+	self->cfg = *cfg;
+	if (self->cfg.tick == 0)
+		self->cfg.tick = RTP_JITTER_GROUP_DEFAULT_TICK;
+	list_init(&self->members);
+	list_init(&self->ready);
+	for (uint32_t i = 0; i < WHEEL_LEVELS; i++) {
+		for (uint32_t j = 0; j < WHEEL_SIZE; j++)
+			list_init(&self->slots[i][j]);
+	}
+
+	if (loop != NULL) {
+		self->timer = pomp_timer_new(loop, &timer_cb, self);
+		if (self->timer == NULL) {
+			free(self);
+			return -ENOMEM;
+		}
+		self->loop = loop;
+		self->now_tick = get_cur_timestamp() / self->cfg.tick;
+		self->started = 1;
+	}
+
+	*ret_obj = self;
+	return 0;
+}
+
+
+int rtp_jitter_group_destroy(struct rtp_jitter_group *self)
+{
+	if (self == NULL)
+		return 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self->member_count != 0, EBUSY);
+
+	if (self->loop != NULL) {
+		if (self->idle_pending)
+			pomp_loop_idle_remove(self->loop, &idle_cb, self);
+		pomp_timer_clear(self->timer);
+		pomp_timer_destroy(self->timer);
+	}
+	for (enum usage usage = 0; usage < USAGE_COUNT; usage++)
+		free(self->heaps[usage]);
+	free(self);
+	return 0;
+}
+
+
+int rtp_jitter_group_add(struct rtp_jitter_group *self,
+			 struct rtp_jitter *jitter)
+{
+	int res = 0;
+	struct rtp_jitter_group_entry *entry = NULL;
+	uint32_t count = 0;
+	size_t bytes = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(jitter == NULL, EINVAL);
+
+	if (self->member_count == self->heap_size) {
+		res = heap_alloc(self,
+				 self->heap_size != 0 ? 2 * self->heap_size
+						      : HEAP_INITIAL_SIZE);
+		if (res < 0)
+			return res;
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	if (entry == NULL)
+		return -ENOMEM;
+	entry->jitter = jitter;
+
+	res = rtp_jitter_set_group(jitter, self, entry);
+	if (res < 0) {
+		ULOG_ERRNO("rtp_jitter_set_group", -res);
+		free(entry);
+		return res;
+	}
+	list_add_before(&self->members, &entry->member_node);
+	self->member_count++;
+
+	/* Account the packets already queued */
+	rtp_jitter_get_queued(jitter, &count, &bytes);
+	heap_push(self, entry);
+	rtp_jitter_group_account(self, entry, count, bytes);
+	rtp_jitter_group_enforce(self);
+
+	rtp_jitter_group_update(self, entry);
+	return 0;
+}
+
+
+int rtp_jitter_group_remove(struct rtp_jitter_group *self,
+			    struct rtp_jitter *jitter)
+{
+	struct rtp_jitter_group_entry *entry = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(jitter == NULL, EINVAL);
+
+	entry = rtp_jitter_get_group_entry(jitter, self);
+	if (entry == NULL)
+		return -ENOENT;
+
+	self->count -= entry->count;
+	self->bytes -= entry->bytes;
+	entry_unlink(self, entry);
+	list_del(&entry->member_node);
+	self->member_count--;
+	heap_remove(self, entry);
+	rtp_jitter_set_group(jitter, NULL, NULL);
+	free(entry);
+	return 0;
+}
+
+
+int rtp_jitter_group_process(struct rtp_jitter_group *self,
+			     uint64_t cur_timestamp)
+{
+	struct list_node tmp;
+	struct rtp_jitter_group_entry *entry = NULL;
+	uint64_t cur_tick = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+
+	cur_tick = cur_timestamp / self->cfg.tick;
+	if (!self->started) {
+		self->now_tick = cur_tick;
+		self->started = 1;
+	}
+	wheel_advance(self, cur_tick);
+
+	/* Members processed here are put back by rtp_jitter_group_update(),
+	 * in the wheel or in the ready list for the next call */
+	list_move_all(&self->ready, &tmp);
+	while (!list_is_empty(&tmp)) {
+		entry = list_entry(
+			list_first(&tmp), struct rtp_jitter_group_entry, node);
+		list_del(&entry->node);
+		entry->state = ENTRY_STATE_IDLE;
+		rtp_jitter_process(entry->jitter, cur_timestamp);
+	}
+
+	loop_schedule(self);
+	return 0;
+}
+
+
+int rtp_jitter_group_get_next_deadline(struct rtp_jitter_group *self,
+				       uint64_t *deadline)
+{
+	uint64_t next = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(deadline == NULL, EINVAL);
+
+	if (!list_is_empty(&self->ready)) {
+		*deadline = 0;
+		return 0;
+	}
+
+	next = wheel_next_tick(self);
+	if (next == 0)
+		return -ENOENT;
+
+	*deadline = next * self->cfg.tick;
+	return 0;
+}
+
+
+int rtp_jitter_group_get_member_count(struct rtp_jitter_group *self,
+				      uint32_t *count)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == NULL, EINVAL);
+
+	*count = self->member_count;
+	return 0;
+}
+
+
+int rtp_jitter_group_get_evictions(struct rtp_jitter_group *self,
+				   uint64_t *pkts,
+				   uint64_t *bytes)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+
+	if (pkts != NULL)
+		*pkts = self->evicted_pkts;
+	if (bytes != NULL)
+		*bytes = self->evicted_bytes;
+
+	return 0;
+}
@@ -34,39 +34,82 @@ ULOG_DECLARE_TAG(rtp);
 
 int rtp_pkt_new(struct rtp_pkt **ret_obj)
 {
-	struct rtp_pkt *pkt = NULL;
+	struct rtp_pkt_priv *priv = NULL;
 
 	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
 
 	*ret_obj = NULL;
 
-	pkt = calloc(1, sizeof(*pkt));
-	if (pkt == NULL)
+	priv = calloc(1, sizeof(*priv));
+	if (priv == NULL)
 		return -ENOMEM;
-	list_node_unref(&pkt->node);
+	list_node_unref(&priv->pkt.node);
 
-	*ret_obj = pkt;
+	*ret_obj = &priv->pkt;
 	return 0;
 }
 
 
-int rtp_pkt_clone(const struct rtp_pkt *pkt, struct rtp_pkt **ret_obj)
+int rtp_pkt_new_from_pool(struct rtp_pkt_pool *pool, struct rtp_pkt **ret_obj)
 {
-	struct rtp_pkt *new_pkt = NULL;
-
+	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
 
 	*ret_obj = NULL;
 
-	new_pkt = calloc(1, sizeof(*new_pkt));
-	if (new_pkt == NULL)
-		return -ENOMEM;
+	return rtp_pkt_pool_get(pool, ret_obj);
+}
 
-	/* Copy contents, and add a ref on internal buffer */
+
+static void pkt_copy(struct rtp_pkt *new_pkt, const struct rtp_pkt *pkt)
+{
+	/* Copy the public contents only (the internal part of the new packet
+	 * is kept, it is in no eviction heap), and add a ref on internal
+	 * buffer */
 	*new_pkt = *pkt;
 	list_node_unref(&new_pkt->node);
 	if (pkt->raw.buf != NULL)
 		pomp_buffer_ref(pkt->raw.buf);
+}
+
+
+int rtp_pkt_clone(const struct rtp_pkt *pkt, struct rtp_pkt **ret_obj)
+{
+	int res = 0;
+	struct rtp_pkt *new_pkt = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	*ret_obj = NULL;
+
+	res = rtp_pkt_new(&new_pkt);
+	if (res < 0)
+		return res;
+	pkt_copy(new_pkt, pkt);
+
+	*ret_obj = new_pkt;
+	return 0;
+}
+
+
+int rtp_pkt_clone_from_pool(struct rtp_pkt_pool *pool,
+			    const struct rtp_pkt *pkt,
+			    struct rtp_pkt **ret_obj)
+{
+	int res = 0;
+	struct rtp_pkt *new_pkt = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	*ret_obj = NULL;
+
+	res = rtp_pkt_pool_get(pool, &new_pkt);
+	if (res < 0)
+		return res;
+	pkt_copy(new_pkt, pkt);
 
 	*ret_obj = new_pkt;
 	return 0;
@@ -82,7 +125,10 @@ int rtp_pkt_destroy(struct rtp_pkt *pkt)
 		ULOGW("packet %p is still in a list", pkt);
 	if (pkt->raw.buf != NULL)
 		pomp_buffer_unref(pkt->raw.buf);
-	free(pkt);
+	if (rtp_pkt_priv(pkt)->pool != NULL)
+		rtp_pkt_pool_put(rtp_pkt_priv(pkt)->pool, pkt);
+	else
+		free(rtp_pkt_priv(pkt));
 	return 0;
 }
 
@@ -116,38 +162,38 @@ int rtp_pkt_finalize_header(struct rtp_pkt *pkt)
 }
 
 
-static int rtp_pkt_read_header(const struct pomp_buffer *buf,
-			       size_t *pos,
-			       struct rtp_pkt_header *header)
+/* The caller must have checked that at least RTP_PKT_HEADER_SIZE bytes are
+ * available */
+static inline void rtp_pkt_decode_header(const uint8_t *data,
+					 struct rtp_pkt_header *header)
 {
-	int res = 0;
-	CHECK(rtp_read_u16(buf, pos, &header->flags));
-	CHECK(rtp_read_u16(buf, pos, &header->seqnum));
-	CHECK(rtp_read_u32(buf, pos, &header->timestamp));
-	CHECK(rtp_read_u32(buf, pos, &header->ssrc));
-out:
-	return res;
+	header->flags = rtp_load_u16(data);
+	header->seqnum = rtp_load_u16(data + 2);
+	header->timestamp = rtp_load_u32(data + 4);
+	header->ssrc = rtp_load_u32(data + 8);
 }
 
 
-int rtp_pkt_read(struct pomp_buffer *buf, struct rtp_pkt *pkt)
+static int rtp_pkt_parse(struct pomp_buffer *buf, struct rtp_pkt *pkt)
 {
 	int res = 0;
 	size_t pos = 0;
 	uint32_t version = 0, csrc_count = 0;
 	uint16_t u16 = 0;
 	uint8_t padding = 0;
-
-	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	const uint8_t *data = NULL;
 
 	/* Get start/end of buffer */
 	pomp_buffer_ref(buf);
 	pkt->raw.buf = buf;
 	pomp_buffer_get_cdata(
 		buf, (const void **)&pkt->raw.cdata, &pkt->raw.len, NULL);
+	memset(&pkt->extheader, 0, sizeof(pkt->extheader));
+	memset(&pkt->padding, 0, sizeof(pkt->padding));
+	data = pkt->raw.cdata;
 
-	/* Read header */
+	/* Read header; all the lengths are checked before accessing the data
+	 * so that fields can be loaded directly from the buffer */
 	if (pkt->raw.len < RTP_PKT_HEADER_SIZE) {
 		res = -EIO;
 		ULOGE("rtp: bad length: %zu (%u)",
@@ -155,7 +201,8 @@ int rtp_pkt_read(struct pomp_buffer *buf, struct rtp_pkt *pkt)
 		      RTP_PKT_HEADER_SIZE);
 		goto out;
 	}
-	CHECK(rtp_pkt_read_header(buf, &pos, &pkt->header));
+	rtp_pkt_decode_header(data, &pkt->header);
+	pos = RTP_PKT_HEADER_SIZE;
 
 	/* Check version */
 	version = RTP_PKT_HEADER_FLAGS_GET(pkt->header.flags, VERSION);
@@ -191,8 +238,9 @@ int rtp_pkt_read(struct pomp_buffer *buf, struct rtp_pkt *pkt)
 
 		/* Read extension id and length (number of 32-bit not
 		 * counting type + length itself) */
-		CHECK(rtp_read_u16(buf, &pos, &pkt->extheader.id));
-		CHECK(rtp_read_u16(buf, &pos, &u16));
+		pkt->extheader.id = rtp_load_u16(data + pos);
+		u16 = rtp_load_u16(data + pos + 2);
+		pos += 4;
 		pkt->extheader.len = u16 * 4 + 4;
 
 		if (pkt->raw.len - pos < (size_t)u16 * 4) {
@@ -216,8 +264,7 @@ int rtp_pkt_read(struct pomp_buffer *buf, struct rtp_pkt *pkt)
 			ULOGE("rtp: bad length: %zu (%u)", pkt->payload.len, 1);
 			goto out;
 		}
-		pos = pkt->raw.len - 1;
-		CHECK(rtp_read_u8(buf, &pos, &padding));
+		padding = data[pkt->raw.len - 1];
 		if (pkt->payload.len < padding) {
 			res = -EIO;
 			ULOGE("rtp: bad length: %zu (%u)",
@@ -233,3 +280,57 @@ int rtp_pkt_read(struct pomp_buffer *buf, struct rtp_pkt *pkt)
 out:
 	return res;
 }
+
+
+int rtp_pkt_read(struct pomp_buffer *buf, struct rtp_pkt *pkt)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+
+	return rtp_pkt_parse(buf, pkt);
+}
+
+
+int rtp_pkt_read_batch(struct pomp_buffer **bufs,
+		       size_t n,
+		       struct rtp_pkt *pkts,
+		       int *results)
+{
+	int res = 0;
+	int count = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(n > 0 && bufs == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(n > 0 && pkts == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(n > INT32_MAX, EINVAL);
+
+	for (size_t i = 0; i < n; i++) {
+		struct rtp_pkt *pkt = &pkts[i];
+		const void *next = NULL;
+
+		/* Prefetch the header of the next packet while parsing this
+		 * one */
+		if (i + 1 < n && bufs[i + 1] != NULL &&
+		    pomp_buffer_get_cdata(bufs[i + 1], &next, NULL, NULL) == 0)
+			__builtin_prefetch(next);
+
+		if (bufs[i] == NULL) {
+			res = -EINVAL;
+			pkt->raw.buf = NULL;
+		} else {
+			res = rtp_pkt_parse(bufs[i], pkt);
+			if (res < 0) {
+				/* Drop the buffer reference, the packet
+				 * can not be destroyed by the caller */
+				pomp_buffer_unref(pkt->raw.buf);
+				pkt->raw.buf = NULL;
+			}
+		}
+
+		if (results != NULL)
+			results[i] = res;
+		if (res == 0)
+			count++;
+	}
+
+	return count;
+}
@@ -0,0 +1,435 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+
+#include "rtp_priv.h"
+
+
+struct pkt_slab {
+	struct pkt_slab *next;
+	uint32_t count;
+	struct rtp_pkt_priv pkts[];
+};
+
+
+/* Per-thread cache of free packets of a pool, only accessed by its thread
+ * except for the counters that are read (without lock) when gathering stats
+ * and the pool, cleared when the pool is destroyed; the caches of a thread
+ * (one per pool it used) are chained in the value of the library-wide key */
+struct pkt_cache {
+	struct rtp_pkt_pool *pool;
+	struct pkt_cache *next;
+	struct list_node node;
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t gets;
+	uint64_t puts;
+
+	uint32_t count;
+	struct rtp_pkt *pkts[];
+};
+
+
+struct rtp_pkt_pool {
+	struct rtp_pkt_pool_cfg cfg;
+	pthread_mutex_t mutex;
+
+	/* Protected by the mutex */
+	struct pkt_slab *slabs;
+	uint32_t allocated;
+	struct rtp_pkt **free_pkts;
+	uint32_t free_count;
+	struct list_node caches;
+
+	/* Counters of caches that have been released */
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t gets;
+	uint64_t puts;
+};
+
+
+/* Must be called with the mutex held */
+static int pool_grow(struct rtp_pkt_pool *self, uint32_t count)
+{
+	struct pkt_slab *slab = NULL;
+	struct rtp_pkt **free_pkts = NULL;
+
+	if (self->cfg.max_count != 0) {
+		if (self->allocated >= self->cfg.max_count)
+			return -ENOSPC;
+		if (count > self->cfg.max_count - self->allocated)
+			count = self->cfg.max_count - self->allocated;
+	}
+	if (count == 0)
+		return 0;
+
+	/* The free array must be able to hold all packets of the pool */
+	free_pkts = realloc(self->free_pkts,
+			    (self->allocated + count) * sizeof(*free_pkts));
+	if (free_pkts == NULL)
+		return -ENOMEM;
+	self->free_pkts = free_pkts;
+
+	slab = malloc(sizeof(*slab) + count * sizeof(slab->pkts[0]));
+	if (slab == NULL)
+		return -ENOMEM;
+	slab->count = count;
+	slab->next = self->slabs;
+	self->slabs = slab;
+
+	for (uint32_t i = 0; i < count; i++)
+		self->free_pkts[self->free_count++] = &slab->pkts[i].pkt;
+	self->allocated += count;
+
+	return 0;
+}
+
+
+/* Must be called with the mutex held */
+static void cache_flush(struct rtp_pkt_pool *self,
+			struct pkt_cache *cache,
+			uint32_t count)
+{
+	while (count > 0 && cache->count > 0) {
+		self->free_pkts[self->free_count++] =
+			cache->pkts[--cache->count];
+		count--;
+	}
+}
+
+
+/* A single key for all the pools, the number of keys of a process is
+ * limited (PTHREAD_KEYS_MAX) and shared with the other libraries */
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+static int cache_key_res;
+
+/* Serializes the release of the caches of an exiting thread with the
+ * destruction of their pools */
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Called on thread exit with the chain of caches of the thread */
+static void cache_release(void *data)
+{
+	struct pkt_cache *cache = data, *next = NULL;
+	struct rtp_pkt_pool *self = NULL;
+
+	pthread_mutex_lock(&cache_mutex);
+	while (cache != NULL) {
+		next = cache->next;
+		self = __atomic_load_n(&cache->pool, __ATOMIC_ACQUIRE);
+		if (self != NULL) {
+			pthread_mutex_lock(&self->mutex);
+			cache_flush(self, cache, cache->count);
+			self->hits += cache->hits;
+			self->misses += cache->misses;
+			self->gets += cache->gets;
+			self->puts += cache->puts;
+			list_del(&cache->node);
+			pthread_mutex_unlock(&self->mutex);
+		}
+		free(cache);
+		cache = next;
+	}
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+
+static void cache_key_create(void)
+{
+	cache_key_res = -pthread_key_create(&cache_key, &cache_release);
+	if (cache_key_res < 0)
+		ULOG_ERRNO("pthread_key_create", -cache_key_res);
+}
+
+
+static struct pkt_cache *cache_get(struct rtp_pkt_pool *self)
+{
+	struct pkt_cache *first = NULL, *head = NULL, *cache = NULL;
+	struct pkt_cache **prev = NULL;
+	struct rtp_pkt_pool *pool = NULL;
+
+	pthread_once(&cache_key_once, &cache_key_create);
+	if (cache_key_res < 0)
+		return NULL;
+
+	/* The cache of the pool is moved to the head of the chain, so it is
+	 * usually the first one; the caches of destroyed pools are freed on
+	 * the way */
+	first = pthread_getspecific(cache_key);
+	head = first;
+	prev = &head;
+	while ((cache = *prev) != NULL) {
+		pool = __atomic_load_n(&cache->pool, __ATOMIC_ACQUIRE);
+		if (pool == self) {
+			*prev = cache->next;
+			break;
+		}
+		if (pool == NULL) {
+			*prev = cache->next;
+			free(cache);
+		} else {
+			prev = &cache->next;
+		}
+	}
+
+	if (cache == NULL) {
+		cache = calloc(1,
+			       sizeof(*cache) + self->cfg.cache_size *
+						       sizeof(cache->pkts[0]));
+		if (cache == NULL)
+			return NULL;
+		cache->pool = self;
+		pthread_mutex_lock(&self->mutex);
+		list_add_before(&self->caches, &cache->node);
+		pthread_mutex_unlock(&self->mutex);
+	}
+	cache->next = head;
+	head = cache;
+
+	/* Setting the value can only fail when the thread has no value yet,
+	 * i.e. for a new cache */
+	if (head != first && pthread_setspecific(cache_key, head) != 0) {
+		pthread_mutex_lock(&self->mutex);
+		list_del(&cache->node);
+		pthread_mutex_unlock(&self->mutex);
+		free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+
+int rtp_pkt_pool_new(const struct rtp_pkt_pool_cfg *cfg,
+		     struct rtp_pkt_pool **ret_obj)
+{
+	int res = 0;
+	struct rtp_pkt_pool *self = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	*ret_obj = NULL;
+
+	self = calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+	self->cfg = *cfg;
+	if (self->cfg.grow_count == 0)
+		self->cfg.grow_count = RTP_PKT_POOL_DEFAULT_GROW_COUNT;
+	if (self->cfg.cache_size == 0)
+		self->cfg.cache_size = RTP_PKT_POOL_DEFAULT_CACHE_SIZE;
+	list_init(&self->caches);
+	pthread_mutex_init(&self->mutex, NULL);
+
+	res = pool_grow(self, self->cfg.initial_count);
+	if (res < 0 && res != -ENOSPC) {
+		ULOG_ERRNO("pool_grow", -res);
+		rtp_pkt_pool_destroy(self);
+		return res;
+	}
+
+	*ret_obj = self;
+	return 0;
+}
+
+
+int rtp_pkt_pool_destroy(struct rtp_pkt_pool *self)
+{
+	struct rtp_pkt_pool_stats stats;
+	struct pkt_cache *cache = NULL, *tmp = NULL;
+	struct pkt_slab *slab = NULL;
+
+	if (self == NULL)
+		return 0;
+
+	rtp_pkt_pool_get_stats(self, &stats);
+	if (stats.outstanding != 0) {
+		ULOGE("pool %p: %u packets still in use",
+		      self,
+		      stats.outstanding);
+		return -EBUSY;
+	}
+
+	/* The remaining thread caches are detached from the pool, their
+	 * threads free them on their next access to the chain or on exit */
+	pthread_mutex_lock(&cache_mutex);
+	pthread_mutex_lock(&self->mutex);
+	list_walk_entry_forward_safe(&self->caches, cache, tmp, node)
+	{
+		list_del(&cache->node);
+		__atomic_store_n(&cache->pool, NULL, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&self->mutex);
+	pthread_mutex_unlock(&cache_mutex);
+
+	while (self->slabs != NULL) {
+		slab = self->slabs;
+		self->slabs = slab->next;
+		free(slab);
+	}
+
+	pthread_mutex_destroy(&self->mutex);
+	free(self->free_pkts);
+	free(self);
+	return 0;
+}
+
+
+int rtp_pkt_pool_get_stats(struct rtp_pkt_pool *self,
+			   struct rtp_pkt_pool_stats *stats)
+{
+	struct pkt_cache *cache = NULL;
+	uint64_t gets = 0, puts = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	pthread_mutex_lock(&self->mutex);
+	stats->hits = self->hits;
+	stats->misses = self->misses;
+	gets = self->gets;
+	puts = self->puts;
+	list_walk_entry_forward(&self->caches, cache, node)
+	{
+		stats->hits += cache->hits;
+		stats->misses += cache->misses;
+		gets += cache->gets;
+		puts += cache->puts;
+	}
+	stats->outstanding = gets > puts ? gets - puts : 0;
+	stats->allocated = self->allocated;
+	pthread_mutex_unlock(&self->mutex);
+
+	return 0;
+}
+
+
+static void count_get(struct rtp_pkt_pool *self,
+		      struct pkt_cache *cache,
+		      bool miss,
+		      bool from_pool)
+{
+	if (cache == NULL) {
+		pthread_mutex_lock(&self->mutex);
+		self->misses += miss;
+		self->hits += !miss;
+		self->gets += from_pool;
+		pthread_mutex_unlock(&self->mutex);
+		return;
+	}
+
+	cache->misses += miss;
+	cache->hits += !miss;
+	cache->gets += from_pool;
+}
+
+
+int rtp_pkt_pool_get(struct rtp_pkt_pool *self, struct rtp_pkt **ret_pkt)
+{
+	int res = 0;
+	struct pkt_cache *cache = NULL;
+	struct rtp_pkt *pkt = NULL;
+	struct rtp_pkt_priv *priv = NULL;
+	bool miss = false;
+	uint32_t count = 0;
+
+	cache = cache_get(self);
+	if (cache != NULL && cache->count > 0) {
+		/* Fast path */
+		pkt = cache->pkts[--cache->count];
+		goto out;
+	}
+
+	pthread_mutex_lock(&self->mutex);
+	if (self->free_count == 0) {
+		res = pool_grow(self, self->cfg.grow_count);
+		miss = true;
+	}
+	if (self->free_count > 0) {
+		pkt = self->free_pkts[--self->free_count];
+
+		/* Refill half of the thread cache */
+		count = cache != NULL ? self->cfg.cache_size / 2 : 0;
+		while (count > 0 && self->free_count > 0) {
+			cache->pkts[cache->count++] =
+				self->free_pkts[--self->free_count];
+			count--;
+		}
+	}
+	pthread_mutex_unlock(&self->mutex);
+
+	if (pkt == NULL) {
+		/* Pool exhausted (or could not grow), use the heap */
+		if (res != -ENOSPC)
+			ULOG_ERRNO("pool_grow", -res);
+		priv = calloc(1, sizeof(*priv));
+		if (priv == NULL)
+			return -ENOMEM;
+		count_get(self, cache, true, false);
+		list_node_unref(&priv->pkt.node);
+		*ret_pkt = &priv->pkt;
+		return 0;
+	}
+
+out:
+	count_get(self, cache, miss, true);
+	priv = rtp_pkt_priv(pkt);
+	memset(priv, 0, sizeof(*priv));
+	list_node_unref(&priv->pkt.node);
+	priv->pool = self;
+	*ret_pkt = &priv->pkt;
+	return 0;
+}
+
+
+void rtp_pkt_pool_put(struct rtp_pkt_pool *self, struct rtp_pkt *pkt)
+{
+	struct pkt_cache *cache = cache_get(self);
+
+	if (cache != NULL && cache->count < self->cfg.cache_size) {
+		/* Fast path */
+		cache->pkts[cache->count++] = pkt;
+		cache->puts++;
+		return;
+	}
+
+	pthread_mutex_lock(&self->mutex);
+	if (cache != NULL) {
+		/* Give half of the thread cache back to the pool */
+		cache_flush(self, cache, (self->cfg.cache_size + 1) / 2);
+		cache->pkts[cache->count++] = pkt;
+		cache->puts++;
+	} else {
+		self->free_pkts[self->free_count++] = pkt;
+		self->puts++;
+	}
+	pthread_mutex_unlock(&self->mutex);
+}
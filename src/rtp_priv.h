@@ -45,6 +45,7 @@
 #include <ulog.h>
 
 #include <futils/list.h>
+#include <futils/timetools.h>
 #include <libpomp.h>
 
 #include "rtp/rtp.h"
@@ -123,6 +124,117 @@ rtp_read_u64(const struct pomp_buffer *buf, size_t *pos, uint64_t *v)
 }
 
 
+/* Big-endian loads from contiguous memory, bounds must be checked by the
+ * caller */
+static inline uint16_t rtp_load_u16(const uint8_t *p)
+{
+	uint16_t v;
+	memcpy(&v, p, sizeof(v));
+	return ntohs(v);
+}
+
+
+static inline uint32_t rtp_load_u32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+
+/* Big-endian stores to contiguous memory, bounds must be checked by the
+ * caller */
+static inline void rtp_store_u16(uint8_t *p, uint16_t v)
+{
+	v = htons(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+
+static inline void rtp_store_u32(uint8_t *p, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+
+/* Internal part of the packets allocated by the library (rtp_pkt_new(),
+ * rtp_pkt_clone() and the packet pool), the public packet is the first
+ * member; packets provided by the caller (e.g. to rtp_pkt_read()) have no
+ * internal part, it must only be accessed on packets the library owns */
+struct rtp_pkt_priv {
+	struct rtp_pkt pkt;
+
+	/* Pool the packet was drawn from (NULL if allocated on the heap) */
+	struct rtp_pkt_pool *pool;
+
+	/* Eviction score and position in the eviction heap of the jitter
+	 * buffer the packet is queued in */
+	uint64_t evict_score;
+	uint32_t evict_index;
+};
+
+
+static inline struct rtp_pkt_priv *rtp_pkt_priv(const struct rtp_pkt *pkt)
+{
+	return (struct rtp_pkt_priv *)pkt;
+}
+
+
+/* Draw a zeroed packet from the pool (see rtp_pkt_pool.c) */
+int rtp_pkt_pool_get(struct rtp_pkt_pool *pool, struct rtp_pkt **ret_pkt);
+
+
+/* Give a packet back to the pool it was drawn from */
+void rtp_pkt_pool_put(struct rtp_pkt_pool *pool, struct rtp_pkt *pkt);
+
+
+struct rtp_jitter_group_entry;
+
+
+/* Set or clear (group == NULL) the group of a jitter buffer; returns -EBUSY
+ * if it is already in a group or attached to a loop */
+int rtp_jitter_set_group(struct rtp_jitter *jitter,
+			 struct rtp_jitter_group *group,
+			 struct rtp_jitter_group_entry *entry);
+
+
+/* Entry of a jitter buffer in the given group, NULL if not a member */
+struct rtp_jitter_group_entry *
+rtp_jitter_get_group_entry(struct rtp_jitter *jitter,
+			   struct rtp_jitter_group *group);
+
+
+/* Number and total size of the packets queued in a jitter buffer */
+void rtp_jitter_get_queued(struct rtp_jitter *jitter,
+			   uint32_t *count,
+			   size_t *bytes);
+
+
+/* Evict the queued packet with the highest eviction score and get its size;
+ * returns -ENOENT if no packet is queued */
+int rtp_jitter_evict(struct rtp_jitter *jitter, size_t *bytes);
+
+
+/* Called by a member when its next deadline may have changed (see
+ * rtp_jitter_group.c) */
+void rtp_jitter_group_update(struct rtp_jitter_group *group,
+			     struct rtp_jitter_group_entry *entry);
+
+
+/* Called by a member when packets are queued (positive values) or removed
+ * (negative values) */
+void rtp_jitter_group_account(struct rtp_jitter_group *group,
+			      struct rtp_jitter_group_entry *entry,
+			      int32_t pkts,
+			      int64_t bytes);
+
+
+/* Called by a member after queuing a packet: evict packets from the members
+ * while the group budget is exceeded */
+void rtp_jitter_group_enforce(struct rtp_jitter_group *group);
+
+
 static inline int16_t rtp_diff_seqnum(uint16_t sq1, uint16_t sq2)
 {
 	return (int16_t)(sq1 - sq2);
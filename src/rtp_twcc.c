@@ -0,0 +1,279 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "rtp_priv.h"
+
+
+/* Arrival time of a sequence number not received */
+#define NOT_RECEIVED UINT64_MAX
+
+/* Unit of the receive deltas (us) */
+#define DELTA_US 250
+
+/* Reference time unit, in receive deltas units (64 ms) */
+#define REF_TIME_DELTAS 256
+
+/* Largest receive delta; a report may be split by
+ * rtcp_pkt_write_rtpfb_split(), which rebases the first delta of the
+ * following packets by less than REF_TIME_DELTAS */
+#define MAX_DELTA (INT16_MAX - (REF_TIME_DELTAS - 1))
+
+
+struct rtp_twcc_recorder {
+	struct rtp_twcc_recorder_cfg cfg;
+	uint32_t mask;
+	struct rtp_recip delta_recip;
+
+	/* Arrival times indexed by extended sequence number, the slots hold
+	 * the sequence numbers from highest - mask to highest; next is the
+	 * first sequence number not reported yet (highest - next <= mask),
+	 * both are valid if started is set */
+	uint64_t *arrivals;
+	uint64_t next;
+	uint64_t highest;
+	int started;
+
+	/* Feedbacks of the last report */
+	struct rtcp_pkt_rtpfb_feedback *feedbacks;
+	uint8_t feedback_pkt_count;
+
+	struct rtp_twcc_recorder_stats stats;
+};
+
+
+int rtp_twcc_recorder_new(const struct rtp_twcc_recorder_cfg *cfg,
+			  struct rtp_twcc_recorder **ret_obj)
+{
+	struct rtp_twcc_recorder *self = NULL;
+	uint32_t size = RTP_TWCC_RECORDER_DEFAULT_SIZE;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->size > RTP_TWCC_RECORDER_MAX_SIZE,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	*ret_obj = NULL;
+
+	if (cfg->size != 0) {
+		size = 1;
+		while (size < cfg->size)
+			size <<= 1;
+	}
+
+	self = calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+	self->cfg = *cfg;
+	self->cfg.size = size;
+	self->mask = size - 1;
+	rtp_recip_init(&self->delta_recip, DELTA_US);
+
+	self->arrivals = malloc(size * sizeof(*self->arrivals));
+	self->feedbacks = calloc(size, sizeof(*self->feedbacks));
+	if (self->arrivals == NULL || self->feedbacks == NULL) {
+		rtp_twcc_recorder_destroy(self);
+		return -ENOMEM;
+	}
+
+	*ret_obj = self;
+	return 0;
+}
+
+
+int rtp_twcc_recorder_destroy(struct rtp_twcc_recorder *self)
+{
+	if (self == NULL)
+		return 0;
+
+	free(self->arrivals);
+	free(self->feedbacks);
+	free(self);
+	return 0;
+}
+
+
+/* Give up reporting the sequence numbers before next */
+static void drop_until(struct rtp_twcc_recorder *self, uint64_t next)
+{
+	uint64_t end = next <= self->highest ? next : self->highest + 1;
+
+	for (uint64_t seq = self->next; seq < end; seq++) {
+		if (self->arrivals[seq & self->mask] != NOT_RECEIVED)
+			self->stats.dropped++;
+	}
+	self->next = next;
+}
+
+
+int rtp_twcc_recorder_record(struct rtp_twcc_recorder *self,
+			     uint16_t seqnum,
+			     uint64_t arrival_us)
+{
+	uint64_t ext, seq;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(arrival_us == NOT_RECEIVED, EINVAL);
+
+	if (!self->started) {
+		/* Start far from 0 so that older sequence numbers can still
+		 * be extended */
+		self->highest = ((uint64_t)1 << 32) | seqnum;
+		self->next = self->highest;
+		self->arrivals[self->highest & self->mask] = NOT_RECEIVED;
+		self->started = 1;
+	}
+	ext = self->highest + rtp_diff_seqnum(seqnum, self->highest);
+
+	if (ext < self->next) {
+		self->stats.late++;
+		return -EALREADY;
+	}
+
+	if (ext > self->highest) {
+		/* Keep the span of the unreported sequence numbers within the
+		 * ring, then clear the slots of the new sequence numbers */
+		if (ext - self->next > self->mask)
+			drop_until(self, ext - self->mask);
+		seq = self->highest + 1;
+		if (ext - seq > self->mask)
+			seq = ext - self->mask;
+		for (; seq < ext; seq++)
+			self->arrivals[seq & self->mask] = NOT_RECEIVED;
+		self->highest = ext;
+	} else if (self->arrivals[ext & self->mask] != NOT_RECEIVED) {
+		self->stats.duplicates++;
+		return -EALREADY;
+	}
+
+	self->arrivals[ext & self->mask] = arrival_us;
+	self->stats.recorded++;
+	return 0;
+}
+
+
+int rtp_twcc_recorder_get_report(struct rtp_twcc_recorder *self,
+				 struct rtcp_pkt_rtpfb_report *report)
+{
+	struct rtcp_pkt_rtpfb_feedback *fb = NULL;
+	uint64_t seq, arrival;
+	int64_t ticks, prev = 0, delta;
+	uint32_t count = 0;
+	int has_ref = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(report == NULL, EINVAL);
+
+	if (!self->started || self->next > self->highest)
+		return -EAGAIN;
+
+	memset(report, 0, sizeof(*report));
+	report->sender_ssrc = self->cfg.sender_ssrc;
+	report->media_ssrc = self->cfg.media_ssrc;
+	report->base_seq = self->next;
+	report->feedback_pkt_count = self->feedback_pkt_count;
+	report->feedbacks = self->feedbacks;
+
+	/* The receive deltas are computed on the 250 us grid of the absolute
+	 * arrival times, so that their rounding errors do not accumulate; the
+	 * reference time is the one of the first packet received */
+	for (seq = self->next; seq <= self->highest; seq++) {
+		fb = &self->feedbacks[count];
+		fb->seq_num = seq;
+		arrival = self->arrivals[seq & self->mask];
+		if (arrival == NOT_RECEIVED) {
+			fb->pkt_status_symbol = 0;
+			fb->recv_delta = 0;
+			count++;
+			continue;
+		}
+
+		ticks = rtp_recip_div(&self->delta_recip, arrival);
+		if (!has_ref) {
+			prev = ticks - ticks % REF_TIME_DELTAS;
+			report->ref_time = (prev / REF_TIME_DELTAS) & 0xFFFFFF;
+			has_ref = 1;
+		}
+		delta = ticks - prev;
+		if (delta < INT16_MIN || delta > MAX_DELTA)
+			break;
+		fb->pkt_status_symbol =
+			delta >= 0 && delta <= UINT8_MAX ? 1 : 2;
+		fb->recv_delta = delta;
+		prev = ticks;
+		count++;
+	}
+
+	report->status_count = count;
+	self->next += count;
+	self->feedback_pkt_count++;
+	self->stats.reports++;
+	return 0;
+}
+
+
+int rtp_twcc_recorder_write(struct rtp_twcc_recorder *self,
+			    struct pomp_buffer *buf,
+			    size_t *pos,
+			    size_t max_size)
+{
+	int res;
+	struct rtcp_pkt_rtpfb_report report;
+	uint64_t next;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pos == NULL, EINVAL);
+
+	next = self->next;
+	res = rtp_twcc_recorder_get_report(self, &report);
+	if (res < 0)
+		return res;
+
+	res = rtcp_pkt_write_rtpfb_split(buf, pos, &report, max_size);
+	if (res < 0) {
+		/* Report the packets again next time */
+		ULOG_ERRNO("rtcp_pkt_write_rtpfb_split", -res);
+		self->next = next;
+		self->feedback_pkt_count--;
+		self->stats.reports--;
+		return res;
+	}
+
+	/* One feedback packet count per RTPFB packet */
+	self->feedback_pkt_count += res - 1;
+	return res;
+}
+
+
+int rtp_twcc_recorder_get_stats(struct rtp_twcc_recorder *self,
+				struct rtp_twcc_recorder_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	*stats = self->stats;
+	return 0;
+}
@@ -0,0 +1,240 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rtp/rtp.h"
+
+#define STATUS_COUNT 1000
+#define ITERATIONS 2000
+#define BATCH_SIZE 64
+
+
+struct bench_ctx {
+	struct rtcp_pkt_rtpfb_feedback feedbacks[STATUS_COUNT];
+	uint64_t count;
+	int64_t sum;
+	int bulk;
+};
+
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Pattern 0: all received with small deltas (run lengths), pattern 1:
+ * random losses (1-bit status vectors), pattern 2: random losses and large
+ * deltas (2-bit status vectors) */
+static struct pomp_buffer *make_report(int pattern,
+				       struct rtcp_pkt_rtpfb_feedback *fb)
+{
+	struct rtcp_pkt_rtpfb_report report = {
+		.sender_ssrc = 0x12345678,
+		.media_ssrc = 0x9abcdef0,
+		.base_seq = 65000,
+		.status_count = STATUS_COUNT,
+		.ref_time = 1234,
+		.feedback_pkt_count = 1,
+		.feedbacks = fb,
+	};
+	struct pomp_buffer *buf = pomp_buffer_new(8192);
+	size_t pos = 0;
+	int res;
+
+	for (int i = 0; i < STATUS_COUNT; i++) {
+		uint8_t symbol = 1;
+		if (pattern >= 1 && rand() % 10 == 0)
+			symbol = 0;
+		else if (pattern == 2 && rand() % 4 == 0)
+			symbol = 2;
+		fb[i].seq_num = report.base_seq + i;
+		fb[i].pkt_status_symbol = symbol;
+		fb[i].recv_delta = symbol == 1	 ? rand() % 256
+				   : symbol == 2 ? -(rand() % 1000)
+						 : 0;
+	}
+
+	res = rtcp_pkt_write_rtpfb(buf, &pos, &report);
+	if (res < 0) {
+		fprintf(stderr, "rtcp_pkt_write_rtpfb: %s\n", strerror(-res));
+		exit(EXIT_FAILURE);
+	}
+	return buf;
+}
+
+
+static void report_cb(const struct rtcp_pkt_rtpfb_report *rtpfb,
+		      void *userdata)
+{
+	struct bench_ctx *ctx = userdata;
+
+	for (int i = 0; i < rtpfb->status_count; i++)
+		ctx->sum += rtpfb->feedbacks[i].recv_delta;
+	ctx->count += rtpfb->status_count;
+	memcpy(ctx->feedbacks,
+	       rtpfb->feedbacks,
+	       rtpfb->status_count * sizeof(*rtpfb->feedbacks));
+}
+
+
+static void report_iter_cb(const struct rtcp_pkt_rtpfb_report *rtpfb,
+			   struct rtcp_pkt_rtpfb_iter *iter,
+			   void *userdata)
+{
+	struct bench_ctx *ctx = userdata;
+	struct rtcp_pkt_rtpfb_feedback *fb = ctx->feedbacks;
+	int n = 0, res;
+
+	if (!ctx->bulk) {
+		while (rtcp_pkt_rtpfb_iter_next(iter, &fb[n]) == 0)
+			ctx->sum += fb[n++].recv_delta;
+	} else {
+		while ((res = rtcp_pkt_rtpfb_iter_read(
+				iter, &fb[n], BATCH_SIZE)) > 0) {
+			for (int i = n; i < n + res; i++)
+				ctx->sum += fb[i].recv_delta;
+			n += res;
+		}
+	}
+	ctx->count += n;
+}
+
+
+static int check(const struct bench_ctx *ctx,
+		 const struct rtcp_pkt_rtpfb_feedback *fb)
+{
+	int errors = 0;
+
+	for (int i = 0; i < STATUS_COUNT; i++) {
+		if (ctx->feedbacks[i].seq_num != fb[i].seq_num ||
+		    ctx->feedbacks[i].pkt_status_symbol !=
+			    fb[i].pkt_status_symbol ||
+		    ctx->feedbacks[i].recv_delta != fb[i].recv_delta)
+			errors++;
+	}
+	return errors;
+}
+
+
+static int bench_write(const char *pattern,
+		       const struct pomp_buffer *ref,
+		       struct rtcp_pkt_rtpfb_feedback *fb)
+{
+	struct rtcp_pkt_rtpfb_report report = {
+		.sender_ssrc = 0x12345678,
+		.media_ssrc = 0x9abcdef0,
+		.base_seq = 65000,
+		.status_count = STATUS_COUNT,
+		.ref_time = 1234,
+		.feedback_pkt_count = 1,
+		.feedbacks = fb,
+	};
+	struct pomp_buffer *buf = pomp_buffer_new(0);
+	const void *ref_data, *data;
+	size_t ref_len, len = 0, pos;
+	uint64_t start, elapsed;
+	int errors = 0;
+
+	start = get_time_ns();
+	for (int it = 0; it < ITERATIONS; it++) {
+		pos = 0;
+		pomp_buffer_set_len(buf, 0);
+		if (rtcp_pkt_write_rtpfb(buf, &pos, &report) < 0)
+			errors++;
+	}
+	elapsed = get_time_ns() - start;
+
+	/* Same output as the packet being read */
+	pomp_buffer_get_cdata(ref, &ref_data, &ref_len, NULL);
+	pomp_buffer_get_cdata(buf, &data, &len, NULL);
+	if (len != ref_len || memcmp(data, ref_data, len) != 0)
+		errors++;
+
+	printf("%-5s write: %5.2f ns/feedback (%zu bytes)\n",
+	       pattern,
+	       (double)elapsed / ((uint64_t)ITERATIONS * STATUS_COUNT),
+	       len);
+	pomp_buffer_unref(buf);
+	return errors;
+}
+
+
+int main()
+{
+	static const char *const patterns[] = {"run", "1-bit", "2-bit"};
+	static const char *const modes[] = {"array", "next", "bulk"};
+	static struct rtcp_pkt_rtpfb_feedback fb[STATUS_COUNT];
+	static struct bench_ctx ctx;
+	struct rtcp_pkt_read_cbs cbs;
+	struct pomp_buffer *buf;
+	uint64_t start, elapsed;
+	int errors = 0;
+
+	srand(1);
+	for (int p = 0; p < 3; p++) {
+		buf = make_report(p, fb);
+		errors += bench_write(patterns[p], buf, fb);
+		for (int m = 0; m < 3; m++) {
+			memset(&cbs, 0, sizeof(cbs));
+			memset(&ctx, 0, sizeof(ctx));
+			if (m == 0)
+				cbs.rtpfb_report = &report_cb;
+			else
+				cbs.rtpfb_report_iter = &report_iter_cb;
+			ctx.bulk = (m == 2);
+
+			start = get_time_ns();
+			for (int it = 0; it < ITERATIONS; it++) {
+				if (rtcp_pkt_read(buf, &cbs, &ctx) < 0)
+					errors++;
+			}
+			elapsed = get_time_ns() - start;
+
+			if (ctx.count != (uint64_t)ITERATIONS * STATUS_COUNT)
+				errors++;
+			errors += check(&ctx, fb);
+			printf("%-5s %-5s: %5.2f ns/feedback (sum %" PRIi64
+			       ")\n",
+			       patterns[p],
+			       modes[m],
+			       (double)elapsed / ctx.count,
+			       ctx.sum / ITERATIONS);
+		}
+		pomp_buffer_unref(buf);
+	}
+
+	printf("errors: %d\n", errors);
+	return errors == 0 ? 0 : 1;
+}
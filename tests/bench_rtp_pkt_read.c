@@ -0,0 +1,141 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rtp/rtp.h"
+
+#define BATCH_SIZE 64
+#define ITERATIONS 20000
+
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static struct pomp_buffer *make_packet(uint16_t seqnum, int variant)
+{
+	uint8_t data[1400];
+	size_t len = 1200 + (seqnum % 100);
+	uint16_t flags = 0;
+	size_t pos = RTP_PKT_HEADER_SIZE;
+
+	memset(data, 0xa5, sizeof(data));
+	RTP_PKT_HEADER_FLAGS_SET(flags, VERSION, RTP_PKT_VERSION);
+	RTP_PKT_HEADER_FLAGS_SET(flags, PAYLOAD_TYPE, 96);
+	RTP_PKT_HEADER_FLAGS_SET(flags, MARKER, seqnum % 10 == 0);
+
+	if (variant == 1) {
+		/* 1 CSRC + 2-word extension header */
+		RTP_PKT_HEADER_FLAGS_SET(flags, CSRC, 1);
+		RTP_PKT_HEADER_FLAGS_SET(flags, EXTENSION, 1);
+		pos += 4;
+		data[pos + 2] = 0;
+		data[pos + 3] = 2;
+	} else if (variant == 2) {
+		/* 4 bytes of padding */
+		RTP_PKT_HEADER_FLAGS_SET(flags, PADDING, 1);
+		data[len - 1] = 4;
+	}
+
+	data[0] = flags >> 8;
+	data[1] = flags & 0xff;
+	data[2] = seqnum >> 8;
+	data[3] = seqnum & 0xff;
+	data[4] = 0x12;
+	data[5] = 0x34;
+	data[6] = 0x56;
+	data[7] = 0x78;
+	data[8] = 0xca;
+	data[9] = 0xfe;
+	data[10] = 0xba;
+	data[11] = 0xbe;
+
+	return pomp_buffer_new_with_data(data, len);
+}
+
+
+int main()
+{
+	struct pomp_buffer *bufs[BATCH_SIZE];
+	struct rtp_pkt pkts[BATCH_SIZE];
+	int results[BATCH_SIZE];
+	uint64_t start = 0, single_ns = 0, batch_ns = 0;
+	uint64_t total = (uint64_t)BATCH_SIZE * ITERATIONS;
+	int count = 0, errors = 0;
+
+	for (int i = 0; i < BATCH_SIZE; i++)
+		bufs[i] = make_packet(i, i % 3);
+
+	/* Single packet path */
+	start = get_time_ns();
+	for (int it = 0; it < ITERATIONS; it++) {
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			memset(&pkts[i], 0, sizeof(pkts[i]));
+			if (rtp_pkt_read(bufs[i], &pkts[i]) < 0)
+				errors++;
+			pomp_buffer_unref(pkts[i].raw.buf);
+		}
+	}
+	single_ns = get_time_ns() - start;
+
+	/* Batch path */
+	memset(pkts, 0, sizeof(pkts));
+	start = get_time_ns();
+	for (int it = 0; it < ITERATIONS; it++) {
+		count = rtp_pkt_read_batch(bufs, BATCH_SIZE, pkts, results);
+		errors += BATCH_SIZE - count;
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			if (results[i] == 0)
+				pomp_buffer_unref(pkts[i].raw.buf);
+		}
+	}
+	batch_ns = get_time_ns() - start;
+
+	printf("packets: %" PRIu64 " (batch size %d), errors: %d\n",
+	       total,
+	       BATCH_SIZE,
+	       errors);
+	printf("single: %.1f ns/pkt, %.0f pkt/s\n",
+	       (double)single_ns / total,
+	       total * 1e9 / single_ns);
+	printf("batch:  %.1f ns/pkt, %.0f pkt/s\n",
+	       (double)batch_ns / total,
+	       total * 1e9 / batch_ns);
+
+	for (int i = 0; i < BATCH_SIZE; i++)
+		pomp_buffer_unref(bufs[i]);
+
+	return errors == 0 ? 0 : 1;
+}
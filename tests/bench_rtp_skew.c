@@ -0,0 +1,306 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rtp/rtp.h"
+
+#include "skew_trace.h"
+
+/**
+ * Skew estimator benchmark: feeds a trace of (input timestamp, RTP
+ * timestamp) pairs through the jitter buffer and through a reference copy
+ * of the previous estimator (sliding window minimum found with a linear
+ * rescan), and compares their outputs and cost.
+ *
+ * Usage: bench-rtp-skew [<trace> [<clk_rate>]]
+ * The trace is a text file with one "<in_us> <rtp_timestamp>" line per
+ * packet (RTP timestamps may wrap); a synthetic trace is used otherwise.
+ */
+
+#define REF_WINDOW_MAX_SIZE 512
+#define REF_WINDOW_TIMEOUT 2000000
+#define REF_AVG_ALPHA 128
+#define REF_LARGE_GAP 1000000
+
+#define DELAY 100000
+
+
+struct ref_skew {
+	uint64_t first_rx_timestamp;
+	uint64_t first_rtp_timestamp;
+	int64_t window[REF_WINDOW_MAX_SIZE];
+	uint32_t window_pos;
+	uint32_t window_size;
+	uint64_t window_start_timestamp;
+	int64_t window_min;
+	int64_t skew_avg;
+	uint64_t rescans;
+};
+
+
+struct lib_output {
+	uint64_t *out;
+	size_t count;
+};
+
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void ref_reset(struct ref_skew *s, uint64_t rx, uint64_t rtp)
+{
+	s->first_rx_timestamp = rx;
+	s->first_rtp_timestamp = rtp;
+	s->window_pos = 0;
+	s->window_size = 0;
+	s->window_start_timestamp = 0;
+	s->window_min = 0;
+	s->skew_avg = 0;
+}
+
+
+/* Previous implementation of the sliding window estimator */
+static uint64_t
+ref_compute_skew(struct ref_skew *s, uint64_t rx, uint64_t rtp, uint32_t clk)
+{
+	int64_t delta_recv, delta_send, skew;
+	uint64_t out;
+
+	if (s->first_rx_timestamp == 0 || s->first_rtp_timestamp == 0)
+		ref_reset(s, rx, rtp);
+
+	delta_send = rtp - s->first_rtp_timestamp;
+	if (delta_send < 0) {
+		ref_reset(s, rx, rtp);
+		delta_send = 0;
+	} else {
+		delta_send = rtp_timestamp_to_us(delta_send, clk);
+	}
+	delta_recv = rx - s->first_rx_timestamp;
+	skew = delta_recv - delta_send;
+
+	if (skew - s->skew_avg < -REF_LARGE_GAP ||
+	    skew - s->skew_avg > REF_LARGE_GAP) {
+		ref_reset(s, rx, rtp);
+		delta_send = 0;
+		delta_recv = 0;
+		skew = 0;
+	}
+
+	if (s->window_size == 0) {
+		s->window[s->window_pos] = skew;
+		if (s->window_pos == 0) {
+			s->window_start_timestamp = rx;
+			s->window_min = skew;
+		} else if (skew < s->window_min) {
+			s->window_min = skew;
+		}
+		s->window_pos++;
+		if (s->window_pos >= REF_WINDOW_MAX_SIZE ||
+		    rx >= s->window_start_timestamp + REF_WINDOW_TIMEOUT) {
+			s->window_size = s->window_pos;
+			s->window_pos = 0;
+			s->skew_avg = s->window_min;
+		} else if (rx >= s->window_start_timestamp) {
+			uint32_t perc_time = (rx - s->window_start_timestamp) *
+					     100 / REF_WINDOW_TIMEOUT;
+			uint32_t perc_window =
+				s->window_pos * 100 / REF_WINDOW_MAX_SIZE;
+			uint32_t perc = perc_time > perc_window ? perc_time
+								: perc_window;
+			perc = perc * perc;
+			s->skew_avg +=
+				perc * (s->window_min - s->skew_avg) / 10000;
+		} else {
+			ref_reset(s, rx, rtp);
+			return rx;
+		}
+	} else {
+		int64_t old = s->window[s->window_pos];
+		s->window[s->window_pos] = skew;
+		if (skew < s->window_min) {
+			s->window_min = skew;
+		} else if (old == s->window_min) {
+			s->rescans++;
+			s->window_min = INT64_MAX;
+			for (uint32_t i = 0; i < s->window_size; i++) {
+				if (s->window[i] == old) {
+					s->window_min = s->window[i];
+					break;
+				} else if (s->window[i] < s->window_min) {
+					s->window_min = s->window[i];
+				}
+			}
+		}
+		s->window_pos++;
+		if (s->window_pos >= s->window_size)
+			s->window_pos = 0;
+		s->skew_avg += (s->window_min - s->skew_avg) / REF_AVG_ALPHA;
+	}
+
+	out = s->first_rx_timestamp + delta_send + s->skew_avg;
+	if (out + DELAY < rx) {
+		ref_reset(s, rx, rtp);
+		out = rx;
+	}
+	return out;
+}
+
+
+static void process_pkt_cb(struct rtp_jitter *jitter,
+			   const struct rtp_pkt *pkt,
+			   uint32_t gap,
+			   void *userdata)
+{
+	struct lib_output *o = userdata;
+	o->out[o->count++] = pkt->out_timestamp;
+}
+
+
+/* Jitter buffer (packets are released immediately), returns the number of
+ * packets whose output differs from the reference */
+static size_t run_lib(const struct trace *t,
+		      int skew_compact,
+		      const uint64_t *ref_out,
+		      const int64_t *ref_avg)
+{
+	int res = 0;
+	struct lib_output lib;
+	struct rtp_jitter *jitter = NULL;
+	struct rtp_jitter_cfg cfg;
+	struct rtp_jitter_cbs cbs = {.process_pkt = &process_pkt_cb};
+	struct rtp_pkt *pkt = NULL;
+	int64_t *lib_avg = NULL;
+	uint64_t start = 0, lib_ns = 0;
+	size_t mem_size = 0;
+	size_t mismatches = 0;
+
+	memset(&lib, 0, sizeof(lib));
+	lib.out = calloc(t->count, sizeof(*lib.out));
+	lib_avg = calloc(t->count, sizeof(*lib_avg));
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.clk_rate = t->clk_rate;
+	cfg.delay = DELAY;
+	cfg.skew_compact = skew_compact;
+	res = rtp_jitter_get_mem_size(&cfg, &mem_size);
+	if (res < 0)
+		goto out;
+	res = rtp_jitter_new(&cfg, &cbs, &lib, &jitter);
+	if (res < 0)
+		goto out;
+	start = get_time_ns();
+	for (size_t i = 0; i < t->count; i++) {
+		rtp_pkt_new(&pkt);
+		pkt->header.seqnum = i & 0xffff;
+		pkt->in_timestamp = t->in[i];
+		pkt->rtp_timestamp = t->rtp[i];
+		rtp_jitter_enqueue(jitter, pkt);
+		rtp_jitter_get_info(jitter, NULL, NULL, &lib_avg[i]);
+		rtp_jitter_process(jitter, UINT64_MAX);
+	}
+	lib_ns = get_time_ns() - start;
+	rtp_jitter_destroy(jitter);
+
+	for (size_t i = 0; i < t->count; i++) {
+		if (i >= lib.count || lib.out[i] != ref_out[i] ||
+		    lib_avg[i] != ref_avg[i]) {
+			if (mismatches == 0)
+				printf("first mismatch at packet %zu\n", i);
+			mismatches++;
+		}
+	}
+
+	printf("rtp_jitter%s (enqueue + process): %.1f ns/pkt, "
+	       "%zu bytes/stream, %zu mismatches\n",
+	       skew_compact ? " compact" : "",
+	       (double)lib_ns / t->count,
+	       mem_size,
+	       mismatches);
+
+out:
+	free(lib.out);
+	free(lib_avg);
+	return res < 0 ? t->count : mismatches;
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct trace t;
+	struct ref_skew ref;
+	uint64_t *ref_out = NULL;
+	int64_t *ref_avg = NULL;
+	uint64_t start = 0, ref_ns = 0;
+	size_t mismatches = 0;
+
+	memset(&t, 0, sizeof(t));
+	memset(&ref, 0, sizeof(ref));
+	if (argc > 1) {
+		t.clk_rate = argc > 2 ? atoi(argv[2]) : 90000;
+		if (trace_load(&t, argv[1]) < 0)
+			return 1;
+	} else {
+		trace_synth(&t);
+	}
+
+	ref_out = calloc(t.count, sizeof(*ref_out));
+	ref_avg = calloc(t.count, sizeof(*ref_avg));
+
+	/* Reference estimator */
+	start = get_time_ns();
+	for (size_t i = 0; i < t.count; i++) {
+		ref_out[i] =
+			ref_compute_skew(&ref, t.in[i], t.rtp[i], t.clk_rate);
+		ref_avg[i] = ref.skew_avg;
+	}
+	ref_ns = get_time_ns() - start;
+
+	printf("packets: %zu (clk_rate %u)\n", t.count, t.clk_rate);
+	printf("reference (linear rescan): %.1f ns/pkt, %" PRIu64
+	       " rescans\n",
+	       (double)ref_ns / t.count,
+	       ref.rescans);
+
+	mismatches += run_lib(&t, 0, ref_out, ref_avg);
+	mismatches += run_lib(&t, 1, ref_out, ref_avg);
+
+	free(t.in);
+	free(t.rtp);
+	free(ref_out);
+	free(ref_avg);
+	return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,191 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rtp/rtp.h"
+
+#include "skew_trace.h"
+
+/**
+ * Skew estimators replay benchmark: feeds a trace of (input timestamp, RTP
+ * timestamp) pairs through jitter buffers using each skew mode and
+ * compares their cost and the stability of their outputs:
+ * - ns/pkt: enqueue + process time per packet,
+ * - out jitter: mean variation of the out timestamps intervals relative to
+ *   the RTP timestamps intervals (0 for a perfectly smooth output),
+ * - transit: mean input timestamp minus out timestamp, close to the mean
+ *   network jitter for an accurate estimator (larger when lagging behind
+ *   the drift, negative when ahead, adding to the delay),
+ * - restarts: skew estimation restarts (rtp_jitter_stats.skew_resets).
+ *
+ * Usage: bench-rtp-skew-replay [<trace> [<clk_rate>]]
+ * The trace is a text file with one "<in_us> <rtp_timestamp>" line per
+ * packet (RTP timestamps may wrap); a synthetic trace is used otherwise.
+ */
+
+#define DELAY 100000
+
+
+struct output {
+	uint64_t *out;
+	size_t count;
+};
+
+
+static const struct {
+	enum rtp_jitter_skew_mode mode;
+	const char *name;
+} modes[] = {
+	{RTP_JITTER_SKEW_MODE_SLIDING, "sliding"},
+	{RTP_JITTER_SKEW_MODE_BLOCK, "block"},
+	{RTP_JITTER_SKEW_MODE_REGRESSION, "regression"},
+	{RTP_JITTER_SKEW_MODE_EWMA, "ewma"},
+};
+
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void process_pkt_cb(struct rtp_jitter *jitter,
+			   const struct rtp_pkt *pkt,
+			   uint32_t gap,
+			   void *userdata)
+{
+	struct output *o = userdata;
+	o->out[o->count++] = pkt->out_timestamp;
+}
+
+
+static int run(const struct trace *t, enum rtp_jitter_skew_mode mode)
+{
+	int res = 0;
+	struct output o;
+	struct rtp_jitter *jitter = NULL;
+	struct rtp_jitter_cfg cfg;
+	struct rtp_jitter_cbs cbs = {.process_pkt = &process_pkt_cb};
+	struct rtp_jitter_stats stats;
+	struct rtp_pkt *pkt = NULL;
+	uint64_t start = 0, ns = 0;
+	size_t mem_size = 0;
+	double out_jitter = 0, transit = 0;
+	int64_t d_out = 0, d_send = 0;
+
+	memset(&o, 0, sizeof(o));
+	o.out = calloc(t->count, sizeof(*o.out));
+	if (o.out == NULL)
+		return -ENOMEM;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.clk_rate = t->clk_rate;
+	cfg.delay = DELAY;
+	cfg.skew_mode = mode;
+	res = rtp_jitter_get_mem_size(&cfg, &mem_size);
+	if (res < 0)
+		goto out;
+	res = rtp_jitter_new(&cfg, &cbs, &o, &jitter);
+	if (res < 0)
+		goto out;
+	start = get_time_ns();
+	for (size_t i = 0; i < t->count; i++) {
+		res = rtp_pkt_new(&pkt);
+		if (res < 0)
+			break;
+		pkt->header.seqnum = i & 0xffff;
+		pkt->in_timestamp = t->in[i];
+		pkt->rtp_timestamp = t->rtp[i];
+		rtp_jitter_enqueue(jitter, pkt);
+		rtp_jitter_process(jitter, UINT64_MAX);
+	}
+	ns = get_time_ns() - start;
+	rtp_jitter_get_stats(jitter, &stats);
+	rtp_jitter_destroy(jitter);
+	if (res < 0 || o.count != t->count)
+		goto out;
+
+	for (size_t i = 0; i < t->count; i++) {
+		transit += (int64_t)(t->in[i] - o.out[i]);
+		if (i == 0)
+			continue;
+		d_out = o.out[i] - o.out[i - 1];
+		d_send = rtp_timestamp_to_us(t->rtp[i] - t->rtp[i - 1],
+					     t->clk_rate);
+		out_jitter += d_out > d_send ? d_out - d_send : d_send - d_out;
+	}
+
+	printf("%-10s %8.1f ns/pkt %6zu bytes/stream %8.1f us out jitter "
+	       "%9.1f us transit %4u restarts %5d ppm drift\n",
+	       modes[mode].name,
+	       (double)ns / t->count,
+	       mem_size,
+	       out_jitter / (t->count - 1),
+	       transit / t->count,
+	       stats.skew_resets,
+	       stats.skew_drift);
+
+out:
+	free(o.out);
+	return res;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int res = 0;
+	struct trace t;
+
+	memset(&t, 0, sizeof(t));
+	if (argc > 1) {
+		t.clk_rate = argc > 2 ? atoi(argv[2]) : 90000;
+		if (trace_load(&t, argv[1]) < 0)
+			return 1;
+	} else {
+		trace_synth(&t);
+	}
+
+	printf("packets: %zu (clk_rate %u)\n", t.count, t.clk_rate);
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		res = run(&t, modes[i].mode);
+		if (res < 0) {
+			fprintf(stderr, "%s: %s\n", modes[i].name, strerror(-res));
+			break;
+		}
+	}
+
+	free(t.in);
+	free(t.rtp);
+	return res < 0 ? 1 : 0;
+}
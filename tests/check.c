@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "check.h"
+
+
+uint64_t failures;
+
+
+static uint64_t rand_state = 0x9e3779b97f4a7c15ULL;
+
+
+void check_cond(const char *what, int cond)
+{
+	if (cond)
+		return;
+	if (failures < CHECK_PRINT_MAX)
+		printf("%s\n", what);
+	failures++;
+}
+
+
+void check_value(const char *what, uint64_t value, int cond)
+{
+	if (cond)
+		return;
+	if (failures < CHECK_PRINT_MAX)
+		printf("%s (%" PRIu64 ")\n", what, value);
+	failures++;
+}
+
+
+void check_eq(const char *what, uint64_t in, uint64_t res, uint64_t ref)
+{
+	if (res == ref)
+		return;
+	if (failures < CHECK_PRINT_MAX) {
+		printf("%s(%" PRIu64 "): %" PRIu64 " != %" PRIu64 "\n",
+		       what,
+		       in,
+		       res,
+		       ref);
+	}
+	failures++;
+}
+
+
+uint64_t rand64(void)
+{
+	rand_state ^= rand_state >> 12;
+	rand_state ^= rand_state << 25;
+	rand_state ^= rand_state >> 27;
+	return rand_state * 0x2545f4914f6cdd1dULL;
+}
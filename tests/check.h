@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+#include <stdint.h>
+
+/**
+ * Checks and pseudo-random numbers shared by the tests.
+ */
+
+/* Number of failures printed, the other ones are only counted */
+#define CHECK_PRINT_MAX 20
+
+
+/* Number of failed checks */
+extern uint64_t failures;
+
+
+/* Count a failure if cond is not set */
+void check_cond(const char *what, int cond);
+
+
+/* Same as check_cond(), printing the value the check relates to (sequence
+ * number, round, time...) */
+void check_value(const char *what, uint64_t value, int cond);
+
+
+/* Count a failure if res is not ref, printing both with the input */
+void check_eq(const char *what, uint64_t in, uint64_t res, uint64_t ref);
+
+
+/* check(what, cond), check(what, value, cond) or check(what, in, res, ref):
+ * one of the above depending on the number of arguments */
+#define CHECK_SELECT(_1, _2, _3, _4, _name, ...) _name
+#define check(...)                                                             \
+	CHECK_SELECT(__VA_ARGS__, check_eq, check_value, check_cond, )         \
+	(__VA_ARGS__)
+
+
+/* xorshift64*, deterministic: the same sequence on each run */
+uint64_t rand64(void);
+
+
+#endif /* !_CHECK_H_ */
@@ -0,0 +1,90 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "skew_trace.h"
+
+
+int trace_load(struct trace *t, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	uint64_t in = 0, rtp = 0, prev = 0, ext = 0;
+	size_t cap = 0;
+
+	if (f == NULL) {
+		fprintf(stderr, "failed to open %s\n", path);
+		return -1;
+	}
+	while (fscanf(f, "%" SCNu64 " %" SCNu64, &in, &rtp) == 2) {
+		if (t->count == cap) {
+			cap = cap ? 2 * cap : 4096;
+			t->in = realloc(t->in, cap * sizeof(*t->in));
+			t->rtp = realloc(t->rtp, cap * sizeof(*t->rtp));
+		}
+		/* Extend 32-bit RTP timestamps */
+		rtp &= 0xffffffff;
+		if (t->count == 0)
+			ext = rtp + 0x100000000ULL;
+		else
+			ext += (int32_t)((uint32_t)rtp - (uint32_t)prev);
+		prev = rtp;
+		t->in[t->count] = in;
+		t->rtp[t->count] = ext;
+		t->count++;
+	}
+	fclose(f);
+	return t->count > 0 ? 0 : -1;
+}
+
+
+void trace_synth(struct trace *t)
+{
+	uint64_t send_us = 0;
+	double drift = 1.00008;
+	uint64_t stall_end = 0;
+
+	srand(42);
+	t->count = SKEW_TRACE_SYNTH_COUNT;
+	t->clk_rate = 90000;
+	t->in = calloc(t->count, sizeof(*t->in));
+	t->rtp = calloc(t->count, sizeof(*t->rtp));
+	for (size_t i = 0; i < t->count; i++) {
+		uint64_t frame = i / 10;
+		uint64_t in = 0;
+		send_us = frame * 1000000 / 30 + (i % 10) * 200;
+		t->rtp[i] = 12345678 + frame * 3000;
+		in = 1000000 + (uint64_t)(send_us * drift) + 20000 +
+		     rand() % 8000;
+		if (i % 100000 == 50000)
+			stall_end = in + 300000;
+		if (in < stall_end)
+			in = stall_end;
+		t->in[i] = in;
+	}
+}
@@ -0,0 +1,60 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SKEW_TRACE_H_
+#define _SKEW_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Traces of (input timestamp, RTP timestamp) pairs shared by the skew
+ * estimator benchmarks.
+ */
+
+#define SKEW_TRACE_SYNTH_COUNT 500000
+
+
+struct trace {
+	uint64_t *in;
+	uint64_t *rtp;
+	size_t count;
+	uint32_t clk_rate;
+};
+
+
+/* Load a text file with one "<in_us> <rtp_timestamp>" line per packet (RTP
+ * timestamps may wrap, they are extended on 64 bits); the clock rate is
+ * left to the caller. Returns -1 on error or if the trace is empty */
+int trace_load(struct trace *t, const char *path);
+
+
+/* Synthetic trace: 30 fps video, 10 packets per frame, sender clock 80 ppm
+ * slower, network jitter up to 8 ms with a few 300 ms stalls */
+void trace_synth(struct trace *t);
+
+
+#endif /* !_SKEW_TRACE_H_ */
@@ -0,0 +1,303 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtp/rtp.h"
+
+#include "check.h"
+
+/**
+ * Round-trip test of the RTPFB transport-wide feedback encoder: reports
+ * with random statuses are written, read back and compared, as a single
+ * packet and split on RTPFB_MAX_PKT statuses and MTUs; the reception
+ * times rebuilt from the split packets must match the original ones. The
+ * reports are read back in parts of RTPFB_REPORT_PART_MAX statuses, which
+ * must give the same reception times, including for the extreme receive
+ * deltas at the start of a part.
+ */
+
+#define ROUNDS 2000
+#define MAX_STATUS 5000
+#define MTU 1200
+
+
+struct received {
+	struct rtcp_pkt_rtpfb_feedback feedbacks[MAX_STATUS];
+	/* Reception times in 250us units, INT64_MIN if not received */
+	int64_t times[MAX_STATUS];
+	uint16_t base_seq;
+	uint32_t count;
+	uint32_t packets;
+	uint32_t parts;
+	uint8_t feedback_pkt_count;
+	int errors;
+};
+
+
+/* Random statuses, with runs and losses of various lengths */
+static void make_report(struct rtcp_pkt_rtpfb_report *report,
+			struct rtcp_pkt_rtpfb_feedback *fb,
+			uint16_t count)
+{
+	uint32_t loss = rand64() % 50, large = rand64() % 50;
+	uint32_t run = 0;
+	uint8_t symbol = 1;
+
+	memset(report, 0, sizeof(*report));
+	report->sender_ssrc = rand64();
+	report->media_ssrc = rand64();
+	report->base_seq = rand64();
+	report->status_count = count;
+	report->ref_time = rand64() & 0xFFFFFF;
+	report->feedback_pkt_count = rand64();
+	report->feedbacks = fb;
+
+	for (uint16_t i = 0; i < count; i++) {
+		if (run == 0) {
+			run = rand64() % 4 == 0 ? 1 + rand64() % 300 : 1;
+			symbol = 1;
+			if (rand64() % 100 < loss)
+				symbol = 0;
+			else if (rand64() % 100 < large)
+				symbol = 2;
+		}
+		run--;
+		fb[i].seq_num = report->base_seq + i;
+		fb[i].pkt_status_symbol = symbol;
+		if (symbol == 1)
+			fb[i].recv_delta = rand64() % 256;
+		else if (symbol == 2)
+			fb[i].recv_delta = (int16_t)(rand64() % 2000) - 1000;
+		else
+			fb[i].recv_delta = 0;
+	}
+}
+
+
+/* Reception times of a report, in 250us units */
+static void report_times(const struct rtcp_pkt_rtpfb_report *report,
+			 int64_t *times)
+{
+	int64_t time = (int64_t)report->ref_time * 256;
+
+	for (uint16_t i = 0; i < report->status_count; i++) {
+		const struct rtcp_pkt_rtpfb_feedback *fb = &report->feedbacks[i];
+		if (fb->pkt_status_symbol == 1 || fb->pkt_status_symbol == 2) {
+			time += fb->recv_delta;
+			times[i] = time;
+		} else {
+			times[i] = INT64_MIN;
+		}
+	}
+}
+
+
+static void report_cb(const struct rtcp_pkt_rtpfb_report *rtpfb,
+		      void *userdata)
+{
+	struct received *rx = userdata;
+	int64_t *times = &rx->times[rx->count];
+	uint16_t expected_seq = rx->base_seq + rx->count;
+	uint8_t next_pkt_count = rx->feedback_pkt_count + rx->packets;
+
+	/* Parts of a packet have the feedback count of the packet */
+	if (rtpfb->base_seq != expected_seq ||
+	    rtpfb->status_count > RTPFB_REPORT_PART_MAX ||
+	    rx->count + rtpfb->status_count > MAX_STATUS) {
+		rx->errors++;
+		return;
+	}
+	if (rtpfb->feedback_pkt_count == next_pkt_count) {
+		rx->packets++;
+	} else if (rx->packets == 0 ||
+		   rtpfb->feedback_pkt_count != (uint8_t)(next_pkt_count - 1)) {
+		rx->errors++;
+		return;
+	}
+	rx->parts++;
+	if (rtpfb->status_count > 0)
+		memcpy(&rx->feedbacks[rx->count],
+		       rtpfb->feedbacks,
+		       rtpfb->status_count * sizeof(*rtpfb->feedbacks));
+	report_times(rtpfb, times);
+	rx->count += rtpfb->status_count;
+}
+
+
+static void test_round(uint32_t round)
+{
+	static struct rtcp_pkt_rtpfb_feedback fb[MAX_STATUS];
+	static int64_t times[MAX_STATUS];
+	static struct received rx;
+	struct rtcp_pkt_rtpfb_report report;
+	struct rtcp_pkt_read_cbs cbs = {.rtpfb_report = &report_cb};
+	struct pomp_buffer *buf = pomp_buffer_new(0);
+	uint16_t count = rand64() % (round % 4 == 0 ? MAX_STATUS : 200);
+	const void *data = NULL;
+	size_t pos = 0, len = 0, pkt_len = 0;
+	size_t mtu = round % 3 == 0 ? 24 + rand64() % 1500 : MTU;
+	int res;
+
+	make_report(&report, fb, count);
+	report_times(&report, times);
+
+	/* Single packet: decoded feedbacks are identical (but the first
+	 * received one of each part after the first, which is rebased) */
+	if (count <= RTPFB_MAX_PKT) {
+		memset(&rx, 0, sizeof(rx));
+		rx.base_seq = report.base_seq;
+		rx.feedback_pkt_count = report.feedback_pkt_count;
+		res = rtcp_pkt_write_rtpfb(buf, &pos, &report);
+		check("write", round, res == 0);
+		check("pos", round, pos % 4 == 0);
+		res = rtcp_pkt_read(buf, &cbs, &rx);
+		check("read", round, res == 0);
+		check("single count",
+		      round,
+		      rx.packets == 1 && rx.count == count && rx.errors == 0);
+		check("single parts",
+		      round,
+		      rx.parts == (count == 0 ? 1
+					      : (count + RTPFB_REPORT_PART_MAX -
+						 1) / RTPFB_REPORT_PART_MAX));
+		for (uint16_t i = 0; i < count && i < rx.count; i++) {
+			check("single feedback",
+			      round,
+			      rx.feedbacks[i].seq_num == fb[i].seq_num &&
+				      (rx.feedbacks[i].pkt_status_symbol ==
+				       0) == (fb[i].pkt_status_symbol == 0) &&
+				      rx.times[i] == times[i]);
+			check("single delta",
+			      round,
+			      i >= RTPFB_REPORT_PART_MAX ||
+				      (rx.feedbacks[i].pkt_status_symbol ==
+					       fb[i].pkt_status_symbol &&
+				       rx.feedbacks[i].recv_delta ==
+					       fb[i].recv_delta));
+		}
+		pomp_buffer_set_len(buf, 0);
+		pos = 0;
+	}
+
+	/* Split packets: statuses and reception times are preserved */
+	memset(&rx, 0, sizeof(rx));
+	rx.base_seq = report.base_seq;
+	rx.feedback_pkt_count = report.feedback_pkt_count;
+	res = rtcp_pkt_write_rtpfb_split(buf, &pos, &report, mtu);
+	check("split write", round, res > 0);
+	res = rtcp_pkt_read(buf, &cbs, &rx);
+	check("split read", round, res == 0);
+	check("split count", round, rx.count == count && rx.errors == 0);
+	for (uint16_t i = 0; i < count && i < rx.count; i++) {
+		check("split status",
+		      round,
+		      (rx.feedbacks[i].pkt_status_symbol == 0) ==
+			      (fb[i].pkt_status_symbol == 0));
+		check("split time", round, rx.times[i] == times[i]);
+	}
+
+	/* Every packet fits the MTU */
+	pomp_buffer_get_cdata(buf, &data, &len, NULL);
+	for (pos = 0; pos + 4 <= len; pos += pkt_len) {
+		const uint8_t *p = (const uint8_t *)data + pos;
+		pkt_len = (((size_t)p[2] << 8 | p[3]) + 1) * 4;
+		check("mtu", round, pkt_len <= mtu);
+	}
+	check("split len", round, pos == len);
+
+	pomp_buffer_unref(buf);
+}
+
+
+/* Extreme receive deltas at the start of the parts, around the wrap of the
+ * 24-bit reference time: the rebased deltas still fit and the reception
+ * times match modulo the reference time period (2^32 deltas) */
+static void test_rebase_limits(void)
+{
+	static const int16_t first_deltas[] = {INT16_MIN, INT16_MAX, -1, 1};
+	static const uint32_t ref_times[] = {0, 1, 0xFFFFFF};
+	static struct rtcp_pkt_rtpfb_feedback fb[4 * RTPFB_REPORT_PART_MAX];
+	static int64_t times[4 * RTPFB_REPORT_PART_MAX];
+	static struct received rx;
+	struct rtcp_pkt_rtpfb_report report;
+	struct rtcp_pkt_read_cbs cbs = {.rtpfb_report = &report_cb};
+	uint16_t count = 4 * RTPFB_REPORT_PART_MAX;
+	struct pomp_buffer *buf = NULL;
+	size_t pos = 0;
+	int res;
+
+	for (uint32_t r = 0; r < 2 * 3; r++) {
+		make_report(&report, fb, count);
+		report.ref_time = ref_times[r % 3];
+		for (uint16_t i = 0; i < count; i++) {
+			fb[i].pkt_status_symbol = 2;
+			fb[i].recv_delta =
+				i % RTPFB_REPORT_PART_MAX == 0
+					? first_deltas[(i / RTPFB_REPORT_PART_MAX +
+							r) %
+						       4]
+					: (int16_t)(rand64() % 512) - 256;
+		}
+		report_times(&report, times);
+
+		buf = pomp_buffer_new(0);
+		pos = 0;
+		res = rtcp_pkt_write_rtpfb(buf, &pos, &report);
+		check("rebase write", r, res == 0);
+		memset(&rx, 0, sizeof(rx));
+		rx.base_seq = report.base_seq;
+		rx.feedback_pkt_count = report.feedback_pkt_count;
+		res = rtcp_pkt_read(buf, &cbs, &rx);
+		check("rebase read", r, res == 0);
+		check("rebase count",
+		      r,
+		      rx.count == count && rx.parts == 4 && rx.errors == 0);
+		for (uint16_t i = 0; i < count && i < rx.count; i++) {
+			check("rebase time",
+			      r,
+			      (uint32_t)(rx.times[i] - times[i]) == 0);
+		}
+		pomp_buffer_unref(buf);
+	}
+}
+
+
+int main()
+{
+	for (uint32_t round = 0; round < ROUNDS; round++)
+		test_round(round);
+	test_rebase_limits();
+
+	printf("%s: %" PRIu64 " failures\n",
+	       failures == 0 ? "OK" : "FAILED",
+	       failures);
+	return failures == 0 ? 0 : 1;
+}
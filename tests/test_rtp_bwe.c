@@ -0,0 +1,414 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtp/rtp.h"
+
+#include "check.h"
+
+/**
+ * Closed-loop test of the bandwidth estimator: a paced sender follows the
+ * target bitrate through a bottleneck link with a FIFO queue, the receiver
+ * records the arrivals with a TWCC recorder and its feedback goes back to
+ * the estimator. The target must converge close to the link capacity
+ * without building a standing queue, follow a capacity drop quickly and
+ * ramp up again after a capacity increase. The simulation runs once with
+ * the rtpfb_report callback and once with rtpfb_report_iter, which must
+ * give the same results. The 24-bit reference time of the reports is
+ * unwrapped, including for a report received late across the wrap.
+ */
+
+#define PKT_SIZE 1200
+#define PROPAGATION_US 20000
+#define FEEDBACK_US 50000
+#define MAX_QUEUE_US 500000
+#define STEP_US 1000
+#define MTU 1200
+#define RUN_US 130000000ULL
+#define START_US 1000000000ULL
+#define MAX_IN_FLIGHT 8192
+
+/* Reference time wrap: 16 packets every 64 ms, 64 reports starting 16
+ * units before the wrap, the reports on both sides of the wrap swapped */
+#define DELTA_US 250
+#define WRAP_PKT_PERIOD 4000
+#define WRAP_BITRATE (PKT_SIZE * 8 * (1000000 / WRAP_PKT_PERIOD))
+#define WRAP_PKTS_PER_REPORT 16
+#define WRAP_REPORTS 64
+#define WRAP_REF_TIME 0xFFFFF0
+#define WRAP_SWAP 15
+
+
+struct phase {
+	uint64_t end;
+	uint32_t capacity;
+};
+
+
+/* Link capacity over time, relative to the start */
+static const struct phase phases[] = {
+	{40000000, 2000000},
+	{70000000, 1000000},
+	{RUN_US, 3000000},
+};
+
+
+struct in_flight {
+	uint16_t seq;
+	uint64_t arrival;
+};
+
+
+struct sim {
+	struct rtp_bwe *bwe;
+	struct rtp_twcc_recorder *recorder;
+	uint64_t now;
+	struct in_flight pkts[MAX_IN_FLIGHT];
+	uint32_t head;
+	uint32_t tail;
+	uint64_t link_free;
+	uint64_t queue_sum;
+	uint64_t queue_count;
+	uint64_t drops;
+	uint64_t target_sum;
+	uint64_t target_count;
+};
+
+
+static void report_cb(const struct rtcp_pkt_rtpfb_report *rtpfb,
+		      void *userdata)
+{
+	struct sim *sim = userdata;
+	int res = rtp_bwe_feedback(sim->bwe, rtpfb, sim->now);
+	check("rtp_bwe_feedback", sim->now, res == 0);
+}
+
+
+static void report_iter_cb(const struct rtcp_pkt_rtpfb_report *rtpfb,
+			   struct rtcp_pkt_rtpfb_iter *iter,
+			   void *userdata)
+{
+	struct sim *sim = userdata;
+	int res = rtp_bwe_feedback_iter(sim->bwe, rtpfb, iter, sim->now);
+	check("rtp_bwe_feedback_iter", sim->now, res == 0);
+}
+
+
+static uint32_t capacity_at(uint64_t t)
+{
+	for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); i++) {
+		if (t < phases[i].end)
+			return phases[i].capacity;
+	}
+	return phases[0].capacity;
+}
+
+
+/* Send a packet through the bottleneck, tail-dropped when the queue is
+ * too long */
+static void send_pkt(struct sim *sim, uint16_t seq)
+{
+	uint32_t capacity = capacity_at(sim->now - START_US);
+	uint64_t start = sim->link_free > sim->now ? sim->link_free : sim->now;
+	struct in_flight *pkt;
+	int res;
+
+	res = rtp_bwe_sent(sim->bwe, seq, PKT_SIZE, sim->now);
+	check("rtp_bwe_sent", sim->now, res == 0);
+
+	sim->queue_sum += start - sim->now;
+	sim->queue_count++;
+	if (start - sim->now > MAX_QUEUE_US ||
+	    sim->tail - sim->head >= MAX_IN_FLIGHT) {
+		sim->drops++;
+		return;
+	}
+	sim->link_free = start + (uint64_t)PKT_SIZE * 8 * 1000000 / capacity;
+	pkt = &sim->pkts[sim->tail++ % MAX_IN_FLIGHT];
+	pkt->seq = seq;
+	pkt->arrival = sim->link_free + PROPAGATION_US;
+}
+
+
+static void run(struct sim *sim, int use_iter, uint32_t *samples)
+{
+	struct rtp_bwe_cfg cfg = {0};
+	struct rtp_twcc_recorder_cfg rcfg = {.sender_ssrc = 1, .media_ssrc = 2};
+	struct rtcp_pkt_read_cbs cbs = {0};
+	struct rtp_bwe_estimate est;
+	struct pomp_buffer *buf = pomp_buffer_new(0);
+	uint64_t next_send = START_US, next_feedback = START_US + FEEDBACK_US;
+	uint16_t seq = 65000;
+	size_t pos;
+	int res;
+
+	memset(sim, 0, sizeof(*sim));
+	if (use_iter)
+		cbs.rtpfb_report_iter = &report_iter_cb;
+	else
+		cbs.rtpfb_report = &report_cb;
+	res = rtp_bwe_new(&cfg, &sim->bwe);
+	check("rtp_bwe_new", 0, res == 0);
+	res = rtp_twcc_recorder_new(&rcfg, &sim->recorder);
+	check("rtp_twcc_recorder_new", 0, res == 0);
+	rtp_bwe_set_rtt(sim->bwe, 2 * PROPAGATION_US);
+
+	for (sim->now = START_US; sim->now < START_US + RUN_US;
+	     sim->now += STEP_US) {
+		/* Receiver */
+		while (sim->head != sim->tail &&
+		       sim->pkts[sim->head % MAX_IN_FLIGHT].arrival <=
+			       sim->now) {
+			struct in_flight *pkt =
+				&sim->pkts[sim->head++ % MAX_IN_FLIGHT];
+			res = rtp_twcc_recorder_record(
+				sim->recorder, pkt->seq, pkt->arrival);
+			check("rtp_twcc_recorder_record", sim->now, res == 0);
+		}
+		if (sim->now >= next_feedback) {
+			next_feedback += FEEDBACK_US;
+			pos = 0;
+			pomp_buffer_set_len(buf, 0);
+			res = rtp_twcc_recorder_write(
+				sim->recorder, buf, &pos, MTU);
+			if (res > 0)
+				rtcp_pkt_read(buf, &cbs, sim);
+		}
+
+		/* Paced sender */
+		rtp_bwe_get_estimate(sim->bwe, &est);
+		while (next_send <= sim->now) {
+			send_pkt(sim, seq++);
+			next_send += (uint64_t)PKT_SIZE * 8 * 1000000 /
+				     est.target_bitrate;
+		}
+		if ((sim->now - START_US) % 1000000 == 0)
+			samples[(sim->now - START_US) / 1000000] =
+				est.target_bitrate;
+	}
+
+	rtp_twcc_recorder_destroy(sim->recorder);
+	pomp_buffer_unref(buf);
+}
+
+
+/* Average target over [start, end[ seconds */
+static uint32_t average(const uint32_t *samples, uint32_t start, uint32_t end)
+{
+	uint64_t sum = 0;
+	for (uint32_t i = start; i < end; i++)
+		sum += samples[i];
+	return sum / (end - start);
+}
+
+
+static void test_convergence(void)
+{
+	static struct sim sims[2];
+	static uint32_t samples[2][RUN_US / 1000000];
+	struct rtp_bwe_stats stats[2];
+	struct rtp_bwe_estimate est[2];
+	uint32_t avg;
+
+	for (int i = 0; i < 2; i++) {
+		run(&sims[i], i, samples[i]);
+		rtp_bwe_get_stats(sims[i].bwe, &stats[i]);
+		rtp_bwe_get_estimate(sims[i].bwe, &est[i]);
+		rtp_bwe_destroy(sims[i].bwe);
+	}
+	check("iter results",
+	      RUN_US,
+	      memcmp(samples[0], samples[1], sizeof(samples[0])) == 0 &&
+		      memcmp(&stats[0], &stats[1], sizeof(stats[0])) == 0);
+
+	for (uint32_t t = 0; t < RUN_US / 1000000; t += 5)
+		printf("%3" PRIu32 " s: capacity %7" PRIu32
+		       " target %7" PRIu32 "\n",
+		       t,
+		       capacity_at(t * 1000000ULL),
+		       samples[0][t]);
+	printf("sent %" PRIu64 ", received %" PRIu64 ", lost %" PRIu64
+	       ", unknown %" PRIu64 ", reports %" PRIu64 ", overuses %" PRIu64
+	       ", average queue %" PRIu64 " ms\n",
+	       stats[0].sent,
+	       stats[0].received,
+	       stats[0].lost,
+	       stats[0].unknown,
+	       stats[0].reports,
+	       stats[0].overuses,
+	       sims[0].queue_sum / sims[0].queue_count / 1000);
+
+	/* Close to the capacity of each phase, after convergence */
+	avg = average(samples[0], 20, 40);
+	check("2 Mbit/s phase", 40000000, avg > 1500000 && avg < 2300000);
+	avg = average(samples[0], 50, 70);
+	check("1 Mbit/s phase", 70000000, avg > 750000 && avg < 1150000);
+	avg = average(samples[0], 110, 130);
+	check("3 Mbit/s phase", RUN_US, avg > 2200000 && avg < 3400000);
+
+	/* Quick reaction to the capacity drop */
+	check("capacity drop", 45000000, samples[0][45] < 1300000);
+
+	/* No standing queue */
+	check("queue",
+	      RUN_US,
+	      sims[0].queue_sum / sims[0].queue_count < 100000);
+	check("stats",
+	      RUN_US,
+	      stats[0].received + stats[0].lost <= stats[0].sent &&
+		      stats[0].unknown == 0 && stats[0].overuses > 0);
+}
+
+
+static void test_errors(void)
+{
+	struct rtp_bwe_cfg cfg = {.start_bitrate = 1000};
+	struct rtcp_pkt_rtpfb_feedback fb = {.pkt_status_symbol = 1};
+	struct rtcp_pkt_rtpfb_report report = {
+		.base_seq = 10,
+		.status_count = 1,
+		.feedbacks = &fb,
+	};
+	struct rtp_bwe_stats stats;
+	struct rtp_bwe *bwe = NULL;
+
+	check("bitrates", 0, rtp_bwe_new(&cfg, &bwe) == -EINVAL);
+	cfg.start_bitrate = 0;
+	cfg.history_size = 100;
+	check("new", 0, rtp_bwe_new(&cfg, &bwe) == 0);
+	if (bwe == NULL)
+		return;
+
+	check("no history", 0, rtp_bwe_feedback(bwe, &report, 0) == -EPROTO);
+	check("sent", 0, rtp_bwe_sent(bwe, 10, PKT_SIZE, 1000) == 0);
+	check("sent", 0, rtp_bwe_sent(bwe, 500, PKT_SIZE, 2000) == 0);
+	check("too old", 0, rtp_bwe_sent(bwe, 300, PKT_SIZE, 3000) == -ERANGE);
+	check("feedback", 0, rtp_bwe_feedback(bwe, &report, 4000) == 0);
+	report.base_seq = 500;
+	check("feedback", 0, rtp_bwe_feedback(bwe, &report, 5000) == 0);
+	check("feedback", 0, rtp_bwe_feedback(bwe, &report, 6000) == 0);
+	rtp_bwe_get_stats(bwe, &stats);
+	check("errors stats",
+	      0,
+	      stats.sent == 2 && stats.received == 1 && stats.unknown == 2 &&
+		      stats.reports == 3);
+	rtp_bwe_destroy(bwe);
+}
+
+/* Reports whose 24-bit reference time wraps around, one of them arriving
+ * late: the reference time is unwrapped backward and forward, the arrival
+ * times stay continuous and the constant delay is not seen as a change */
+static void test_ref_time_wrap(void)
+{
+	struct rtp_bwe_cfg cfg = {0};
+	struct rtcp_pkt_rtpfb_feedback fbs[WRAP_PKTS_PER_REPORT];
+	struct rtcp_pkt_rtpfb_report report = {
+		.status_count = WRAP_PKTS_PER_REPORT,
+		.feedback_pkt_count = WRAP_PKTS_PER_REPORT,
+		.feedbacks = fbs,
+	};
+	struct rtp_bwe_stats stats;
+	struct rtp_bwe_estimate est;
+	struct rtp_bwe *bwe = NULL;
+	uint64_t send_us = 0, now = 0;
+	uint32_t k, n;
+	int res;
+
+	check("wrap: new", 0, rtp_bwe_new(&cfg, &bwe) == 0);
+	if (bwe == NULL)
+		return;
+	rtp_bwe_set_rtt(bwe, 2 * PROPAGATION_US);
+
+	/* Each report covers 64 ms, i.e. one unit of reference time; the
+	 * reports on both sides of the wrap are swapped */
+	for (k = 0; k <= WRAP_REPORTS; k++) {
+		for (uint32_t i = 0; k < WRAP_REPORTS &&
+				     i < WRAP_PKTS_PER_REPORT;
+		     i++) {
+			send_us = START_US + (k * WRAP_PKTS_PER_REPORT + i) *
+						     WRAP_PKT_PERIOD;
+			res = rtp_bwe_sent(bwe,
+					   k * WRAP_PKTS_PER_REPORT + i,
+					   PKT_SIZE,
+					   send_us);
+			check("wrap: sent", send_us, res == 0);
+		}
+		if (k == 0)
+			continue;
+		n = k - 1;
+		if (n == WRAP_SWAP)
+			n = WRAP_SWAP + 1;
+		else if (n == WRAP_SWAP + 1)
+			n = WRAP_SWAP;
+		report.base_seq = n * WRAP_PKTS_PER_REPORT;
+		report.ref_time = (WRAP_REF_TIME + n) & 0xFFFFFF;
+		for (uint32_t i = 0; i < WRAP_PKTS_PER_REPORT; i++) {
+			fbs[i].seq_num = n * WRAP_PKTS_PER_REPORT + i;
+			fbs[i].pkt_status_symbol = 1;
+			fbs[i].recv_delta =
+				i == 0 ? 0 : WRAP_PKT_PERIOD / DELTA_US;
+		}
+		now = START_US + k * WRAP_PKTS_PER_REPORT * WRAP_PKT_PERIOD +
+		      PROPAGATION_US;
+		res = rtp_bwe_feedback(bwe, &report, now);
+		check("wrap: feedback", now, res == 0);
+	}
+
+	rtp_bwe_get_stats(bwe, &stats);
+	rtp_bwe_get_estimate(bwe, &est);
+	check("wrap: stats",
+	      now,
+	      stats.received == WRAP_REPORTS * WRAP_PKTS_PER_REPORT &&
+		      stats.lost == 0 && stats.unknown == 0 &&
+		      stats.reports == WRAP_REPORTS);
+	check("wrap: no overuse",
+	      now,
+	      stats.overuses == 0 && est.usage == RTP_BWE_USAGE_NORMAL);
+	check("wrap: acked",
+	      now,
+	      est.acked_bitrate > WRAP_BITRATE * 9 / 10 &&
+		      est.acked_bitrate < WRAP_BITRATE * 11 / 10);
+	rtp_bwe_destroy(bwe);
+}
+
+
+
+int main()
+{
+	test_errors();
+	test_ref_time_wrap();
+	test_convergence();
+
+	printf("%s: %" PRIu64 " failures\n",
+	       failures == 0 ? "OK" : "FAILED",
+	       failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtp/rtp.h"
+
+#include "check.h"
+
+/**
+ * Equivalence test of the division-free conversions with the division based
+ * ones they replace: every result must be bit-exact, including the rounding
+ * and the wrapping of the intermediate products.
+ *
+ * Usage: tst-rtp-clk [--full]
+ * By default the tick values are swept exhaustively up to 2^26 and the
+ * nanoseconds with a stride, plus quotient boundaries and random values
+ * over the whole 64-bit range; --full sweeps the whole 32-bit RTP
+ * timestamp range for 90 kHz and 48 kHz and all the nanosecond values
+ * (takes a minute or so).
+ */
+
+#define RANDOM_COUNT 2000000
+
+
+/* Random value with a random number of significant bits, to cover small
+ * values as well as large ones */
+static uint64_t rand_bits(void)
+{
+	uint32_t bits = rand64() % 65;
+	return bits == 64 ? rand64() : rand64() & ((1ULL << bits) - 1);
+}
+
+
+/* Reference implementations (with divisions) */
+static uint64_t ref_to_us(uint64_t ts, uint32_t clk_rate)
+{
+	if (clk_rate == 0)
+		return 0;
+	return (ts * 1000000 + clk_rate / 2) / clk_rate;
+}
+
+
+static uint64_t ref_from_us(uint64_t us, uint32_t clk_rate)
+{
+	return (us * clk_rate + 500000) / 1000000;
+}
+
+
+static void check_div(const struct rtp_recip *recip, uint32_t div, uint64_t n)
+{
+	check("recip_div", n, rtp_recip_div(recip, n), n / div);
+}
+
+
+static void test_recip(uint32_t div)
+{
+	struct rtp_recip recip;
+	uint64_t n = 0, q = 0;
+
+	rtp_recip_init(&recip, div);
+	for (n = 0; n < (1 << 20); n++)
+		check_div(&recip, div, n);
+	for (uint32_t i = 0; i < RANDOM_COUNT / 4; i++) {
+		/* Around the quotient boundaries */
+		q = rand_bits() / div;
+		check_div(&recip, div, q * div - 1);
+		check_div(&recip, div, q * div);
+		check_div(&recip, div, q * div + 1);
+		check_div(&recip, div, rand_bits());
+	}
+	check_div(&recip, div, UINT64_MAX);
+}
+
+
+static void check_to_us(const struct rtp_clk *clk, uint64_t v)
+{
+	uint64_t ref = ref_to_us(v, clk->clk_rate);
+
+	check("to_us", v, rtp_clk_to_us(clk, v), ref);
+	check("timestamp_to_us", v, rtp_timestamp_to_us(v, clk->clk_rate), ref);
+}
+
+
+static void test_clk(uint32_t clk_rate, uint64_t sweep)
+{
+	struct rtp_clk clk;
+	uint64_t *in = NULL, *out = NULL;
+	uint64_t v = 0;
+	size_t count = 4096;
+
+	rtp_clk_init(&clk, clk_rate);
+	for (v = 0; v < sweep; v++)
+		check_to_us(&clk, v);
+	for (uint32_t i = 0; i < RANDOM_COUNT; i++) {
+		v = rand_bits();
+		check_to_us(&clk, v);
+		check("from_us",
+		      v,
+		      rtp_clk_from_us(&clk, v),
+		      ref_from_us(v, clk_rate));
+		check("timestamp_from_us",
+		      v,
+		      rtp_timestamp_from_us(v, clk_rate),
+		      ref_from_us(v, clk_rate));
+	}
+
+	/* Batch variants */
+	in = calloc(count, sizeof(*in));
+	out = calloc(count, sizeof(*out));
+	if (in == NULL || out == NULL) {
+		failures++;
+		goto out;
+	}
+	for (size_t i = 0; i < count; i++)
+		in[i] = rand_bits();
+	rtp_clk_to_us_batch(&clk, in, out, count);
+	for (size_t i = 0; i < count; i++)
+		check("to_us_batch", in[i], out[i], ref_to_us(in[i], clk_rate));
+	rtp_clk_from_us_batch(&clk, in, out, count);
+	for (size_t i = 0; i < count; i++) {
+		check("from_us_batch",
+		      in[i],
+		      out[i],
+		      ref_from_us(in[i], clk_rate));
+	}
+
+out:
+	free(in);
+	free(out);
+}
+
+
+static void check_ntp_us(uint64_t us)
+{
+	struct ntp_timestamp64 t64;
+	struct ntp_timestamp32 t32;
+
+	ntp_timestamp64_from_us(&t64, us);
+	check("ntp64_from_us.seconds",
+	      us,
+	      t64.seconds,
+	      (uint32_t)(us / 1000000));
+	check("ntp64_from_us.fraction",
+	      us,
+	      t64.fraction,
+	      (uint32_t)(((uint64_t)(us % 1000000) << 32) / 1000000));
+	ntp_timestamp32_from_us(&t32, us);
+	check("ntp32_from_us.seconds",
+	      us,
+	      t32.seconds,
+	      (uint16_t)(us / 1000000));
+	check("ntp32_from_us.fraction",
+	      us,
+	      t32.fraction,
+	      (uint16_t)(((uint64_t)(us % 1000000) << 16) / 1000000));
+}
+
+
+static void check_ntp_nsec(long nsec)
+{
+	struct timespec ts = {0, nsec};
+	struct ntp_timestamp64 t64;
+	struct ntp_timestamp32 t32;
+
+	ntp_timestamp64_from_timespec(&t64, &ts);
+	check("ntp64_from_timespec",
+	      nsec,
+	      t64.fraction,
+	      (uint32_t)(((uint64_t)nsec << 32) / 1000000000));
+	ntp_timestamp32_from_timespec(&t32, &ts);
+	check("ntp32_from_timespec",
+	      nsec,
+	      t32.fraction,
+	      (uint16_t)(((uint64_t)nsec << 16) / 1000000000));
+}
+
+
+static void test_ntp(long nsec_stride)
+{
+	for (uint64_t us = 0; us < (1 << 24); us++)
+		check_ntp_us(us);
+	for (uint32_t i = 0; i < RANDOM_COUNT; i++)
+		check_ntp_us(rand_bits());
+
+	for (long nsec = 0; nsec < 1000000000; nsec += nsec_stride)
+		check_ntp_nsec(nsec);
+	for (uint32_t i = 0; i < RANDOM_COUNT; i++)
+		check_ntp_nsec(rand64() % 1000000000);
+}
+
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t rates[] = {
+		0,
+		1,
+		2,
+		3,
+		7,
+		1000,
+		8000,
+		16000,
+		22050,
+		44100,
+		48000,
+		90000,
+		96000,
+		1 << 20,
+		1000000,
+		0x7fffffff,
+		0x80000000,
+		0xffffffff,
+	};
+	int full = (argc > 1 && strcmp(argv[1], "--full") == 0);
+	uint64_t sweep = 0;
+
+	for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		if (rates[i] != 0)
+			test_recip(rates[i]);
+		sweep = 1 << 20;
+		if (rates[i] == 90000 || rates[i] == 48000)
+			sweep = full ? (1ULL << 32) : (1 << 26);
+		test_clk(rates[i], sweep);
+		printf("clk_rate %u: %" PRIu64 " failures\n",
+		       rates[i],
+		       failures);
+	}
+
+	test_ntp(full ? 1 : 997);
+	printf("ntp: %" PRIu64 " failures\n", failures);
+
+	return failures == 0 ? 0 : 1;
+}
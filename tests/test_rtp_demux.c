@@ -0,0 +1,556 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libpomp.h>
+
+#include "rtp/rtp.h"
+
+#include "check.h"
+
+/**
+ * Test of the RTP demultiplexer: random additions and removals checked
+ * against a model (collisions, table growth and backward-shift deletion),
+ * overflow of the maximum number of sources, expiration of the least
+ * recently active sources, removal of the sources of an RTCP BYE for both
+ * keying modes, ownership of the packets dropped by a full jitter
+ * buffer ingress ring, and forwarding of the RTPFB reports.
+ */
+
+#define MODEL_SSRC_COUNT 96
+#define MODEL_PT_COUNT 4
+#define MODEL_ITERATIONS 20000
+
+
+struct ctx {
+	/* Jitter buffer given to the added sources */
+	struct rtp_jitter *jitter;
+	uint32_t added;
+	uint32_t removed;
+	uint32_t processed;
+	enum rtp_demux_remove_reason last_reason;
+	uint32_t last_ssrc;
+	uint8_t last_pt;
+	/* Indexed by [ssrc index][pt], for the model test */
+	uint8_t present[MODEL_SSRC_COUNT][MODEL_PT_COUNT];
+	/* RTPFB reports received */
+	uint32_t rtpfb_reports;
+	uint16_t rtpfb_count;
+	int rtpfb_ok;
+};
+
+
+/* Spread the SSRC values so that the hash is not trivially sequential */
+static uint32_t model_ssrc(uint32_t index)
+{
+	return index * 0x9e3779b1u + 1;
+}
+
+
+static int source_add_cb(struct rtp_demux *demux,
+			 const struct rtp_pkt *pkt,
+			 struct rtp_jitter **ret_jitter,
+			 void **ret_source_userdata,
+			 void *userdata)
+{
+	struct ctx *ctx = userdata;
+	ctx->added++;
+	*ret_jitter = ctx->jitter;
+	*ret_source_userdata = (void *)(uintptr_t)pkt->header.ssrc;
+	return 0;
+}
+
+
+static void source_remove_cb(struct rtp_demux *demux,
+			     uint32_t ssrc,
+			     uint8_t payload_type,
+			     struct rtp_jitter *jitter,
+			     void *source_userdata,
+			     enum rtp_demux_remove_reason reason,
+			     void *userdata)
+{
+	struct ctx *ctx = userdata;
+	ctx->removed++;
+	ctx->last_reason = reason;
+	ctx->last_ssrc = ssrc;
+	ctx->last_pt = payload_type;
+	check("source userdata", (uintptr_t)source_userdata == ssrc);
+}
+
+
+static void process_pkt_cb(struct rtp_demux *demux,
+			   struct rtp_pkt *pkt,
+			   void *source_userdata,
+			   void *userdata)
+{
+	struct ctx *ctx = userdata;
+	ctx->processed++;
+	check("pkt userdata", (uintptr_t)source_userdata == pkt->header.ssrc);
+	rtp_pkt_destroy(pkt);
+}
+
+
+static const struct rtp_demux_cbs cbs = {
+	.source_add = &source_add_cb,
+	.source_remove = &source_remove_cb,
+	.process_pkt = &process_pkt_cb,
+};
+
+
+static void jitter_process_pkt_cb(struct rtp_jitter *jitter,
+				  const struct rtp_pkt *pkt,
+				  uint32_t gap,
+				  void *userdata)
+{
+}
+
+
+static const struct rtp_jitter_cbs jitter_cbs = {
+	.process_pkt = &jitter_process_pkt_cb,
+};
+
+
+static int dispatch(struct rtp_demux *demux,
+		    uint32_t ssrc,
+		    uint8_t pt,
+		    uint64_t timestamp)
+{
+	struct rtp_pkt *pkt = NULL;
+	int res = rtp_pkt_new(&pkt);
+	if (res < 0)
+		return res;
+	pkt->header.ssrc = ssrc;
+	RTP_PKT_HEADER_FLAGS_SET(pkt->header.flags, PAYLOAD_TYPE, pt);
+	pkt->in_timestamp = timestamp;
+	return rtp_demux_dispatch(demux, pkt);
+}
+
+
+static uint32_t get_count(struct rtp_demux *demux)
+{
+	uint32_t count = 0;
+	rtp_demux_get_source_count(demux, &count);
+	return count;
+}
+
+
+static void model_check(struct rtp_demux *demux, struct ctx *ctx, int by_pt)
+{
+	uint32_t expected = 0;
+	uint32_t pt_count = by_pt ? MODEL_PT_COUNT : 1;
+	void *source_userdata = NULL;
+	int res;
+
+	/* The payload type is ignored if keyed by SSRC only */
+	for (uint32_t i = 0; i < MODEL_SSRC_COUNT; i++) {
+		for (uint32_t pt = 0; pt < pt_count; pt++) {
+			res = rtp_demux_get_source(demux,
+						   model_ssrc(i),
+						   pt,
+						   NULL,
+						   &source_userdata);
+			if (ctx->present[i][pt]) {
+				expected++;
+				check("model: source missing", res == 0);
+				check("model: source userdata",
+				      res < 0 || (uintptr_t)source_userdata ==
+							 model_ssrc(i));
+			} else {
+				check("model: unexpected source",
+				      res == -ENOENT);
+			}
+		}
+	}
+	check("model: source count", get_count(demux) == expected);
+	check("model: added - removed",
+	      ctx->added - ctx->removed == expected);
+}
+
+
+static void test_model(int by_pt)
+{
+	struct rtp_demux_cfg cfg = {
+		.flags = by_pt ? RTP_DEMUX_FLAG_KEY_PAYLOAD_TYPE : 0,
+		.capacity = 4,
+	};
+	struct rtp_demux *demux = NULL;
+	struct ctx ctx;
+	uint32_t i = 0, pt = 0, n = 0;
+	int res;
+
+	memset(&ctx, 0, sizeof(ctx));
+	res = rtp_demux_new(&cfg, &cbs, &ctx, &demux);
+	check("model: new", res == 0);
+	if (res < 0)
+		return;
+
+	for (n = 0; n < MODEL_ITERATIONS; n++) {
+		i = rand64() % MODEL_SSRC_COUNT;
+		pt = by_pt ? rand64() % MODEL_PT_COUNT : 0;
+		if (rand64() % 3 != 0) {
+			res = dispatch(demux, model_ssrc(i), pt, n);
+			check("model: dispatch", res == 0);
+			ctx.present[i][pt] = 1;
+		} else {
+			res = rtp_demux_remove_source(demux, model_ssrc(i));
+			check("model: remove", res == 0 || res == -ENOENT);
+			for (pt = 0; pt < MODEL_PT_COUNT; pt++)
+				ctx.present[i][pt] = 0;
+		}
+		if (n % 64 == 0)
+			model_check(demux, &ctx, by_pt);
+	}
+	model_check(demux, &ctx, by_pt);
+
+	res = rtp_demux_destroy(demux);
+	check("model: destroy", res == 0);
+	check("model: all removed", ctx.added == ctx.removed);
+	check("model: destroy reason",
+	      ctx.last_reason == RTP_DEMUX_REMOVE_REASON_DESTROY ||
+		      ctx.added == 0);
+}
+
+
+static void test_max_sources(void)
+{
+	struct rtp_demux_cfg cfg = {
+		.max_sources = 4,
+	};
+	struct rtp_demux *demux = NULL;
+	struct ctx ctx;
+	int res;
+
+	memset(&ctx, 0, sizeof(ctx));
+	res = rtp_demux_new(&cfg, &cbs, &ctx, &demux);
+	check("max_sources: new", res == 0);
+	if (res < 0)
+		return;
+
+	for (uint32_t i = 0; i < 4; i++) {
+		res = dispatch(demux, 100 + i, 96, i);
+		check("max_sources: dispatch", res == 0);
+	}
+
+	/* A fifth source is rejected (and its packet destroyed), the known
+	 * sources are still accepted */
+	res = dispatch(demux, 200, 96, 10);
+	check("max_sources: overflow", res == -ENOSPC);
+	check("max_sources: overflow count", get_count(demux) == 4);
+	res = dispatch(demux, 101, 96, 11);
+	check("max_sources: known source", res == 0);
+	check("max_sources: processed", ctx.processed == 5);
+
+	/* Once a source is removed, a new one can be added */
+	res = rtp_demux_remove_source(demux, 102);
+	check("max_sources: remove", res == 0);
+	check("max_sources: remove reason",
+	      ctx.last_reason == RTP_DEMUX_REMOVE_REASON_EXPLICIT &&
+		      ctx.last_ssrc == 102);
+	res = dispatch(demux, 200, 96, 12);
+	check("max_sources: add after remove", res == 0);
+	check("max_sources: count", get_count(demux) == 4);
+
+	rtp_demux_destroy(demux);
+}
+
+
+static void test_expire(void)
+{
+	struct rtp_demux_cfg cfg = {
+		.timeout = 1000,
+	};
+	struct rtp_demux *demux = NULL;
+	struct ctx ctx;
+	int res;
+
+	memset(&ctx, 0, sizeof(ctx));
+	res = rtp_demux_new(&cfg, &cbs, &ctx, &demux);
+	check("expire: new", res == 0);
+	if (res < 0)
+		return;
+
+	/* Sources 1..4 seen at 0, 100, 200, 300; then source 1 is refreshed
+	 * so that it becomes the most recently active one */
+	for (uint32_t i = 0; i < 4; i++)
+		dispatch(demux, 1 + i, 96, i * 100);
+	dispatch(demux, 1, 96, 400);
+
+	/* Nothing is inactive for more than 1000 us yet */
+	rtp_demux_expire(demux, 1000);
+	check("expire: none", get_count(demux) == 4 && ctx.removed == 0);
+
+	/* Sources 2 and 3 are the least recently active ones */
+	rtp_demux_expire(demux, 1250);
+	check("expire: two removed", ctx.removed == 2);
+	check("expire: reason",
+	      ctx.last_reason == RTP_DEMUX_REMOVE_REASON_TIMEOUT);
+	check("expire: source 2",
+	      rtp_demux_get_source(demux, 2, 96, NULL, NULL) == -ENOENT);
+	check("expire: source 3",
+	      rtp_demux_get_source(demux, 3, 96, NULL, NULL) == -ENOENT);
+	check("expire: source 1",
+	      rtp_demux_get_source(demux, 1, 96, NULL, NULL) == 0);
+
+	/* Then source 4, source 1 last */
+	rtp_demux_expire(demux, 1350);
+	check("expire: source 4", ctx.removed == 3 && ctx.last_ssrc == 4);
+	rtp_demux_expire(demux, 1450);
+	check("expire: source 1 last", ctx.removed == 4 && ctx.last_ssrc == 1);
+	check("expire: empty", get_count(demux) == 0);
+
+	rtp_demux_destroy(demux);
+}
+
+
+static void test_bye(int by_pt)
+{
+	struct rtp_demux_cfg cfg = {
+		.flags = by_pt ? RTP_DEMUX_FLAG_KEY_PAYLOAD_TYPE : 0,
+	};
+	struct rtcp_pkt_read_cbs rtcp_cbs;
+	struct rtcp_pkt_bye bye;
+	struct rtp_demux *demux = NULL;
+	struct pomp_buffer *buf = NULL;
+	struct ctx ctx;
+	size_t pos = 0;
+	int res;
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&rtcp_cbs, 0, sizeof(rtcp_cbs));
+	memset(&bye, 0, sizeof(bye));
+	res = rtp_demux_new(&cfg, &cbs, &ctx, &demux);
+	check("bye: new", res == 0);
+	if (res < 0)
+		return;
+
+	/* Sources 10 and 20 with 3 payload types each (a single source per
+	 * SSRC if keyed by SSRC only), and source 30 */
+	for (uint32_t pt = 96; pt < 99; pt++) {
+		dispatch(demux, 10, pt, 0);
+		dispatch(demux, 20, pt, 0);
+	}
+	dispatch(demux, 30, 96, 0);
+	check("bye: count", get_count(demux) == (by_pt ? 7 : 3));
+
+	buf = pomp_buffer_new(0);
+	bye.source_count = 2;
+	bye.sources[0] = 10;
+	bye.sources[1] = 30;
+	res = rtcp_pkt_write_bye(buf, &pos, &bye);
+	check("bye: write", res == 0);
+
+	res = rtp_demux_rtcp_read(demux, buf, &rtcp_cbs, NULL);
+	check("bye: read", res == 0);
+	check("bye: removed", ctx.removed == (by_pt ? 4 : 2));
+	check("bye: reason", ctx.last_reason == RTP_DEMUX_REMOVE_REASON_BYE);
+	check("bye: remaining", get_count(demux) == (by_pt ? 3 : 1));
+	for (uint32_t pt = 96; pt < 99; pt++) {
+		check("bye: source 10",
+		      rtp_demux_get_source(demux, 10, pt, NULL, NULL) ==
+			      -ENOENT);
+		check("bye: source 20",
+		      rtp_demux_get_source(demux, 20, pt, NULL, NULL) == 0);
+	}
+
+	/* Unknown sources are ignored */
+	res = rtp_demux_process_bye(demux, &bye);
+	check("bye: unknown", res == 0 && ctx.removed == (by_pt ? 4 : 2));
+
+	pomp_buffer_unref(buf);
+	rtp_demux_destroy(demux);
+}
+
+
+static void rtpfb_report_cb(const struct rtcp_pkt_rtpfb_report *rtpfb,
+			    void *userdata)
+{
+	struct ctx *ctx = userdata;
+
+	ctx->rtpfb_reports++;
+	ctx->rtpfb_count = rtpfb->status_count;
+	ctx->rtpfb_ok = 1;
+	for (uint16_t i = 0; i < rtpfb->status_count; i++) {
+		if (rtpfb->feedbacks[i].seq_num != (uint16_t)(100 + i) ||
+		    rtpfb->feedbacks[i].pkt_status_symbol != 1 ||
+		    rtpfb->feedbacks[i].recv_delta != (int16_t)i)
+			ctx->rtpfb_ok = 0;
+	}
+}
+
+
+/* RTPFB reports are forwarded to the rtpfb_report callback */
+static void test_rtpfb(void)
+{
+	struct rtp_demux_cfg cfg = {0};
+	struct rtcp_pkt_rtpfb_feedback fb[10];
+	struct rtcp_pkt_rtpfb_report report;
+	struct rtcp_pkt_read_cbs rtcp_cbs;
+	struct rtp_demux *demux = NULL;
+	struct pomp_buffer *buf = NULL;
+	struct ctx ctx;
+	size_t pos = 0;
+	int res;
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&rtcp_cbs, 0, sizeof(rtcp_cbs));
+	memset(&report, 0, sizeof(report));
+	res = rtp_demux_new(&cfg, &cbs, &ctx, &demux);
+	check("rtpfb: new", res == 0);
+	if (res < 0)
+		return;
+
+	report.sender_ssrc = 1;
+	report.media_ssrc = 2;
+	report.base_seq = 100;
+	report.status_count = 10;
+	report.feedbacks = fb;
+	for (uint16_t i = 0; i < 10; i++) {
+		fb[i].seq_num = 100 + i;
+		fb[i].pkt_status_symbol = 1;
+		fb[i].recv_delta = i;
+	}
+	buf = pomp_buffer_new(0);
+	res = rtcp_pkt_write_rtpfb(buf, &pos, &report);
+	check("rtpfb: write", res == 0);
+
+	rtcp_cbs.rtpfb_report = &rtpfb_report_cb;
+	res = rtp_demux_rtcp_read(demux, buf, &rtcp_cbs, &ctx);
+	check("rtpfb: read", res == 0);
+	check("rtpfb: report",
+	      ctx.rtpfb_reports == 1 && ctx.rtpfb_count == 10 &&
+		      ctx.rtpfb_ok);
+
+	pomp_buffer_unref(buf);
+	rtp_demux_destroy(demux);
+}
+
+
+/* Packets dropped when the ingress ring of the jitter buffer of a source is
+ * full are destroyed, without disturbing the estimations */
+static void test_ingress_full(void)
+{
+	struct rtp_jitter_cfg jitter_cfg = {
+		.clk_rate = 90000,
+		.delay = 100000,
+		.ingress_size = 8,
+	};
+	struct rtp_pkt_pool_cfg pool_cfg = {0};
+	struct rtp_demux_cfg cfg = {0};
+	struct rtp_jitter_stats stats;
+	struct rtp_pkt_pool_stats pool_stats;
+	struct rtp_pkt_pool *pool = NULL;
+	struct rtp_demux *demux = NULL;
+	struct rtp_pkt *pkt = NULL;
+	struct ctx ctx;
+	uint64_t ts = 1000000;
+	int res;
+
+	memset(&ctx, 0, sizeof(ctx));
+	res = rtp_pkt_pool_new(&pool_cfg, &pool);
+	check("ingress: pool", res == 0);
+	if (res < 0)
+		return;
+	res = rtp_jitter_new(&jitter_cfg, &jitter_cbs, NULL, &ctx.jitter);
+	check("ingress: jitter", res == 0);
+	if (res < 0)
+		goto out;
+	rtp_jitter_clear(ctx.jitter, 0);
+	res = rtp_demux_new(&cfg, &cbs, &ctx, &demux);
+	check("ingress: demux", res == 0);
+	if (res < 0)
+		goto out;
+
+	/* Without consumer, the packets after the 8th one are dropped; they
+	 * are received 3 s late, which would restart the skew estimation if
+	 * they were accounted */
+	for (uint16_t seqnum = 0; seqnum < 12; seqnum++) {
+		res = rtp_pkt_new_from_pool(pool, &pkt);
+		check("ingress: new pkt", res == 0);
+		if (res < 0)
+			break;
+		pkt->header.ssrc = 1;
+		pkt->header.seqnum = seqnum;
+		pkt->rtp_timestamp = 1000 + seqnum * 900;
+		pkt->in_timestamp = ts + seqnum * 10000;
+		if (seqnum >= 8)
+			pkt->in_timestamp += 3000000;
+		res = rtp_demux_dispatch(demux, pkt);
+		check("ingress: dispatch",
+		      seqnum < 8 ? res == 0 : res == -ENOBUFS);
+	}
+	rtp_pkt_pool_get_stats(pool, &pool_stats);
+	check("ingress: queued", pool_stats.outstanding == 8);
+	rtp_jitter_get_stats(ctx.jitter, &stats);
+	check("ingress: enqueued", stats.enqueued == 8);
+	check("ingress: dropped", stats.ingress_dropped == 4);
+
+	/* Once drained, the ring accepts packets again */
+	rtp_jitter_process(ctx.jitter, ts + 1000000);
+	res = rtp_pkt_new_from_pool(pool, &pkt);
+	check("ingress: new pkt", res == 0);
+	if (res == 0) {
+		pkt->header.ssrc = 1;
+		pkt->header.seqnum = 12;
+		pkt->rtp_timestamp = 1000 + 12 * 900;
+		pkt->in_timestamp = ts + 12 * 10000;
+		res = rtp_demux_dispatch(demux, pkt);
+		check("ingress: dispatch after drain", res == 0);
+	}
+	rtp_jitter_process(ctx.jitter, ts + 1000000);
+	rtp_jitter_get_stats(ctx.jitter, &stats);
+	check("ingress: released", stats.released == 9 && stats.lost == 4);
+	check("ingress: no skew reset", stats.skew_resets == 0);
+	rtp_pkt_pool_get_stats(pool, &pool_stats);
+	check("ingress: all released", pool_stats.outstanding == 0);
+
+out:
+	rtp_demux_destroy(demux);
+	rtp_jitter_destroy(ctx.jitter);
+	rtp_pkt_pool_destroy(pool);
+}
+
+
+int main(int argc, char *argv[])
+{
+	test_model(0);
+	test_model(1);
+	test_max_sources();
+	test_expire();
+	test_bye(0);
+	test_bye(1);
+	test_ingress_full();
+	test_rtpfb();
+
+	printf("%s: %" PRIu64 " failures\n",
+	       failures == 0 ? "OK" : "FAILED",
+	       failures);
+	return failures != 0;
+}
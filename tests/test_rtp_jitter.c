@@ -0,0 +1,1646 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <futils/timetools.h>
+#include <libpomp.h>
+
+#include "rtp/rtp.h"
+
+#include "check.h"
+
+/**
+ * Test of the jitter buffer: ring storage (sequence number wrap-around,
+ * out of order insertions, overflow and removal of arbitrary packets on
+ * eviction, checked against the list storage), next deadline and loop
+ * scheduling, batched release with ownership transfer, ingress ring between
+ * a producer and a consumer thread, frame release mode, loss deadlines
+ * (including holes inside frames), adaptive delay, live mode, skew
+ * estimators on a drifting clock, statistics matching the traffic.
+ */
+
+#define CLK_RATE 90000
+#define DELAY 100000
+#define START_TIMESTAMP 1000000
+#define PKT_PERIOD 10000
+#define MAX_RELEASED 4096
+#define MAX_TAKEN 64
+#define SPSC_PKT_COUNT 4000
+#define MAX_FRAMES 64
+#define FRAME_PERIOD 33333
+
+/* Default slew of the adaptive delay (per second) */
+#define DELAY_SLEW 10000
+
+/* Live mode */
+#define MAX_LATENCY 150000
+
+/* Skew estimators: receiver clock 50 ppm faster than the sender, network
+ * jitter up to 5 ms */
+#define SKEW_DRIFT 50
+#define SKEW_JITTER 5000
+#define SKEW_DURATION 120
+
+/* Statistics */
+#define STATS_PKT_COUNT 3000
+#define STATS_MAX_EVENTS (2 * STATS_PKT_COUNT)
+
+
+/* Released packets, in order; taken are the packets whose ownership was
+ * taken by the batch callback, calls the number of callback calls; number
+ * of packets and flags of the released frames; packets reported by the
+ * skip callback and number of calls */
+struct ctx {
+	uint16_t seqnums[MAX_RELEASED];
+	uint32_t gaps[MAX_RELEASED];
+	uint32_t count;
+	struct rtp_pkt *taken[MAX_TAKEN];
+	uint32_t taken_count;
+	uint32_t calls;
+	uint32_t frame_sizes[MAX_FRAMES];
+	uint32_t frame_flags[MAX_FRAMES];
+	uint32_t frames;
+	uint32_t skipped;
+	uint32_t skip_calls;
+};
+
+
+static void record(struct ctx *ctx, uint16_t seqnum, uint32_t gap)
+{
+	if (ctx->count >= MAX_RELEASED) {
+		check("too many released packets", 0);
+		return;
+	}
+	ctx->seqnums[ctx->count] = seqnum;
+	ctx->gaps[ctx->count] = gap;
+	ctx->count++;
+}
+
+
+static void process_pkt_cb(struct rtp_jitter *jitter,
+			   const struct rtp_pkt *pkt,
+			   uint32_t gap,
+			   void *userdata)
+{
+	record(userdata, pkt->header.seqnum, gap);
+}
+
+
+/* Take the ownership of one packet out of 3 */
+static void process_pkts_cb(struct rtp_jitter *jitter,
+			    struct rtp_pkt **pkts,
+			    const uint32_t *gaps,
+			    size_t count,
+			    void *userdata)
+{
+	struct ctx *ctx = userdata;
+
+	ctx->calls++;
+	for (size_t i = 0; i < count; i++) {
+		record(ctx, pkts[i]->header.seqnum, gaps[i]);
+		if (pkts[i]->header.seqnum % 3 != 0 ||
+		    ctx->taken_count >= MAX_TAKEN)
+			continue;
+		ctx->taken[ctx->taken_count++] = pkts[i];
+		pkts[i] = NULL;
+	}
+}
+
+
+static void process_frame_cb(struct rtp_jitter *jitter,
+			     struct rtp_pkt **pkts,
+			     const uint32_t *gaps,
+			     size_t count,
+			     uint32_t flags,
+			     void *userdata)
+{
+	struct ctx *ctx = userdata;
+
+	for (size_t i = 0; i < count; i++)
+		record(ctx, pkts[i]->header.seqnum, gaps[i]);
+	if (ctx->frames >= MAX_FRAMES) {
+		check("too many frames", 0);
+		return;
+	}
+	ctx->frame_sizes[ctx->frames] = count;
+	ctx->frame_flags[ctx->frames] = flags;
+	ctx->frames++;
+}
+
+
+static void skip_pkts_cb(struct rtp_jitter *jitter,
+			 uint32_t count,
+			 void *userdata)
+{
+	struct ctx *ctx = userdata;
+
+	ctx->skipped += count;
+	ctx->skip_calls++;
+}
+
+
+static const struct rtp_jitter_cbs pkt_cbs = {
+	.process_pkt = &process_pkt_cb,
+};
+
+
+static const struct rtp_jitter_cbs batch_cbs = {
+	.process_pkts = &process_pkts_cb,
+};
+
+
+static const struct rtp_jitter_cbs frame_cbs = {
+	.process_frame = &process_frame_cb,
+};
+
+
+static const struct rtp_jitter_cbs live_cbs = {
+	.process_pkt = &process_pkt_cb,
+	.skip_pkts = &skip_pkts_cb,
+};
+
+
+static uint64_t get_time(void)
+{
+	struct timespec ts = {0, 0};
+	uint64_t now = 0;
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &now);
+	return now;
+}
+
+
+/* Packet sent at PKT_PERIOD intervals according to its sequence number
+ * (relative to base), received at in_timestamp */
+static struct rtp_pkt *
+new_pkt(uint16_t seqnum, uint16_t base, uint64_t in_timestamp, size_t len)
+{
+	struct rtp_pkt *pkt = NULL;
+	uint16_t index = seqnum - base;
+
+	if (rtp_pkt_new(&pkt) < 0) {
+		check("rtp_pkt_new", 0);
+		return NULL;
+	}
+	pkt->header.seqnum = seqnum;
+	pkt->rtp_timestamp =
+		1000 + (uint64_t)index * PKT_PERIOD * (CLK_RATE / 1000) / 1000;
+	pkt->header.timestamp = pkt->rtp_timestamp;
+	pkt->in_timestamp = in_timestamp;
+	pkt->raw.len = len;
+	return pkt;
+}
+
+
+static int enqueue(struct rtp_jitter *jitter,
+		   uint16_t seqnum,
+		   uint16_t base,
+		   uint64_t in_timestamp,
+		   size_t len,
+		   uint32_t importance)
+{
+	struct rtp_pkt *pkt = new_pkt(seqnum, base, in_timestamp, len);
+	if (pkt == NULL)
+		return -ENOMEM;
+	pkt->importance = importance;
+	return rtp_jitter_enqueue(jitter, pkt);
+}
+
+
+static struct rtp_jitter *new_jitter(const struct rtp_jitter_cfg *cfg,
+				     const struct rtp_jitter_cbs *cbs,
+				     void *userdata)
+{
+	struct rtp_jitter *jitter = NULL;
+	int res = rtp_jitter_new(cfg, cbs, userdata, &jitter);
+	check("rtp_jitter_new", res == 0);
+	return jitter;
+}
+
+
+static void get_stats(struct rtp_jitter *jitter, struct rtp_jitter_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	rtp_jitter_get_stats(jitter, stats);
+}
+
+
+/* All the packets received around the wrap-around of the sequence numbers,
+ * out of order, are released in order once due */
+static void test_ring_wrap(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+		.storage = RTP_JITTER_STORAGE_RING,
+		.ring_size = 32,
+	};
+	static const int16_t order[] = {
+		0, 2, 1, 3, 6, 4, 5, 7, 10, 9, 8, 11, 12, 15, 14, 13,
+	};
+	struct rtp_jitter_stats stats;
+	struct rtp_jitter *jitter = NULL;
+	struct ctx ctx;
+	uint16_t base = 65528;
+	uint64_t ts = START_TIMESTAMP;
+	uint32_t i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	jitter = new_jitter(&cfg, &pkt_cbs, &ctx);
+	if (jitter == NULL)
+		return;
+	rtp_jitter_clear(jitter, base);
+
+	/* Packet 0 is the next expected one: released on the first process,
+	 * the others wait for their missing predecessors */
+	for (i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+		enqueue(jitter, base + order[i], base, ts, 100, 0);
+		ts += PKT_PERIOD;
+		rtp_jitter_process(jitter, ts);
+	}
+	rtp_jitter_process(jitter, ts + 10 * DELAY);
+
+	check("ring wrap: count", ctx.count == 16);
+	for (i = 0; i < ctx.count; i++) {
+		check("ring wrap: order",
+		      ctx.seqnums[i] == (uint16_t)(base + i));
+		check("ring wrap: gap", ctx.gaps[i] == 0);
+	}
+	get_stats(jitter, &stats);
+	check("ring wrap: reordered", stats.reordered == 7);
+	check("ring wrap: queue", stats.queue_pkts == 0);
+	check("ring wrap: lost", stats.lost == 0);
+	rtp_jitter_destroy(jitter);
+}
+
+
+/* Packets beyond the span of the ring: the oldest ones are dropped to make
+ * room for a new last packet, a new first packet that does not fit is
+ * dropped */
+static void test_ring_overflow(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+		.storage = RTP_JITTER_STORAGE_RING,
+		.ring_size = 16,
+	};
+	struct rtp_jitter_stats stats;
+	struct rtp_jitter *jitter = NULL;
+	struct ctx ctx;
+	uint16_t base = 65530;
+	uint64_t ts = START_TIMESTAMP;
+	uint16_t i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	jitter = new_jitter(&cfg, &pkt_cbs, &ctx);
+	if (jitter == NULL)
+		return;
+	rtp_jitter_clear(jitter, base);
+
+	/* Packet base is missing: 1..5 are queued */
+	for (i = 1; i <= 5; i++)
+		enqueue(jitter, base + i, base, ts, 100, 0);
+
+	/* base + 20 only fits if 1..4 are dropped (span of 16) */
+	enqueue(jitter, base + 20, base, ts, 100, 0);
+	get_stats(jitter, &stats);
+	check("ring overflow: dropped", stats.overflow == 4);
+	check("ring overflow: queue", stats.queue_pkts == 2);
+
+	/* base + 4 is before the first queued packet and does not fit */
+	enqueue(jitter, base + 4, base, ts, 100, 0);
+	get_stats(jitter, &stats);
+	check("ring overflow: too old", stats.overflow == 5);
+	check("ring overflow: queue after old", stats.queue_pkts == 2);
+
+	/* base + 6 is within the span */
+	enqueue(jitter, base + 6, base, ts, 100, 0);
+	get_stats(jitter, &stats);
+	check("ring overflow: new first", stats.queue_pkts == 3);
+
+	rtp_jitter_process(jitter, ts + 10 * DELAY);
+	check("ring overflow: released", ctx.count == 3);
+	check("ring overflow: first",
+	      ctx.count > 0 && ctx.seqnums[0] == (uint16_t)(base + 5) &&
+		      ctx.gaps[0] == 5);
+	check("ring overflow: second",
+	      ctx.count > 1 && ctx.seqnums[1] == (uint16_t)(base + 6) &&
+		      ctx.gaps[1] == 0);
+	check("ring overflow: third",
+	      ctx.count > 2 && ctx.seqnums[2] == (uint16_t)(base + 20) &&
+		      ctx.gaps[2] == 13);
+	rtp_jitter_destroy(jitter);
+}
+
+
+/* Evicting the first, last and middle packets keeps the ring consistent */
+static void test_ring_evict(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+		.storage = RTP_JITTER_STORAGE_RING,
+		.ring_size = 64,
+		.max_pkts = 6,
+	};
+	/* Importance of packets 1..9 (packet 0 is missing): the least
+	 * important ones (highest values) are evicted first */
+	static const uint32_t importance[] = {0, 5, 0, 0, 4, 0, 0, 0, 0, 3};
+	static const uint16_t expected[] = {3, 5, 6, 7, 8, 10};
+	static const uint32_t expected_gaps[] = {3, 1, 0, 0, 0, 1};
+	struct rtp_jitter_stats stats;
+	struct rtp_jitter *jitter = NULL;
+	struct ctx ctx;
+	uint16_t base = 65533;
+	uint64_t ts = START_TIMESTAMP;
+	uint16_t i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	jitter = new_jitter(&cfg, &pkt_cbs, &ctx);
+	if (jitter == NULL)
+		return;
+	rtp_jitter_clear(jitter, base);
+
+	/* 1 (head) is evicted by 7, 4 (middle) by 8, 9 (tail) by itself */
+	for (i = 1; i <= 9; i++) {
+		enqueue(jitter, base + i, base, ts, 100, importance[i]);
+		ts += PKT_PERIOD;
+	}
+	get_stats(jitter, &stats);
+	check("ring evict: evicted", stats.evicted_pkts == 3);
+	check("ring evict: evicted bytes", stats.evicted_bytes == 300);
+	check("ring evict: queue", stats.queue_pkts == 6);
+	check("ring evict: queue bytes", stats.queue_bytes == 600);
+
+	/* A new last packet is queued after the evicted tail, evicting the
+	 * oldest packet as all the scores are now equal */
+	enqueue(jitter, base + 10, base, ts, 100, 0);
+	get_stats(jitter, &stats);
+	check("ring evict: oldest among equals", stats.evicted_pkts == 4);
+
+	rtp_jitter_process(jitter, ts + 10 * DELAY);
+	check("ring evict: released", ctx.count == 6);
+	for (i = 0; i < ctx.count && i < 6; i++) {
+		check("ring evict: order",
+		      ctx.seqnums[i] == (uint16_t)(base + expected[i]));
+		check("ring evict: gap", ctx.gaps[i] == expected_gaps[i]);
+	}
+	rtp_jitter_destroy(jitter);
+}
+
+
+/* Random reordering, losses and duplicates: the ring storage releases the
+ * same packets as the list storage */
+static void test_ring_vs_list(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+		.ring_size = 64,
+	};
+	struct rtp_jitter_stats list_stats, ring_stats;
+	struct rtp_jitter *list = NULL, *ring = NULL;
+	struct ctx *list_ctx = calloc(1, sizeof(*list_ctx));
+	struct ctx *ring_ctx = calloc(1, sizeof(*ring_ctx));
+	uint16_t seqnums[2048];
+	uint32_t count = 0, i, j;
+	uint16_t base = 65000, tmp;
+	uint64_t ts = START_TIMESTAMP;
+
+	if (list_ctx == NULL || ring_ctx == NULL)
+		goto out;
+	cfg.storage = RTP_JITTER_STORAGE_LIST;
+	list = new_jitter(&cfg, &pkt_cbs, list_ctx);
+	cfg.storage = RTP_JITTER_STORAGE_RING;
+	ring = new_jitter(&cfg, &pkt_cbs, ring_ctx);
+	if (list == NULL || ring == NULL)
+		goto out;
+	rtp_jitter_clear(list, base);
+	rtp_jitter_clear(ring, base);
+
+	/* 5% losses, 3% duplicates, then local swaps up to 8 packets apart */
+	for (i = 0; i < 1800; i++) {
+		if (rand64() % 100 < 5)
+			continue;
+		seqnums[count++] = base + i;
+		if (rand64() % 100 < 3)
+			seqnums[count++] = base + i;
+	}
+	for (i = 0; i + 1 < count; i++) {
+		if (rand64() % 100 >= 20)
+			continue;
+		j = i + 1 + rand64() % 7;
+		if (j >= count)
+			continue;
+		tmp = seqnums[i];
+		seqnums[i] = seqnums[j];
+		seqnums[j] = tmp;
+	}
+
+	for (i = 0; i < count; i++) {
+		ts += PKT_PERIOD / 2 + rand64() % PKT_PERIOD;
+		enqueue(list, seqnums[i], base, ts, 100, 0);
+		enqueue(ring, seqnums[i], base, ts, 100, 0);
+		rtp_jitter_process(list, ts);
+		rtp_jitter_process(ring, ts);
+	}
+	rtp_jitter_process(list, ts + 10 * DELAY);
+	rtp_jitter_process(ring, ts + 10 * DELAY);
+
+	check("ring vs list: count", list_ctx->count == ring_ctx->count);
+	check("ring vs list: released", list_ctx->count > 1500);
+	for (i = 0; i < list_ctx->count && i < ring_ctx->count; i++) {
+		check("ring vs list: seqnum",
+		      list_ctx->seqnums[i] == ring_ctx->seqnums[i]);
+		check("ring vs list: gap",
+		      list_ctx->gaps[i] == ring_ctx->gaps[i]);
+	}
+	get_stats(list, &list_stats);
+	get_stats(ring, &ring_stats);
+	check("ring vs list: no overflow", ring_stats.overflow == 0);
+	check("ring vs list: duplicates",
+	      list_stats.duplicates == ring_stats.duplicates);
+	check("ring vs list: late", list_stats.late == ring_stats.late);
+	check("ring vs list: lost", list_stats.lost == ring_stats.lost);
+	check("ring vs list: reordered",
+	      list_stats.reordered == ring_stats.reordered);
+	check("ring vs list: empty", ring_stats.queue_pkts == 0);
+
+out:
+	rtp_jitter_destroy(list);
+	rtp_jitter_destroy(ring);
+	free(list_ctx);
+	free(ring_ctx);
+}
+
+
+/* The next deadline is 0 if the head packet is the next expected one, its
+ * out timestamp plus the delay otherwise */
+static void test_next_deadline(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+	};
+	struct rtp_jitter *jitter = NULL;
+	struct ctx ctx;
+	uint64_t deadline = 0;
+	int res;
+
+	memset(&ctx, 0, sizeof(ctx));
+	jitter = new_jitter(&cfg, &pkt_cbs, &ctx);
+	if (jitter == NULL)
+		return;
+	rtp_jitter_clear(jitter, 100);
+
+	res = rtp_jitter_get_next_deadline(jitter, &deadline);
+	check("deadline: empty", res == -ENOENT);
+
+	/* The out timestamp of the first packet is its input timestamp */
+	enqueue(jitter, 101, 100, START_TIMESTAMP, 100, 0);
+	res = rtp_jitter_get_next_deadline(jitter, &deadline);
+	check("deadline: missing head",
+	      res == 0 && deadline == START_TIMESTAMP + DELAY);
+	rtp_jitter_process(jitter, START_TIMESTAMP + DELAY - 1);
+	check("deadline: not due", ctx.count == 0);
+
+	enqueue(jitter, 100, 100, START_TIMESTAMP + 1000, 100, 0);
+	res = rtp_jitter_get_next_deadline(jitter, &deadline);
+	check("deadline: next expected", res == 0 && deadline == 0);
+	rtp_jitter_process(jitter, START_TIMESTAMP + 1000);
+	check("deadline: released", ctx.count == 2);
+
+	res = rtp_jitter_get_next_deadline(jitter, &deadline);
+	check("deadline: empty again", res == -ENOENT);
+	rtp_jitter_destroy(jitter);
+}
+
+
+/* Run the loop until count packets are released or timeout (in ms) */
+static void run_loop(struct pomp_loop *loop,
+		     struct ctx *ctx,
+		     uint32_t count,
+		     uint32_t timeout,
+		     uint32_t *wakeups)
+{
+	uint64_t end = get_time() + (uint64_t)timeout * 1000;
+	uint64_t now = 0;
+
+	while (ctx->count < count && (now = get_time()) < end) {
+		if (pomp_loop_wait_and_process(loop, (end - now) / 1000 + 1) ==
+		    0)
+			(*wakeups)++;
+	}
+}
+
+
+/* With a loop attached, the timer is armed for the deadline of the head
+ * packet and a due packet is processed from an idle, without polling */
+static void test_loop_schedule(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = 30000,
+	};
+	struct rtp_jitter *jitter = NULL;
+	struct pomp_loop *loop = NULL;
+	struct ctx ctx;
+	uint64_t start = 0, elapsed = 0;
+	uint32_t wakeups = 0;
+	int res;
+
+	memset(&ctx, 0, sizeof(ctx));
+	loop = pomp_loop_new();
+	check("loop: new", loop != NULL);
+	if (loop == NULL)
+		return;
+	jitter = new_jitter(&cfg, &pkt_cbs, &ctx);
+	if (jitter == NULL)
+		goto out;
+	res = rtp_jitter_attach_loop(jitter, loop);
+	check("loop: attach", res == 0);
+	rtp_jitter_clear(jitter, 0);
+
+	/* Packet 0 is missing: packet 1 is released by the timer once its
+	 * deadline is reached, in a single wake up */
+	start = get_time();
+	enqueue(jitter, 1, 0, start, 100, 0);
+	run_loop(loop, &ctx, 1, 1000, &wakeups);
+	elapsed = get_time() - start;
+	check("loop: timer released", ctx.count == 1 && ctx.gaps[0] == 1);
+	check("loop: timer not early", elapsed >= cfg.delay);
+	check("loop: timer not late", elapsed < cfg.delay + 20000);
+	check("loop: timer wake ups", wakeups == 1);
+
+	/* Packet 2 is the next expected one: released from an idle */
+	wakeups = 0;
+	start = get_time();
+	enqueue(jitter, 2, 0, start, 100, 0);
+	check("loop: not released from enqueue", ctx.count == 1);
+	run_loop(loop, &ctx, 2, 1000, &wakeups);
+	elapsed = get_time() - start;
+	check("loop: idle released", ctx.count == 2 && ctx.gaps[1] == 0);
+	check("loop: idle immediate", elapsed < 10000);
+	check("loop: idle wake ups", wakeups == 1);
+
+	/* Nothing queued: no timer left armed */
+	res = pomp_loop_wait_and_process(loop, 2 * cfg.delay / 1000);
+	check("loop: idle when empty", res == -ETIMEDOUT);
+
+	/* A clear disarms the timer of a pending packet */
+	enqueue(jitter, 10, 0, get_time(), 100, 0);
+	rtp_jitter_clear(jitter, 20);
+	res = pomp_loop_wait_and_process(loop, 2 * cfg.delay / 1000);
+	check("loop: cleared", res == -ETIMEDOUT && ctx.count == 2);
+
+	res = rtp_jitter_detach_loop(jitter);
+	check("loop: detach", res == 0);
+
+out:
+	rtp_jitter_destroy(jitter);
+	pomp_loop_destroy(loop);
+}
+
+
+/* Packets released by a process are given in order to a single call of the
+ * batch callback, which can keep some of them; the others are destroyed */
+static void test_batch(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+	};
+	struct rtp_pkt_pool_cfg pool_cfg = {0};
+	struct rtp_pkt_pool_stats pool_stats;
+	struct rtp_pkt_pool *pool = NULL;
+	struct rtp_jitter *jitter = NULL;
+	struct rtp_pkt *pkt = NULL;
+	struct ctx ctx;
+	uint16_t seqnum;
+	uint32_t i, taken = 0;
+	int res;
+
+	memset(&ctx, 0, sizeof(ctx));
+	res = rtp_pkt_pool_new(&pool_cfg, &pool);
+	check("batch: pool", res == 0);
+	if (res < 0)
+		return;
+	jitter = new_jitter(&cfg, &batch_cbs, &ctx);
+	if (jitter == NULL)
+		goto out;
+	rtp_jitter_clear(jitter, 0);
+
+	/* 0..39 without 5 and 17, more than the initial batch size */
+	for (seqnum = 0; seqnum < 40; seqnum++) {
+		if (seqnum == 5 || seqnum == 17)
+			continue;
+		res = rtp_pkt_new_from_pool(pool, &pkt);
+		check("batch: new pkt", res == 0);
+		if (res < 0)
+			break;
+		pkt->header.seqnum = seqnum;
+		pkt->rtp_timestamp = 1000 + seqnum * 900;
+		pkt->in_timestamp = START_TIMESTAMP;
+		rtp_jitter_enqueue(jitter, pkt);
+		if (seqnum % 3 == 0)
+			taken++;
+	}
+	/* 0..4 are released at once, the others wait for their deadline */
+	rtp_jitter_process(jitter, START_TIMESTAMP);
+	check("batch: head released", ctx.calls == 1 && ctx.count == 5);
+
+	ctx.calls = 0;
+	rtp_jitter_process(jitter, START_TIMESTAMP + 10 * DELAY);
+	check("batch: single call", ctx.calls == 1);
+	check("batch: count", ctx.count == 38);
+	for (i = 0, seqnum = 0; i < ctx.count; i++, seqnum++) {
+		uint32_t gap = (seqnum == 5 || seqnum == 17) ? 1 : 0;
+		seqnum += gap;
+		check("batch: order", ctx.seqnums[i] == seqnum);
+		check("batch: gap", ctx.gaps[i] == gap);
+	}
+
+	/* The kept packets are still valid, all the others were returned */
+	check("batch: taken", ctx.taken_count == taken);
+	for (i = 0; i < ctx.taken_count; i++)
+		check("batch: taken pkt", ctx.taken[i]->header.seqnum % 3 == 0);
+	rtp_pkt_pool_get_stats(pool, &pool_stats);
+	check("batch: outstanding", pool_stats.outstanding == taken);
+	for (i = 0; i < ctx.taken_count; i++)
+		rtp_pkt_destroy(ctx.taken[i]);
+	rtp_pkt_pool_get_stats(pool, &pool_stats);
+	check("batch: all returned", pool_stats.outstanding == 0);
+
+	/* No call without released packet */
+	ctx.calls = 0;
+	rtp_jitter_process(jitter, START_TIMESTAMP + 20 * DELAY);
+	check("batch: no empty call", ctx.calls == 0);
+
+out:
+	rtp_jitter_destroy(jitter);
+	rtp_pkt_pool_destroy(pool);
+}
+
+
+/* Single thread use of the ingress ring: packets are only queued when
+ * drained by the consumer, a full ring drops the new packets, a clear from
+ * the consumer resets the estimation on the next enqueue, and an ingress
+ * jitter buffer can not join a group */
+static void test_ingress(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+		.ingress_size = 8,
+	};
+	struct rtp_jitter_group_cfg group_cfg = {0};
+	struct rtp_jitter_group *group = NULL;
+	struct rtp_jitter_stats stats;
+	struct rtp_jitter *jitter = NULL;
+	struct ctx ctx;
+	uint64_t ts = START_TIMESTAMP, deadline = 0;
+	uint16_t seqnum;
+	int res;
+
+	memset(&ctx, 0, sizeof(ctx));
+	jitter = new_jitter(&cfg, &pkt_cbs, &ctx);
+	if (jitter == NULL)
+		return;
+	rtp_jitter_clear(jitter, 0);
+
+	/* 8 packets fit, the next ones are dropped */
+	for (seqnum = 0; seqnum < 10; seqnum++) {
+		res = enqueue(
+			jitter, seqnum, 0, ts + seqnum * PKT_PERIOD, 100, 0);
+		check("ingress: enqueue",
+		      seqnum < 8 ? res == 0 : res == -ENOBUFS);
+	}
+	get_stats(jitter, &stats);
+	check("ingress: not drained", stats.queue_pkts == 0);
+	check("ingress: dropped", stats.ingress_dropped == 2);
+	check("ingress: enqueued", stats.enqueued == 8);
+	rtp_jitter_process(jitter, ts);
+	check("ingress: released", ctx.count == 8);
+
+	/* The ring accepts packets again once drained */
+	res = enqueue(jitter, 10, 0, ts + 10 * PKT_PERIOD, 100, 0);
+	check("ingress: enqueue after drain", res == 0);
+	res = rtp_jitter_get_next_deadline(jitter, &deadline);
+	check("ingress: deadline after drain",
+	      res == 0 && deadline == START_TIMESTAMP + 10 * PKT_PERIOD +
+					      DELAY);
+
+	/* Without the reset, the out timestamp of packet 21 would follow the
+	 * sender timeline (ts + 21 periods) and not its late arrival */
+	rtp_jitter_clear(jitter, 20);
+	res = enqueue(jitter, 21, 0, ts + 26 * PKT_PERIOD, 100, 0);
+	check("ingress: enqueue after clear", res == 0);
+	res = rtp_jitter_get_next_deadline(jitter, &deadline);
+	check("ingress: reset on enqueue",
+	      res == 0 && deadline == ts + 26 * PKT_PERIOD + DELAY);
+	get_stats(jitter, &stats);
+	check("ingress: cleared", stats.queue_pkts == 1);
+
+	res = rtp_jitter_group_new(&group_cfg, NULL, &group);
+	check("ingress: group", res == 0);
+	res = rtp_jitter_group_add(group, jitter);
+	check("ingress: no group", res == -EINVAL);
+	rtp_jitter_group_destroy(group);
+
+	rtp_jitter_destroy(jitter);
+}
+
+
+struct producer {
+	struct rtp_jitter *jitter;
+	uint64_t start;
+	uint32_t dropped;
+	int done;
+};
+
+
+/* Packets sent in real time (RTP timestamps follow the input timestamps),
+ * in bursts larger than the ring */
+static void *producer_thread(void *userdata)
+{
+	struct producer *producer = userdata;
+	uint64_t now = 0, elapsed = 0;
+	int res;
+
+	for (uint32_t i = 0; i < SPSC_PKT_COUNT; i++) {
+		struct rtp_pkt *pkt = NULL;
+		if (rtp_pkt_new(&pkt) < 0)
+			break;
+		now = get_time();
+		elapsed = now - producer->start;
+		pkt->header.seqnum = i;
+		pkt->in_timestamp = now;
+		pkt->rtp_timestamp = 1000 + elapsed * (CLK_RATE / 1000) / 1000;
+		pkt->raw.len = 100;
+		res = rtp_jitter_enqueue(producer->jitter, pkt);
+		if (res == -ENOBUFS)
+			producer->dropped++;
+		if (i % 64 == 63)
+			usleep(1000);
+	}
+	__atomic_store_n(&producer->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+
+/* Producer thread enqueuing through the ingress ring, consumer loop woken up
+ * by its event: all the packets are released in order or dropped */
+static void test_spsc(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = 5000,
+		.ingress_size = 32,
+	};
+	struct rtp_jitter_stats stats;
+	struct producer producer;
+	struct pomp_loop *loop = NULL;
+	struct ctx *ctx = calloc(1, sizeof(*ctx));
+	pthread_t thread;
+	uint64_t end = 0, enqueued = 0;
+	uint32_t i, expected = 0, lost = 0;
+	int res;
+
+	memset(&producer, 0, sizeof(producer));
+	loop = pomp_loop_new();
+	check("spsc: loop", loop != NULL);
+	if (loop == NULL || ctx == NULL)
+		goto out;
+	producer.jitter = new_jitter(&cfg, &pkt_cbs, ctx);
+	if (producer.jitter == NULL)
+		goto out;
+	rtp_jitter_clear(producer.jitter, 0);
+	res = rtp_jitter_attach_loop(producer.jitter, loop);
+	check("spsc: attach", res == 0);
+
+	producer.start = get_time();
+	res = pthread_create(&thread, NULL, &producer_thread, &producer);
+	check("spsc: thread", res == 0);
+	if (res != 0)
+		goto out;
+
+	/* The producer counters are read while it runs and must not go
+	 * backwards; then run until the last packets are released, or on
+	 * timeout */
+	end = get_time() + 10000000;
+	while (!__atomic_load_n(&producer.done, __ATOMIC_ACQUIRE) &&
+	       get_time() < end) {
+		get_stats(producer.jitter, &stats);
+		check("spsc: enqueued monotonic", stats.enqueued >= enqueued);
+		enqueued = stats.enqueued;
+		pomp_loop_wait_and_process(loop, 10);
+	}
+	pthread_join(thread, NULL);
+	do {
+		get_stats(producer.jitter, &stats);
+		if (stats.released == stats.enqueued)
+			break;
+		pomp_loop_wait_and_process(loop, 10);
+	} while (get_time() < end);
+
+	get_stats(producer.jitter, &stats);
+	check("spsc: all enqueued",
+	      stats.enqueued + stats.ingress_dropped == SPSC_PKT_COUNT);
+	check("spsc: dropped", stats.ingress_dropped == producer.dropped);
+	check("spsc: all released", stats.released == stats.enqueued);
+	check("spsc: recorded", ctx->count == stats.released);
+	for (i = 0; i < ctx->count; i++) {
+		check("spsc: order", ctx->seqnums[i] >= expected);
+		check("spsc: gap",
+		      ctx->gaps[i] == (uint32_t)(ctx->seqnums[i] - expected));
+		lost += ctx->gaps[i];
+		expected = ctx->seqnums[i] + 1;
+	}
+	check("spsc: lost", stats.lost == lost);
+	check("spsc: lost dropped", lost <= producer.dropped);
+	check("spsc: empty", stats.queue_pkts == 0);
+
+	rtp_jitter_detach_loop(producer.jitter);
+
+out:
+	rtp_jitter_destroy(producer.jitter);
+	if (loop != NULL)
+		pomp_loop_destroy(loop);
+	free(ctx);
+}
+
+
+static int enqueue_frame_pkt(struct rtp_jitter *jitter,
+			     uint16_t seqnum,
+			     uint32_t frame,
+			     int marker,
+			     uint64_t in_timestamp)
+{
+	struct rtp_pkt *pkt = new_pkt(seqnum, 0, in_timestamp, 100);
+	uint64_t period = FRAME_PERIOD * (CLK_RATE / 1000) / 1000;
+	if (pkt == NULL)
+		return -ENOMEM;
+	pkt->rtp_timestamp = 1000 + frame * period;
+	pkt->header.timestamp = pkt->rtp_timestamp;
+	if (marker)
+		RTP_PKT_HEADER_FLAGS_SET(pkt->header.flags, MARKER, 1);
+	return rtp_jitter_enqueue(jitter, pkt);
+}
+
+
+/* Frames are released as soon as they are complete, or at their deadline
+ * with all their queued packets otherwise; the gaps account for the holes
+ * before and within the frames */
+static void test_frame(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+		.release_mode = RTP_JITTER_RELEASE_MODE_FRAME,
+	};
+	/* Frames 0 and 1 complete, frame 2 without its middle packet (7),
+	 * frame 3 without its first and last packets (9 and 12), frame 4
+	 * complete but after a missing packet */
+	static const uint32_t sizes[] = {3, 3, 2, 2, 2};
+	static const uint32_t flags[] = {
+		0,
+		0,
+		RTP_JITTER_FRAME_FLAG_INCOMPLETE,
+		RTP_JITTER_FRAME_FLAG_INCOMPLETE,
+		RTP_JITTER_FRAME_FLAG_INCOMPLETE,
+	};
+	static const uint16_t seqnums[] = {
+		0, 1, 2, 3, 4, 5, 6, 8, 10, 11, 13, 14,
+	};
+	static const uint32_t gaps[] = {0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 1, 0};
+	struct rtp_jitter_stats stats;
+	struct rtp_jitter *jitter = NULL;
+	struct ctx *ctx = calloc(1, sizeof(*ctx));
+	uint64_t ts = START_TIMESTAMP;
+	uint32_t i;
+
+	if (ctx == NULL)
+		return;
+	jitter = new_jitter(&cfg, &frame_cbs, ctx);
+	if (jitter == NULL)
+		goto out;
+	rtp_jitter_clear(jitter, 0);
+
+	enqueue_frame_pkt(jitter, 0, 0, 0, ts);
+	enqueue_frame_pkt(jitter, 1, 0, 0, ts);
+	enqueue_frame_pkt(jitter, 2, 0, 1, ts);
+	rtp_jitter_process(jitter, ts);
+	check("frame: complete", ctx->frames == 1);
+
+	/* Frame 1 out of order: released once its middle packet arrives */
+	ts += FRAME_PERIOD;
+	enqueue_frame_pkt(jitter, 5, 1, 1, ts);
+	enqueue_frame_pkt(jitter, 3, 1, 0, ts);
+	rtp_jitter_process(jitter, ts);
+	check("frame: waiting", ctx->frames == 1);
+	enqueue_frame_pkt(jitter, 4, 1, 0, ts + 1000);
+	rtp_jitter_process(jitter, ts + 1000);
+	check("frame: completed", ctx->frames == 2);
+
+	ts += FRAME_PERIOD;
+	enqueue_frame_pkt(jitter, 6, 2, 0, ts);
+	enqueue_frame_pkt(jitter, 8, 2, 1, ts);
+	ts += FRAME_PERIOD;
+	enqueue_frame_pkt(jitter, 10, 3, 0, ts);
+	enqueue_frame_pkt(jitter, 11, 3, 0, ts);
+	ts += FRAME_PERIOD;
+	enqueue_frame_pkt(jitter, 13, 4, 0, ts);
+	enqueue_frame_pkt(jitter, 14, 4, 1, ts);
+	rtp_jitter_process(jitter, ts);
+	check("frame: incomplete waiting", ctx->frames == 2);
+
+	rtp_jitter_process(jitter, ts + 10 * DELAY);
+	check("frame: count", ctx->frames == 5);
+	for (i = 0; i < ctx->frames && i < 5; i++) {
+		check("frame: size", ctx->frame_sizes[i] == sizes[i]);
+		check("frame: flags", ctx->frame_flags[i] == flags[i]);
+	}
+	check("frame: released", ctx->count == 12);
+	for (i = 0; i < ctx->count && i < 12; i++) {
+		check("frame: order", ctx->seqnums[i] == seqnums[i]);
+		check("frame: gap", ctx->gaps[i] == gaps[i]);
+	}
+	get_stats(jitter, &stats);
+	check("frame: lost", stats.lost == 3);
+	check("frame: stats released", stats.released == 12);
+
+out:
+	rtp_jitter_destroy(jitter);
+	free(ctx);
+}
+
+
+/* With a reorder tolerance, missing packets are declared lost at their
+ * expected arrival (interpolated for the last one) plus the tolerance, if
+ * earlier than the deadline of the next packet */
+static void test_loss_deadline(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+		.reorder_tolerance = 20000,
+	};
+	struct rtp_jitter *jitter = NULL;
+	struct ctx ctx;
+	uint64_t ts = START_TIMESTAMP, deadline = 0;
+	int res;
+
+	memset(&ctx, 0, sizeof(ctx));
+	jitter = new_jitter(&cfg, &pkt_cbs, &ctx);
+	if (jitter == NULL)
+		return;
+	rtp_jitter_clear(jitter, 0);
+
+	/* Nothing released yet: the deadline of the packet applies */
+	enqueue(jitter, 1, 0, ts + PKT_PERIOD, 100, 0);
+	res = rtp_jitter_get_next_deadline(jitter, &deadline);
+	check("loss: first", res == 0 && deadline == ts + PKT_PERIOD + DELAY);
+	enqueue(jitter, 0, 0, ts, 100, 0);
+	rtp_jitter_process(jitter, ts + PKT_PERIOD);
+	check("loss: head released", ctx.count == 2);
+
+	/* Packet 2 is missing: it was expected at ts + 2 periods */
+	enqueue(jitter, 3, 0, ts + 3 * PKT_PERIOD, 100, 0);
+	res = rtp_jitter_get_next_deadline(jitter, &deadline);
+	check("loss: one missing",
+	      res == 0 && deadline == ts + 2 * PKT_PERIOD + 20000);
+	rtp_jitter_process(jitter, deadline - 1);
+	check("loss: one missing not early", ctx.count == 2);
+	rtp_jitter_process(jitter, deadline);
+	check("loss: one missing released",
+	      ctx.count == 3 && ctx.seqnums[2] == 3 && ctx.gaps[2] == 1);
+
+	/* Packets 4 to 6 are missing, the last one was expected at ts + 6
+	 * periods, interpolated between packets 3 and 7 */
+	enqueue(jitter, 7, 0, ts + 7 * PKT_PERIOD, 100, 0);
+	res = rtp_jitter_get_next_deadline(jitter, &deadline);
+	check("loss: three missing",
+	      res == 0 && deadline == ts + 6 * PKT_PERIOD + 20000);
+	rtp_jitter_process(jitter, deadline - 1);
+	check("loss: three missing not early", ctx.count == 3);
+	rtp_jitter_process(jitter, deadline);
+	check("loss: three missing released",
+	      ctx.count == 4 && ctx.seqnums[3] == 7 && ctx.gaps[3] == 3);
+
+	rtp_jitter_destroy(jitter);
+
+	/* A tolerance beyond the delay never makes the deadline later */
+	memset(&ctx, 0, sizeof(ctx));
+	cfg.reorder_tolerance = 2 * DELAY;
+	jitter = new_jitter(&cfg, &pkt_cbs, &ctx);
+	if (jitter == NULL)
+		return;
+	rtp_jitter_clear(jitter, 0);
+	enqueue(jitter, 0, 0, ts, 100, 0);
+	rtp_jitter_process(jitter, ts);
+	enqueue(jitter, 2, 0, ts + 2 * PKT_PERIOD, 100, 0);
+	res = rtp_jitter_get_next_deadline(jitter, &deadline);
+	check("loss: packet deadline",
+	      res == 0 && deadline == ts + 2 * PKT_PERIOD + DELAY);
+	rtp_jitter_destroy(jitter);
+}
+
+
+/* Frame release mode: a frame with a packet that never arrives is released
+ * once the packet is declared lost (expected arrival plus the tolerance),
+ * not at the deadline of the frame */
+static void test_frame_loss_deadline(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+		.release_mode = RTP_JITTER_RELEASE_MODE_FRAME,
+		.reorder_tolerance = 20000,
+	};
+	struct rtp_jitter *jitter = NULL;
+	struct ctx *ctx = calloc(1, sizeof(*ctx));
+	uint64_t ts = START_TIMESTAMP, deadline = 0;
+	int res;
+
+	if (ctx == NULL)
+		return;
+	jitter = new_jitter(&cfg, &frame_cbs, ctx);
+	if (jitter == NULL)
+		goto out;
+	rtp_jitter_clear(jitter, 0);
+
+	/* Frame 0 complete */
+	enqueue_frame_pkt(jitter, 0, 0, 0, ts);
+	enqueue_frame_pkt(jitter, 1, 0, 0, ts);
+	enqueue_frame_pkt(jitter, 2, 0, 1, ts);
+	rtp_jitter_process(jitter, ts);
+	check("frame loss: first frame", ctx->frames == 1);
+
+	/* Frame 1 without its middle packet (4) */
+	ts += FRAME_PERIOD;
+	enqueue_frame_pkt(jitter, 3, 1, 0, ts);
+	enqueue_frame_pkt(jitter, 5, 1, 1, ts + 1000);
+	rtp_jitter_process(jitter, ts + 1000);
+	check("frame loss: incomplete kept", ctx->frames == 1);
+	res = rtp_jitter_get_next_deadline(jitter, &deadline);
+	check("frame loss: deadline",
+	      res == 0 && deadline + 1000 >= ts + cfg.reorder_tolerance &&
+		      deadline <= ts + cfg.reorder_tolerance);
+	rtp_jitter_process(jitter, deadline - 1);
+	check("frame loss: not early", ctx->frames == 1);
+	rtp_jitter_process(jitter, deadline);
+	check("frame loss: released",
+	      ctx->frames == 2 && ctx->frame_sizes[1] == 2 &&
+		      (ctx->frame_flags[1] &
+		       RTP_JITTER_FRAME_FLAG_INCOMPLETE) != 0);
+	check("frame loss: gaps",
+	      ctx->count == 5 && ctx->seqnums[3] == 3 && ctx->gaps[3] == 0 &&
+		      ctx->seqnums[4] == 5 && ctx->gaps[4] == 1);
+
+	/* Without a later packet, the hole is not known yet */
+	ts += FRAME_PERIOD;
+	enqueue_frame_pkt(jitter, 6, 2, 0, ts);
+	res = rtp_jitter_get_next_deadline(jitter, &deadline);
+	check("frame loss: no later packet",
+	      res == 0 && deadline > ts + cfg.reorder_tolerance + 1000);
+
+out:
+	rtp_jitter_destroy(jitter);
+	free(ctx);
+}
+
+
+/* Adaptive delay under a constant jitter profile (transit variation
+ * uniform up to 20 ms, then up to 40 ms, packets kept in order): the delay
+ * moves by at most the slew per second towards the 95th percentile plus the
+ * margin, then stays stable */
+static void test_adaptive_delay(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = 200000,
+		.delay_percentile = 95,
+		.delay_margin = 5000,
+		.delay_min = 5000,
+	};
+	/* Per second: 100 packets */
+	static const uint32_t phase_duration = 60;
+	struct rtp_jitter_stats stats;
+	struct rtp_jitter *jitter = NULL;
+	struct ctx *ctx = calloc(1, sizeof(*ctx));
+	uint64_t ts = 0, prev_ts = 0;
+	uint32_t delay = 0, prev_delay = 0, stable_delay = 0;
+	uint32_t max_variation = 20000;
+	uint32_t i, second;
+
+	if (ctx == NULL)
+		return;
+	jitter = new_jitter(&cfg, &pkt_cbs, ctx);
+	if (jitter == NULL)
+		goto out;
+	rtp_jitter_clear(jitter, 0);
+	rtp_jitter_get_target_delay(jitter, &prev_delay);
+	check("adaptive: initial", prev_delay == cfg.delay);
+
+	for (i = 0; i < 2 * phase_duration * 100; i++) {
+		if (i == phase_duration * 100)
+			max_variation = 40000;
+		ts = START_TIMESTAMP + (uint64_t)i * PKT_PERIOD +
+		     rand64() % max_variation;
+		if (ts < prev_ts)
+			ts = prev_ts;
+		prev_ts = ts;
+		enqueue(jitter, i, 0, ts, 100, 0);
+		rtp_jitter_process(jitter, ts);
+		ctx->count = 0;
+		if (i % 100 != 99)
+			continue;
+
+		second = i / 100 + 1;
+		rtp_jitter_get_target_delay(jitter, &delay);
+		check("adaptive: slew",
+		      delay <= prev_delay + DELAY_SLEW &&
+			      delay + DELAY_SLEW >= prev_delay);
+		if (second <= phase_duration)
+			check("adaptive: decreasing", delay <= prev_delay);
+		else
+			check("adaptive: increasing", delay >= prev_delay);
+
+		/* Converged after 30 s of each phase, then stable */
+		if (second % phase_duration == 30)
+			stable_delay = delay;
+		else if (second % phase_duration > 30 ||
+			 second % phase_duration == 0)
+			check("adaptive: stable", delay == stable_delay);
+		if (second == phase_duration) {
+			check("adaptive: first target",
+			      delay >= 19000 + cfg.delay_margin &&
+				      delay <= 25000 + cfg.delay_margin);
+		} else if (second == 2 * phase_duration) {
+			check("adaptive: second target",
+			      delay >= 38000 + cfg.delay_margin &&
+				      delay <= 48000 + cfg.delay_margin);
+		}
+		prev_delay = delay;
+	}
+
+	get_stats(jitter, &stats);
+	check("adaptive: stats delay", stats.delay == delay);
+	check("adaptive: no loss", stats.lost == 0 && stats.late == 0);
+
+out:
+	rtp_jitter_destroy(jitter);
+	free(ctx);
+}
+
+
+/* Live mode, consumer side: after a stall of the consumer, the packets
+ * older than max_latency are dropped from the head of the queue, except
+ * the important ones which are released */
+static void test_live_stale(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+		.max_latency = MAX_LATENCY,
+		.skip_keep_importance = 1,
+	};
+	struct rtp_jitter_stats stats;
+	struct rtp_jitter *jitter = NULL;
+	struct ctx *ctx = calloc(1, sizeof(*ctx));
+	uint64_t cur = START_TIMESTAMP + 39 * PKT_PERIOD;
+	uint64_t in_timestamp = 0;
+	uint32_t kept = 0;
+	uint16_t seqnum;
+
+	if (ctx == NULL)
+		return;
+	jitter = new_jitter(&cfg, &live_cbs, ctx);
+	if (jitter == NULL)
+		goto out;
+	rtp_jitter_clear(jitter, 0);
+
+	/* One packet out of 8 is important */
+	for (uint16_t i = 0; i < 40; i++) {
+		enqueue(jitter,
+			i,
+			0,
+			START_TIMESTAMP + i * PKT_PERIOD,
+			100,
+			i % 8 == 0 ? 0 : 1);
+	}
+	rtp_jitter_process(jitter, cur);
+
+	/* 0 to 23 are stale, 0, 8 and 16 kept */
+	check("live stale: skipped", ctx->skipped == 21);
+	check("live stale: skip calls", ctx->skip_calls == 1);
+	check("live stale: released", ctx->count == 19);
+	for (uint32_t i = 0; i < ctx->count; i++) {
+		seqnum = ctx->seqnums[i];
+		in_timestamp = START_TIMESTAMP + seqnum * PKT_PERIOD;
+		if (seqnum % 8 == 0 && seqnum < 24) {
+			kept++;
+			continue;
+		}
+		check("live stale: latency",
+		      cur <= in_timestamp + cfg.max_latency);
+		check("live stale: gap", ctx->gaps[i] == 0);
+	}
+	check("live stale: kept", kept == 3);
+	check("live stale: order",
+	      ctx->count == 19 && ctx->seqnums[0] == 0 &&
+		      ctx->seqnums[2] == 16 && ctx->seqnums[3] == 24 &&
+		      ctx->seqnums[18] == 39);
+
+	get_stats(jitter, &stats);
+	check("live stale: stats skipped", stats.skipped == 21);
+	check("live stale: stats released", stats.released == 19);
+	check("live stale: stats lost", stats.lost == 0);
+
+	/* Back to normal */
+	ctx->count = 0;
+	enqueue(jitter, 40, 0, cur + PKT_PERIOD, 100, 1);
+	rtp_jitter_process(jitter, cur + PKT_PERIOD);
+	check("live stale: resumed",
+	      ctx->count == 1 && ctx->seqnums[0] == 40 && ctx->gaps[0] == 0);
+	check("live stale: no more skip", ctx->skip_calls == 1);
+
+out:
+	rtp_jitter_destroy(jitter);
+	free(ctx);
+}
+
+
+/* Live mode, producer side: after a network stall, the burst of packets
+ * would be released more than max_latency after their arrival; the timing
+ * restarts from each packet over the limit and the packets before the last
+ * restart are dropped */
+static void test_live_cut(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+		.max_latency = MAX_LATENCY,
+	};
+	struct rtp_jitter_stats stats;
+	struct rtp_jitter *jitter = NULL;
+	struct ctx *ctx = calloc(1, sizeof(*ctx));
+	uint64_t ts = 0, deadline = 0;
+	int res;
+
+	if (ctx == NULL)
+		return;
+	jitter = new_jitter(&cfg, &live_cbs, ctx);
+	if (jitter == NULL)
+		goto out;
+	rtp_jitter_clear(jitter, 0);
+
+	for (uint16_t i = 0; i < 10; i++) {
+		ts = START_TIMESTAMP + i * PKT_PERIOD;
+		enqueue(jitter, i, 0, ts, 100, 0);
+		rtp_jitter_process(jitter, ts);
+	}
+	check("live cut: before", ctx->count == 10 && ctx->skipped == 0);
+
+	/* 10 to 29 received at once, 200 ms late: the timing restarts at 10
+	 * (skew reset), then at 16, 22 and 28 which would be released 60 ms
+	 * after the limit; only 28 and 29 are kept */
+	ts = START_TIMESTAMP + 30 * PKT_PERIOD;
+	for (uint16_t i = 10; i < 30; i++)
+		enqueue(jitter, i, 0, ts, 100, 0);
+	res = rtp_jitter_get_next_deadline(jitter, &deadline);
+	check("live cut: deadline", res == 0 && deadline <= ts);
+	rtp_jitter_process(jitter, ts);
+
+	check("live cut: skipped", ctx->skipped == 18 && ctx->skip_calls == 1);
+	check("live cut: released", ctx->count == 12);
+	for (uint32_t i = 0; i < ctx->count; i++) {
+		check("live cut: order",
+		      ctx->seqnums[i] == (i < 10 ? i : i + 18));
+		check("live cut: gap", ctx->gaps[i] == 0);
+	}
+
+	get_stats(jitter, &stats);
+	check("live cut: stats skipped", stats.skipped == 18);
+	check("live cut: stats released", stats.released == 12);
+	check("live cut: stats lost", stats.lost == 0);
+	check("live cut: skew resets", stats.skew_resets == 4);
+
+out:
+	rtp_jitter_destroy(jitter);
+	free(ctx);
+}
+
+/* Skew estimators on a trace with a known clock drift: the regression
+ * converges to the drift and its skew follows the lower envelope of the
+ * samples; the EWMA, which does not estimate the drift, stays within the
+ * jitter of the envelope; without memory (skew_avg_alpha 1) the regression
+ * has a single point, no slope, and falls back to the last block minimum */
+static void test_skew_drift(void)
+{
+	/* Bounds of the skew above and below the envelope (in us) and of
+	 * the estimated drift (in ppm) */
+	static const struct {
+		enum rtp_jitter_skew_mode mode;
+		uint32_t skew_avg_alpha;
+		const char *name;
+		int64_t above;
+		int64_t below;
+		int32_t drift_min;
+		int32_t drift_max;
+	} runs[] = {
+		{RTP_JITTER_SKEW_MODE_REGRESSION,
+		 0,
+		 "regression",
+		 300,
+		 20,
+		 SKEW_DRIFT - 5,
+		 SKEW_DRIFT + 5},
+		{RTP_JITTER_SKEW_MODE_EWMA, 0, "ewma", 1500, 500, 0, 0},
+		{RTP_JITTER_SKEW_MODE_REGRESSION,
+		 1,
+		 "regression alpha 1",
+		 500,
+		 200,
+		 0,
+		 0},
+	};
+	struct rtp_jitter_cfg cfg;
+	struct rtp_jitter_stats stats;
+	struct rtp_jitter *jitter = NULL;
+	struct ctx *ctx = calloc(1, sizeof(*ctx));
+	char what[64];
+	uint64_t ts = 0, send = 0;
+	int64_t skew_avg = 0, envelope = 0, first_jitter = 0, jitter_us = 0;
+	int64_t max_above = 0, max_below = 0;
+	int32_t drift_min = 0, drift_max = 0;
+
+	if (ctx == NULL)
+		return;
+
+	for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) {
+		memset(&cfg, 0, sizeof(cfg));
+		cfg.clk_rate = CLK_RATE;
+		cfg.delay = DELAY;
+		cfg.skew_mode = runs[r].mode;
+		cfg.skew_avg_alpha = runs[r].skew_avg_alpha;
+		jitter = new_jitter(&cfg, &pkt_cbs, ctx);
+		if (jitter == NULL)
+			break;
+		max_above = INT64_MIN;
+		max_below = INT64_MIN;
+		drift_min = INT32_MAX;
+		drift_max = INT32_MIN;
+
+		for (uint32_t i = 0; i < SKEW_DURATION * 100; i++) {
+			send = (uint64_t)i * PKT_PERIOD;
+			jitter_us = rand64() % SKEW_JITTER;
+			if (i == 0)
+				first_jitter = jitter_us;
+			ts = START_TIMESTAMP + send +
+			     send * SKEW_DRIFT / 1000000 + jitter_us;
+			enqueue(jitter, i, 0, ts, 100, 0);
+			rtp_jitter_process(jitter, ts);
+			ctx->count = 0;
+
+			/* Compare the skew (relative to the first packet) to
+			 * the lower envelope of the samples after 30 s */
+			if (i < 30 * 100)
+				continue;
+			rtp_jitter_get_info(jitter, NULL, NULL, &skew_avg);
+			envelope = send * SKEW_DRIFT / 1000000 - first_jitter;
+			if (skew_avg - envelope > max_above)
+				max_above = skew_avg - envelope;
+			if (envelope - skew_avg > max_below)
+				max_below = envelope - skew_avg;
+			get_stats(jitter, &stats);
+			if (stats.skew_drift < drift_min)
+				drift_min = stats.skew_drift;
+			if (stats.skew_drift > drift_max)
+				drift_max = stats.skew_drift;
+		}
+
+		get_stats(jitter, &stats);
+		snprintf(what, sizeof(what), "%s: no reset", runs[r].name);
+		check(what, stats.skew_resets == 0);
+		snprintf(what, sizeof(what), "%s: bounded", runs[r].name);
+		check(what,
+		      max_above <= runs[r].above && max_below <= runs[r].below);
+		snprintf(what, sizeof(what), "%s: drift", runs[r].name);
+		check(what,
+		      drift_min >= runs[r].drift_min &&
+			      drift_max <= runs[r].drift_max);
+
+		rtp_jitter_destroy(jitter);
+		jitter = NULL;
+	}
+
+	free(ctx);
+}
+
+
+
+struct event {
+	uint16_t index;
+	uint64_t in_timestamp;
+};
+
+
+static int event_cmp(const void *a, const void *b)
+{
+	const struct event *ea = a, *eb = b;
+
+	if (ea->in_timestamp != eb->in_timestamp)
+		return ea->in_timestamp < eb->in_timestamp ? -1 : 1;
+	return ea->index < eb->index ? -1 : ea->index > eb->index;
+}
+
+
+/* Statistics against random traffic (losses, reordering, late packets and
+ * duplicates around the sequence number wrap-around): the expected counters
+ * are derived from what was enqueued and released */
+static void test_stats(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+	};
+	struct rtp_jitter_stats stats;
+	struct rtp_jitter *jitter = NULL;
+	struct ctx *ctx = calloc(1, sizeof(*ctx));
+	struct event *events = calloc(STATS_MAX_EVENTS, sizeof(*events));
+	uint8_t *queued = calloc(STATS_PKT_COUNT, sizeof(*queued));
+	uint16_t base = 64000, seqnum, index, highest = 0;
+	uint64_t sent_ts = 0, ts = 0;
+	uint64_t gaps = 0, late = 0, duplicates = 0, reordered = 0;
+	uint32_t count = 0, released = 0, prob, max_depth = 0;
+	int16_t depth;
+	int res, ok = 1;
+
+	if (ctx == NULL || events == NULL || queued == NULL)
+		goto out;
+	jitter = new_jitter(&cfg, &pkt_cbs, ctx);
+	if (jitter == NULL)
+		goto out;
+	rtp_jitter_clear(jitter, base);
+
+	/* Traffic: 4% never received, 5% delayed by 1 to 3 packets
+	 * (reordered), 2% delayed after the following ones are released
+	 * (late), 3% received twice */
+	for (uint32_t i = 0; i < STATS_PKT_COUNT; i++) {
+		prob = rand64() % 100;
+		if (prob < 4)
+			continue;
+		sent_ts = START_TIMESTAMP + (uint64_t)i * PKT_PERIOD;
+		ts = sent_ts + rand64() % 3000;
+		if (prob < 9)
+			ts += 15000 + rand64() % 20000;
+		else if (prob < 11)
+			ts += 2 * DELAY + rand64() % DELAY;
+		events[count].index = i;
+		events[count++].in_timestamp = ts;
+		if (prob >= 97) {
+			events[count].index = i;
+			events[count++].in_timestamp =
+				ts + rand64() % (2 * DELAY);
+		}
+	}
+	qsort(events, count, sizeof(*events), &event_cmp);
+
+	for (uint32_t i = 0; i < count; i++) {
+		index = events[i].index;
+		seqnum = base + index;
+		ts = events[i].in_timestamp;
+
+		/* Expected outcome */
+		if (i == 0) {
+			highest = seqnum;
+		} else {
+			depth = (int16_t)(highest - seqnum);
+			if (depth < 0) {
+				highest = seqnum;
+			} else if (depth > 0) {
+				reordered++;
+				if ((uint32_t)depth > max_depth)
+					max_depth = depth;
+			}
+		}
+		if (ctx->count > 0 &&
+		    (int16_t)(ctx->seqnums[ctx->count - 1] - seqnum) >= 0)
+			late++;
+		else if (queued[index])
+			duplicates++;
+		else
+			queued[index] = 1;
+
+		res = enqueue(jitter, seqnum, base, ts, 100, 0);
+		check("stats: enqueue", res == 0);
+		released = ctx->count;
+		rtp_jitter_process(jitter, ts);
+		for (uint32_t j = released; j < ctx->count; j++) {
+			index = ctx->seqnums[j] - base;
+			ok = ok && queued[index];
+			queued[index] = 0;
+		}
+	}
+	released = ctx->count;
+	rtp_jitter_process(jitter, UINT64_MAX / 2);
+	for (uint32_t j = released; j < ctx->count; j++)
+		queued[(uint16_t)(ctx->seqnums[j] - base)] = 0;
+	check("stats: released queued packets", ok);
+
+	/* Released in order, exactly once */
+	for (uint32_t j = 0; j < ctx->count; j++) {
+		gaps += ctx->gaps[j];
+		check("stats: order",
+		      j == 0 || (int16_t)(ctx->seqnums[j] -
+					  ctx->seqnums[j - 1]) > 0);
+	}
+	for (uint32_t j = 0; j < STATS_PKT_COUNT; j++)
+		check("stats: all released", !queued[j]);
+
+	get_stats(jitter, &stats);
+	check("stats: enqueued", stats.enqueued == count);
+	check("stats: released", stats.released == ctx->count);
+	check("stats: lost", stats.lost == gaps);
+	check("stats: lost count",
+	      ctx->count > 0 &&
+		      stats.lost == (uint16_t)(ctx->seqnums[ctx->count - 1] -
+					       base) +
+					    1 - ctx->count);
+	check("stats: late", stats.late == late && late > 0);
+	check("stats: duplicates",
+	      stats.duplicates == duplicates && duplicates > 0);
+	check("stats: reordered",
+	      stats.reordered == reordered && reordered > 0);
+	check("stats: reorder depth", stats.reorder_max_depth == max_depth);
+	check("stats: dropped", stats.overflow == 0 && stats.skipped == 0);
+	check("stats: balance",
+	      stats.enqueued ==
+		      stats.released + stats.late + stats.duplicates);
+	check("stats: queue", stats.queue_pkts == 0 && stats.queue_bytes == 0);
+
+out:
+	rtp_jitter_destroy(jitter);
+	free(queued);
+	free(events);
+	free(ctx);
+}
+
+
+int main(int argc, char *argv[])
+{
+	test_ring_wrap();
+	test_ring_overflow();
+	test_ring_evict();
+	test_ring_vs_list();
+	test_next_deadline();
+	test_loop_schedule();
+	test_batch();
+	test_ingress();
+	test_spsc();
+	test_frame();
+	test_loss_deadline();
+	test_frame_loss_deadline();
+	test_adaptive_delay();
+	test_live_stale();
+	test_live_cut();
+	test_skew_drift();
+	test_stats();
+
+	printf("%s: %" PRIu64 " failures\n",
+	       failures == 0 ? "OK" : "FAILED",
+	       failures);
+	return failures != 0;
+}
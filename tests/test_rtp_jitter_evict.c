@@ -0,0 +1,579 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtp/rtp.h"
+
+#include "check.h"
+
+/**
+ * Test of the eviction of the jitter buffer: per-buffer packet and byte
+ * budgets, eviction order (least important first, oldest among equals,
+ * including the new packet), custom policy callback evaluated once per
+ * packet, per-group budgets evicting from the member using the most of the
+ * exceeded budget (checked against a model with random traffic, releases
+ * and membership changes), and the eviction counters.
+ */
+
+#define CLK_RATE 90000
+#define DELAY 100000
+#define START_TIMESTAMP 1000000
+#define PKT_PERIOD 10000
+#define MAX_PKTS 256
+#define MODEL_MEMBERS 16
+#define MODEL_MAX_PKTS 80
+#define MODEL_OPS 20000
+
+
+/* Packets queued according to the test (model), in sequence order */
+struct member {
+	struct rtp_jitter *jitter;
+	uint16_t next_seqnum;
+	uint16_t seqnums[MAX_PKTS];
+	uint32_t importances[MAX_PKTS];
+	size_t lens[MAX_PKTS];
+	uint32_t count;
+	uint32_t score_calls;
+	uint64_t evicted_pkts;
+	uint64_t evicted_bytes;
+};
+
+
+static void model_add(struct member *m,
+		      uint16_t seqnum,
+		      uint32_t importance,
+		      size_t len)
+{
+	if (m->count >= MAX_PKTS) {
+		check("too many packets", 0);
+		return;
+	}
+	m->seqnums[m->count] = seqnum;
+	m->importances[m->count] = importance;
+	m->lens[m->count] = len;
+	m->count++;
+}
+
+
+static void model_remove(struct member *m, uint32_t index)
+{
+	m->count--;
+	memmove(&m->seqnums[index],
+		&m->seqnums[index + 1],
+		(m->count - index) * sizeof(m->seqnums[0]));
+	memmove(&m->importances[index],
+		&m->importances[index + 1],
+		(m->count - index) * sizeof(m->importances[0]));
+	memmove(&m->lens[index],
+		&m->lens[index + 1],
+		(m->count - index) * sizeof(m->lens[0]));
+}
+
+
+static int model_find(struct member *m, uint16_t seqnum)
+{
+	for (uint32_t i = 0; i < m->count; i++) {
+		if (m->seqnums[i] == seqnum)
+			return i;
+	}
+	return -1;
+}
+
+
+/* Expected victim with the default policy: highest importance value, the
+ * oldest among equals */
+static int model_victim(struct member *m)
+{
+	int victim = -1;
+
+	for (uint32_t i = 0; i < m->count; i++) {
+		if (victim < 0 || m->importances[i] > m->importances[victim])
+			victim = i;
+	}
+	return victim;
+}
+
+
+/* Packets released are removed from the model */
+static void process_pkt_cb(struct rtp_jitter *jitter,
+			   const struct rtp_pkt *pkt,
+			   uint32_t gap,
+			   void *userdata)
+{
+	struct member *m = userdata;
+	int index = model_find(m, pkt->header.seqnum);
+
+	check("released packet not queued", index >= 0);
+	if (index >= 0)
+		model_remove(m, index);
+}
+
+
+/* Evict the newest packets first */
+static uint64_t evict_score_cb(struct rtp_jitter *jitter,
+			       const struct rtp_pkt *pkt,
+			       void *userdata)
+{
+	struct member *m = userdata;
+
+	m->score_calls++;
+	return pkt->header.seqnum;
+}
+
+
+static const struct rtp_jitter_cbs cbs = {
+	.process_pkt = &process_pkt_cb,
+};
+
+
+static const struct rtp_jitter_cbs policy_cbs = {
+	.process_pkt = &process_pkt_cb,
+	.evict_score = &evict_score_cb,
+};
+
+
+static void member_init(struct member *m,
+			const struct rtp_jitter_cfg *cfg,
+			const struct rtp_jitter_cbs *member_cbs)
+{
+	int res;
+
+	memset(m, 0, sizeof(*m));
+	res = rtp_jitter_new(cfg, member_cbs, m, &m->jitter);
+	check("rtp_jitter_new", res == 0);
+	if (res == 0)
+		rtp_jitter_clear(m->jitter, 0);
+}
+
+
+/* Enqueue the next packet of a member, without processing it */
+static int enqueue(struct member *m, uint32_t importance, size_t len)
+{
+	struct rtp_pkt *pkt = NULL;
+	uint16_t seqnum = m->next_seqnum++;
+	int res;
+
+	res = rtp_pkt_new(&pkt);
+	if (res < 0) {
+		check("rtp_pkt_new", 0);
+		return res;
+	}
+	pkt->header.seqnum = seqnum;
+	pkt->rtp_timestamp =
+		1000 + (uint64_t)seqnum * PKT_PERIOD * (CLK_RATE / 1000) / 1000;
+	pkt->header.timestamp = pkt->rtp_timestamp;
+	pkt->in_timestamp = START_TIMESTAMP + (uint64_t)seqnum * PKT_PERIOD;
+	pkt->raw.len = len;
+	pkt->importance = importance;
+	model_add(m, seqnum, importance, len);
+	return rtp_jitter_enqueue(m->jitter, pkt);
+}
+
+
+/* Update the model with the packets evicted since the last call, in the
+ * expected order; returns the number of packets evicted */
+static uint32_t sync_evictions(struct member *m, const char *what)
+{
+	uint64_t pkts = 0, bytes = 0, evicted_bytes = 0;
+	uint32_t count = 0;
+	int victim;
+
+	rtp_jitter_get_evictions(m->jitter, &pkts, &bytes);
+	count = pkts - m->evicted_pkts;
+	for (uint32_t i = 0; i < count; i++) {
+		victim = model_victim(m);
+		if (victim < 0)
+			break;
+		evicted_bytes += m->lens[victim];
+		model_remove(m, victim);
+	}
+	check(what, bytes - m->evicted_bytes == evicted_bytes);
+	m->evicted_pkts = pkts;
+	m->evicted_bytes = bytes;
+	return count;
+}
+
+
+/* Queued packets of the jitter buffer, released at once */
+static void check_queued(struct member *m, const char *what)
+{
+	uint16_t expected[MAX_PKTS];
+	uint32_t count = m->count;
+
+	memcpy(expected, m->seqnums, count * sizeof(expected[0]));
+	rtp_jitter_process(m->jitter, UINT64_MAX / 2);
+	check(what, m->count == 0);
+	for (uint32_t i = 0; i < count; i++)
+		check(what, model_find(m, expected[i]) < 0);
+}
+
+
+/* Packet budget: least important first, oldest among equals, including
+ * the new packet */
+static void test_buffer_pkts(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+		.max_pkts = 8,
+	};
+	static const uint32_t importances[] = {2, 1, 3, 3, 0, 1, 3, 2};
+	static const uint16_t expected[] = {4, 5, 8, 9, 10, 11, 12, 13};
+	static const uint16_t evicted[] = {2, 3, 6, 0, 7, 1, 14};
+	struct rtp_jitter_stats stats;
+	struct member *m = calloc(1, sizeof(*m));
+	uint64_t pkts = 0, bytes = 0;
+	size_t evicted_bytes = 0;
+
+	if (m == NULL)
+		return;
+	member_init(m, &cfg, &cbs);
+	if (m->jitter == NULL)
+		goto out;
+
+	for (uint32_t i = 0; i < 8; i++)
+		enqueue(m, importances[i], 100 + i);
+	rtp_jitter_get_evictions(m->jitter, &pkts, &bytes);
+	check("buffer pkts: within budget", pkts == 0);
+
+	/* Evicts 2, 3, 6 (3), 0, 7 (2) then 1 (oldest 1), then 14 itself */
+	for (uint32_t i = 8; i < 14; i++)
+		enqueue(m, 1, 100 + i);
+	enqueue(m, 3, 114);
+	for (uint32_t i = 0; i < 7; i++)
+		evicted_bytes += 100 + evicted[i];
+	sync_evictions(m, "buffer pkts: evicted bytes");
+	check("buffer pkts: model",
+	      m->count == 8 && memcmp(m->seqnums,
+				      expected,
+				      sizeof(expected)) == 0);
+
+	rtp_jitter_get_evictions(m->jitter, &pkts, &bytes);
+	check("buffer pkts: evictions", pkts == 7 && bytes == evicted_bytes);
+	memset(&stats, 0, sizeof(stats));
+	rtp_jitter_get_stats(m->jitter, &stats);
+	check("buffer pkts: stats",
+	      stats.evicted_pkts == 7 && stats.evicted_bytes == evicted_bytes);
+	check_queued(m, "buffer pkts: released");
+
+out:
+	rtp_jitter_destroy(m->jitter);
+	free(m);
+}
+
+
+/* Byte budget */
+static void test_buffer_bytes(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+		.max_bytes = 1000,
+	};
+	static const uint16_t expected[] = {2, 3, 5};
+	struct member *m = calloc(1, sizeof(*m));
+	uint64_t pkts = 0, bytes = 0;
+
+	if (m == NULL)
+		return;
+	member_init(m, &cfg, &cbs);
+	if (m->jitter == NULL)
+		goto out;
+
+	enqueue(m, 0, 300);
+	enqueue(m, 1, 300);
+	enqueue(m, 0, 300);
+	/* 1100 bytes: evicts 1 */
+	enqueue(m, 0, 200);
+	/* Evicts itself */
+	enqueue(m, 1, 300);
+	/* 1200 bytes: evicts 0, the oldest */
+	enqueue(m, 0, 400);
+	sync_evictions(m, "buffer bytes: evicted bytes");
+	check("buffer bytes: model",
+	      m->count == 3 && memcmp(m->seqnums,
+				      expected,
+				      sizeof(expected)) == 0);
+
+	rtp_jitter_get_evictions(m->jitter, &pkts, &bytes);
+	check("buffer bytes: evictions", pkts == 3 && bytes == 900);
+	check_queued(m, "buffer bytes: released");
+
+out:
+	rtp_jitter_destroy(m->jitter);
+	free(m);
+}
+
+
+/* Custom policy: the newest packets are evicted first, the score of each
+ * packet is computed once, and only if a budget applies */
+static void test_policy(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+		.max_pkts = 4,
+	};
+	static const uint16_t expected[] = {0, 1, 2, 3};
+	struct member *m = calloc(1, sizeof(*m));
+	uint64_t pkts = 0;
+
+	if (m == NULL)
+		return;
+	member_init(m, &cfg, &policy_cbs);
+	if (m->jitter == NULL)
+		goto out;
+
+	for (uint32_t i = 0; i < 20; i++)
+		enqueue(m, 0, 100);
+	rtp_jitter_get_evictions(m->jitter, &pkts, NULL);
+	check("policy: evictions", pkts == 16);
+	check("policy: calls", m->score_calls == 20);
+	m->count = 4;
+	check("policy: model",
+	      memcmp(m->seqnums, expected, sizeof(expected)) == 0);
+	check_queued(m, "policy: released");
+	rtp_jitter_destroy(m->jitter);
+
+	/* No budget */
+	cfg.max_pkts = 0;
+	member_init(m, &cfg, &policy_cbs);
+	if (m->jitter == NULL)
+		goto out;
+	for (uint32_t i = 0; i < 20; i++)
+		enqueue(m, 0, 100);
+	check("policy: no budget", m->score_calls == 0);
+	check_queued(m, "policy: no budget released");
+
+out:
+	rtp_jitter_destroy(m->jitter);
+	free(m);
+}
+
+
+/* Group budgets: evict from the member using the most of the exceeded
+ * budget */
+static void test_group(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+	};
+	struct rtp_jitter_group_cfg group_cfg = {
+		.max_pkts = 10,
+		.max_bytes = 1300,
+	};
+	struct rtp_jitter_group *group = NULL;
+	struct member *m = calloc(3, sizeof(*m));
+	uint64_t pkts = 0, bytes = 0;
+	int res;
+
+	if (m == NULL)
+		return;
+	res = rtp_jitter_group_new(&group_cfg, NULL, &group);
+	check("group: new", res == 0);
+	if (res < 0)
+		goto out;
+	for (uint32_t i = 0; i < 3; i++) {
+		member_init(&m[i], &cfg, &cbs);
+		res = rtp_jitter_group_add(group, m[i].jitter);
+		check("group: add", res == 0);
+	}
+
+	/* Packets: 5, 2, 2; bytes: 250, 800, 200 */
+	for (uint32_t i = 0; i < 5; i++)
+		enqueue(&m[0], i == 1 ? 2 : 1, 50);
+	enqueue(&m[1], 0, 400);
+	enqueue(&m[1], 1, 400);
+	enqueue(&m[2], 0, 100);
+	enqueue(&m[2], 0, 100);
+
+	/* 1350 bytes: evicts from 1 (most bytes) */
+	enqueue(&m[0], 1, 100);
+	check("group: bytes victim",
+	      sync_evictions(&m[0], "group: bytes 0") == 0 &&
+		      sync_evictions(&m[1], "group: bytes 1") == 1 &&
+		      sync_evictions(&m[2], "group: bytes 2") == 0);
+	check("group: bytes model", m[1].count == 1 && m[1].seqnums[0] == 0);
+
+	/* 11 packets: evicts from 0 (most packets), the least important */
+	enqueue(&m[2], 0, 10);
+	enqueue(&m[2], 0, 10);
+	check("group: pkts victim",
+	      sync_evictions(&m[0], "group: pkts 0") == 1 &&
+		      sync_evictions(&m[1], "group: pkts 1") == 0 &&
+		      sync_evictions(&m[2], "group: pkts 2") == 0);
+	check("group: pkts model", model_find(&m[0], 1) < 0);
+
+	rtp_jitter_group_get_evictions(group, &pkts, &bytes);
+	check("group: evictions", pkts == 2 && bytes == 450);
+
+	for (uint32_t i = 0; i < 3; i++) {
+		check_queued(&m[i], "group: released");
+		rtp_jitter_destroy(m[i].jitter);
+		m[i].jitter = NULL;
+	}
+
+out:
+	rtp_jitter_group_destroy(group);
+	free(m);
+}
+
+
+/* Random traffic over a group with a packet budget: every eviction comes
+ * from a member with the highest usage and evicts its expected packet;
+ * members are released and removed from the group at random */
+static void test_group_model(void)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = DELAY,
+	};
+	struct rtp_jitter_group_cfg group_cfg = {
+		.max_pkts = MODEL_MAX_PKTS,
+	};
+	struct rtp_jitter_group *group = NULL;
+	struct member *m = calloc(MODEL_MEMBERS, sizeof(*m));
+	int in_group[MODEL_MEMBERS];
+	uint64_t group_pkts = 0, group_bytes = 0;
+	uint64_t total_pkts = 0, total_bytes = 0, pkts = 0, bytes = 0;
+	uint32_t total = 0, max_usage = 0, evicted = 0, victims = 0;
+	uint32_t n = 0;
+	int res;
+
+	if (m == NULL)
+		return;
+	res = rtp_jitter_group_new(&group_cfg, NULL, &group);
+	check("model: new", res == 0);
+	if (res < 0)
+		goto out;
+	for (uint32_t i = 0; i < MODEL_MEMBERS; i++) {
+		member_init(&m[i], &cfg, &cbs);
+		res = rtp_jitter_group_add(group, m[i].jitter);
+		check("model: add", res == 0);
+		in_group[i] = 1;
+	}
+
+	for (uint32_t op = 0; op < MODEL_OPS; op++) {
+		uint32_t i = rand64() % MODEL_MEMBERS;
+		uint32_t action = rand64() % 100;
+
+		if (action < 5) {
+			/* Release the packets that can be */
+			rtp_jitter_process(
+				m[i].jitter,
+				START_TIMESTAMP +
+					(uint64_t)m[i].next_seqnum *
+						PKT_PERIOD);
+		} else if (action < 15) {
+			/* Leave or join again, the packets queued
+			 * meanwhile are evicted when joining */
+			if (in_group[i]) {
+				res = rtp_jitter_group_remove(group,
+							      m[i].jitter);
+				check("model: remove", res == 0);
+			} else {
+				res = rtp_jitter_group_add(group, m[i].jitter);
+				check("model: add again", res == 0);
+			}
+			in_group[i] = !in_group[i];
+			for (uint32_t j = 0; j < MODEL_MEMBERS; j++)
+				sync_evictions(&m[j], "model: join bytes");
+		} else {
+			if (m[i].count >= MAX_PKTS / 2)
+				continue;
+			enqueue(&m[i], rand64() % 4, 50 + rand64() % 400);
+
+			/* At most one eviction, from a member with the
+			 * highest usage */
+			max_usage = 0;
+			for (uint32_t j = 0; j < MODEL_MEMBERS; j++) {
+				if (in_group[j] && m[j].count > max_usage)
+					max_usage = m[j].count;
+			}
+			evicted = 0;
+			victims = 0;
+			for (uint32_t j = 0; j < MODEL_MEMBERS; j++) {
+				n = m[j].count;
+				evicted = sync_evictions(&m[j], "model: bytes");
+				if (evicted == 0)
+					continue;
+				victims++;
+				check("model: victim", n == max_usage);
+				check("model: one eviction", evicted == 1);
+			}
+			check("model: single victim", victims <= 1);
+		}
+
+		total = 0;
+		for (uint32_t j = 0; j < MODEL_MEMBERS; j++) {
+			if (in_group[j])
+				total += m[j].count;
+		}
+		check("model: budget", total <= MODEL_MAX_PKTS);
+	}
+
+	/* Members only evict because of the group */
+	for (uint32_t j = 0; j < MODEL_MEMBERS; j++) {
+		rtp_jitter_get_evictions(m[j].jitter, &pkts, &bytes);
+		total_pkts += pkts;
+		total_bytes += bytes;
+	}
+	rtp_jitter_group_get_evictions(group, &group_pkts, &group_bytes);
+	check("model: evictions",
+	      group_pkts == total_pkts && group_bytes == total_bytes &&
+		      group_pkts > 0);
+
+	for (uint32_t j = 0; j < MODEL_MEMBERS; j++) {
+		check_queued(&m[j], "model: released");
+		rtp_jitter_destroy(m[j].jitter);
+		m[j].jitter = NULL;
+	}
+
+out:
+	rtp_jitter_group_destroy(group);
+	free(m);
+}
+
+
+int main(int argc, char *argv[])
+{
+	test_buffer_pkts();
+	test_buffer_bytes();
+	test_policy();
+	test_group();
+	test_group_model();
+
+	printf("%s: %" PRIu64 " failures\n",
+	       failures == 0 ? "OK" : "FAILED",
+	       failures);
+	return failures != 0;
+}
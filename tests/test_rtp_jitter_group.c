@@ -0,0 +1,369 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <futils/timetools.h>
+#include <libpomp.h>
+
+#include "rtp/rtp.h"
+
+#include "check.h"
+
+/**
+ * Test of the jitter buffer group: members scheduled at every level of the
+ * timing wheel and beyond its span are processed exactly at their deadline
+ * (with a 1 us tick) without visiting the empty ticks, removed or cleared
+ * members are cancelled, earlier deadlines are rescheduled, and with a
+ * loop the members are processed from the group timer, one wake up per
+ * deadline.
+ */
+
+#define CLK_RATE 90000
+#define PKT_PERIOD 10000
+#define START_TIMESTAMP 1000003
+
+
+struct member {
+	struct rtp_jitter *jitter;
+	uint64_t deadline;
+	uint64_t released_at;
+	uint32_t released;
+};
+
+
+/* Timestamp given to the current process (released_at) */
+static uint64_t cur_time;
+
+
+static uint64_t get_time(void)
+{
+	struct timespec ts = {0, 0};
+	uint64_t now = 0;
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &now);
+	return now;
+}
+
+
+static void process_pkt_cb(struct rtp_jitter *jitter,
+			   const struct rtp_pkt *pkt,
+			   uint32_t gap,
+			   void *userdata)
+{
+	struct member *member = userdata;
+
+	if (member->released == 0)
+		member->released_at = cur_time != 0 ? cur_time : get_time();
+	member->released++;
+}
+
+
+static const struct rtp_jitter_cbs cbs = {
+	.process_pkt = &process_pkt_cb,
+};
+
+
+static int enqueue(struct rtp_jitter *jitter,
+		   uint16_t seqnum,
+		   uint64_t in_timestamp)
+{
+	struct rtp_pkt *pkt = NULL;
+	int res = rtp_pkt_new(&pkt);
+	if (res < 0)
+		return res;
+	pkt->header.seqnum = seqnum;
+	pkt->rtp_timestamp =
+		1000 + (uint64_t)seqnum * PKT_PERIOD * (CLK_RATE / 1000) / 1000;
+	pkt->in_timestamp = in_timestamp;
+	pkt->raw.len = 100;
+	return rtp_jitter_enqueue(jitter, pkt);
+}
+
+
+static int member_init(struct member *member,
+		       struct rtp_jitter_group *group,
+		       uint32_t delay)
+{
+	struct rtp_jitter_cfg cfg = {
+		.clk_rate = CLK_RATE,
+		.delay = delay,
+	};
+	int res;
+
+	memset(member, 0, sizeof(*member));
+	res = rtp_jitter_new(&cfg, &cbs, member, &member->jitter);
+	check("rtp_jitter_new", res == 0);
+	if (res < 0)
+		return res;
+	rtp_jitter_clear(member->jitter, 0);
+	res = rtp_jitter_group_add(group, member->jitter);
+	check("rtp_jitter_group_add", res == 0);
+	return res;
+}
+
+
+/* Member whose first packet (1) is received at in_timestamp while packet 0
+ * is missing: it is due after the given delay */
+static int member_init_due(struct member *member,
+			   struct rtp_jitter_group *group,
+			   uint32_t delay,
+			   uint64_t in_timestamp)
+{
+	int res = member_init(member, group, delay);
+	if (res < 0)
+		return res;
+	enqueue(member->jitter, 1, in_timestamp);
+	res = rtp_jitter_get_next_deadline(member->jitter, &member->deadline);
+	check("member deadline", res == 0);
+	return res;
+}
+
+
+/* Process the group at each of its next deadlines until nothing is left
+ * scheduled, returns the number of processes */
+static uint32_t run_group(struct rtp_jitter_group *group, uint32_t max)
+{
+	uint64_t deadline = 0;
+	uint32_t count = 0;
+
+	while (count < max &&
+	       rtp_jitter_group_get_next_deadline(group, &deadline) == 0) {
+		check("group deadline goes back", deadline >= cur_time);
+		cur_time = deadline > cur_time ? deadline : cur_time;
+		rtp_jitter_group_process(group, cur_time);
+		count++;
+	}
+	return count;
+}
+
+
+/* Deadlines on every level of the wheel (64, 64^2, 64^3 and 64^4 ticks)
+ * and beyond its span */
+static void test_levels(void)
+{
+	static const uint32_t delays[] = {
+		5, 63, 64, 100, 4095, 4096, 5000, 262143, 262144,
+		300000, 16777215, 16777216, 20000000, 40000000,
+	};
+	struct rtp_jitter_group_cfg cfg = {.tick = 1};
+	struct rtp_jitter_group *group = NULL;
+	size_t n = sizeof(delays) / sizeof(delays[0]);
+	struct member members[sizeof(delays) / sizeof(delays[0])];
+	uint32_t count = 0;
+	int res;
+
+	res = rtp_jitter_group_new(&cfg, NULL, &group);
+	check("levels: new", res == 0);
+	if (res < 0)
+		return;
+
+	/* Start the wheel before adding the members */
+	cur_time = START_TIMESTAMP;
+	rtp_jitter_group_process(group, cur_time);
+
+	for (size_t i = 0; i < n; i++)
+		member_init_due(
+			&members[i], group, delays[i], START_TIMESTAMP);
+
+	/* Cascades are serviced too, but far fewer ticks than the span */
+	count = run_group(group, 10000);
+	check("levels: process count", count < 64 * 4 * 3);
+	for (size_t i = 0; i < n; i++) {
+		check("levels: released", members[i].released == 1);
+		check("levels: at deadline",
+		      members[i].released_at == members[i].deadline);
+		check("levels: deadline",
+		      members[i].deadline == START_TIMESTAMP + delays[i]);
+	}
+
+	for (size_t i = 0; i < n; i++)
+		rtp_jitter_destroy(members[i].jitter);
+	res = rtp_jitter_group_destroy(group);
+	check("levels: destroy", res == 0);
+	cur_time = 0;
+}
+
+
+/* Removed and cleared members are cancelled, a member made due
+ * immediately or earlier is rescheduled */
+static void test_cancel_reschedule(void)
+{
+	struct rtp_jitter_group_cfg cfg = {.tick = 1};
+	struct rtp_jitter_group *group = NULL;
+	struct member removed, cleared, ready, earlier;
+	uint64_t deadline = 0, later = 0;
+	uint32_t count = 0;
+	int res;
+
+	res = rtp_jitter_group_new(&cfg, NULL, &group);
+	check("cancel: new", res == 0);
+	if (res < 0)
+		return;
+	cur_time = START_TIMESTAMP;
+	rtp_jitter_group_process(group, cur_time);
+
+	member_init_due(&removed, group, 1000, START_TIMESTAMP);
+	member_init_due(&cleared, group, 2000, START_TIMESTAMP);
+	member_init_due(&ready, group, 300000, START_TIMESTAMP);
+	member_init(&earlier, group, 500000);
+	res = rtp_jitter_group_get_member_count(group, &count);
+	check("cancel: member count", res == 0 && count == 4);
+
+	/* The next tick to service can be a cascade before the deadline */
+	res = rtp_jitter_group_get_next_deadline(group, &deadline);
+	check("cancel: first deadline",
+	      res == 0 && deadline > START_TIMESTAMP &&
+		      deadline <= START_TIMESTAMP + 1000);
+
+	/* Cancelled members */
+	res = rtp_jitter_group_remove(group, removed.jitter);
+	check("cancel: remove", res == 0);
+	res = rtp_jitter_group_remove(group, removed.jitter);
+	check("cancel: remove again", res == -ENOENT);
+	rtp_jitter_clear(cleared.jitter, 0);
+
+	/* The missing packet arrives: the member is ready immediately */
+	cur_time = START_TIMESTAMP + 10;
+	enqueue(ready.jitter, 0, cur_time);
+	res = rtp_jitter_group_get_next_deadline(group, &deadline);
+	check("reschedule: ready", res == 0 && deadline == 0);
+	rtp_jitter_group_process(group, cur_time);
+	check("reschedule: ready released",
+	      ready.released == 2 && ready.released_at == cur_time);
+
+	/* Packet 0 is released, packet 3 is received 300 ms late, then packet
+	 * 2 (sent 10 ms before) makes the head due 10 ms earlier */
+	enqueue(earlier.jitter, 0, cur_time);
+	rtp_jitter_group_process(group, cur_time);
+	check("reschedule: first released", earlier.released == 1);
+	earlier.released = 0;
+	enqueue(earlier.jitter, 3, cur_time + 300000);
+	rtp_jitter_get_next_deadline(earlier.jitter, &later);
+	enqueue(earlier.jitter, 2, cur_time + 300100);
+	rtp_jitter_get_next_deadline(earlier.jitter, &earlier.deadline);
+	check("reschedule: earlier deadline",
+	      earlier.deadline + PKT_PERIOD == later);
+
+	count = run_group(group, 1000);
+	check("reschedule: process count", count < 64 * 4 * 3);
+	check("reschedule: released", earlier.released == 2);
+	check("reschedule: at deadline",
+	      earlier.released_at == earlier.deadline);
+	check("reschedule: ready once", ready.released == 2);
+
+	/* Nothing left scheduled */
+	check("cancel: removed not released", removed.released == 0);
+	check("cancel: cleared not released", cleared.released == 0);
+	res = rtp_jitter_group_get_next_deadline(group, &deadline);
+	check("cancel: empty", res == -ENOENT);
+
+	rtp_jitter_destroy(removed.jitter);
+	rtp_jitter_destroy(cleared.jitter);
+	rtp_jitter_destroy(ready.jitter);
+	rtp_jitter_destroy(earlier.jitter);
+	res = rtp_jitter_group_get_member_count(group, &count);
+	check("cancel: no member", res == 0 && count == 0);
+	rtp_jitter_group_destroy(group);
+	cur_time = 0;
+}
+
+
+/* With a loop, the members are processed from the group timer, re-armed
+ * for each deadline */
+static void test_loop(void)
+{
+	static const uint32_t delays[] = {40000, 20000, 60000};
+	struct rtp_jitter_group_cfg cfg = {0};
+	struct rtp_jitter_group *group = NULL;
+	struct pomp_loop *loop = NULL;
+	size_t n = sizeof(delays) / sizeof(delays[0]);
+	struct member members[sizeof(delays) / sizeof(delays[0])];
+	uint64_t start = 0, end = 0, now = 0;
+	uint32_t wakeups = 0, released = 0;
+	int res;
+
+	loop = pomp_loop_new();
+	check("loop: new", loop != NULL);
+	if (loop == NULL)
+		return;
+	res = rtp_jitter_group_new(&cfg, loop, &group);
+	check("loop: group", res == 0);
+	if (res < 0)
+		goto out;
+
+	start = get_time();
+	for (size_t i = 0; i < n; i++)
+		member_init_due(&members[i], group, delays[i], start);
+
+	end = start + 1000000;
+	while (released < n && (now = get_time()) < end) {
+		if (pomp_loop_wait_and_process(loop, (end - now) / 1000 + 1) ==
+		    0)
+			wakeups++;
+		released = 0;
+		for (size_t i = 0; i < n; i++)
+			released += members[i].released;
+	}
+	check("loop: released", released == n);
+	check("loop: wake ups", wakeups == n);
+	for (size_t i = 0; i < n; i++) {
+		check("loop: not early",
+		      members[i].released_at >= members[i].deadline);
+		check("loop: not late",
+		      members[i].released_at <
+			      members[i].deadline +
+					      RTP_JITTER_GROUP_DEFAULT_TICK +
+					      20000);
+	}
+	res = pomp_loop_wait_and_process(loop, 50);
+	check("loop: timer disarmed", res == -ETIMEDOUT);
+
+	for (size_t i = 0; i < n; i++)
+		rtp_jitter_destroy(members[i].jitter);
+	res = rtp_jitter_group_destroy(group);
+	check("loop: destroy", res == 0);
+
+out:
+	pomp_loop_destroy(loop);
+}
+
+
+int main(int argc, char *argv[])
+{
+	test_levels();
+	test_cancel_reschedule();
+	test_loop();
+
+	printf("%s: %" PRIu64 " failures\n",
+	       failures == 0 ? "OK" : "FAILED",
+	       failures);
+	return failures != 0;
+}
@@ -0,0 +1,325 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtp/rtp.h"
+
+#include "check.h"
+
+/**
+ * Test of the routing helpers: rtp_pkt_classify() on the boundaries of the
+ * RTCP packet types multiplexed with RTP (RFC 5761) and on short buffers,
+ * rtp_pkt_peek() against rtp_pkt_read() on the same data, and
+ * rtp_pkt_read_batch() against rtp_pkt_read() on a mix of valid, truncated
+ * and missing buffers.
+ */
+
+
+static void make_pkt(uint8_t *data, uint8_t second_byte)
+{
+	static const uint8_t header[RTP_PKT_HEADER_SIZE] = {
+		0x80,
+		0x00,
+		0x12,
+		0x34,
+		0xde,
+		0xad,
+		0xbe,
+		0xef,
+		0x01,
+		0x23,
+		0x45,
+		0x67,
+	};
+
+	memcpy(data, header, sizeof(header));
+	data[1] = second_byte;
+}
+
+
+static void test_classify(void)
+{
+	uint8_t data[RTP_PKT_HEADER_SIZE];
+	enum rtp_pkt_class cls;
+
+	/* Second byte: marker bit and payload type for RTP, packet type for
+	 * RTCP (192 to 223) */
+	for (uint32_t b = 0; b < 256; b++) {
+		make_pkt(data, b);
+		cls = rtp_pkt_classify(data, sizeof(data));
+		if (b >= 192 && b <= 223)
+			check("rtcp type", b, cls == RTP_PKT_CLASS_RTCP);
+		else
+			check("rtp type", b, cls == RTP_PKT_CLASS_RTP);
+	}
+	make_pkt(data, 191);
+	check("191", 191, rtp_pkt_classify(data, 12) == RTP_PKT_CLASS_RTP);
+	make_pkt(data, 192);
+	check("192", 192, rtp_pkt_classify(data, 12) == RTP_PKT_CLASS_RTCP);
+	make_pkt(data, 223);
+	check("223", 223, rtp_pkt_classify(data, 12) == RTP_PKT_CLASS_RTCP);
+	make_pkt(data, 224);
+	check("224", 224, rtp_pkt_classify(data, 12) == RTP_PKT_CLASS_RTP);
+
+	/* RTCP needs its 4-byte header, RTP its 12-byte fixed header */
+	for (uint32_t len = 0; len <= RTP_PKT_HEADER_SIZE; len++) {
+		make_pkt(data, RTCP_PKT_TYPE_SR);
+		cls = rtp_pkt_classify(data, len);
+		check("short rtcp",
+		      len,
+		      cls == (len < RTCP_PKT_HEADER_SIZE ? RTP_PKT_CLASS_INVALID
+							 : RTP_PKT_CLASS_RTCP));
+		make_pkt(data, 96);
+		cls = rtp_pkt_classify(data, len);
+		check("short rtp",
+		      len,
+		      cls == (len < RTP_PKT_HEADER_SIZE ? RTP_PKT_CLASS_INVALID
+							: RTP_PKT_CLASS_RTP));
+	}
+
+	/* Bad version */
+	for (uint32_t v = 0; v < 4; v++) {
+		make_pkt(data, 96);
+		data[0] = (v << 6) | (data[0] & 0x3f);
+		cls = rtp_pkt_classify(data, sizeof(data));
+		check("version",
+		      v,
+		      cls == (v == RTP_PKT_VERSION ? RTP_PKT_CLASS_RTP
+						   : RTP_PKT_CLASS_INVALID));
+	}
+	check("null", 0, rtp_pkt_classify(NULL, 12) == RTP_PKT_CLASS_INVALID);
+}
+
+
+static void test_peek(void)
+{
+	uint8_t data[RTP_PKT_HEADER_SIZE];
+	struct rtp_pkt_peek_info info;
+	struct pomp_buffer *buf = NULL;
+	struct rtp_pkt *pkt = NULL;
+
+	for (uint32_t b = 0; b < 256; b++) {
+		make_pkt(data, b);
+		memset(&info, 0xff, sizeof(info));
+		if (b >= 192 && b <= 223) {
+			check("peek rtcp",
+			      b,
+			      rtp_pkt_peek(data, sizeof(data), &info) == -EIO);
+			continue;
+		}
+		check("peek", b, rtp_pkt_peek(data, sizeof(data), &info) == 0);
+
+		/* Same fields as the full parse */
+		rtp_pkt_new(&pkt);
+		buf = pomp_buffer_new_with_data(data, sizeof(data));
+		check("read", b, rtp_pkt_read(buf, pkt) == 0);
+		check("ssrc", b, info.ssrc == pkt->header.ssrc);
+		check("timestamp", b, info.timestamp == pkt->header.timestamp);
+		check("seqnum", b, info.seqnum == pkt->header.seqnum);
+		check("payload type",
+		      b,
+		      info.payload_type ==
+			      RTP_PKT_HEADER_FLAGS_GET(pkt->header.flags,
+						       PAYLOAD_TYPE));
+		check("marker",
+		      b,
+		      info.marker == RTP_PKT_HEADER_FLAGS_GET(
+					     pkt->header.flags, MARKER));
+		rtp_pkt_destroy(pkt);
+		pomp_buffer_unref(buf);
+	}
+
+	make_pkt(data, 0xe0);
+	check("peek fields", 0, rtp_pkt_peek(data, sizeof(data), &info) == 0);
+	check("peek values",
+	      0,
+	      info.ssrc == 0x01234567 && info.timestamp == 0xdeadbeef &&
+		      info.seqnum == 0x1234 && info.payload_type == 96 &&
+		      info.marker == 1);
+
+	for (uint32_t len = 0; len < RTP_PKT_HEADER_SIZE; len++)
+		check("peek short", len, rtp_pkt_peek(data, len, &info) == -EIO);
+	check("peek null info", 0, rtp_pkt_peek(data, 12, NULL) == -EINVAL);
+	check("peek null data", 0, rtp_pkt_peek(NULL, 12, &info) == -EIO);
+}
+
+
+static struct pomp_buffer *make_buf(uint8_t flags,
+				    uint32_t ext_words,
+				    size_t payload_len,
+				    uint8_t padding,
+				    size_t truncate)
+{
+	uint8_t data[256];
+	size_t len = 0;
+	uint32_t csrc_count = flags & 0x0f;
+
+	make_pkt(data, 96);
+	data[0] = flags;
+	len = RTP_PKT_HEADER_SIZE;
+	for (uint32_t i = 0; i < csrc_count * 4; i++)
+		data[len++] = i;
+	if (flags & 0x10) {
+		data[len++] = 0xbe;
+		data[len++] = 0xde;
+		data[len++] = ext_words >> 8;
+		data[len++] = ext_words & 0xff;
+		for (uint32_t i = 0; i < ext_words * 4; i++)
+			data[len++] = i;
+	}
+	for (size_t i = 0; i < payload_len; i++)
+		data[len++] = i;
+	if (flags & 0x20) {
+		for (uint32_t i = 1; i < padding; i++)
+			data[len++] = 0;
+		data[len++] = padding;
+	}
+	return pomp_buffer_new_with_data(data, len - truncate);
+}
+
+
+static void test_read_batch(void)
+{
+	/* flags, extension words, payload, padding, truncated bytes */
+	static const uint32_t cases[][5] = {
+		{0x80, 0, 100, 0, 0},
+		{0x90, 3, 50, 0, 0},
+		{0xa0, 0, 20, 4, 0},
+		{0xb2, 1, 0, 1, 0},
+		{0x90, 3, 0, 0, 10},
+		{0x40, 0, 10, 0, 0},
+		{0x80, 0, 0, 0, 2},
+		{0x83, 0, 8, 0, 0},
+		{0xa0, 0, 0, 200, 100},
+	};
+	size_t n = sizeof(cases) / sizeof(cases[0]) + 1;
+	struct pomp_buffer *bufs[sizeof(cases) / sizeof(cases[0]) + 1];
+	struct rtp_pkt pkts[sizeof(cases) / sizeof(cases[0]) + 1];
+	int results[sizeof(cases) / sizeof(cases[0]) + 1];
+	struct rtp_pkt *pkt = NULL;
+	int res, count = 0;
+
+	/* The missing buffer is in the middle of the batch */
+	for (size_t i = 0, j = 0; i < n; i++) {
+		if (i == n / 2) {
+			bufs[i] = NULL;
+			continue;
+		}
+		bufs[i] = make_buf(cases[j][0],
+				   cases[j][1],
+				   cases[j][2],
+				   cases[j][3],
+				   cases[j][4]);
+		j++;
+	}
+	memset(pkts, 0xff, sizeof(pkts));
+	memset(results, 0x7f, sizeof(results));
+	res = rtp_pkt_read_batch(bufs, n, pkts, results);
+
+	for (uint32_t i = 0; i < n; i++) {
+		if (bufs[i] == NULL) {
+			check("batch null", i, results[i] == -EINVAL);
+			check("batch null buf", i, pkts[i].raw.buf == NULL);
+			continue;
+		}
+		rtp_pkt_new(&pkt);
+		check("batch result",
+		      i,
+		      results[i] == rtp_pkt_read(bufs[i], pkt));
+		if (results[i] < 0) {
+			check("batch error buf", i, pkts[i].raw.buf == NULL);
+			rtp_pkt_destroy(pkt);
+			continue;
+		}
+		count++;
+		check("batch buf", i, pkts[i].raw.buf == bufs[i]);
+		check("batch data", i, pkts[i].raw.cdata == pkt->raw.cdata);
+		check("batch len", i, pkts[i].raw.len == pkt->raw.len);
+		check("batch flags",
+		      i,
+		      pkts[i].header.flags == pkt->header.flags);
+		check("batch seqnum",
+		      i,
+		      pkts[i].header.seqnum == pkt->header.seqnum);
+		check("batch timestamp",
+		      i,
+		      pkts[i].header.timestamp == pkt->header.timestamp);
+		check("batch ssrc", i, pkts[i].header.ssrc == pkt->header.ssrc);
+		check("batch ext id",
+		      i,
+		      pkts[i].extheader.id == pkt->extheader.id);
+		check("batch ext off",
+		      i,
+		      pkts[i].extheader.off == pkt->extheader.off);
+		check("batch ext len",
+		      i,
+		      pkts[i].extheader.len == pkt->extheader.len);
+		check("batch payload off",
+		      i,
+		      pkts[i].payload.off == pkt->payload.off);
+		check("batch payload len",
+		      i,
+		      pkts[i].payload.len == pkt->payload.len);
+		check("batch padding off",
+		      i,
+		      pkts[i].padding.off == pkt->padding.off);
+		check("batch padding len",
+		      i,
+		      pkts[i].padding.len == pkt->padding.len);
+		rtp_pkt_destroy(pkt);
+		pomp_buffer_unref(pkts[i].raw.buf);
+	}
+	check("batch count", res, res == count);
+	check("batch valid", count, count == 6);
+
+	for (size_t i = 0; i < n; i++) {
+		if (bufs[i] != NULL)
+			pomp_buffer_unref(bufs[i]);
+	}
+
+	check("batch empty", 0, rtp_pkt_read_batch(NULL, 0, NULL, NULL) == 0);
+	check("batch null bufs",
+	      0,
+	      rtp_pkt_read_batch(NULL, 1, pkts, NULL) == -EINVAL);
+}
+
+
+int main()
+{
+	test_classify();
+	test_peek();
+	test_read_batch();
+
+	printf("%s: %" PRIu64 " failures\n",
+	       failures == 0 ? "OK" : "FAILED",
+	       failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,351 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtp/rtp.h"
+
+#include "check.h"
+
+/**
+ * Test of the packet pool: reuse of the freed packets, heap fallback once
+ * the high-water mark is reached, release of packets from another thread
+ * than the one that drew them, clones drawn from the pool of the original
+ * packet, destruction of the pool while other threads still have a cache,
+ * and more pools than thread-specific keys used by the same thread.
+ */
+
+#define PKT_COUNT 64
+
+#ifdef PTHREAD_KEYS_MAX
+#	define POOL_COUNT (PTHREAD_KEYS_MAX + 64)
+#else
+#	define POOL_COUNT 1088
+#endif
+
+
+struct thread_ctx {
+	struct rtp_pkt_pool *pool;
+	struct rtp_pkt **pkts;
+	uint32_t count;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int ready;
+	int done;
+};
+
+
+static uint32_t get_outstanding(struct rtp_pkt_pool *pool)
+{
+	struct rtp_pkt_pool_stats stats;
+	rtp_pkt_pool_get_stats(pool, &stats);
+	return stats.outstanding;
+}
+
+
+static void test_reuse(void)
+{
+	struct rtp_pkt_pool_cfg cfg = {.initial_count = 16};
+	struct rtp_pkt_pool *pool = NULL;
+	struct rtp_pkt_pool_stats stats;
+	struct rtp_pkt *pkt = NULL, *first = NULL;
+
+	check("reuse: new", rtp_pkt_pool_new(&cfg, &pool) == 0);
+	if (pool == NULL)
+		return;
+
+	check("reuse: get", rtp_pkt_new_from_pool(pool, &first) == 0);
+	check("reuse: pool", get_outstanding(pool) == 1);
+	first->priority = 12;
+	rtp_pkt_destroy(first);
+
+	/* The last freed packet is drawn first, zeroed */
+	check("reuse: get", rtp_pkt_new_from_pool(pool, &pkt) == 0);
+	check("reuse: same packet", pkt == first);
+	check("reuse: zeroed",
+	      pkt->priority == 0 && get_outstanding(pool) == 1);
+	rtp_pkt_destroy(pkt);
+
+	rtp_pkt_pool_get_stats(pool, &stats);
+	check("reuse: stats",
+	      stats.hits == 2 && stats.misses == 0 && stats.outstanding == 0 &&
+		      stats.allocated == 16);
+	check("reuse: destroy", rtp_pkt_pool_destroy(pool) == 0);
+}
+
+
+static void test_max_count(void)
+{
+	struct rtp_pkt_pool_cfg cfg = {
+		.grow_count = 4,
+		.max_count = 8,
+		.cache_size = 4,
+	};
+	struct rtp_pkt_pool *pool = NULL;
+	struct rtp_pkt_pool_stats stats;
+	struct rtp_pkt *pkts[10];
+
+	check("max_count: new", rtp_pkt_pool_new(&cfg, &pool) == 0);
+	if (pool == NULL)
+		return;
+
+	for (uint32_t i = 0; i < 10; i++)
+		check("max_count: get",
+		      rtp_pkt_new_from_pool(pool, &pkts[i]) == 0);
+
+	/* The last 2 packets fell back to the heap */
+	rtp_pkt_pool_get_stats(pool, &stats);
+	check("max_count: heap",
+	      stats.allocated == 8 && stats.outstanding == 8);
+	check("max_count: busy", rtp_pkt_pool_destroy(pool) == -EBUSY);
+
+	/* Heap packets are not returned to the pool */
+	for (uint32_t i = 0; i < 10; i++)
+		rtp_pkt_destroy(pkts[i]);
+	rtp_pkt_pool_get_stats(pool, &stats);
+	check("max_count: released",
+	      stats.allocated == 8 && stats.outstanding == 0);
+	check("max_count: destroy", rtp_pkt_pool_destroy(pool) == 0);
+}
+
+
+static void *release_thread(void *userdata)
+{
+	struct thread_ctx *ctx = userdata;
+
+	for (uint32_t i = 0; i < ctx->count; i++)
+		rtp_pkt_destroy(ctx->pkts[i]);
+	return NULL;
+}
+
+
+static void test_cross_thread(void)
+{
+	struct rtp_pkt_pool_cfg cfg = {.grow_count = 16, .cache_size = 4};
+	struct rtp_pkt_pool *pool = NULL;
+	struct rtp_pkt_pool_stats stats;
+	struct rtp_pkt *pkts[PKT_COUNT];
+	struct thread_ctx ctx = {.pkts = pkts, .count = PKT_COUNT};
+	pthread_t thread;
+	uint32_t allocated = 0;
+
+	check("cross thread: new", rtp_pkt_pool_new(&cfg, &pool) == 0);
+	if (pool == NULL)
+		return;
+
+	for (uint32_t i = 0; i < PKT_COUNT; i++)
+		check("cross thread: get",
+		      rtp_pkt_new_from_pool(pool, &pkts[i]) == 0);
+	rtp_pkt_pool_get_stats(pool, &stats);
+	allocated = stats.allocated;
+
+	/* The thread cache of the other thread overflows into the shared
+	 * free list, then it is released when the thread exits */
+	ctx.pool = pool;
+	pthread_create(&thread, NULL, &release_thread, &ctx);
+	pthread_join(thread, NULL);
+	check("cross thread: outstanding", get_outstanding(pool) == 0);
+
+	/* All the packets are available again without growing */
+	for (uint32_t i = 0; i < PKT_COUNT; i++)
+		check("cross thread: get again",
+		      rtp_pkt_new_from_pool(pool, &pkts[i]) == 0);
+	rtp_pkt_pool_get_stats(pool, &stats);
+	check("cross thread: no growth",
+	      stats.allocated == allocated && stats.outstanding == PKT_COUNT);
+	for (uint32_t i = 0; i < PKT_COUNT; i++)
+		rtp_pkt_destroy(pkts[i]);
+	check("cross thread: destroy", rtp_pkt_pool_destroy(pool) == 0);
+}
+
+
+static void test_clone(void)
+{
+	struct rtp_pkt_pool_cfg cfg = {.max_count = 2, .grow_count = 2};
+	struct rtp_pkt_pool *pool = NULL;
+	struct rtp_pkt *pkt = NULL, *clone = NULL, *heap_clone = NULL;
+	struct rtp_pkt *overflow = NULL, *local_clone = NULL;
+	struct rtp_pkt local;
+
+	check("clone: new", rtp_pkt_pool_new(&cfg, &pool) == 0);
+	if (pool == NULL)
+		return;
+
+	rtp_pkt_new_from_pool(pool, &pkt);
+	pkt->raw.buf = pomp_buffer_new(16);
+	pkt->importance = 3;
+	check("clone", rtp_pkt_clone_from_pool(pool, pkt, &clone) == 0);
+	check("clone: pool", get_outstanding(pool) == 2 && clone != pkt);
+	check("clone: content",
+	      clone->importance == 3 && clone->raw.buf == pkt->raw.buf);
+
+	/* The pool is exhausted, the next clone falls back to the heap */
+	check("clone: overflow",
+	      rtp_pkt_clone_from_pool(pool, pkt, &overflow) == 0);
+	check("clone: overflow heap", get_outstanding(pool) == 2);
+
+	/* Plain clones are on the heap, even of pool packets */
+	check("clone: heap", rtp_pkt_clone(pkt, &heap_clone) == 0);
+	check("clone: heap pool", get_outstanding(pool) == 2);
+
+	/* Packets not allocated by the library can be cloned */
+	memset(&local, 0, sizeof(local));
+	local.importance = 5;
+	check("clone: local", rtp_pkt_clone(&local, &local_clone) == 0);
+	check("clone: local content", local_clone->importance == 5);
+
+	rtp_pkt_destroy(pkt);
+	rtp_pkt_destroy(clone);
+	rtp_pkt_destroy(overflow);
+	rtp_pkt_destroy(heap_clone);
+	rtp_pkt_destroy(local_clone);
+	check("clone: released", get_outstanding(pool) == 0);
+	check("clone: destroy", rtp_pkt_pool_destroy(pool) == 0);
+}
+
+
+static void *cache_thread(void *userdata)
+{
+	struct thread_ctx *ctx = userdata;
+	struct rtp_pkt *pkts[8];
+
+	/* Fill the cache of this thread */
+	for (uint32_t i = 0; i < 8; i++)
+		rtp_pkt_new_from_pool(ctx->pool, &pkts[i]);
+	for (uint32_t i = 0; i < 8; i++)
+		rtp_pkt_destroy(pkts[i]);
+
+	/* Stay alive until the pool is destroyed */
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->ready = 1;
+	pthread_cond_broadcast(&ctx->cond);
+	while (!ctx->done)
+		pthread_cond_wait(&ctx->cond, &ctx->mutex);
+	pthread_mutex_unlock(&ctx->mutex);
+	return NULL;
+}
+
+
+static void test_destroy_live_caches(void)
+{
+	struct rtp_pkt_pool_cfg cfg = {.initial_count = 32};
+	struct thread_ctx ctx = {0};
+	pthread_t thread;
+
+	check("live caches: new", rtp_pkt_pool_new(&cfg, &ctx.pool) == 0);
+	if (ctx.pool == NULL)
+		return;
+	pthread_mutex_init(&ctx.mutex, NULL);
+	pthread_cond_init(&ctx.cond, NULL);
+	pthread_create(&thread, NULL, &cache_thread, &ctx);
+
+	pthread_mutex_lock(&ctx.mutex);
+	while (!ctx.ready)
+		pthread_cond_wait(&ctx.cond, &ctx.mutex);
+	pthread_mutex_unlock(&ctx.mutex);
+
+	/* The cache of the thread is released by the pool, not by the thread
+	 * exit afterwards */
+	check("live caches: destroy", rtp_pkt_pool_destroy(ctx.pool) == 0);
+
+	pthread_mutex_lock(&ctx.mutex);
+	ctx.done = 1;
+	pthread_cond_broadcast(&ctx.cond);
+	pthread_mutex_unlock(&ctx.mutex);
+	pthread_join(thread, NULL);
+	pthread_cond_destroy(&ctx.cond);
+	pthread_mutex_destroy(&ctx.mutex);
+}
+
+
+/* The pools share a single thread-specific key, each thread chaining one
+ * cache per pool it uses */
+static void test_many_pools(void)
+{
+	struct rtp_pkt_pool_cfg cfg = {.grow_count = 4, .cache_size = 2};
+	struct rtp_pkt_pool **pools = NULL;
+	struct rtp_pkt *pkt = NULL;
+	uint32_t created = 0, outstanding = 0;
+
+	pools = calloc(POOL_COUNT, sizeof(*pools));
+	if (pools == NULL)
+		return;
+	for (uint32_t i = 0; i < POOL_COUNT; i++) {
+		if (rtp_pkt_pool_new(&cfg, &pools[i]) < 0)
+			break;
+		created++;
+	}
+	check("many pools: new", created == POOL_COUNT);
+
+	/* Interleave the pools, each packet goes back to its own pool */
+	for (uint32_t n = 0; n < 3; n++) {
+		for (uint32_t i = 0; i < created; i++) {
+			check("many pools: get",
+			      rtp_pkt_new_from_pool(pools[i], &pkt) == 0);
+			outstanding += get_outstanding(pools[i]);
+			rtp_pkt_destroy(pkt);
+			outstanding += get_outstanding(pools[i]);
+		}
+	}
+	check("many pools: outstanding", outstanding == 3 * created);
+
+	/* Destroying a pool leaves the others' caches usable */
+	for (uint32_t i = 0; i < created; i += 2) {
+		check("many pools: destroy",
+		      rtp_pkt_pool_destroy(pools[i]) == 0);
+		pools[i] = NULL;
+	}
+	for (uint32_t i = 1; i < created; i += 2) {
+		check("many pools: get again",
+		      rtp_pkt_new_from_pool(pools[i], &pkt) == 0);
+		rtp_pkt_destroy(pkt);
+		check("many pools: destroy",
+		      rtp_pkt_pool_destroy(pools[i]) == 0);
+	}
+	free(pools);
+}
+
+
+int main()
+{
+	test_reuse();
+	test_max_count();
+	test_cross_thread();
+	test_clone();
+	test_destroy_live_caches();
+	test_many_pools();
+
+	printf("%s: %" PRIu64 " failures\n",
+	       failures == 0 ? "OK" : "FAILED",
+	       failures);
+	return failures == 0 ? 0 : 1;
+}
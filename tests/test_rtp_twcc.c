@@ -0,0 +1,261 @@
+/**
+ * Copyright (c) 2016 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtp/rtp.h"
+
+#include "check.h"
+
+/**
+ * Test of the transport-wide congestion control feedback recorder: a
+ * stream of packets with jitter (hence reordering), losses, duplicates,
+ * sequence number wraps and large gaps is recorded, the reports are
+ * written, read back and checked against the recorded arrival times. A
+ * second pass uses a small ring with rare reports so that packets are
+ * dropped before being reported.
+ */
+
+#define PKT_COUNT 100000
+#define PERIOD_US 500
+#define REPORT_US 50000
+#define MTU 1200
+#define FIRST_SEQ 65000
+#define START_US 500000000000ULL
+
+
+struct event {
+	/* Extended transport sequence number */
+	uint32_t seq;
+	uint64_t arrival;
+};
+
+
+struct expect {
+	uint64_t arrival;
+	int recorded;
+	int reported;
+};
+
+
+static struct event events[2 * PKT_COUNT];
+static struct expect expects[2 * PKT_COUNT];
+static uint32_t event_count;
+static uint32_t seq_count;
+
+/* End of the reported sequence numbers, received statuses reported */
+static uint32_t reported_end;
+static uint64_t reported_received;
+
+static int event_cmp(const void *a, const void *b)
+{
+	const struct event *e1 = a, *e2 = b;
+	if (e1->arrival != e2->arrival)
+		return e1->arrival < e2->arrival ? -1 : 1;
+	return e1->seq < e2->seq ? -1 : e1->seq > e2->seq;
+}
+
+
+/* Packets sent every PERIOD_US with up to 3 ms of jitter, 5% of losses,
+ * 1% of duplicates and a few large gaps, sorted by arrival time */
+static void make_events(void)
+{
+	uint32_t seq = 0;
+	uint64_t arrival;
+
+	event_count = 0;
+	for (uint32_t i = 0; i < PKT_COUNT; i++, seq++) {
+		if (i % 20000 == 19999)
+			seq += 1000 + rand64() % 2000;
+		if (rand64() % 100 < 5)
+			continue;
+		arrival = START_US + (uint64_t)i * PERIOD_US + rand64() % 3000;
+		events[event_count].seq = seq;
+		events[event_count++].arrival = arrival;
+		if (rand64() % 100 == 0) {
+			events[event_count].seq = seq;
+			events[event_count++].arrival = arrival + 100;
+		}
+	}
+	seq_count = seq;
+	qsort(events, event_count, sizeof(events[0]), &event_cmp);
+}
+
+
+static void report_cb(const struct rtcp_pkt_rtpfb_report *rtpfb,
+		      void *userdata)
+{
+	int64_t ticks = (int64_t)rtpfb->ref_time * 256;
+	uint32_t seq;
+
+	/* Reports are contiguous, except after dropped packets */
+	seq = reported_end + (uint16_t)(rtpfb->base_seq -
+					(uint16_t)(FIRST_SEQ + reported_end));
+	check("contiguous", seq, userdata != NULL || seq == reported_end);
+	check("backward", seq, seq >= reported_end);
+
+	for (uint16_t i = 0; i < rtpfb->status_count; i++, seq++) {
+		const struct rtcp_pkt_rtpfb_feedback *fb = &rtpfb->feedbacks[i];
+		struct expect *e = &expects[seq];
+		if (seq >= seq_count) {
+			check("beyond", seq, 0);
+			return;
+		}
+		check("reported twice", seq, !e->reported);
+		e->reported = 1;
+		if (fb->pkt_status_symbol == 0) {
+			check("lost", seq, !e->recorded);
+			continue;
+		}
+		ticks += fb->recv_delta;
+		check("received", seq, e->recorded);
+		check("arrival", seq, ticks == (int64_t)((e->arrival / 250) &
+							   0xFFFFFFFF));
+		reported_received++;
+	}
+	reported_end = seq;
+}
+
+
+static void read_report(struct pomp_buffer *buf, int allow_drops)
+{
+	struct rtcp_pkt_read_cbs cbs = {.rtpfb_report = &report_cb};
+	const void *data = NULL;
+	size_t len = 0, pos, pkt_len;
+
+	pomp_buffer_get_cdata(buf, &data, &len, NULL);
+	for (pos = 0; pos + 4 <= len; pos += pkt_len) {
+		const uint8_t *p = (const uint8_t *)data + pos;
+		pkt_len = (((size_t)p[2] << 8 | p[3]) + 1) * 4;
+		check("mtu", reported_end, pkt_len <= MTU);
+	}
+	check("read",
+	      reported_end,
+	      rtcp_pkt_read(buf, &cbs, allow_drops ? &cbs : NULL) == 0);
+}
+
+
+static void test_recorder(uint32_t size, uint64_t report_us)
+{
+	struct rtp_twcc_recorder_cfg cfg = {
+		.sender_ssrc = 1,
+		.media_ssrc = 2,
+		.size = size,
+	};
+	struct rtp_twcc_recorder *recorder = NULL;
+	struct rtp_twcc_recorder_stats stats;
+	struct pomp_buffer *buf = pomp_buffer_new(0);
+	uint64_t next_report = START_US + report_us;
+	uint64_t duplicates = 0, late = 0;
+	size_t pos;
+	int res;
+
+	memset(expects, 0, sizeof(expects));
+	reported_end = 0;
+	reported_received = 0;
+
+	res = rtp_twcc_recorder_new(&cfg, &recorder);
+	check("new", 0, res == 0);
+	if (res < 0)
+		return;
+
+	for (uint32_t i = 0; i <= event_count; i++) {
+		const struct event *ev = &events[i];
+		while (i == event_count || ev->arrival >= next_report) {
+			pos = 0;
+			pomp_buffer_set_len(buf, 0);
+			res = rtp_twcc_recorder_write(recorder, buf, &pos, MTU);
+			if (res == -EAGAIN && i == event_count)
+				break;
+			if (res == -EAGAIN) {
+				next_report += report_us;
+				continue;
+			}
+			check("write", reported_end, res > 0);
+			read_report(buf, report_us > REPORT_US);
+			if (i < event_count)
+				next_report += report_us;
+		}
+		if (i == event_count)
+			break;
+
+		res = rtp_twcc_recorder_record(
+			recorder, (uint16_t)(FIRST_SEQ + ev->seq), ev->arrival);
+		if (res == 0) {
+			check("record", ev->seq, !expects[ev->seq].recorded);
+			expects[ev->seq].recorded = 1;
+			expects[ev->seq].arrival = ev->arrival;
+		} else if (expects[ev->seq].recorded &&
+			   !expects[ev->seq].reported) {
+			duplicates++;
+		} else {
+			check("late", ev->seq, res == -EALREADY);
+			late++;
+		}
+	}
+
+	rtp_twcc_recorder_get_stats(recorder, &stats);
+	check("stats recorded",
+	      0,
+	      stats.recorded + stats.duplicates + stats.late == event_count);
+	check("stats reported",
+	      0,
+	      stats.recorded - stats.dropped == reported_received);
+	if (report_us <= REPORT_US)
+		check("stats dropped", 0, stats.dropped == 0);
+	else
+		check("stats dropped", 0, stats.dropped > 0);
+	printf("size %" PRIu32 ", reports every %" PRIu64
+	       " ms: %" PRIu64 " recorded, %" PRIu64 " duplicates, %" PRIu64
+	       " late, %" PRIu64 " dropped, %" PRIu64 " reports\n",
+	       size,
+	       report_us / 1000,
+	       stats.recorded,
+	       stats.duplicates,
+	       stats.late,
+	       stats.dropped,
+	       stats.reports);
+
+	rtp_twcc_recorder_destroy(recorder);
+	pomp_buffer_unref(buf);
+}
+
+
+int main()
+{
+	make_events();
+	test_recorder(0, REPORT_US);
+	test_recorder(64, 20 * REPORT_US);
+
+	printf("%s: %" PRIu64 " failures\n",
+	       failures == 0 ? "OK" : "FAILED",
+	       failures);
+	return failures == 0 ? 0 : 1;
+}